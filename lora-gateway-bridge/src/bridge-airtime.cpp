@@ -0,0 +1,342 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行空中时间与占空比
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-airtime.hpp"
+#include "bridge-json-scan.hpp"
+#include "bridge-uplink.hpp"
+#include <math.h>
+
+#define LORA_SF_MIN   7
+#define LORA_SF_MAX   12
+#define LORA_BW_COUNT 3
+
+static constexpr uint32_t lora_bandwidths[LORA_BW_COUNT] = { 125000, 250000, 500000 };
+
+// 符号时间2^SF/BW，这几种带宽下以ns为单位都是整数
+static constexpr uint32_t lora_symbol_time_ns(int sf, int bw)
+{
+    return (1u << sf) * (1000000000u / lora_bandwidths[bw]);
+}
+
+#define LORA_SYMBOL_ROW(sf) \
+    { lora_symbol_time_ns(sf, 0), lora_symbol_time_ns(sf, 1), lora_symbol_time_ns(sf, 2) }
+
+static constexpr uint32_t lora_symbol_ns[LORA_SF_MAX - LORA_SF_MIN + 1][LORA_BW_COUNT] = {
+    LORA_SYMBOL_ROW(7),  LORA_SYMBOL_ROW(8),  LORA_SYMBOL_ROW(9),
+    LORA_SYMBOL_ROW(10), LORA_SYMBOL_ROW(11), LORA_SYMBOL_ROW(12),
+};
+
+static_assert(lora_symbol_ns[0][0] == 1024000, "SF7BW125 symbol is 1.024ms");
+static_assert(lora_symbol_ns[5][2] == 8192000, "SF12BW500 symbol is 8.192ms");
+
+// 符号时间超过16ms时集中器开启低速率优化(SF11/12 BW125、SF12 BW250)
+#define LORA_LDRO_SYMBOL_NS 16000000
+
+/*
+ * EU868子频段(ETSI EN 300 220)，不在表内的频点不计占空比，
+ * 由forwarder按自己的频率范围检查。
+ */
+static const struct duty_cycle_band eu868_bands[] = {
+    { "g0", 863000000, 865000000, 1 },
+    { "g", 865000000, 868000000, 10 },
+    { "g1", 868000000, 868600000, 10 },
+    { "g2", 868700000, 869200000, 1 },
+    { "g3", 869400000, 869650000, 100 },
+    { "g4", 869700000, 870000000, 10 },
+};
+
+/*
+ * Semtech AN1200.13的LoRa空中时间:
+ * Tpacket = Tsym * (preamble + 4.25 + 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH) /
+ *           (4(SF - 2DE))) * (CR + 4), 0))
+ * 全程整数运算，preamble + 4.25按1/4符号计，结果向上取整到us。
+ * SF或带宽不在表内时返回0。
+ */
+uint32_t lora_airtime_us(uint8_t sf, uint32_t bandwidth, uint8_t coding_rate, uint16_t preamble,
+                         uint16_t size, bool crc, bool implicit_header)
+{
+    int bw;
+
+    for (bw = 0; bw < LORA_BW_COUNT && lora_bandwidths[bw] != bandwidth; bw++) {}
+    if (sf < LORA_SF_MIN || sf > LORA_SF_MAX || bw == LORA_BW_COUNT || coding_rate < 1 ||
+        coding_rate > 4) {
+        return 0;
+    }
+    uint64_t symbol_ns = lora_symbol_ns[sf - LORA_SF_MIN][bw];
+    int      de        = (symbol_ns > LORA_LDRO_SYMBOL_NS) ? 1 : 0;
+    int      numerator = 8 * size - 4 * sf + 28 + (crc ? 16 : 0) - (implicit_header ? 20 : 0);
+    int      divisor   = 4 * (sf - 2 * de);
+    uint64_t symbols   = 8;
+    if (numerator > 0) {
+        symbols += (uint64_t)((numerator + divisor - 1) / divisor) * (coding_rate + 4);
+    }
+    uint64_t quarters = 4 * (preamble + symbols) + 17;
+    return (uint32_t)((symbol_ns * quarters / 4 + 999) / 1000);
+}
+
+// 前导 + 同步字 + 长度字节 + 负载 + CRC，与lgw_time_on_air相同
+uint32_t fsk_airtime_us(uint32_t datarate, uint16_t preamble, uint16_t size, bool crc)
+{
+    if (datarate == 0) {
+        return 0;
+    }
+    uint64_t bits = 8ULL * (preamble + FSK_SYNC_WORD_SIZE + 1 + size + (crc ? 2 : 0));
+    return (uint32_t)((bits * 1000000 + datarate - 1) / datarate);
+}
+
+uint32_t txpk_airtime_us(const struct txpk_airtime *txpk)
+{
+    if (txpk->fsk) {
+        return fsk_airtime_us(txpk->datarate, txpk->preamble, txpk->size, txpk->crc);
+    }
+    return lora_airtime_us(txpk->spreading_factor, txpk->bandwidth, txpk->coding_rate,
+                           txpk->preamble, txpk->size, txpk->crc, txpk->implicit_header);
+}
+
+// 与forwarder一致，同时接受4/6写成2/3、4/8写成1/2
+static int parse_coding_rate(const struct json_span *codr, uint8_t *coding_rate)
+{
+    static const char   *codr_tb[] = { "4/5", "4/6", "2/3", "4/7", "4/8", "1/2" };
+    static const uint8_t rate_tb[] = { 1, 2, 2, 3, 4, 4 };
+
+    for (size_t i = 0; i < sizeof(codr_tb) / sizeof(codr_tb[0]); i++) {
+        if (json_span_equals(codr, codr_tb[i])) {
+            *coding_rate = rate_tb[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 取出txpk中计算空中时间的字段，缺省值与forwarder解析txpk时相同:
+ * LoRa前导8个符号、FSK前导5字节，带CRC，显式头。
+ * 缺少freq/datr/size或取值不合法时返回-1。
+ */
+int downlink_txpk_airtime(const char *payload, size_t len, struct txpk_airtime *txpk)
+{
+    struct json_span   root, key, value, txpk_obj;
+    struct json_cursor cursor;
+    double             freq = 0;
+    int64_t            number;
+    bool               has_freq = false, has_datr = false, has_size = false;
+    int64_t            preamble = -1;
+    uint8_t            sf       = 0;
+    uint16_t           bw       = 0;
+
+    txpk_obj.type         = JSON_SCAN_NONE;
+    txpk->coding_rate     = 1;
+    txpk->crc             = true;
+    txpk->implicit_header = false;
+    if (json_scan_document(payload, len, &root) < 0 || json_scan_open(&root, &cursor) < 0) {
+        return -1;
+    }
+    while (json_scan_next_member(&cursor, &key, &value) > 0) {
+        if (json_span_equals(&key, "txpk") && value.type == JSON_SCAN_OBJECT) {
+            txpk_obj = value;
+        }
+    }
+    if (txpk_obj.type == JSON_SCAN_NONE || json_scan_open(&txpk_obj, &cursor) < 0) {
+        return -1;
+    }
+    while (json_scan_next_member(&cursor, &key, &value) > 0) {
+        if (json_span_equals(&key, "freq")) {
+            has_freq = (json_span_to_double(&value, &freq) == 0 && freq > 0 && freq < 4294);
+        } else if (json_span_equals(&key, "datr") && value.type == JSON_SCAN_STRING) {
+            has_datr               = (semtech_datr_parse(&value, sf, bw) == 0);
+            txpk->fsk              = false;
+            txpk->spreading_factor = sf;
+            txpk->bandwidth        = bw * 1000;
+        } else if (json_span_equals(&key, "datr") && json_span_to_int64(&value, &number) == 0) {
+            has_datr       = (number > 0 && number <= UINT32_MAX);
+            txpk->fsk      = true;
+            txpk->datarate = (uint32_t)number;
+        } else if (json_span_equals(&key, "codr") && value.type == JSON_SCAN_STRING) {
+            parse_coding_rate(&value, &txpk->coding_rate);
+        } else if (json_span_equals(&key, "size") && json_span_to_int64(&value, &number) == 0) {
+            has_size   = (number >= 0 && number <= UINT16_MAX);
+            txpk->size = (uint16_t)number;
+        } else if (json_span_equals(&key, "prea") && json_span_to_int64(&value, &number) == 0) {
+            preamble = number;
+        } else if (json_span_equals(&key, "ncrc")) {
+            txpk->crc = (value.type != JSON_SCAN_TRUE);
+        } else if (json_span_equals(&key, "nhdr")) {
+            txpk->implicit_header = (value.type == JSON_SCAN_TRUE);
+        }
+    }
+    if (!has_freq || !has_datr || !has_size) {
+        return -1;
+    }
+    txpk->frequency = (uint32_t)llround(freq * 1e6);
+    if (preamble < 0) {
+        preamble = txpk->fsk ? FSK_PREAMBLE_DEFAULT : LORA_PREAMBLE_DEFAULT;
+    } else if (preamble < (txpk->fsk ? FSK_PREAMBLE_MIN : LORA_PREAMBLE_MIN)) {
+        preamble = txpk->fsk ? FSK_PREAMBLE_MIN : LORA_PREAMBLE_MIN;
+    }
+    txpk->preamble = (preamble > UINT16_MAX) ? UINT16_MAX : (uint16_t)preamble;
+    return 0;
+}
+
+int duty_cycle_region_parse(const string &name, enum duty_cycle_region *region)
+{
+    if (name.empty()) {
+        *region = DUTY_CYCLE_NONE;
+    } else if (name == "EU868") {
+        *region = DUTY_CYCLE_EU868;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+DutyCycleLedger::DutyCycleLedger(enum duty_cycle_region region)
+{
+    pthread_mutex_init(&this->mutex, NULL);
+    this->bands      = nullptr;
+    this->band_count = 0;
+    if (region == DUTY_CYCLE_EU868) {
+        this->bands      = eu868_bands;
+        this->band_count = sizeof(eu868_bands) / sizeof(eu868_bands[0]);
+    }
+    this->records.resize(this->band_count);
+    this->used_us.assign(this->band_count, 0);
+}
+
+DutyCycleLedger::~DutyCycleLedger()
+{
+    pthread_mutex_destroy(&this->mutex);
+}
+
+int DutyCycleLedger::band_of(uint32_t frequency) const
+{
+    for (size_t i = 0; i < this->band_count; i++) {
+        if (frequency >= this->bands[i].freq_min && frequency < this->bands[i].freq_max) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// 去掉已发完的发射区间和滑出窗口的占空比记录
+void DutyCycleLedger::prune(uint64_t now_us)
+{
+    while (!this->busy.empty() && this->busy.front().end_us <= now_us) {
+        this->busy.pop_front();
+    }
+    for (size_t i = 0; i < this->band_count; i++) {
+        deque<struct airtime_record> &band = this->records[i];
+        while (!band.empty() && band.front().end_us + DUTY_CYCLE_WINDOW_US <= now_us) {
+            this->used_us[i] -= band.front().end_us - band.front().begin_us;
+            band.pop_front();
+        }
+    }
+}
+
+/*
+ * 为一个下行记账。start_us为预计开始发射的时刻(单调时钟)，为NULL时发射时刻
+ * 未知，只检查占空比。与已接受的发射重叠时，defer_max_us不为0的帧顺延到
+ * 空闲处并更新*start_us，顺延不超过defer_max_us，否则返回AIRTIME_COLLISION。
+ * 占空比按窗口内已接受的发射时间累计，不等帧真正发出；帧最终没有发射时
+ * 调用者用记在*reservation中的账release退回。
+ */
+int DutyCycleLedger::reserve(uint32_t frequency, uint32_t airtime_us, uint64_t now_us,
+                             uint64_t *start_us, uint64_t defer_max_us,
+                             struct airtime_reservation *reservation)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->prune(now_us);
+    int band = this->band_of(frequency);
+    if (band >= 0 && this->used_us[band] + airtime_us >
+                         DUTY_CYCLE_WINDOW_US * this->bands[band].permille / 1000) {
+        pthread_mutex_unlock(&this->mutex);
+        return AIRTIME_DUTY_CYCLE;
+    }
+    uint64_t start = (start_us != nullptr) ? *start_us : now_us;
+    if (start_us != nullptr) {
+        // busy按begin排序且互不重叠，顺延后只会与后面的区间冲突，一遍即可
+        auto pos = this->busy.begin();
+        for (; pos != this->busy.end(); ++pos) {
+            uint64_t begin = start - DOWNLINK_TX_PRE_US;
+            uint64_t end   = start + airtime_us + DOWNLINK_TX_POST_US;
+            if (end <= pos->begin_us) {
+                break;
+            }
+            if (begin < pos->end_us) {
+                start = pos->end_us + DOWNLINK_TX_PRE_US;
+            }
+        }
+        if (start - *start_us > defer_max_us) {
+            pthread_mutex_unlock(&this->mutex);
+            return AIRTIME_COLLISION;
+        }
+        this->busy.insert(pos, airtime_record{ start - DOWNLINK_TX_PRE_US,
+                                               start + airtime_us + DOWNLINK_TX_POST_US });
+        *start_us = start;
+    }
+    if (band >= 0) {
+        this->records[band].push_back(airtime_record{ start, start + airtime_us });
+        this->used_us[band] += airtime_us;
+    }
+    reservation->frequency  = frequency;
+    reservation->airtime_us = airtime_us;
+    reservation->start_us   = start;
+    reservation->busy       = (start_us != nullptr);
+    pthread_mutex_unlock(&this->mutex);
+    return AIRTIME_OK;
+}
+
+/*
+ * 退回reserve记的账: 去掉发射区间，从子频段的窗口中扣除这次发射时间。
+ * 已被prune去掉的部分不再处理；退回后清空*reservation，重复调用无影响。
+ */
+void DutyCycleLedger::release(struct airtime_reservation *reservation)
+{
+    uint64_t start = reservation->start_us;
+    uint64_t end   = start + reservation->airtime_us;
+
+    if (reservation->airtime_us == 0) {
+        return;
+    }
+    pthread_mutex_lock(&this->mutex);
+    if (reservation->busy) {
+        for (auto it = this->busy.begin(); it != this->busy.end(); ++it) {
+            if (it->begin_us == start - DOWNLINK_TX_PRE_US &&
+                it->end_us == end + DOWNLINK_TX_POST_US) {
+                this->busy.erase(it);
+                break;
+            }
+        }
+    }
+    int band = this->band_of(reservation->frequency);
+    if (band >= 0) {
+        deque<struct airtime_record> &records = this->records[band];
+        for (auto it = records.begin(); it != records.end(); ++it) {
+            if (it->begin_us == start && it->end_us == end) {
+                this->used_us[band] -= reservation->airtime_us;
+                records.erase(it);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    reservation->airtime_us = 0;
+}
+
+// 各子频段的占用和预算，未开启区域限制时返回0
+size_t DutyCycleLedger::usage(uint64_t now_us, struct duty_cycle_usage *out, size_t max)
+{
+    size_t count = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    this->prune(now_us);
+    for (size_t i = 0; i < this->band_count && count < max; i++, count++) {
+        out[count].name      = this->bands[i].name;
+        out[count].used_us   = this->used_us[i];
+        out[count].budget_us = DUTY_CYCLE_WINDOW_US * this->bands[i].permille / 1000;
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return count;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行空中时间与占空比
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 按txpk的调制参数算出空中时间(与libloragw的lgw_time_on_air一致)，
+ *          每个网关一本账: 记录已接受下行的发射区间，新下行与之重叠时推迟
+ *          或拒绝；开启区域限制时按子频段统计滑动窗口内的发射时间，超出
+ *          占空比预算的下行直接拒绝。过期或网关报错未发射的下行退回所记的账。
+ */
+
+#ifndef _BRIDGE_AIRTIME_HPP_
+#define _BRIDGE_AIRTIME_HPP_
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define LORA_PREAMBLE_DEFAULT 8 /* forwarder的STD_LORA_PREAMB */
+#define LORA_PREAMBLE_MIN     6
+#define FSK_PREAMBLE_DEFAULT  5 /* forwarder的STD_FSK_PREAMB */
+#define FSK_PREAMBLE_MIN      3
+#define FSK_SYNC_WORD_SIZE    3
+
+// forwarder JIT队列判断冲突时在发射前后留的余量
+#define DOWNLINK_TX_PRE_US  2500    /* TX_START_DELAY 1.5ms + TX_MARGIN_DELAY 1ms */
+#define DOWNLINK_TX_POST_US 1000    /* TX_MARGIN_DELAY */
+#define DOWNLINK_TX_JIT_US  40000   /* 立即发送的帧在forwarder里推迟TX_JIT_DELAY再发 */
+#define DOWNLINK_DEFER_MAX  3000000 /* us，立即发送的帧为避开在途发射最多推迟3秒 */
+
+#define DUTY_CYCLE_WINDOW_US 3600000000ULL /* ETSI按1小时统计占空比 */
+#define DUTY_CYCLE_BANDS_MAX 8
+
+using namespace std;
+
+enum duty_cycle_region {
+    DUTY_CYCLE_NONE = 0, // 只检查发射重叠
+    DUTY_CYCLE_EU868,
+};
+
+enum airtime_verdict {
+    AIRTIME_OK = 0,
+    AIRTIME_COLLISION,  // 与已接受的下行发射重叠
+    AIRTIME_DUTY_CYCLE, // 子频段占空比预算不足
+};
+
+// txpk中决定空中时间的字段，未出现的按forwarder的默认值
+struct txpk_airtime {
+    uint32_t frequency; // Hz
+    bool     fsk;
+    uint8_t  spreading_factor;
+    uint32_t bandwidth;   // Hz
+    uint8_t  coding_rate; // 4/5..4/8记为1..4
+    uint32_t datarate;    // FSK bps
+    uint16_t preamble;
+    uint16_t size;
+    bool     crc;
+    bool     implicit_header;
+};
+
+struct duty_cycle_band {
+    const char *name;
+    uint32_t    freq_min; // Hz，含
+    uint32_t    freq_max; // Hz，不含
+    uint32_t    permille; // 占空比，千分之
+};
+
+struct duty_cycle_usage {
+    const char *name;
+    uint64_t    used_us;   // 窗口内已占用(含已接受未发出)的发射时间
+    uint64_t    budget_us; // 窗口内允许的发射时间
+};
+
+uint32_t lora_airtime_us(uint8_t sf, uint32_t bandwidth, uint8_t coding_rate, uint16_t preamble,
+                         uint16_t size, bool crc, bool implicit_header);
+uint32_t fsk_airtime_us(uint32_t datarate, uint16_t preamble, uint16_t size, bool crc);
+uint32_t txpk_airtime_us(const struct txpk_airtime *txpk);
+int      downlink_txpk_airtime(const char *payload, size_t len, struct txpk_airtime *txpk);
+int      duty_cycle_region_parse(const string &name, enum duty_cycle_region *region);
+
+// 发射区间；busy中的begin/end已含forwarder的前后余量
+struct airtime_record {
+    uint64_t begin_us;
+    uint64_t end_us;
+};
+
+// reserve记下的一笔账，帧最终没有发射时按此release退回
+struct airtime_reservation {
+    uint32_t frequency;  // Hz
+    uint32_t airtime_us; // 0表示没有记账
+    uint64_t start_us;   // 占空比记录的开始时刻
+    bool     busy;       // 同时记了发射区间
+};
+
+// 由该网关的pull worker记账，stat由push worker读取，加锁
+class DutyCycleLedger
+{
+  private:
+    pthread_mutex_t                      mutex;
+    const struct duty_cycle_band        *bands;
+    size_t                               band_count;
+    deque<struct airtime_record>         busy;    // 按begin排序，互不重叠
+    vector<deque<struct airtime_record>> records; // 各子频段窗口内的发射
+    vector<uint64_t>                     used_us;
+
+    int  band_of(uint32_t frequency) const;
+    void prune(uint64_t now_us);
+
+  public:
+    explicit DutyCycleLedger(enum duty_cycle_region region);
+    ~DutyCycleLedger();
+    DutyCycleLedger(const DutyCycleLedger &)            = delete;
+    DutyCycleLedger &operator=(const DutyCycleLedger &) = delete;
+
+    int    reserve(uint32_t frequency, uint32_t airtime_us, uint64_t now_us, uint64_t *start_us,
+                   uint64_t defer_max_us, struct airtime_reservation *reservation);
+    void   release(struct airtime_reservation *reservation);
+    size_t usage(uint64_t now_us, struct duty_cycle_usage *out, size_t max);
+};
+
+#endif
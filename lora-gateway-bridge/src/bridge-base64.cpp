@@ -0,0 +1,424 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge Base64编解码
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-base64.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BASE64_NEON
+#endif
+
+#define BASE64_INVALID 0xff
+
+// 向量实现只处理完整的块，返回消耗的输入长度，其余交给标量实现
+struct base64_impl {
+    const char *name;
+    size_t (*encode_blocks)(const uint8_t *in, size_t len, char *out);
+    size_t (*decode_blocks)(const char *in, size_t len, uint8_t *out, size_t out_len);
+};
+
+static const char base64_alphabet[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint8_t base64_values[256];
+
+static size_t encode_blocks_none(const uint8_t *in, size_t len, char *out)
+{
+    return 0;
+}
+
+static size_t decode_blocks_none(const char *in, size_t len, uint8_t *out, size_t out_len)
+{
+    return 0;
+}
+
+static const struct base64_impl base64_scalar = {
+    "scalar",
+    encode_blocks_none,
+    decode_blocks_none,
+};
+
+#ifdef BASE64_X86
+/*
+ * SSSE3/AVX2实现参考Wojciech Muła和Daniel Lemire的算法：编码时把每3字节
+ * 扩展为4个6位索引，再按索引区间查偏移表得到字符；解码时按字符的高低
+ * 半字节查表判断合法性并得到偏移，最后用乘加把4个6位值拼回3字节。
+ */
+__attribute__((target("ssse3"))) static __m128i encode_indices_ssse3(__m128i in)
+{
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+    in         = _mm_shuffle_epi8(in, shuffle);
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3"))) static __m128i encode_chars_ssse3(__m128i indices)
+{
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+    // 0..25映射到13，26..51到0，52..61到1..10，62到11，63到12
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less    = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced         = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, reduced), indices);
+}
+
+// 每次读16字节用其中12字节
+__attribute__((target("ssse3"))) static size_t encode_blocks_ssse3(const uint8_t *in, size_t len,
+                                                                   char *out)
+{
+    size_t done = 0;
+    for (; len - done >= 16; done += 12, out += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(in + done));
+        _mm_storeu_si128((__m128i *)out, encode_chars_ssse3(encode_indices_ssse3(block)));
+    }
+    return done;
+}
+
+// 非法字符返回false，合法时把字符换成6位值
+__attribute__((target("ssse3"))) static bool decode_values_ssse3(__m128i *block)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll =
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i hi    = _mm_and_si128(_mm_srli_epi32(*block, 4), nibble);
+    __m128i lo    = _mm_and_si128(*block, nibble);
+    __m128i check = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(check, _mm_setzero_si128())) != 0xffff) {
+        return false;
+    }
+    __m128i slash = _mm_cmpeq_epi8(*block, _mm_set1_epi8('/'));
+    __m128i roll  = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(slash, hi));
+    *block        = _mm_add_epi8(*block, roll);
+    return true;
+}
+
+__attribute__((target("ssse3"))) static __m128i decode_pack_ssse3(__m128i values)
+{
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(packed,
+                            _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// 每次写16字节其中12字节有效，遇到非法字符停下由标量实现报错
+__attribute__((target("ssse3"))) static size_t decode_blocks_ssse3(const char *in, size_t len,
+                                                                   uint8_t *out, size_t out_len)
+{
+    size_t done = 0;
+    for (; len - done >= 16 && out_len >= 16; done += 16, out += 12, out_len -= 12) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(in + done));
+        if (!decode_values_ssse3(&block)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)out, decode_pack_ssse3(block));
+    }
+    return done;
+}
+
+static const struct base64_impl base64_ssse3 = {
+    "ssse3",
+    encode_blocks_ssse3,
+    decode_blocks_ssse3,
+};
+
+/*
+ * AVX2的字节重排不跨128位通道，两个通道各处理一组，与SSSE3相同。
+ * 编码时两通道分别从in和in+12读入，解码时两通道的12字节分别写出。
+ */
+__attribute__((target("avx2"))) static size_t encode_blocks_avx2(const uint8_t *in, size_t len,
+                                                                 char *out)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1,
+                                             0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift =
+        _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+    for (; len - done >= 28; done += 24, out += 32) {
+        __m128i lo    = _mm_loadu_si128((const __m128i *)(in + done));
+        __m128i hi    = _mm_loadu_si128((const __m128i *)(in + done + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        block      = _mm256_shuffle_epi8(block, shuffle);
+        __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+
+        __m256i indices = _mm256_or_si256(t1, t3);
+        __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i less    = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        reduced         = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        block           = _mm256_add_epi8(_mm256_shuffle_epi8(shift, reduced), indices);
+        _mm256_storeu_si256((__m256i *)out, block);
+    }
+    return done;
+}
+
+__attribute__((target("avx2"))) static size_t decode_blocks_avx2(const char *in, size_t len,
+                                                                 uint8_t *out, size_t out_len)
+{
+    const __m256i lut_lo =
+        _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                         0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi =
+        _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                                              0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0,
+                                              0, 0, 0, 0);
+    const __m256i pack =
+        _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+                         10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    size_t done = 0;
+    for (; len - done >= 32 && out_len >= 28; done += 32, out += 24, out_len -= 24) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(in + done));
+        __m256i hi    = _mm256_and_si256(_mm256_srli_epi32(block, 4), nibble);
+        __m256i lo    = _mm256_and_si256(block, nibble);
+        __m256i check = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+                                         _mm256_shuffle_epi8(lut_hi, hi));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(check, _mm256_setzero_si256())) != -1) {
+            break;
+        }
+        __m256i slash = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('/'));
+        block = _mm256_add_epi8(block, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slash, hi)));
+
+        __m256i merged = _mm256_maddubs_epi16(block, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_shuffle_epi8(
+            _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)), pack);
+        // 先写低通道，高通道的16字节覆盖低通道末尾4个无效字节
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(packed));
+        _mm_storeu_si128((__m128i *)(out + 12), _mm256_extracti128_si256(packed, 1));
+    }
+    return done;
+}
+
+static const struct base64_impl base64_avx2 = {
+    "avx2",
+    encode_blocks_avx2,
+    decode_blocks_avx2,
+};
+#endif
+
+#ifdef BASE64_NEON
+/*
+ * NEON用交错读写直接拆分/合并3字节和4字符，每次编码48字节、解码64字符，
+ * 编码用64字节的字母表做一次四表查找，解码的合法性检查和偏移与SSSE3相同。
+ */
+static size_t encode_blocks_neon(const uint8_t *in, size_t len, char *out)
+{
+    const uint8_t *alphabet = (const uint8_t *)base64_alphabet;
+    const uint8x16_t mask   = vdupq_n_u8(0x3f);
+    uint8x16x4_t     table;
+    uint8x16x4_t     chars;
+
+    table.val[0] = vld1q_u8(alphabet);
+    table.val[1] = vld1q_u8(alphabet + 16);
+    table.val[2] = vld1q_u8(alphabet + 32);
+    table.val[3] = vld1q_u8(alphabet + 48);
+
+    size_t done = 0;
+    for (; len - done >= 48; done += 48, out += 64) {
+        uint8x16x3_t block = vld3q_u8(in + done);
+        uint8x16_t   i1    = vorrq_u8(vshrq_n_u8(block.val[1], 4), vshlq_n_u8(block.val[0], 4));
+        uint8x16_t   i2    = vorrq_u8(vshrq_n_u8(block.val[2], 6), vshlq_n_u8(block.val[1], 2));
+
+        chars.val[0] = vqtbl4q_u8(table, vshrq_n_u8(block.val[0], 2));
+        chars.val[1] = vqtbl4q_u8(table, vandq_u8(i1, mask));
+        chars.val[2] = vqtbl4q_u8(table, vandq_u8(i2, mask));
+        chars.val[3] = vqtbl4q_u8(table, vandq_u8(block.val[2], mask));
+        vst4q_u8((uint8_t *)out, chars);
+    }
+    return done;
+}
+
+static const uint8_t neon_lut_lo[16] = { 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a };
+static const uint8_t neon_lut_hi[16] = { 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
+static const uint8_t neon_lut_roll[16] = { 0,   16,  19, 4, 191, 191, 185, 185,
+                                           0,   0,   0,  0, 0,   0,   0,   0 };
+
+// 返回非零表示有非法字符
+static uint8x16_t decode_values_neon(uint8x16_t *chars)
+{
+    uint8x16_t hi    = vshrq_n_u8(*chars, 4);
+    uint8x16_t lo    = vandq_u8(*chars, vdupq_n_u8(0x0f));
+    uint8x16_t check = vandq_u8(vqtbl1q_u8(vld1q_u8(neon_lut_lo), lo),
+                                vqtbl1q_u8(vld1q_u8(neon_lut_hi), hi));
+    uint8x16_t slash = vceqq_u8(*chars, vdupq_n_u8('/'));
+    *chars = vaddq_u8(*chars, vqtbl1q_u8(vld1q_u8(neon_lut_roll), vaddq_u8(slash, hi)));
+    return check;
+}
+
+static size_t decode_blocks_neon(const char *in, size_t len, uint8_t *out, size_t out_len)
+{
+    size_t done = 0;
+    for (; len - done >= 64 && out_len >= 48; done += 64, out += 48, out_len -= 48) {
+        uint8x16x4_t block = vld4q_u8((const uint8_t *)in + done);
+        uint8x16_t   check = vorrq_u8(vorrq_u8(decode_values_neon(&block.val[0]),
+                                               decode_values_neon(&block.val[1])),
+                                      vorrq_u8(decode_values_neon(&block.val[2]),
+                                               decode_values_neon(&block.val[3])));
+        if (vmaxvq_u8(check) != 0) {
+            break;
+        }
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(block.val[0], 2), vshrq_n_u8(block.val[1], 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(block.val[1], 4), vshrq_n_u8(block.val[2], 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(block.val[2], 6), block.val[3]);
+        vst3q_u8(out, bytes);
+    }
+    return done;
+}
+
+static const struct base64_impl base64_neon = {
+    "neon",
+    encode_blocks_neon,
+    decode_blocks_neon,
+};
+#endif
+
+#define BASE64_IMPLS_MAX 4
+
+// 本机可用的实现，按优先顺序排列，scalar总在最后
+static const struct base64_impl *base64_usable[BASE64_IMPLS_MAX];
+static size_t                    base64_usable_count;
+
+// 在main之前的静态初始化中选定实现，之后只读，多线程使用无需加锁
+static const struct base64_impl *base64_select(void)
+{
+    memset(base64_values, BASE64_INVALID, sizeof(base64_values));
+    for (uint8_t i = 0; i < 64; i++) { base64_values[(uint8_t)base64_alphabet[i]] = i; }
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        base64_usable[base64_usable_count++] = &base64_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        base64_usable[base64_usable_count++] = &base64_ssse3;
+    }
+#elif defined(BASE64_NEON)
+    base64_usable[base64_usable_count++] = &base64_neon;
+#endif
+    base64_usable[base64_usable_count++] = &base64_scalar;
+    return base64_usable[0];
+}
+
+static const struct base64_impl *base64_active = base64_select();
+
+const char *base64_impl_name(void)
+{
+    return base64_active->name;
+}
+
+size_t base64_impl_count(void)
+{
+    return base64_usable_count;
+}
+
+// 测试用，换成第index个可用实现；不加锁，不能与其他线程的编解码同时调用
+int base64_impl_select(size_t index)
+{
+    if (index >= base64_usable_count) {
+        return -1;
+    }
+    base64_active = base64_usable[index];
+    return 0;
+}
+
+// 输出带'='填充，不写结束符，返回写入的字符数
+int base64_encode(const uint8_t *in, size_t len, char *out, size_t out_len)
+{
+    size_t need = BASE64_ENCODED_LEN(len);
+    if (need > out_len || need > INT32_MAX) {
+        return -1;
+    }
+    size_t done = base64_active->encode_blocks(in, len, out);
+    out += done / 3 * 4;
+    for (; len - done >= 3; done += 3, out += 4) {
+        uint32_t group = (uint32_t)in[done] << 16 | (uint32_t)in[done + 1] << 8 | in[done + 2];
+        out[0]         = base64_alphabet[group >> 18];
+        out[1]         = base64_alphabet[(group >> 12) & 0x3f];
+        out[2]         = base64_alphabet[(group >> 6) & 0x3f];
+        out[3]         = base64_alphabet[group & 0x3f];
+    }
+    if (len - done > 0) {
+        uint32_t group = (uint32_t)in[done] << 16;
+        if (len - done == 2) {
+            group |= (uint32_t)in[done + 1] << 8;
+        }
+        out[0] = base64_alphabet[group >> 18];
+        out[1] = base64_alphabet[(group >> 12) & 0x3f];
+        out[2] = (len - done == 2) ? base64_alphabet[(group >> 6) & 0x3f] : '=';
+        out[3] = '=';
+    }
+    return (int)need;
+}
+
+// 接受带或不带'='填充的输入，非法字符、长度不对或空间不足返回-1，否则返回解码的字节数
+int base64_decode(const char *in, size_t len, uint8_t *out, size_t out_len)
+{
+    if (len % 4 == 0 && len > 0 && in[len - 1] == '=') {
+        len -= (in[len - 2] == '=') ? 2 : 1;
+    }
+    if (len % 4 == 1 || len > INT32_MAX) {
+        return -1;
+    }
+    size_t need = len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+    if (need > out_len) {
+        return -1;
+    }
+    size_t done = base64_active->decode_blocks(in, len, out, out_len);
+    out += done / 4 * 3;
+
+    const uint8_t *src   = (const uint8_t *)in;
+    uint8_t        error = 0;
+    for (; len - done >= 4; done += 4, out += 3) {
+        uint8_t v0 = base64_values[src[done]];
+        uint8_t v1 = base64_values[src[done + 1]];
+        uint8_t v2 = base64_values[src[done + 2]];
+        uint8_t v3 = base64_values[src[done + 3]];
+        error |= v0 | v1 | v2 | v3;
+        out[0] = (uint8_t)(v0 << 2 | v1 >> 4);
+        out[1] = (uint8_t)(v1 << 4 | v2 >> 2);
+        out[2] = (uint8_t)(v2 << 6 | v3);
+    }
+    if (len - done >= 2) {
+        uint8_t v0 = base64_values[src[done]];
+        uint8_t v1 = base64_values[src[done + 1]];
+        error |= v0 | v1;
+        out[0] = (uint8_t)(v0 << 2 | v1 >> 4);
+        if (len - done == 3) {
+            uint8_t v2 = base64_values[src[done + 2]];
+            error |= v2;
+            out[1] = (uint8_t)(v1 << 4 | v2 >> 2);
+        }
+    }
+    // 合法值都小于64，或起来最高位为1说明有非法字符
+    return (error & 0x80) ? -1 : (int)need;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge Base64编解码
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 编解码到调用者提供的缓冲区，不分配内存，出错返回-1而不抛异常。
+ *          x86上启动时按CPU选择AVX2或SSSE3实现，aarch64上用NEON，其他
+ *          平台(及不足一个向量的尾部)用查表的标量实现。解码接受带或不带
+ *          '='填充的输入。测试可以用base64_impl_select逐个切换实现。
+ */
+
+#ifndef _BRIDGE_BASE64_HPP_
+#define _BRIDGE_BASE64_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 编码后的长度(含填充)和解码后的最大长度
+#define BASE64_ENCODED_LEN(n) (((n) + 2) / 3 * 4)
+#define BASE64_DECODED_MAX(n) (((n) + 3) / 4 * 3)
+
+int         base64_encode(const uint8_t *in, size_t len, char *out, size_t out_len);
+int         base64_decode(const char *in, size_t len, uint8_t *out, size_t out_len);
+const char *base64_impl_name(void);
+
+// 本机可用的实现按优先顺序编号，0为启动时选定的实现，最后一个为scalar
+size_t base64_impl_count(void);
+int    base64_impl_select(size_t index);
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行合并发布
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-batch.hpp"
+#include "bridge-proto.hpp"
+
+// rx_us为帧所在数据报的接收时刻，合并窗口和最大延迟都从接收时算起
+void uplink_batch_append(struct uplink_batch *batch, const string &frame, bool protobuf,
+                         uint64_t rx_us)
+{
+    if (batch->frames == 0) {
+        batch->first_us = rx_us;
+    }
+    if (protobuf) {
+        proto_put_varint(batch->payload, frame.length());
+    } else {
+        batch->payload += (batch->frames == 0) ? '[' : ',';
+    }
+    batch->payload += frame;
+    batch->last_us = rx_us;
+    batch->rx_us.push_back(rx_us);
+    batch->frames++;
+}
+
+// 发布前调用，JSON补上数组结尾
+void uplink_batch_finish(struct uplink_batch *batch, bool protobuf)
+{
+    if (!protobuf && batch->frames > 0) {
+        batch->payload += ']';
+    }
+}
+
+// 清空但保留payload的容量，下一批复用
+void uplink_batch_reset(struct uplink_batch *batch)
+{
+    batch->payload.clear();
+    batch->rx_us.clear();
+    batch->frames   = 0;
+    batch->first_us = 0;
+    batch->last_us  = 0;
+}
+
+/*
+ * 最近一帧后window_us内没有新帧就发布，但从第一帧算起不超过max_delay_us。
+ * 空批次返回false。
+ */
+bool uplink_batch_deadline(const struct uplink_batch *batch, uint64_t window_us,
+                           uint64_t max_delay_us, uint64_t *deadline_us)
+{
+    if (batch->frames == 0) {
+        return false;
+    }
+    uint64_t idle = batch->last_us + window_us;
+    uint64_t cap  = batch->first_us + max_delay_us;
+    *deadline_us  = (idle < cap) ? idle : cap;
+    return true;
+}
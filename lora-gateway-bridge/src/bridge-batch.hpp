@@ -0,0 +1,42 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行合并发布
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 同一网关在合并窗口内的多个上行拼成一条MQTT消息发到batch topic。
+ *          JSON为上行对象组成的数组；protobuf为多个UplinkFrame，每个前面
+ *          带varint长度(与protobuf的writeDelimitedTo格式相同)。
+ */
+
+#ifndef _BRIDGE_BATCH_HPP_
+#define _BRIDGE_BATCH_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define UPLINK_BATCH_WINDOW_MAX     1000 /* ms */
+#define UPLINK_BATCH_SIZE_DEFAULT   16
+#define UPLINK_BATCH_SIZE_MAX       256
+#define UPLINK_BATCH_DELAY_DEFAULT  50   /* ms */
+#define UPLINK_BATCH_DELAY_MAX      5000 /* ms */
+#define UPLINK_BATCH_TOPIC_SUFFIX   "_batch"
+
+using namespace std;
+
+struct uplink_batch {
+    string   payload;
+    uint32_t frames;
+    uint64_t first_us; // 第一帧进入的时刻，用于最大延迟
+    uint64_t last_us;  // 最近一帧进入的时刻，用于合并窗口
+    vector<uint64_t> rx_us; // 各帧的UDP接收时刻，用于上行时延统计
+};
+
+void uplink_batch_append(struct uplink_batch *batch, const string &frame, bool protobuf,
+                         uint64_t rx_us);
+void uplink_batch_finish(struct uplink_batch *batch, bool protobuf);
+void uplink_batch_reset(struct uplink_batch *batch);
+bool uplink_batch_deadline(const struct uplink_batch *batch, uint64_t window_us,
+                           uint64_t max_delay_us, uint64_t *deadline_us);
+
+#endif
@@ -0,0 +1,149 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行去重
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-dedup.hpp"
+
+// FNV-1a，对base64文本计算即可，不必先解码
+static uint64_t payload_hash(const char *payload, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)payload[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+UplinkDedup::UplinkDedup(uint64_t window_us, enum uplink_dedup_policy policy)
+{
+    pthread_mutex_init(&this->mutex, NULL);
+    this->slots.resize(UPLINK_DEDUP_SLOTS);
+    this->set_mask  = UPLINK_DEDUP_SLOTS / UPLINK_DEDUP_WAYS - 1;
+    this->window_us = window_us;
+    this->policy    = policy;
+}
+
+UplinkDedup::~UplinkDedup()
+{
+    pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+ * 窗口内已有同一帧时按策略并入，否则在该组的空槽新建条目。
+ * 保留的字段从copy中移走，调用者每次重新填写copy。
+ */
+enum uplink_dedup_result UplinkDedup::add(const char *payload, size_t len, int owner,
+                                          uint64_t rx_us, struct uplink_copy *copy)
+{
+    uint64_t            hash      = payload_hash(payload, len);
+    struct dedup_entry *ways      = &this->slots[(hash & this->set_mask) * UPLINK_DEDUP_WAYS];
+    struct dedup_entry *free_slot = nullptr;
+
+    pthread_mutex_lock(&this->mutex);
+    for (int i = 0; i < UPLINK_DEDUP_WAYS; i++) {
+        struct dedup_entry *entry = &ways[i];
+        if (entry->hash == 0) {
+            free_slot = free_slot ? free_slot : entry;
+            continue;
+        }
+        // 已过窗口但还没被collect的条目不再接收副本
+        if (entry->hash != hash || rx_us >= entry->first_us + this->window_us ||
+            entry->payload.compare(0, string::npos, payload, len) != 0) {
+            continue;
+        }
+        entry->copies++;
+        bool better = copy->snr > entry->snr;
+        if (better) {
+            entry->session = copy->session;
+            entry->snr     = copy->snr;
+            entry->head    = std::move(copy->head);
+            entry->tail    = std::move(copy->tail);
+        }
+        // merge满了以后更好的副本顶替原来最好的一份，保证up topic发布的是SNR最高的
+        if (this->policy == UPLINK_DEDUP_MERGE &&
+            entry->rx_infos.size() < UPLINK_DEDUP_RXINFO_MAX) {
+            entry->rx_infos.push_back(std::move(copy->rx_info));
+            if (better) {
+                entry->best = entry->rx_infos.size() - 1;
+            }
+        } else if (better) {
+            entry->rx_infos[entry->best] = std::move(copy->rx_info);
+        }
+        pthread_mutex_unlock(&this->mutex);
+        return UPLINK_DEDUP_DUPLICATE;
+    }
+    if (!free_slot) {
+        pthread_mutex_unlock(&this->mutex);
+        return UPLINK_DEDUP_FULL;
+    }
+    free_slot->hash = hash;
+    free_slot->payload.assign(payload, len);
+    free_slot->owner    = owner;
+    free_slot->first_us = rx_us;
+    free_slot->copies   = 1;
+    free_slot->session  = copy->session;
+    free_slot->snr      = copy->snr;
+    free_slot->head     = std::move(copy->head);
+    free_slot->tail     = std::move(copy->tail);
+    free_slot->rx_infos.clear();
+    free_slot->rx_infos.push_back(std::move(copy->rx_info));
+    free_slot->best = 0;
+    pthread_mutex_unlock(&this->mutex);
+    return UPLINK_DEDUP_FIRST;
+}
+
+// 取出owner创建且窗口已结束的条目，返回其余条目中最早的结束时刻，没有则为0
+uint64_t UplinkDedup::collect(int owner, uint64_t now_us, vector<struct dedup_entry> &out)
+{
+    uint64_t earliest = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    for (auto &entry : this->slots) {
+        if (entry.hash == 0 || entry.owner != owner) {
+            continue;
+        }
+        uint64_t deadline_us = entry.first_us + this->window_us;
+        if (deadline_us <= now_us) {
+            out.push_back(std::move(entry));
+            entry.hash = 0;
+        } else if (earliest == 0 || deadline_us < earliest) {
+            earliest = deadline_us;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return earliest;
+}
+
+// UplinkFrame只带SNR最高的一份rxInfo，与未去重时的格式相同
+void UplinkDedup::assemble(const struct dedup_entry *entry, string &out) const
+{
+    out += entry->head;
+    out += entry->rx_infos[entry->best];
+    out += entry->tail;
+}
+
+/*
+ * UplinkFrameSet: phy_payload(1) tx_info(2) rx_info(3)与UplinkFrame的字段号
+ * 相同，protobuf的rx_info是最后一个字段，依次追加即为repeated。
+ * JSON的rxInfo为数组，每个元素带gatewayID。
+ */
+void UplinkDedup::assemble_set(const struct dedup_entry *entry, bool protobuf, string &out) const
+{
+    out += entry->head;
+    if (protobuf) {
+        for (const auto &rx_info : entry->rx_infos) { out += rx_info; }
+        return;
+    }
+    out += '[';
+    for (size_t i = 0; i < entry->rx_infos.size(); i++) {
+        if (i) {
+            out += ',';
+        }
+        out += entry->rx_infos[i];
+    }
+    out += ']';
+    out += entry->tail;
+}
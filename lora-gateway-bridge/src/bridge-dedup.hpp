@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行去重
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 同一帧会被多个RF链或多个packet forwarder收到。以PHYPayload的哈希
+ *          为键，第一份到达后等待去重窗口，窗口内到达的副本按策略处理：
+ *          两种策略都在up topic上发布SNR最高的一份(UplinkFrame不变)，merge
+ *          另外把各副本的rxInfo合并成UplinkFrameSet发布到up_set topic。
+ *          表为固定大小的组相联哈希表，满了的帧不去重直接发布。
+ */
+
+#ifndef _BRIDGE_DEDUP_HPP_
+#define _BRIDGE_DEDUP_HPP_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define UPLINK_DEDUP_WINDOW_DEFAULT 0    /* ms，0为不去重 */
+#define UPLINK_DEDUP_WINDOW_MAX     1000 /* ms */
+#define UPLINK_DEDUP_SLOTS          512
+#define UPLINK_DEDUP_WAYS           4  /* 每组的槽位数，组内顺序查找 */
+#define UPLINK_DEDUP_RXINFO_MAX     16 /* merge时每帧最多保留的rxInfo个数 */
+
+// merge时UplinkFrameSet的topic为<up topic>_set
+#define UPLINK_DEDUP_SET_TOPIC_SUFFIX "_set"
+
+using namespace std;
+
+struct gateway_session;
+
+enum uplink_dedup_policy {
+    UPLINK_DEDUP_MERGE = 0,
+    UPLINK_DEDUP_BEST_SNR,
+};
+
+// add()的返回值
+enum uplink_dedup_result {
+    UPLINK_DEDUP_FULL = -1, // 组内无空位，调用者直接发布
+    UPLINK_DEDUP_DUPLICATE, // 已并入窗口内的同一帧
+    UPLINK_DEDUP_FIRST,     // 新建条目，调用者在窗口结束时collect
+};
+
+// 一份接收副本按marshaler序列化后的三段，rx_info之外的部分取自同一副本
+struct uplink_copy {
+    struct gateway_session *session;
+    double                  snr;
+    string                  head;
+    string                  rx_info;
+    string                  tail;
+};
+
+struct dedup_entry {
+    uint64_t                hash;    // 0为空槽
+    string                  payload; // base64 PHYPayload，哈希相同时再比对
+    int                     owner;   // 创建条目的worker，窗口结束由它发布
+    uint64_t                first_us;
+    uint32_t                copies;
+    struct gateway_session *session; // 发布到该网关的topic
+    double                  snr;
+    string                  head;
+    string                  tail;
+    vector<string>          rx_infos;
+    uint32_t                best; // SNR最高的一份在rx_infos中的下标
+};
+
+// 不同worker可能收到同一帧的副本，所有操作加锁
+class UplinkDedup
+{
+  private:
+    pthread_mutex_t            mutex;
+    vector<struct dedup_entry> slots;
+    uint32_t                   set_mask;
+    uint64_t                   window_us;
+    enum uplink_dedup_policy   policy;
+
+  public:
+    UplinkDedup(uint64_t window_us, enum uplink_dedup_policy policy);
+    ~UplinkDedup();
+    UplinkDedup(const UplinkDedup &)            = delete;
+    UplinkDedup &operator=(const UplinkDedup &) = delete;
+
+    enum uplink_dedup_result add(const char *payload, size_t len, int owner, uint64_t rx_us,
+                                 struct uplink_copy *copy);
+    uint64_t collect(int owner, uint64_t now_us, vector<struct dedup_entry> &out);
+    void     assemble(const struct dedup_entry *entry, string &out) const;
+    void     assemble_set(const struct dedup_entry *entry, bool protobuf, string &out) const;
+    bool     merging(void) const { return this->policy == UPLINK_DEDUP_MERGE; }
+};
+
+#endif
@@ -0,0 +1,721 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行命令转换
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-downlink.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#define FIELD_ERROR(name) "Missing or invalid " name " field."
+#define FIELD_COUNT(tb)   (sizeof(tb) / sizeof((tb)[0]))
+
+#define DOWNLINK_PHY_PAYLOAD_MAX 255 /* txpk的size为8位 */
+
+// downlinkItems中一项用到的字段，txInfo和modulationInfo展开到同一个视图
+struct downlink_item {
+    struct json_span phy_payload;
+    struct json_span phy_payload_size;
+    struct json_span modulation;
+    struct json_span tx_info;
+    struct json_span timing;
+    struct json_span timestamp;
+    struct json_span power;
+    struct json_span frequency;
+    struct json_span preamble_size;
+    struct json_span no_crc;
+    struct json_span no_header;
+    struct json_span modulation_info;
+    struct json_span bandwidth;
+    struct json_span spreading_factor;
+    struct json_span code_rate;
+    struct json_span polarization_inversion;
+    struct json_span fsk_datarate;
+    struct json_span fsk_freq_dev;
+};
+
+struct item_field {
+    const char *name;
+    size_t      offset;
+};
+
+static const struct item_field item_fields[] = {
+    { "phyPayload", offsetof(struct downlink_item, phy_payload) },
+    { "phyPayloadSize", offsetof(struct downlink_item, phy_payload_size) },
+    { "modulation", offsetof(struct downlink_item, modulation) },
+    { "txInfo", offsetof(struct downlink_item, tx_info) },
+};
+
+static const struct item_field tx_info_fields[] = {
+    { "timing", offsetof(struct downlink_item, timing) },
+    { "timestamp", offsetof(struct downlink_item, timestamp) },
+    { "power", offsetof(struct downlink_item, power) },
+    { "frequency", offsetof(struct downlink_item, frequency) },
+    { "preambleSize", offsetof(struct downlink_item, preamble_size) },
+    { "noCRC", offsetof(struct downlink_item, no_crc) },
+    { "noHeader", offsetof(struct downlink_item, no_header) },
+    { "modulationInfo", offsetof(struct downlink_item, modulation_info) },
+};
+
+static const struct item_field modulation_info_fields[] = {
+    { "bandwidth", offsetof(struct downlink_item, bandwidth) },
+    { "spreadingFactor", offsetof(struct downlink_item, spreading_factor) },
+    { "codeRate", offsetof(struct downlink_item, code_rate) },
+    { "polarizationInversion", offsetof(struct downlink_item, polarization_inversion) },
+    { "FSKDataRate", offsetof(struct downlink_item, fsk_datarate) },
+    { "FSKFreqDev", offsetof(struct downlink_item, fsk_freq_dev) },
+};
+
+// 定长缓冲区上的JSON输出，超出容量后只累计长度，由调用者按len判断
+struct txpk_writer {
+    char  *buf;
+    size_t cap;
+    size_t len;
+    bool   first;
+};
+
+/*
+ * 扫描顶层字段。downlinkID在v3中为UUID的base64字符串，也接受整数；
+ * 报文不是合法JSON对象时返回-1。
+ */
+int chirpstack_downlink_command_parse(const char *payload, size_t len,
+                                      struct chirpstack_downlink_command *command)
+{
+    struct json_cursor cursor;
+    struct json_span   root, key, value;
+    int64_t            token;
+    int                ret;
+
+    memset(command, 0, sizeof(*command));
+    if (json_scan_document(payload, len, &root) < 0 || root.type != JSON_SCAN_OBJECT ||
+        json_scan_open(&root, &cursor) < 0) {
+        return -1;
+    }
+    while ((ret = json_scan_next_member(&cursor, &key, &value)) > 0) {
+        if (json_span_equals(&key, "gatewayID")) {
+            command->gateway_id = value;
+        } else if (json_span_equals(&key, "downlinkID") || json_span_equals(&key, "downlinkId")) {
+            if (value.type == JSON_SCAN_STRING || json_span_is_integer(&value)) {
+                command->downlink_id = value;
+            }
+        } else if (json_span_equals(&key, "token")) {
+            if (json_span_to_int64(&value, &token) == 0 && token >= 0 && token <= UINT32_MAX) {
+                command->token = static_cast<uint32_t>(token);
+            }
+        } else if (json_span_equals(&key, "txpk")) {
+            command->txpk = value;
+        } else if (json_span_equals(&key, "downlinkItems")) {
+            command->items = value;
+        }
+    }
+    return ret;
+}
+
+/*
+ * DownlinkFrame: phy_payload(1) tx_info(2)为旧版的单项格式，token(3)
+ * downlink_id(4) items(5) gateway_id(6)。先完整走一遍，格式错误返回-1。
+ */
+int chirpstack_downlink_command_proto_parse(const void *payload, size_t len,
+                                            struct chirpstack_downlink_command *command)
+{
+    struct proto_reader reader;
+    struct proto_field  field;
+    int                 ret, n;
+
+    memset(command, 0, sizeof(*command));
+    command->protobuf  = true;
+    command->frame     = static_cast<const uint8_t *>(payload);
+    command->frame_len = len;
+    proto_reader_init(&reader, payload, len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (field.number == 3 && field.wire_type == PROTO_WIRE_VARINT) {
+            command->token = static_cast<uint32_t>(field.value);
+        } else if (field.number == 4 && field.wire_type == PROTO_WIRE_LEN &&
+                   field.len > 0 && field.len <= DOWNLINK_PROTO_ID_MAX) {
+            n = base64_encode(field.ptr,
+                              field.len,
+                              command->downlink_id_text,
+                              sizeof(command->downlink_id_text));
+            if (n > 0) {
+                command->downlink_id.type = JSON_SCAN_STRING;
+                command->downlink_id.ptr  = command->downlink_id_text;
+                command->downlink_id.len  = n;
+            }
+        } else if (field.number == 6 && field.wire_type == PROTO_WIRE_LEN && field.len == 8) {
+            command->has_gateway_eui = true;
+            for (int i = 0; i < 8; i++) {
+                command->gateway_eui = (command->gateway_eui << 8) | field.ptr[i];
+            }
+        }
+    }
+    return ret;
+}
+
+void chirpstack_downlink_proto_open(const struct chirpstack_downlink_command *command,
+                                    struct downlink_proto_cursor             *cursor)
+{
+    struct proto_field field;
+
+    cursor->legacy = true;
+    proto_reader_init(&cursor->reader, command->frame, command->frame_len);
+    while (proto_next_field(&cursor->reader, &field) > 0) {
+        if (field.number == 5) {
+            cursor->legacy = false;
+            break;
+        }
+    }
+    proto_reader_init(&cursor->reader, command->frame, command->frame_len);
+}
+
+// 旧版格式中DownlinkFrame的字段1、2与DownlinkFrameItem相同，整帧当作一项
+int chirpstack_downlink_proto_next(struct downlink_proto_cursor *cursor, const uint8_t **item,
+                                   size_t *len)
+{
+    struct proto_field field;
+    int                ret;
+
+    if (cursor->legacy) {
+        if (cursor->reader.pos >= cursor->reader.end) {
+            return 0;
+        }
+        *item              = cursor->reader.pos;
+        *len               = cursor->reader.end - cursor->reader.pos;
+        cursor->reader.pos = cursor->reader.end;
+        return 1;
+    }
+    while ((ret = proto_next_field(&cursor->reader, &field)) > 0) {
+        if (field.number != 5) {
+            continue;
+        }
+        if (field.wire_type != PROTO_WIRE_LEN) {
+            return -1;
+        }
+        *item = field.ptr;
+        *len  = field.len;
+        return 1;
+    }
+    return ret;
+}
+
+// 对象不存在或不是对象时返回-1
+static int scan_fields(const struct json_span *object, const struct item_field *fields,
+                       size_t count, struct downlink_item *item)
+{
+    struct json_cursor cursor;
+    struct json_span   key, value;
+    int                ret;
+
+    if (object->type != JSON_SCAN_OBJECT || json_scan_open(object, &cursor) < 0) {
+        return -1;
+    }
+    while ((ret = json_scan_next_member(&cursor, &key, &value)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (json_span_equals(&key, fields[i].name)) {
+                char *base = reinterpret_cast<char *>(item);
+                *reinterpret_cast<struct json_span *>(base + fields[i].offset) = value;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+static inline bool is_bool(const struct json_span *value)
+{
+    return value->type == JSON_SCAN_TRUE || value->type == JSON_SCAN_FALSE;
+}
+
+// 可选字段: 没有或类型相符
+static inline bool optional_integer(const struct json_span *value)
+{
+    return value->type == JSON_SCAN_NONE || json_span_is_integer(value);
+}
+
+static inline bool optional_bool(const struct json_span *value)
+{
+    return value->type == JSON_SCAN_NONE || is_bool(value);
+}
+
+static inline void put_raw(struct txpk_writer *w, const char *data, size_t n)
+{
+    if (w->len + n <= w->cap) {
+        memcpy(w->buf + w->len, data, n);
+    }
+    w->len += n;
+}
+
+static inline void put_key(struct txpk_writer *w, const char *key)
+{
+    if (!w->first) {
+        put_raw(w, ",", 1);
+    }
+    w->first = false;
+    put_raw(w, "\"", 1);
+    put_raw(w, key, strlen(key));
+    put_raw(w, "\":", 2);
+}
+
+// 字符串原样带回引号，转义保持不变
+static inline void put_member(struct txpk_writer *w, const char *key,
+                              const struct json_span *value)
+{
+    put_key(w, key);
+    if (value->type == JSON_SCAN_STRING) {
+        put_raw(w, "\"", 1);
+        put_raw(w, value->ptr, value->len);
+        put_raw(w, "\"", 1);
+    } else {
+        put_raw(w, value->ptr, value->len);
+    }
+}
+
+static inline void put_optional(struct txpk_writer *w, const char *key,
+                                const struct json_span *value)
+{
+    if (value->type != JSON_SCAN_NONE) {
+        put_member(w, key, value);
+    }
+}
+
+static inline void put_text(struct txpk_writer *w, const char *key, const char *text, int n)
+{
+    put_key(w, key);
+    put_raw(w, text, n);
+}
+
+// LoRa: datr由spreadingFactor和bandwidth(kHz)拼成"SF7BW125"
+static int put_lora(struct txpk_writer *w, const struct downlink_item *item, const char **error)
+{
+    int64_t bw, sf;
+    char    datr[32];
+    int     n;
+
+    if (json_span_to_int64(&item->bandwidth, &bw) < 0 || bw <= 0 || bw > 1000) {
+        *error = FIELD_ERROR("bandwidth");
+        return -1;
+    }
+    if (json_span_to_int64(&item->spreading_factor, &sf) < 0 || sf <= 0 || sf > 12) {
+        *error = FIELD_ERROR("spreadingFactor");
+        return -1;
+    }
+    if (item->code_rate.type != JSON_SCAN_STRING) {
+        *error = FIELD_ERROR("codeRate");
+        return -1;
+    }
+    if (!optional_bool(&item->polarization_inversion)) {
+        *error = FIELD_ERROR("polarizationInversion");
+        return -1;
+    }
+    n = snprintf(datr, sizeof(datr), "\"SF%dBW%d\"", (int)sf, (int)bw);
+    put_text(w, "datr", datr, n);
+    put_member(w, "codr", &item->code_rate);
+    put_optional(w, "ipol", &item->polarization_inversion);
+    return 0;
+}
+
+static int put_fsk(struct txpk_writer *w, const struct downlink_item *item, const char **error)
+{
+    if (!json_span_is_integer(&item->fsk_datarate)) {
+        *error = FIELD_ERROR("FSKDataRate");
+        return -1;
+    }
+    if (!optional_integer(&item->fsk_freq_dev)) {
+        *error = FIELD_ERROR("FSKFreqDev");
+        return -1;
+    }
+    put_member(w, "datr", &item->fsk_datarate);
+    put_optional(w, "fdev", &item->fsk_freq_dev);
+    return 0;
+}
+
+/*
+ * 把downlinkItems中的一项写成{"txpk":{...}}，返回写入的长度(不含结束符)。
+ * 缺少必需字段或类型不对时返回-1，error指向可直接报告给服务端的原因。
+ * frequency(Hz)按整数换算成MHz文本，不经过浮点。
+ */
+int chirpstack_downlink_item_txpk(const struct json_span *object, char *out, size_t out_len,
+                                  const char **error)
+{
+    struct downlink_item item;
+    struct txpk_writer   w = { out, out_len, 0, true };
+    int64_t              frequency, tmst;
+    char                 text[24];
+    int                  n, ret;
+
+    memset(&item, 0, sizeof(item));
+    if (scan_fields(object, item_fields, FIELD_COUNT(item_fields), &item) < 0) {
+        *error = "Invalid downlink item.";
+        return -1;
+    }
+    if (scan_fields(&item.tx_info, tx_info_fields, FIELD_COUNT(tx_info_fields), &item) < 0) {
+        *error = FIELD_ERROR("txInfo");
+        return -1;
+    }
+    if (item.modulation_info.type != JSON_SCAN_NONE &&
+        scan_fields(&item.modulation_info,
+                    modulation_info_fields,
+                    FIELD_COUNT(modulation_info_fields),
+                    &item) < 0) {
+        *error = FIELD_ERROR("modulationInfo");
+        return -1;
+    }
+    if (item.phy_payload.type != JSON_SCAN_STRING) {
+        *error = FIELD_ERROR("phyPayload");
+        return -1;
+    }
+    if (!json_span_is_integer(&item.phy_payload_size)) {
+        *error = FIELD_ERROR("phyPayloadSize");
+        return -1;
+    }
+    if (json_span_to_int64(&item.frequency, &frequency) < 0 || frequency <= 0 ||
+        frequency > UINT32_MAX) {
+        *error = FIELD_ERROR("frequency");
+        return -1;
+    }
+    if (!optional_integer(&item.power) || !optional_integer(&item.preamble_size) ||
+        !optional_bool(&item.no_crc) || !optional_bool(&item.no_header)) {
+        *error = "Invalid txInfo field type.";
+        return -1;
+    }
+
+    put_raw(&w, "{\"txpk\":{", 9);
+    put_member(&w, "data", &item.phy_payload);
+    put_member(&w, "size", &item.phy_payload_size);
+    //  CLASS A or CLASS C
+    if (json_span_equals(&item.timing, "IMMEDIATELY")) {
+        put_text(&w, "imme", "true", 4);
+    } else if (json_span_equals(&item.timing, "DELAY")) {
+        if (json_span_to_int64(&item.timestamp, &tmst) < 0 || tmst < 0 || tmst > UINT32_MAX) {
+            *error = FIELD_ERROR("timestamp");
+            return -1;
+        }
+        put_text(&w, "imme", "false", 5);
+        put_member(&w, "tmst", &item.timestamp);
+    } else {
+        *error = "Error: Unrecognized timing type.";
+        return -1;
+    }
+    n = snprintf(text,
+                 sizeof(text),
+                 "%u.%06u",
+                 (unsigned)(frequency / 1000000),
+                 (unsigned)(frequency % 1000000));
+    put_text(&w, "freq", text, n);
+    // 只能是0
+    put_text(&w, "rfch", "0", 1);
+    put_optional(&w, "powe", &item.power);
+    put_member(&w, "modu", &item.modulation);
+    if (json_span_equals(&item.modulation, "LORA")) {
+        ret = put_lora(&w, &item, error);
+    } else if (json_span_equals(&item.modulation, "FSK")) {
+        ret = put_fsk(&w, &item, error);
+    } else {
+        *error = "ERROR modulation.";
+        ret    = -1;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    put_optional(&w, "prea", &item.preamble_size);
+    put_optional(&w, "ncrc", &item.no_crc);
+    put_optional(&w, "nhdr", &item.no_header);
+    put_raw(&w, "}}", 2);
+    if (w.len > w.cap) {
+        *error = "Downlink frame too long.";
+        return -1;
+    }
+    return static_cast<int>(w.len);
+}
+
+// txInfo展开后的视图，has_*表示字段出现过
+struct downlink_proto_item {
+    const uint8_t *phy_payload;
+    size_t         phy_payload_len;
+    bool           has_tx_info;
+    uint32_t       frequency;
+    int32_t        power;
+    uint32_t       modulation;
+    bool           has_lora;
+    uint32_t       bandwidth;
+    uint32_t       spreading_factor;
+    const uint8_t *code_rate;
+    size_t         code_rate_len;
+    bool           polarization_inversion;
+    bool           has_fsk;
+    uint32_t       frequency_deviation;
+    uint32_t       datarate;
+    uint32_t       timing;
+    uint64_t       delay_us;
+    bool           has_gps_time;
+    uint64_t       gps_time_ms;
+    bool           has_context;
+    uint32_t       context;
+};
+
+// google.protobuf.Duration: seconds(1) nanos(2)，负数视为格式错误
+static int proto_duration_us(const uint8_t *data, size_t len, uint64_t *us)
+{
+    struct proto_reader reader;
+    struct proto_field  field;
+    int64_t             seconds = 0, nanos = 0;
+    int                 ret;
+
+    proto_reader_init(&reader, data, len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (field.wire_type != PROTO_WIRE_VARINT) {
+            continue;
+        }
+        if (field.number == 1) {
+            seconds = static_cast<int64_t>(field.value);
+        } else if (field.number == 2) {
+            nanos = static_cast<int32_t>(field.value);
+        }
+    }
+    if (ret < 0 || seconds < 0 || nanos < 0 || seconds > UINT32_MAX) {
+        return -1;
+    }
+    *us = static_cast<uint64_t>(seconds) * 1000000 + nanos / 1000;
+    return 0;
+}
+
+// 取timing_info中唯一的Duration字段(delay或time_since_gps_epoch)
+static int proto_timing_us(const struct proto_field *info, uint64_t *us)
+{
+    struct proto_reader reader;
+    struct proto_field  field;
+    int                 ret;
+
+    *us = 0;
+    proto_reader_init(&reader, info->ptr, info->len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (field.number == 1 && field.wire_type == PROTO_WIRE_LEN &&
+            proto_duration_us(field.ptr, field.len, us) < 0) {
+            return -1;
+        }
+    }
+    return ret;
+}
+
+static int scan_proto_modulation(const struct proto_field *info, struct downlink_proto_item *item)
+{
+    struct proto_reader reader;
+    struct proto_field  field;
+    bool                lora = (info->number == 8);
+    int                 ret;
+
+    proto_reader_init(&reader, info->ptr, info->len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (lora && field.number == 3 && field.wire_type == PROTO_WIRE_LEN) {
+            item->code_rate     = field.ptr;
+            item->code_rate_len = field.len;
+        } else if (field.wire_type != PROTO_WIRE_VARINT) {
+            continue;
+        } else if (lora && field.number == 1) {
+            item->bandwidth = static_cast<uint32_t>(field.value);
+        } else if (lora && field.number == 2) {
+            item->spreading_factor = static_cast<uint32_t>(field.value);
+        } else if (lora && field.number == 4) {
+            item->polarization_inversion = field.value != 0;
+        } else if (field.number == 1) {
+            item->frequency_deviation = static_cast<uint32_t>(field.value);
+        } else if (field.number == 2) {
+            item->datarate = static_cast<uint32_t>(field.value);
+        }
+    }
+    return ret;
+}
+
+/*
+ * DownlinkTXInfo: frequency(5) power(6) modulation(7) lora(8) fsk(9) timing(12)
+ * immediately(13) delay(14) gps_epoch(15) context(16)，其他字段忽略
+ */
+static int scan_proto_tx_info(const uint8_t *data, size_t len, struct downlink_proto_item *item)
+{
+    struct proto_reader reader;
+    struct proto_field  field;
+    int                 ret;
+
+    proto_reader_init(&reader, data, len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (field.wire_type == PROTO_WIRE_VARINT) {
+            if (field.number == 5) {
+                item->frequency = static_cast<uint32_t>(field.value);
+            } else if (field.number == 6) {
+                item->power = static_cast<int32_t>(field.value);
+            } else if (field.number == 7) {
+                item->modulation = static_cast<uint32_t>(field.value);
+            } else if (field.number == 12) {
+                item->timing = static_cast<uint32_t>(field.value);
+            }
+        } else if (field.wire_type != PROTO_WIRE_LEN) {
+            continue;
+        } else if (field.number == 8 || field.number == 9) {
+            item->has_lora = item->has_lora || field.number == 8;
+            item->has_fsk  = item->has_fsk || field.number == 9;
+            if (scan_proto_modulation(&field, item) < 0) {
+                return -1;
+            }
+        } else if (field.number == 14) {
+            if (proto_timing_us(&field, &item->delay_us) < 0) {
+                return -1;
+            }
+        } else if (field.number == 15) {
+            if (proto_timing_us(&field, &item->gps_time_ms) < 0) {
+                return -1;
+            }
+            item->gps_time_ms /= 1000;
+            item->has_gps_time = true;
+        } else if (field.number == 16 && field.len == 4) {
+            item->context     = (uint32_t)field.ptr[0] << 24 | (uint32_t)field.ptr[1] << 16 |
+                                (uint32_t)field.ptr[2] << 8 | field.ptr[3];
+            item->has_context = true;
+        }
+    }
+    return ret;
+}
+
+// codeRate原样写进JSON字符串，只接受"4/5"、"4/5LI"这样的文本
+static bool code_rate_valid(const uint8_t *code_rate, size_t len)
+{
+    if (len == 0 || len > 8) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!memchr("0123456789/LI", code_rate[i], 13)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * 把protobuf的一项DownlinkFrameItem写成{"txpk":{...}}，与JSON命令的输出一致。
+ * DELAY的tmst为context(上行的tmst)加上delay；GPS_EPOCH写成tmms。
+ */
+int chirpstack_downlink_proto_item_txpk(const uint8_t *data, size_t len, char *out,
+                                        size_t out_len, const char **error)
+{
+    struct downlink_proto_item item;
+    struct proto_reader        reader;
+    struct proto_field         field;
+    struct txpk_writer         w = { out, out_len, 0, true };
+    char                       text[48];
+    int                        n, ret;
+
+    memset(&item, 0, sizeof(item));
+    proto_reader_init(&reader, data, len);
+    while ((ret = proto_next_field(&reader, &field)) > 0) {
+        if (field.number == 1 && field.wire_type == PROTO_WIRE_LEN) {
+            item.phy_payload     = field.ptr;
+            item.phy_payload_len = field.len;
+        } else if (field.number == 2 && field.wire_type == PROTO_WIRE_LEN) {
+            item.has_tx_info = true;
+            if (scan_proto_tx_info(field.ptr, field.len, &item) < 0) {
+                *error = FIELD_ERROR("txInfo");
+                return -1;
+            }
+        }
+    }
+    if (ret < 0) {
+        *error = "Invalid downlink item.";
+        return -1;
+    }
+    if (item.phy_payload_len == 0 || item.phy_payload_len > DOWNLINK_PHY_PAYLOAD_MAX) {
+        *error = FIELD_ERROR("phyPayload");
+        return -1;
+    }
+    if (!item.has_tx_info) {
+        *error = FIELD_ERROR("txInfo");
+        return -1;
+    }
+    if (item.frequency == 0) {
+        *error = FIELD_ERROR("frequency");
+        return -1;
+    }
+
+    put_raw(&w, "{\"txpk\":{", 9);
+    put_key(&w, "data");
+    put_raw(&w, "\"", 1);
+    if (w.len + BASE64_ENCODED_LEN(item.phy_payload_len) <= w.cap) {
+        base64_encode(item.phy_payload, item.phy_payload_len, w.buf + w.len, w.cap - w.len);
+    }
+    w.len += BASE64_ENCODED_LEN(item.phy_payload_len);
+    put_raw(&w, "\"", 1);
+    n = snprintf(text, sizeof(text), "%u", (unsigned)item.phy_payload_len);
+    put_text(&w, "size", text, n);
+    if (item.timing == CHIRPSTACK_TIMING_IMMEDIATELY) {
+        put_text(&w, "imme", "true", 4);
+    } else if (item.timing == CHIRPSTACK_TIMING_DELAY) {
+        if (!item.has_context) {
+            *error = FIELD_ERROR("context");
+            return -1;
+        }
+        n = snprintf(text, sizeof(text), "%u", (unsigned)(item.context + item.delay_us));
+        put_text(&w, "imme", "false", 5);
+        put_text(&w, "tmst", text, n);
+    } else if (item.timing == CHIRPSTACK_TIMING_GPS_EPOCH && item.has_gps_time) {
+        n = snprintf(text, sizeof(text), "%llu", (unsigned long long)item.gps_time_ms);
+        put_text(&w, "imme", "false", 5);
+        put_text(&w, "tmms", text, n);
+    } else {
+        *error = "Error: Unrecognized timing type.";
+        return -1;
+    }
+    n = snprintf(text,
+                 sizeof(text),
+                 "%u.%06u",
+                 (unsigned)(item.frequency / 1000000),
+                 (unsigned)(item.frequency % 1000000));
+    put_text(&w, "freq", text, n);
+    // 只能是0
+    put_text(&w, "rfch", "0", 1);
+    n = snprintf(text, sizeof(text), "%d", (int)item.power);
+    put_text(&w, "powe", text, n);
+    if (item.modulation == CHIRPSTACK_MODULATION_LORA && item.has_lora) {
+        if (item.bandwidth == 0 || item.bandwidth > 1000) {
+            *error = FIELD_ERROR("bandwidth");
+            return -1;
+        }
+        if (item.spreading_factor == 0 || item.spreading_factor > 12) {
+            *error = FIELD_ERROR("spreadingFactor");
+            return -1;
+        }
+        if (!code_rate_valid(item.code_rate, item.code_rate_len)) {
+            *error = FIELD_ERROR("codeRate");
+            return -1;
+        }
+        put_text(&w, "modu", "\"LORA\"", 6);
+        n = snprintf(text,
+                     sizeof(text),
+                     "\"SF%uBW%u\"",
+                     (unsigned)item.spreading_factor,
+                     (unsigned)item.bandwidth);
+        put_text(&w, "datr", text, n);
+        n = snprintf(text, sizeof(text), "\"%.*s\"", (int)item.code_rate_len, item.code_rate);
+        put_text(&w, "codr", text, n);
+        put_text(&w,
+                 "ipol",
+                 item.polarization_inversion ? "true" : "false",
+                 item.polarization_inversion ? 4 : 5);
+    } else if (item.modulation == CHIRPSTACK_MODULATION_FSK && item.has_fsk) {
+        if (item.datarate == 0) {
+            *error = FIELD_ERROR("FSKDataRate");
+            return -1;
+        }
+        put_text(&w, "modu", "\"FSK\"", 5);
+        n = snprintf(text, sizeof(text), "%u", (unsigned)item.datarate);
+        put_text(&w, "datr", text, n);
+        n = snprintf(text, sizeof(text), "%u", (unsigned)item.frequency_deviation);
+        put_text(&w, "fdev", text, n);
+    } else {
+        *error = "ERROR modulation.";
+        return -1;
+    }
+    put_raw(&w, "}}", 2);
+    if (w.len > w.cap) {
+        *error = "Downlink frame too long.";
+        return -1;
+    }
+    return static_cast<int>(w.len);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行命令转换
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 直接在MQTT报文上扫描下行命令，只取用到的字段。Semtech格式的命令
+ *          原样入队；ChirpStack格式的downlinkItems逐项写成Semtech txpk，
+ *          写入调用者提供的缓冲区，不构造DOM。protobuf编码的DownlinkFrame
+ *          同样逐项写成txpk，与JSON命令走同一个下行队列。
+ */
+
+#ifndef _BRIDGE_DOWNLINK_HPP_
+#define _BRIDGE_DOWNLINK_HPP_
+
+#include "bridge-base64.hpp"
+#include "bridge-json-scan.hpp"
+#include "bridge-proto.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+// protobuf命令中downlink_id为UUID的16字节
+#define DOWNLINK_PROTO_ID_MAX 16
+
+/*
+ * 下行命令的顶层字段，未出现的字段type为JSON_SCAN_NONE。
+ * protobuf命令: frame指向DownlinkFrame，gateway_id为8字节EUI，
+ * downlink_id按base64写入downlink_id_text并由downlink_id指向，与JSON命令一致。
+ */
+struct chirpstack_downlink_command {
+    struct json_span gateway_id;
+    struct json_span downlink_id; // 字符串或整数，其他类型视为没有
+    struct json_span txpk;        // Semtech格式的命令
+    struct json_span items;       // ChirpStack格式的downlinkItems
+    uint32_t         token;       // 0表示没有
+    bool             protobuf;
+    bool             has_gateway_eui;
+    uint64_t         gateway_eui;
+    const uint8_t   *frame;
+    size_t           frame_len;
+    char             downlink_id_text[BASE64_ENCODED_LEN(DOWNLINK_PROTO_ID_MAX)];
+};
+
+// protobuf DownlinkFrame中的下行项，返回1取到一项，0读完，-1格式错误
+struct downlink_proto_cursor {
+    struct proto_reader reader;
+    bool                legacy; // 没有items时整帧按旧版的phy_payload/tx_info当作一项
+};
+
+int  chirpstack_downlink_command_parse(const char *payload, size_t len,
+                                       struct chirpstack_downlink_command *command);
+int  chirpstack_downlink_command_proto_parse(const void *payload, size_t len,
+                                             struct chirpstack_downlink_command *command);
+int  chirpstack_downlink_item_txpk(const struct json_span *item, char *out, size_t out_len,
+                                   const char **error);
+void chirpstack_downlink_proto_open(const struct chirpstack_downlink_command *command,
+                                    struct downlink_proto_cursor             *cursor);
+int  chirpstack_downlink_proto_next(struct downlink_proto_cursor *cursor, const uint8_t **item,
+                                    size_t *len);
+int  chirpstack_downlink_proto_item_txpk(const uint8_t *item, size_t len, char *out,
+                                         size_t out_len, const char **error);
+
+#endif
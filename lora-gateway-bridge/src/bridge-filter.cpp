@@ -0,0 +1,176 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行过滤
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-filter.hpp"
+#include "bridge-base64.hpp"
+#include "bridge-log.hpp"
+#include <algorithm>
+#include <stdlib.h>
+
+// 各NetID类型的NwkID位数，见LoRaWAN Backend Interfaces 1.0
+static const uint8_t nwkid_bits[NETID_TYPES] = { 6, 6, 9, 11, 12, 13, 15, 17 };
+
+#define LORAWAN_HEADER_CHARS BASE64_ENCODED_LEN(LORAWAN_HEADER_BYTES)
+
+static bool parse_hex(const string &text, size_t digits, uint64_t *value)
+{
+    if (text.length() != digits ||
+        text.find_first_not_of("0123456789abcdefABCDEF") != string::npos) {
+        return false;
+    }
+    *value = strtoull(text.c_str(), NULL, 16);
+    return true;
+}
+
+// 从低位开始按字节读出小端整数
+static uint64_t get_le(const uint8_t *bytes, size_t len)
+{
+    uint64_t value = 0;
+    while (len-- > 0) { value = (value << 8) | bytes[len]; }
+    return value;
+}
+
+UplinkFilter::UplinkFilter() : netid_enabled(false) {}
+
+/*
+ * NetID的高3位为类型，DevAddr以类型个1加一个0开头，其后是NetID低位的NwkID。
+ * 把两者拼成前缀放进该类型的表，DevAddr匹配时只需按类型取同样长度的高位。
+ */
+void UplinkFilter::set_net_ids(const vector<string> &net_ids)
+{
+    uint64_t net_id;
+
+    for (auto &table : this->netid_prefixes) { table.clear(); }
+    this->netid_enabled = false;
+    for (const auto &text : net_ids) {
+        if (!parse_hex(text, 6, &net_id)) {
+            log_warn("Invalid net_id: %s, ignored.", text.c_str());
+            continue;
+        }
+        uint32_t type   = net_id >> 21;
+        uint32_t bits   = nwkid_bits[type];
+        uint32_t prefix = ((1U << type) - 1) << 1;
+        prefix          = (prefix << bits) | (net_id & ((1U << bits) - 1));
+        this->netid_prefixes[type].push_back(prefix);
+        this->netid_enabled = true;
+    }
+    for (auto &table : this->netid_prefixes) {
+        sort(table.begin(), table.end());
+        table.erase(unique(table.begin(), table.end()), table.end());
+    }
+}
+
+// 区间按起点排序，重叠或相邻的合并，查找时只需看起点不大于JoinEUI的最后一个区间
+void UplinkFilter::set_join_euis(const vector<array<string, 2>> &join_euis)
+{
+    vector<struct joineui_range> ranges;
+    struct joineui_range         range;
+
+    for (const auto &pair : join_euis) {
+        if (!parse_hex(pair[0], 16, &range.first) || !parse_hex(pair[1], 16, &range.last) ||
+            range.first > range.last) {
+            log_warn("Invalid join_eui range: [%s, %s], ignored.", pair[0].c_str(),
+                     pair[1].c_str());
+            continue;
+        }
+        ranges.push_back(range);
+    }
+    sort(ranges.begin(), ranges.end(),
+         [](const struct joineui_range &a, const struct joineui_range &b) {
+             return a.first < b.first;
+         });
+    this->joineui_ranges.clear();
+    for (const auto &r : ranges) {
+        if (!this->joineui_ranges.empty() && this->joineui_ranges.back().last != UINT64_MAX &&
+            r.first <= this->joineui_ranges.back().last + 1) {
+            this->joineui_ranges.back().last = max(this->joineui_ranges.back().last, r.last);
+        } else {
+            this->joineui_ranges.push_back(r);
+        }
+    }
+}
+
+bool UplinkFilter::devaddr_allowed(uint32_t devaddr) const
+{
+    // 开头连续1的个数即NetID类型，8个及以上不是合法的DevAddr
+    if (devaddr >= 0xff000000U) {
+        return false;
+    }
+    uint32_t type = __builtin_clz(~devaddr);
+    const auto &table = this->netid_prefixes[type];
+    uint32_t    key   = devaddr >> (32 - (type + 1 + nwkid_bits[type]));
+    return binary_search(table.begin(), table.end(), key);
+}
+
+bool UplinkFilter::joineui_allowed(uint64_t join_eui) const
+{
+    auto it = upper_bound(this->joineui_ranges.begin(), this->joineui_ranges.end(), join_eui,
+                          [](uint64_t eui, const struct joineui_range &r) {
+                              return eui < r.first;
+                          });
+    return it != this->joineui_ranges.begin() && join_eui <= (it - 1)->last;
+}
+
+/*
+ * 只解码data开头覆盖LORAWAN_HEADER_BYTES个字节的整组，中间的组不能带'='。
+ * data不是合法base64时返回-1；长度不够的帧data_up和join_request为false。
+ */
+int lorawan_header_decode(const struct json_span *data, struct lorawan_header *header)
+{
+    uint8_t bytes[BASE64_DECODED_MAX(LORAWAN_HEADER_CHARS)];
+    size_t  chars = min(data->len, (size_t)LORAWAN_HEADER_CHARS);
+
+    if (data->type != JSON_SCAN_STRING || data->len == 0 || data->len % 4 != 0 ||
+        (chars < data->len && data->ptr[chars - 1] == '=') ||
+        base64_decode(data->ptr, chars, bytes, sizeof(bytes)) < 1) {
+        return -1;
+    }
+    size_t pad   = (data->ptr[data->len - 1] == '=') + (data->ptr[data->len - 2] == '=');
+    header->size = data->len / 4 * 3 - pad;
+    uint8_t mtype   = bytes[0] >> 5;
+    bool    data_up = mtype == LORAWAN_MTYPE_UNCONFIRMED_UP || mtype == LORAWAN_MTYPE_CONFIRMED_UP;
+
+    header->mtype        = mtype;
+    header->data_up      = data_up && header->size >= LORAWAN_DATA_UP_MIN_SIZE;
+    header->join_request = mtype == LORAWAN_MTYPE_JOIN_REQUEST &&
+                           header->size == LORAWAN_JOIN_REQUEST_SIZE;
+    if (header->data_up) {
+        header->dev_addr = get_le(bytes + 1, 4);
+        header->fcnt     = get_le(bytes + 6, 2);
+    }
+    if (header->join_request) {
+        header->join_eui = get_le(bytes + 1, 8);
+        header->dev_eui  = get_le(bytes + 9, 8);
+    }
+    return 0;
+}
+
+// 数据上行看DevAddr，Join-request看JoinEUI，其他类型不过滤
+enum uplink_filter_result UplinkFilter::match(const struct lorawan_header *header) const
+{
+    switch (header->mtype) {
+    case LORAWAN_MTYPE_UNCONFIRMED_UP:
+    case LORAWAN_MTYPE_CONFIRMED_UP:
+        if (!this->netid_enabled) {
+            return UPLINK_FILTER_PASS;
+        }
+        if (!header->data_up) {
+            return UPLINK_FILTER_MALFORMED;
+        }
+        return this->devaddr_allowed(header->dev_addr) ? UPLINK_FILTER_PASS : UPLINK_FILTER_NETID;
+    case LORAWAN_MTYPE_JOIN_REQUEST:
+        if (this->joineui_ranges.empty()) {
+            return UPLINK_FILTER_PASS;
+        }
+        if (!header->join_request) {
+            return UPLINK_FILTER_MALFORMED;
+        }
+        return this->joineui_allowed(header->join_eui) ? UPLINK_FILTER_PASS
+                                                       : UPLINK_FILTER_JOINEUI;
+    default:
+        return UPLINK_FILTER_PASS;
+    }
+}
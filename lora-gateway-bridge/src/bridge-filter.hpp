@@ -0,0 +1,81 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行过滤
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 按[filters]的net_ids和join_euis丢弃其他网络的上行。只解码base64
+ *          data开头的几个字节取出MHDR、DevAddr或JoinEUI，不做完整解析。
+ *          数据帧的DevAddr按NetID类型查对应的前缀表，Join-request的JoinEUI
+ *          在排序合并后的区间数组中二分查找。配置为空的一项不过滤。
+ */
+
+#ifndef _BRIDGE_FILTER_HPP_
+#define _BRIDGE_FILTER_HPP_
+
+#include "bridge-json-scan.hpp"
+#include <array>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define NETID_TYPES 8
+
+#define LORAWAN_MTYPE_JOIN_REQUEST   0
+#define LORAWAN_MTYPE_UNCONFIRMED_UP 2
+#define LORAWAN_MTYPE_CONFIRMED_UP   4
+#define LORAWAN_DATA_UP_MIN_SIZE     12 /* MHDR + FHDR(DevAddr FCtrl FCnt) + MIC */
+#define LORAWAN_JOIN_REQUEST_SIZE    23
+#define LORAWAN_HEADER_BYTES         17 /* MHDR + JoinEUI + DevEUI */
+
+using namespace std;
+
+enum uplink_filter_result {
+    UPLINK_FILTER_PASS = 0,
+    UPLINK_FILTER_NETID,     // DevAddr不属于任何配置的NetID
+    UPLINK_FILTER_JOINEUI,   // JoinEUI不在任何配置的区间内
+    UPLINK_FILTER_MALFORMED, // data不是合法base64或长度不够
+    UPLINK_FILTER_DEVEUI,    // DevEUI不在白名单中
+    UPLINK_FILTER_DEVADDR,   // DevAddr不属于白名单中已入网的设备
+};
+
+// 从data开头解出的字段，data_up/join_request为false时对应字段无效
+struct lorawan_header {
+    uint8_t  mtype;
+    size_t   size; // 整个PHYPayload的长度
+    bool     data_up;
+    uint32_t dev_addr;
+    uint16_t fcnt;
+    bool     join_request;
+    uint64_t join_eui;
+    uint64_t dev_eui;
+};
+
+struct joineui_range {
+    uint64_t first;
+    uint64_t last;
+};
+
+// 启动时编译，之后只读，各worker无需加锁
+class UplinkFilter
+{
+  private:
+    // 每种NetID类型一张表：DevAddr高位的类型前缀加NwkID，已排序
+    vector<uint32_t>             netid_prefixes[NETID_TYPES];
+    bool                         netid_enabled;
+    vector<struct joineui_range> joineui_ranges;
+
+    bool devaddr_allowed(uint32_t devaddr) const;
+    bool joineui_allowed(uint64_t join_eui) const;
+
+  public:
+    UplinkFilter();
+
+    void set_net_ids(const vector<string> &net_ids);
+    void set_join_euis(const vector<array<string, 2>> &join_euis);
+    bool enabled(void) const { return this->netid_enabled || !this->joineui_ranges.empty(); }
+    enum uplink_filter_result match(const struct lorawan_header *header) const;
+};
+
+int lorawan_header_decode(const struct json_span *data, struct lorawan_header *header);
+
+#endif
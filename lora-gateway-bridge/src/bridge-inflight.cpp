@@ -0,0 +1,186 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT在途消息跟踪
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-inflight.hpp"
+#include <string.h>
+
+#define SLOT_NONE ((size_t)-1)
+
+const uint32_t puback_hist_bounds_ms[PUBACK_HIST_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000,
+};
+
+InflightTable::InflightTable(uint32_t window)
+{
+    // 槽位至少为窗口的4倍，下行和ACK的发布不受窗口限制也要有位置
+    uint32_t capacity = 64;
+    while (capacity < window * 4) { capacity <<= 1; }
+    pthread_mutex_init(&this->mutex, NULL);
+    this->slots.assign(capacity, inflight_entry{});
+    this->mask      = capacity - 1;
+    this->used      = 0;
+    this->pending   = 0;
+    this->untracked = 0;
+    memset(this->hist, 0, sizeof(this->hist));
+}
+
+InflightTable::~InflightTable()
+{
+    pthread_mutex_destroy(&this->mutex);
+}
+
+// mid由libmosquitto顺序分配，直接取低位即可均匀分布
+size_t InflightTable::find(uint16_t mid) const
+{
+    for (size_t idx = mid & this->mask;; idx = (idx + 1) & this->mask) {
+        if (this->slots[idx].mid == mid) {
+            return idx;
+        }
+        if (this->slots[idx].mid == 0) {
+            return SLOT_NONE;
+        }
+    }
+}
+
+size_t InflightTable::insert_slot(uint16_t mid)
+{
+    // 负载超过3/4后不再记录，避免探测链过长
+    if ((this->used + 1) * 4 > this->slots.size() * 3) {
+        return SLOT_NONE;
+    }
+    size_t idx = mid & this->mask;
+    while (this->slots[idx].mid != 0) { idx = (idx + 1) & this->mask; }
+    this->slots[idx].mid = mid;
+    this->used++;
+    return idx;
+}
+
+void InflightTable::erase(size_t idx)
+{
+    size_t hole = idx;
+    size_t next = (idx + 1) & this->mask;
+    while (this->slots[next].mid != 0) {
+        size_t home = this->slots[next].mid & this->mask;
+        // home在(hole, next]之间的记录留在原处，否则前移填补空位
+        bool stay = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!stay) {
+            this->slots[hole] = this->slots[next];
+            hole              = next;
+        }
+        next = (next + 1) & this->mask;
+    }
+    this->slots[hole].mid = 0;
+    this->used--;
+}
+
+void InflightTable::record(uint8_t qos, uint64_t latency_us)
+{
+    struct puback_histogram &h      = this->hist[qos < MQTT_QOS_LEVELS ? qos : 0];
+    size_t                   bucket = 0;
+    while (bucket < PUBACK_HIST_BUCKETS - 1 && latency_us > puback_hist_bounds_ms[bucket] * 1000) {
+        bucket++;
+    }
+    h.buckets[bucket]++;
+    h.count++;
+    h.sum_us += latency_us;
+    h.max_us = (latency_us > h.max_us) ? latency_us : h.max_us;
+}
+
+// mosquitto_publish成功后由发布线程调用，sent_us为调用publish之前的时刻
+void InflightTable::sent(int mid, uint8_t qos, uint64_t sent_us)
+{
+    pthread_mutex_lock(&this->mutex);
+    size_t idx = this->find((uint16_t)mid);
+    if (idx != SLOT_NONE && this->slots[idx].acked) {
+        uint64_t acked_us = this->slots[idx].at_us;
+        this->record(qos, acked_us > sent_us ? acked_us - sent_us : 0);
+        this->erase(idx);
+    } else {
+        if (idx == SLOT_NONE) {
+            idx = this->insert_slot((uint16_t)mid);
+            if (idx == SLOT_NONE) {
+                this->untracked++;
+                pthread_mutex_unlock(&this->mutex);
+                return;
+            }
+            this->pending++;
+        }
+        // 已有未确认的同mid记录时是mid回绕后的旧记录，直接覆盖
+        this->slots[idx].qos   = qos;
+        this->slots[idx].acked = false;
+        this->slots[idx].at_us = sent_us;
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+// on_publish回调
+void InflightTable::acked(int mid, uint64_t now_us)
+{
+    pthread_mutex_lock(&this->mutex);
+    size_t idx = this->find((uint16_t)mid);
+    if (idx != SLOT_NONE && !this->slots[idx].acked) {
+        uint64_t sent_us = this->slots[idx].at_us;
+        this->record(this->slots[idx].qos, now_us > sent_us ? now_us - sent_us : 0);
+        this->erase(idx);
+        this->pending--;
+    } else {
+        // QoS 0在mosquitto_publish返回前就可能回调，先占位等sent()
+        if (idx == SLOT_NONE) {
+            idx = this->insert_slot((uint16_t)mid);
+        }
+        if (idx != SLOT_NONE) {
+            this->slots[idx].acked = true;
+            this->slots[idx].at_us = now_us;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+// 移除超时未确认的记录，返回其中等待确认的条数
+uint32_t InflightTable::expire(uint64_t now_us, uint64_t timeout_us)
+{
+    vector<uint16_t> mids;
+    uint32_t         expired = 0;
+    pthread_mutex_lock(&this->mutex);
+    for (auto &slot : this->slots) {
+        if (slot.mid != 0 && slot.at_us + timeout_us < now_us) {
+            mids.push_back(slot.mid);
+        }
+    }
+    for (auto mid : mids) {
+        size_t idx = this->find(mid);
+        if (!this->slots[idx].acked) {
+            this->pending--;
+            expired++;
+        }
+        this->erase(idx);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return expired;
+}
+
+uint32_t InflightTable::size(void)
+{
+    pthread_mutex_lock(&this->mutex);
+    uint32_t pending = this->pending;
+    pthread_mutex_unlock(&this->mutex);
+    return pending;
+}
+
+uint64_t InflightTable::untracked_count(void)
+{
+    pthread_mutex_lock(&this->mutex);
+    uint64_t untracked = this->untracked;
+    pthread_mutex_unlock(&this->mutex);
+    return untracked;
+}
+
+void InflightTable::histogram(uint8_t qos, struct puback_histogram *out)
+{
+    pthread_mutex_lock(&this->mutex);
+    *out = this->hist[qos < MQTT_QOS_LEVELS ? qos : 0];
+    pthread_mutex_unlock(&this->mutex);
+}
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT在途消息跟踪
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 按mosquitto_publish返回的mid记录发送时刻，on_publish到达时算出
+ *          发布到确认的耗时，按QoS分别计入直方图。QoS 0的"确认"是消息写入
+ *          socket，QoS 1为PUBACK，QoS 2为PUBCOMP。表的大小即在途消息数，
+ *          上行路径据此限制窗口。
+ */
+
+#ifndef _BRIDGE_INFLIGHT_HPP_
+#define _BRIDGE_INFLIGHT_HPP_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define MQTT_INFLIGHT_DEFAULT 64
+#define MQTT_INFLIGHT_MAX     1024
+#define MQTT_ACK_TIMEOUT      60 /* seconds，超时未确认的记录从窗口中移除 */
+#define MQTT_QOS_LEVELS       3
+#define PUBACK_HIST_BUCKETS   13 /* 最后一个桶为+Inf */
+
+using namespace std;
+
+extern const uint32_t puback_hist_bounds_ms[PUBACK_HIST_BUCKETS - 1];
+
+struct puback_histogram {
+    uint64_t buckets[PUBACK_HIST_BUCKETS]; // 各桶独立计数，不累计
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+};
+
+struct inflight_entry {
+    uint16_t mid;   // 0为空槽，libmosquitto不会分配0
+    uint8_t  qos;
+    bool     acked; // on_publish先于发布线程记录到达
+    uint64_t at_us; // 发送时刻；acked时为确认时刻
+};
+
+// 开放寻址(线性探测)，删除时后移填补，不留墓碑
+class InflightTable
+{
+  private:
+    pthread_mutex_t               mutex;
+    vector<struct inflight_entry> slots;
+    uint32_t                      mask;
+    uint32_t                      used;    // 含acked占位
+    uint32_t                      pending; // 等待确认的消息数
+    uint64_t                      untracked;
+    struct puback_histogram       hist[MQTT_QOS_LEVELS];
+
+    size_t find(uint16_t mid) const;
+    size_t insert_slot(uint16_t mid);
+    void   erase(size_t idx);
+    void   record(uint8_t qos, uint64_t latency_us);
+
+  public:
+    explicit InflightTable(uint32_t window);
+    ~InflightTable();
+    InflightTable(const InflightTable &)            = delete;
+    InflightTable &operator=(const InflightTable &) = delete;
+
+    void     sent(int mid, uint8_t qos, uint64_t sent_us);
+    void     acked(int mid, uint64_t now_us);
+    uint32_t expire(uint64_t now_us, uint64_t timeout_us);
+    uint32_t size(void);
+    uint64_t untracked_count(void);
+    void     histogram(uint8_t qos, struct puback_histogram *out);
+};
+
+#endif
@@ -0,0 +1,347 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 按需JSON扫描
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details json_scan_document一次性校验整个文档(RFC 8259语法)，之后游标遍历
+ *          只需跳过已校验过的值，不再重复做错误处理以外的工作。
+ */
+
+#include "bridge-json-scan.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *scan_value(const char *p, const char *end, int depth, struct json_span *span);
+
+static inline const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) { p++; }
+    return p;
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_hex(char c)
+{
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// p指向开头的引号，返回结尾引号之后的位置
+static const char *scan_string(const char *p, const char *end, struct json_span *span)
+{
+    const char *start = ++p;
+    while (p < end) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '"') {
+            if (span) {
+                span->type = JSON_SCAN_STRING;
+                span->ptr  = start;
+                span->len  = p - start;
+            }
+            return p + 1;
+        }
+        if (c < 0x20) {
+            return nullptr;
+        }
+        if (c == '\\') {
+            if (++p >= end) {
+                return nullptr;
+            }
+            if (*p == 'u') {
+                if (end - p < 5 || !is_hex(p[1]) || !is_hex(p[2]) || !is_hex(p[3]) ||
+                    !is_hex(p[4])) {
+                    return nullptr;
+                }
+                p += 4;
+            } else if (*p == '\0' || !strchr("\"\\/bfnrt", *p)) {
+                return nullptr;
+            }
+        }
+        p++;
+    }
+    return nullptr;
+}
+
+static const char *scan_number(const char *p, const char *end, struct json_span *span)
+{
+    const char *start = p;
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p >= end || !is_digit(*p)) {
+        return nullptr;
+    }
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && is_digit(*p)) { p++; }
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !is_digit(*p)) {
+            return nullptr;
+        }
+        while (p < end && is_digit(*p)) { p++; }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p >= end || !is_digit(*p)) {
+            return nullptr;
+        }
+        while (p < end && is_digit(*p)) { p++; }
+    }
+    span->type = JSON_SCAN_NUMBER;
+    span->ptr  = start;
+    span->len  = p - start;
+    return p;
+}
+
+static const char *scan_literal(const char *p, const char *end, const char *word,
+                                enum json_scan_type type, struct json_span *span)
+{
+    size_t n = strlen(word);
+    if (static_cast<size_t>(end - p) < n || memcmp(p, word, n) != 0) {
+        return nullptr;
+    }
+    span->type = type;
+    span->ptr  = p;
+    span->len  = n;
+    return p + n;
+}
+
+// 对象和数组: 逐个成员校验，深度受JSON_SCAN_MAX_DEPTH限制
+static const char *scan_container(const char *p, const char *end, int depth,
+                                  struct json_span *span)
+{
+    const char      *start  = p;
+    bool             object = (*p == '{');
+    char             close  = object ? '}' : ']';
+    struct json_span tmp;
+
+    if (depth >= JSON_SCAN_MAX_DEPTH) {
+        return nullptr;
+    }
+    p = skip_ws(p + 1, end);
+    if (p < end && *p == close) {
+        p++;
+    } else {
+        for (;;) {
+            if (object) {
+                if (p >= end || *p != '"' || !(p = scan_string(p, end, nullptr))) {
+                    return nullptr;
+                }
+                p = skip_ws(p, end);
+                if (p >= end || *p != ':') {
+                    return nullptr;
+                }
+                p = skip_ws(p + 1, end);
+            }
+            if (!(p = scan_value(p, end, depth + 1, &tmp))) {
+                return nullptr;
+            }
+            p = skip_ws(p, end);
+            if (p >= end) {
+                return nullptr;
+            }
+            if (*p == close) {
+                p++;
+                break;
+            }
+            if (*p != ',') {
+                return nullptr;
+            }
+            p = skip_ws(p + 1, end);
+        }
+    }
+    span->type = object ? JSON_SCAN_OBJECT : JSON_SCAN_ARRAY;
+    span->ptr  = start;
+    span->len  = p - start;
+    return p;
+}
+
+static const char *scan_value(const char *p, const char *end, int depth, struct json_span *span)
+{
+    if (p >= end) {
+        return nullptr;
+    }
+    switch (*p) {
+    case '{':
+    case '[':
+        return scan_container(p, end, depth, span);
+    case '"':
+        return scan_string(p, end, span);
+    case 't':
+        return scan_literal(p, end, "true", JSON_SCAN_TRUE, span);
+    case 'f':
+        return scan_literal(p, end, "false", JSON_SCAN_FALSE, span);
+    case 'n':
+        return scan_literal(p, end, "null", JSON_SCAN_NULL, span);
+    default:
+        return scan_number(p, end, span);
+    }
+}
+
+/*
+ * p指向开头引号之后，返回结尾引号的位置。字符串已校验过，用memchr找引号，
+ * 前面紧挨着奇数个反斜杠的是转义的引号。
+ */
+static inline const char *skip_string(const char *p, const char *end)
+{
+    while ((p = static_cast<const char *>(memchr(p, '"', end - p))) != nullptr) {
+        const char *q = p;
+        while (q[-1] == '\\') { q--; }
+        if ((p - q) % 2 == 0) {
+            return p;
+        }
+        p++;
+    }
+    return nullptr;
+}
+
+/*
+ * 跳过一个已经校验过的值。容器只做括号配对(跳过字符串内容)，
+ * 游标遍历时不再重复完整校验，整个报文只被完整扫描一次。
+ */
+static const char *skip_value(const char *p, const char *end, struct json_span *span)
+{
+    const char *start = p;
+    int         depth = 0;
+    if (p >= end || (*p != '{' && *p != '[')) {
+        return scan_value(p, end, 0, span);
+    }
+    for (; p < end; p++) {
+        if (*p == '"' && (p = skip_string(p + 1, end)) == nullptr) {
+            return nullptr;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if ((*p == '}' || *p == ']') && --depth == 0) {
+            span->type = (*start == '{') ? JSON_SCAN_OBJECT : JSON_SCAN_ARRAY;
+            span->ptr  = start;
+            span->len  = p + 1 - start;
+            return p + 1;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * 校验buf中的整个JSON文档并返回根节点，文档后只允许空白(及结尾的'\0')。
+ * 成功返回0，语法错误返回-1。
+ */
+int json_scan_document(const char *buf, size_t len, struct json_span *root)
+{
+    const char *end = buf + len;
+    const char *p   = scan_value(skip_ws(buf, end), end, 0, root);
+    if (p == nullptr) {
+        return -1;
+    }
+    p = skip_ws(p, end);
+    while (p < end && *p == '\0') { p++; }
+    return (p == end) ? 0 : -1;
+}
+
+// container必须来自json_scan_document或本模块的游标
+int json_scan_open(const struct json_span *container, struct json_cursor *cursor)
+{
+    if (container->type != JSON_SCAN_OBJECT && container->type != JSON_SCAN_ARRAY) {
+        return -1;
+    }
+    cursor->pos   = container->ptr + 1;
+    cursor->end   = container->ptr + container->len - 1;
+    cursor->first = true;
+    return 0;
+}
+
+// 返回1取到一个成员，0遍历结束，-1出错
+int json_scan_next_member(struct json_cursor *cursor, struct json_span *key,
+                          struct json_span *value)
+{
+    const char *p = skip_ws(cursor->pos, cursor->end);
+    if (p >= cursor->end) {
+        return 0;
+    }
+    if (!cursor->first) {
+        if (*p != ',') {
+            return -1;
+        }
+        p = skip_ws(p + 1, cursor->end);
+    }
+    if (p >= cursor->end || *p != '"' || !(p = scan_string(p, cursor->end, key))) {
+        return -1;
+    }
+    p = skip_ws(p, cursor->end);
+    if (p >= cursor->end || *p != ':') {
+        return -1;
+    }
+    p = skip_value(skip_ws(p + 1, cursor->end), cursor->end, value);
+    if (p == nullptr) {
+        return -1;
+    }
+    cursor->pos   = p;
+    cursor->first = false;
+    return 1;
+}
+
+int json_scan_next_element(struct json_cursor *cursor, struct json_span *value)
+{
+    const char *p = skip_ws(cursor->pos, cursor->end);
+    if (p >= cursor->end) {
+        return 0;
+    }
+    if (!cursor->first) {
+        if (*p != ',') {
+            return -1;
+        }
+        p = skip_ws(p + 1, cursor->end);
+    }
+    p = skip_value(p, cursor->end, value);
+    if (p == nullptr) {
+        return -1;
+    }
+    cursor->pos   = p;
+    cursor->first = false;
+    return 1;
+}
+
+// 按原始字节比较，不处理转义(协议字段名都不含转义)
+bool json_span_equals(const struct json_span *span, const char *str)
+{
+    size_t n = strlen(str);
+    return span->len == n && memcmp(span->ptr, str, n) == 0;
+}
+
+bool json_span_is_integer(const struct json_span *span)
+{
+    return span->type == JSON_SCAN_NUMBER && !memchr(span->ptr, '.', span->len) &&
+           !memchr(span->ptr, 'e', span->len) && !memchr(span->ptr, 'E', span->len);
+}
+
+int json_span_to_double(const struct json_span *span, double *value)
+{
+    char buf[64];
+    if (span->type != JSON_SCAN_NUMBER || span->len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, span->ptr, span->len);
+    buf[span->len] = '\0';
+    *value         = strtod(buf, NULL);
+    return 0;
+}
+
+int json_span_to_int64(const struct json_span *span, int64_t *value)
+{
+    char buf[32];
+    if (!json_span_is_integer(span) || span->len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, span->ptr, span->len);
+    buf[span->len] = '\0';
+    *value         = strtoll(buf, NULL, 10);
+    return 0;
+}
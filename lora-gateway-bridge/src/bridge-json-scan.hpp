@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 按需JSON扫描
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 直接在收到的报文上定位字段，不建DOM、不分配内存。
+ *          扫描结果是指向原报文的指针+长度，报文在使用期间必须保持有效。
+ */
+
+#ifndef _BRIDGE_JSON_SCAN_HPP_
+#define _BRIDGE_JSON_SCAN_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_SCAN_MAX_DEPTH 32
+
+enum json_scan_type {
+    JSON_SCAN_NONE = 0,
+    JSON_SCAN_OBJECT,
+    JSON_SCAN_ARRAY,
+    JSON_SCAN_STRING,
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_TRUE,
+    JSON_SCAN_FALSE,
+    JSON_SCAN_NULL,
+};
+
+/*
+ * 字符串: 不含两侧引号，转义序列保持原样，可原样写回JSON；
+ * 对象/数组: 包含两侧括号；数字: 原始文本。
+ */
+struct json_span {
+    enum json_scan_type type;
+    const char         *ptr;
+    size_t              len;
+};
+
+// 遍历对象成员或数组元素的游标
+struct json_cursor {
+    const char *pos;
+    const char *end;
+    bool        first;
+};
+
+int  json_scan_document(const char *buf, size_t len, struct json_span *root);
+int  json_scan_open(const struct json_span *container, struct json_cursor *cursor);
+int  json_scan_next_member(struct json_cursor *cursor, struct json_span *key,
+                           struct json_span *value);
+int  json_scan_next_element(struct json_cursor *cursor, struct json_span *value);
+bool json_span_equals(const struct json_span *span, const char *str);
+int  json_span_to_double(const struct json_span *span, double *value);
+int  json_span_to_int64(const struct json_span *span, int64_t *value);
+bool json_span_is_integer(const struct json_span *span);
+
+#endif
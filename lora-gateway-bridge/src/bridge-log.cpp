@@ -0,0 +1,206 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 异步日志
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-log.hpp"
+#include "bridge-ring.hpp"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define LOG_FLUSH_BYTES 8192 /* 攒够这么多字节就写一次 */
+#define LOG_IDLE_WAIT   1000 /* ms，空闲时最长睡眠，防止漏掉唤醒 */
+
+struct log_record {
+    int    level;
+    size_t len;
+    char   text[LOG_LINE_MAX];
+};
+
+static const char *const log_level_names[] = {
+    "PANIC", "FATAL", "ERROR", "WARN", "INFO", "DEBUG",
+};
+
+atomic<int> bridge_log_level(BRIDGE_LOG_DEFAULT);
+
+static BoundedRing<struct log_record> log_ring(LOG_RING_SIZE);
+static atomic<uint64_t>               log_dropped(0);
+static atomic<bool>                   log_running(false);
+static atomic<bool>                   log_stopping(false);
+static atomic<bool>                   log_writer_idle(false);
+static int                            log_event_fd = -1;
+static pthread_t                      log_tid;
+
+static void log_write_fd(int fd, const string &buf)
+{
+    size_t off = 0;
+    while (off < buf.length()) {
+        ssize_t n = write(fd, buf.data() + off, buf.length() - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        off += n;
+    }
+}
+
+static void log_append(string &buf, int level, const char *text, size_t len)
+{
+    buf.append(log_level_names[level]).append(": ").append(text, len).append("\n");
+}
+
+// error及以上写stderr，其余写stdout，与原来的cerr/cout分流一致
+static void log_flush(string &out, string &err)
+{
+    uint64_t dropped = log_dropped.exchange(0, memory_order_relaxed);
+    if (dropped) {
+        char line[64];
+        int  len = snprintf(line, sizeof(line), "%llu log line(s) dropped",
+                            (unsigned long long)dropped);
+        log_append(out, BRIDGE_LOG_WARN, line, len);
+    }
+    if (!err.empty()) {
+        log_write_fd(STDERR_FILENO, err);
+        err.clear();
+    }
+    if (!out.empty()) {
+        log_write_fd(STDOUT_FILENO, out);
+        out.clear();
+    }
+}
+
+static void *log_writer_thread(void *arg)
+{
+    string   out, err;
+    uint64_t wakeups;
+
+    out.reserve(LOG_FLUSH_BYTES + LOG_LINE_MAX);
+    err.reserve(LOG_LINE_MAX * 4);
+    auto take = [&out, &err](struct log_record &r) {
+        log_append(r.level <= BRIDGE_LOG_ERROR ? err : out, r.level, r.text, r.len);
+    };
+    for (;;) {
+        size_t taken = 0;
+        while (out.length() < LOG_FLUSH_BYTES && log_ring.pop(take)) { taken++; }
+        if (taken > 0 || log_dropped.load(memory_order_relaxed)) {
+            log_flush(out, err);
+            continue;
+        }
+        if (log_stopping.load()) {
+            break;
+        }
+        // 先标记空闲再检查一次队列，和生产者的fence配对，不会漏掉唤醒
+        log_writer_idle.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (log_ring.size() == 0 && !log_stopping.load()) {
+            struct pollfd pfd = { log_event_fd, POLLIN, 0 };
+            if (poll(&pfd, 1, LOG_IDLE_WAIT) > 0) {
+                ssize_t n = read(log_event_fd, &wakeups, sizeof(wakeups));
+                (void)n;
+            }
+        }
+        log_writer_idle.store(false, memory_order_relaxed);
+    }
+    return nullptr;
+}
+
+static void log_wake_writer(void)
+{
+    uint64_t one = 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (log_writer_idle.load(memory_order_relaxed) &&
+        log_writer_idle.exchange(false, memory_order_relaxed)) {
+        ssize_t n = write(log_event_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void bridge_log_write(int level, const char *fmt, ...)
+{
+    va_list args;
+
+    if (level < BRIDGE_LOG_PANIC || level > BRIDGE_LOG_DEBUG) {
+        level = BRIDGE_LOG_DEBUG;
+    }
+    // 后台线程启动前和退出后直接同步写出
+    if (!log_running.load(memory_order_acquire)) {
+        struct log_record r;
+        string            buf;
+        va_start(args, fmt);
+        int len = vsnprintf(r.text, sizeof(r.text), fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return;
+        }
+        log_append(buf, level, r.text, (size_t)len < sizeof(r.text) ? len : sizeof(r.text) - 1);
+        log_write_fd(level <= BRIDGE_LOG_ERROR ? STDERR_FILENO : STDOUT_FILENO, buf);
+        return;
+    }
+    // 直接格式化进槽位，不经过临时缓冲
+    va_start(args, fmt);
+    bool queued = log_ring.push([&](struct log_record &r) {
+        int len = vsnprintf(r.text, sizeof(r.text), fmt, args);
+        r.level = level;
+        r.len   = (len < 0) ? 0 : ((size_t)len < sizeof(r.text) ? len : sizeof(r.text) - 1);
+    });
+    va_end(args);
+    if (!queued) {
+        log_dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    log_wake_writer();
+}
+
+void bridge_log_set_level(int level)
+{
+    bridge_log_level.store(level, memory_order_relaxed);
+}
+
+// 进程退出时由atexit调用，写完队列里剩下的日志
+void bridge_log_stop(void)
+{
+    uint64_t one = 1;
+    string   out, err;
+    if (!log_running.exchange(false)) {
+        return;
+    }
+    log_stopping.store(true);
+    ssize_t n = write(log_event_fd, &one, sizeof(one));
+    (void)n;
+    pthread_join(log_tid, NULL);
+    close(log_event_fd);
+    log_event_fd = -1;
+    // 后台线程最后一次检查之后才入队的
+    while (log_ring.pop([&out, &err](struct log_record &r) {
+        log_append(r.level <= BRIDGE_LOG_ERROR ? err : out, r.level, r.text, r.len);
+    })) {
+    }
+    log_flush(out, err);
+}
+
+int bridge_log_start(void)
+{
+    log_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (log_event_fd < 0) {
+        return -1;
+    }
+    if (pthread_create(&log_tid, NULL, log_writer_thread, NULL) != 0) {
+        close(log_event_fd);
+        log_event_fd = -1;
+        return -1;
+    }
+    log_running.store(true, memory_order_release);
+    atexit(bridge_log_stop);
+    return 0;
+}
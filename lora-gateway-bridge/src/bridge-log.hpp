@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 异步日志
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 调用线程只把格式化好的一行写进无锁环形队列，由后台线程批量
+ *          write到stdout/stderr，报文路径上不再有同步刷新。级别在编译期和
+ *          运行期各过滤一次，被过滤掉的日志连参数都不会求值。队列满时丢弃，
+ *          丢弃的条数由后台线程补一行说明。
+ */
+
+#ifndef _BRIDGE_LOG_HPP_
+#define _BRIDGE_LOG_HPP_
+
+#include <atomic>
+#include <stdint.h>
+
+/* 与[general] log_level的取值一致 */
+#define BRIDGE_LOG_PANIC   0
+#define BRIDGE_LOG_FATAL   1
+#define BRIDGE_LOG_ERROR   2
+#define BRIDGE_LOG_WARN    3
+#define BRIDGE_LOG_INFO    4
+#define BRIDGE_LOG_DEBUG   5
+#define BRIDGE_LOG_DEFAULT BRIDGE_LOG_INFO
+
+/* 编译时可用-DBRIDGE_LOG_COMPILE_LEVEL=BRIDGE_LOG_INFO去掉debug日志 */
+#ifndef BRIDGE_LOG_COMPILE_LEVEL
+#define BRIDGE_LOG_COMPILE_LEVEL BRIDGE_LOG_DEBUG
+#endif
+
+#define LOG_RING_SIZE 256 /* 队列槽位数 */
+#define LOG_LINE_MAX  512 /* 单行上限，超出截断 */
+
+extern std::atomic<int> bridge_log_level;
+
+#define BRIDGE_LOG(level, ...)                                                                     \
+    do {                                                                                           \
+        if ((level) <= BRIDGE_LOG_COMPILE_LEVEL &&                                                 \
+            (level) <= bridge_log_level.load(std::memory_order_relaxed)) {                         \
+            bridge_log_write((level), __VA_ARGS__);                                                \
+        }                                                                                          \
+    } while (0)
+
+#define log_fatal(...) BRIDGE_LOG(BRIDGE_LOG_FATAL, __VA_ARGS__)
+#define log_error(...) BRIDGE_LOG(BRIDGE_LOG_ERROR, __VA_ARGS__)
+#define log_warn(...)  BRIDGE_LOG(BRIDGE_LOG_WARN, __VA_ARGS__)
+#define log_info(...)  BRIDGE_LOG(BRIDGE_LOG_INFO, __VA_ARGS__)
+#define log_debug(...) BRIDGE_LOG(BRIDGE_LOG_DEBUG, __VA_ARGS__)
+
+void bridge_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void bridge_log_set_level(int level);
+int  bridge_log_start(void);
+void bridge_log_stop(void);
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 运行计数器
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-metrics.hpp"
+#include "bridge-log.hpp"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+static vector<struct bridge_metrics_shard *> shard_list;
+static pthread_mutex_t                       shard_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static thread_local struct bridge_metrics_shard *local_shard = nullptr;
+
+const uint64_t bridge_hist_bounds_us[BRIDGE_HIST_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+    2500000, 5000000,
+};
+
+struct bridge_metrics_shard *bridge_metrics_local_shard(void)
+{
+    if (local_shard == nullptr) {
+        // 线程第一次计数时注册分片，分片随进程存在，不释放
+        struct bridge_metrics_shard *shard = new bridge_metrics_shard();
+        for (auto &c : shard->counters) { c.store(0, memory_order_relaxed); }
+        for (auto &h : shard->hist_buckets) {
+            for (auto &c : h) { c.store(0, memory_order_relaxed); }
+        }
+        for (auto &c : shard->hist_sum_us) { c.store(0, memory_order_relaxed); }
+        pthread_mutex_lock(&shard_list_mutex);
+        shard_list.push_back(shard);
+        pthread_mutex_unlock(&shard_list_mutex);
+        local_shard = shard;
+    }
+    return local_shard;
+}
+
+uint64_t bridge_metrics_sum(enum bridge_counter id)
+{
+    uint64_t sum = 0;
+    pthread_mutex_lock(&shard_list_mutex);
+    for (auto shard : shard_list) { sum += shard->counters[id].load(memory_order_relaxed); }
+    pthread_mutex_unlock(&shard_list_mutex);
+    return sum;
+}
+
+uint64_t bridge_metrics_max(enum bridge_counter id)
+{
+    uint64_t max = 0;
+    pthread_mutex_lock(&shard_list_mutex);
+    for (auto shard : shard_list) {
+        uint64_t value = shard->counters[id].load(memory_order_relaxed);
+        max            = (value > max) ? value : max;
+    }
+    pthread_mutex_unlock(&shard_list_mutex);
+    return max;
+}
+
+void bridge_metrics_histogram(enum bridge_histogram id, struct bridge_histogram_snapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&shard_list_mutex);
+    for (auto shard : shard_list) {
+        for (size_t i = 0; i < BRIDGE_HIST_BUCKETS; i++) {
+            uint64_t n = shard->hist_buckets[id][i].load(memory_order_relaxed);
+            out->buckets[i] += n;
+            out->count += n;
+        }
+        out->sum_us += shard->hist_sum_us[id].load(memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard_list_mutex);
+}
+
+void bridge_metrics_log_summary(void)
+{
+    uint64_t wakeups   = bridge_metrics_sum(BRIDGE_CNT_UDP_RX_WAKEUPS);
+    uint64_t datagrams = bridge_metrics_sum(BRIDGE_CNT_UDP_RX_DATAGRAMS);
+    uint64_t batches   = bridge_metrics_sum(BRIDGE_CNT_UDP_TX_BATCHES);
+    uint64_t acks      = bridge_metrics_sum(BRIDGE_CNT_UDP_TX_ACKS);
+
+    log_info("[metrics] udp rx wakeups:%llu datagrams:%llu avg batch fill:%.2f, "
+             "tx ack batches:%llu acks:%llu avg batch fill:%.2f, "
+             "gateways refused:%llu evicted:%llu",
+             (unsigned long long)wakeups,
+             (unsigned long long)datagrams,
+             wakeups ? (double)datagrams / wakeups : 0.0,
+             (unsigned long long)batches,
+             (unsigned long long)acks,
+             batches ? (double)acks / batches : 0.0,
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_GATEWAYS_REFUSED),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_GATEWAYS_EVICTED));
+
+    uint64_t frames    = bridge_metrics_sum(BRIDGE_CNT_UPLINK_FRAMES);
+    uint64_t publishes = bridge_metrics_sum(BRIDGE_CNT_UPLINK_PUBLISHES);
+    log_info("[metrics] uplink frames:%llu publishes:%llu frames per publish:%.2f duplicates:%llu",
+             (unsigned long long)frames,
+             (unsigned long long)publishes,
+             publishes ? (double)frames / publishes : 0.0,
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_UPLINK_DUPLICATES));
+
+    uint64_t downlinks = bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_SENT);
+    uint64_t latency   = bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_LATENCY_US);
+    uint64_t tx_bytes  = bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_TX_BYTES);
+    uint64_t airtime   = bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_AIRTIME_US);
+    log_info("[metrics] downlink sent:%llu dropped:%llu expired:%llu collision:%llu "
+             "duty-cycle:%llu deferred:%llu retries:%llu ack-missing:%llu "
+             "ready-to-send avg:%lluus max:%lluus bytes per downlink:%llu airtime:%llums",
+             (unsigned long long)downlinks,
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_DROPS),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_EXPIRED),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_COLLISIONS),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_DUTY_CYCLE),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_DEFERRED),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_RETRIES),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_DOWNLINK_ACK_MISSING),
+             (unsigned long long)(downlinks ? latency / downlinks : 0),
+             (unsigned long long)bridge_metrics_max(BRIDGE_CNT_DOWNLINK_LATENCY_MAX_US),
+             (unsigned long long)(downlinks ? tx_bytes / downlinks : 0),
+             (unsigned long long)(airtime / 1000));
+
+    uint64_t reconnects = bridge_metrics_sum(BRIDGE_CNT_MQTT_RECONNECTS);
+    uint64_t outage     = bridge_metrics_sum(BRIDGE_CNT_MQTT_RECONNECT_US);
+    log_info("[metrics] mqtt reconnects:%llu attempts:%llu tls resumed:%llu "
+             "time to reconnect avg:%llums max:%llums",
+             (unsigned long long)reconnects,
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_MQTT_RECONNECT_ATTEMPTS),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_MQTT_TLS_RESUMED),
+             (unsigned long long)(reconnects ? outage / reconnects / 1000 : 0),
+             (unsigned long long)(bridge_metrics_max(BRIDGE_CNT_MQTT_RECONNECT_MAX_US) / 1000));
+}
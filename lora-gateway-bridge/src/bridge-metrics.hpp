@@ -0,0 +1,135 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 运行计数器
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 每个线程写自己的分片，不加锁；读取时才把所有分片累加。
+ *          直方图同样按分片记录各桶计数，导出时再合并。
+ */
+
+#ifndef _BRIDGE_METRICS_HPP_
+#define _BRIDGE_METRICS_HPP_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BRIDGE_HIST_BUCKETS 16 /* 最后一个桶为+Inf */
+
+enum bridge_counter {
+    BRIDGE_CNT_UDP_RX_WAKEUPS = 0,
+    BRIDGE_CNT_UDP_RX_DATAGRAMS,
+    BRIDGE_CNT_UDP_PUSH_DATA,
+    BRIDGE_CNT_UDP_PULL_DATA,
+    BRIDGE_CNT_UDP_TX_ACK,
+    BRIDGE_CNT_UDP_INVALID,             // 长度、版本或类型不对的数据报
+    BRIDGE_CNT_UDP_PARSE_ERRORS,        // PUSH_DATA/TX_ACK的json或rxpk解析失败
+    BRIDGE_CNT_GATEWAYS_REFUSED,        // 会话表满，新网关的数据报被丢弃
+    BRIDGE_CNT_GATEWAYS_EVICTED,        // 空闲超时被移除的网关会话
+    BRIDGE_CNT_RXPK,
+    BRIDGE_CNT_TXPK,                    // MQTT收到并入队的下行
+    BRIDGE_CNT_MQTT_PARSE_ERRORS,       // 下行命令解析失败
+    BRIDGE_CNT_MQTT_PUBLISH_ERRORS,
+    BRIDGE_CNT_UDP_TX_BATCHES,
+    BRIDGE_CNT_UDP_TX_ACKS,
+    BRIDGE_CNT_DOWNLINK_SENT,
+    BRIDGE_CNT_DOWNLINK_TX_BYTES,       // PULL_RESP数据报的字节数累计
+    BRIDGE_CNT_DOWNLINK_LATENCY_US,     // 可发送(入队或到达释放时刻)到发出的耗时累计
+    BRIDGE_CNT_DOWNLINK_LATENCY_MAX_US, // 按最大值聚合
+    BRIDGE_CNT_DOWNLINK_DROPS,
+    BRIDGE_CNT_DOWNLINK_EXPIRED,        // 错过发射窗口，未下发
+    BRIDGE_CNT_DOWNLINK_COLLISIONS,     // 与已接受的下行发射重叠，未下发
+    BRIDGE_CNT_DOWNLINK_DUTY_CYCLE,     // 超出子频段占空比预算，未下发
+    BRIDGE_CNT_DOWNLINK_DEFERRED,       // 为避开在途发射而顺延的立即发送帧
+    BRIDGE_CNT_DOWNLINK_AIRTIME_US,     // 已下发帧的空中时间累计
+    BRIDGE_CNT_DOWNLINK_RETRIES,        // TX_ACK报临时性错误后重发的次数
+    BRIDGE_CNT_DOWNLINK_ACK_MISSING,    // 没等到TX_ACK就被新PULL_RESP覆盖的记录
+    BRIDGE_CNT_UPLINK_FRAMES,
+    BRIDGE_CNT_UPLINK_PUBLISHES,        // 开启合并时一次发布包含多帧
+    BRIDGE_CNT_UPLINK_DUPLICATES,       // 去重窗口内并入或丢弃的副本
+    BRIDGE_CNT_UPLINK_DEDUP_FULL,       // 去重表对应组已满，未去重直接发布
+    BRIDGE_CNT_FILTER_NETID,            // DevAddr不属于[filters] net_ids
+    BRIDGE_CNT_FILTER_JOINEUI,          // JoinEUI不在[filters] join_euis区间内
+    BRIDGE_CNT_FILTER_MALFORMED,        // 开启过滤时data无法解码出所需字段
+    BRIDGE_CNT_FILTER_DEVEUI,           // Join-request的DevEUI不在白名单中
+    BRIDGE_CNT_FILTER_DEVADDR,          // 数据帧的DevAddr未对应到白名单设备
+    BRIDGE_CNT_SPOOL_WRITTEN,
+    BRIDGE_CNT_SPOOL_WRITE_ERRORS,
+    BRIDGE_CNT_SPOOL_REPLAYED,
+    BRIDGE_CNT_SPOOL_REPLAY_BYTES,
+    BRIDGE_CNT_SPOOL_REPLAY_MS,         // 有积压可回放的累计时间
+    BRIDGE_CNT_MQTT_RECONNECT_ATTEMPTS,
+    BRIDGE_CNT_MQTT_RECONNECTS,
+    BRIDGE_CNT_MQTT_RECONNECT_US,       // 断线(或首次连接失败)到重新连上的耗时累计
+    BRIDGE_CNT_MQTT_RECONNECT_MAX_US,   // 按最大值聚合
+    BRIDGE_CNT_MQTT_TLS_RESUMED,        // 恢复了之前TLS会话的连接
+    BRIDGE_CNT_MQTT_BACKPRESSURE,       // 在途窗口满，上行转入spool或丢弃
+    BRIDGE_CNT_MQTT_ACK_TIMEOUTS,       // 超过MQTT_ACK_TIMEOUT未确认
+    BRIDGE_CNT_MAX,
+};
+
+enum bridge_histogram {
+    BRIDGE_HIST_UPLINK_PUBLISH_US = 0, // UDP收到到交给MQTT发布(或写入spool)
+    BRIDGE_HIST_DOWNLINK_SEND_US,      // MQTT入队到PULL_RESP发出，含按计划等待的时间
+    BRIDGE_HIST_DOWNLINK_ACK_US,       // MQTT入队到收到网关的TX_ACK，含重发
+    BRIDGE_HIST_MAX,
+};
+
+extern const uint64_t bridge_hist_bounds_us[BRIDGE_HIST_BUCKETS - 1];
+
+struct bridge_metrics_shard {
+    std::atomic<uint64_t> counters[BRIDGE_CNT_MAX];
+    std::atomic<uint64_t> hist_buckets[BRIDGE_HIST_MAX][BRIDGE_HIST_BUCKETS];
+    std::atomic<uint64_t> hist_sum_us[BRIDGE_HIST_MAX];
+};
+
+struct bridge_histogram_snapshot {
+    uint64_t buckets[BRIDGE_HIST_BUCKETS]; // 各桶独立计数，不累计
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+struct bridge_metrics_shard *bridge_metrics_local_shard(void);
+
+// 单写者分片，relaxed读写即可，无需原子加
+static inline void bridge_metrics_add(enum bridge_counter id, uint64_t n = 1)
+{
+    std::atomic<uint64_t> &c = bridge_metrics_local_shard()->counters[id];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline void bridge_metrics_set_max(enum bridge_counter id, uint64_t value)
+{
+    std::atomic<uint64_t> &c = bridge_metrics_local_shard()->counters[id];
+    if (value > c.load(std::memory_order_relaxed)) {
+        c.store(value, std::memory_order_relaxed);
+    }
+}
+
+static inline void bridge_metrics_observe(enum bridge_histogram id, uint64_t value_us)
+{
+    struct bridge_metrics_shard *shard  = bridge_metrics_local_shard();
+    size_t                       bucket = 0;
+    while (bucket < BRIDGE_HIST_BUCKETS - 1 && value_us > bridge_hist_bounds_us[bucket]) {
+        bucket++;
+    }
+    std::atomic<uint64_t> &c = shard->hist_buckets[id][bucket];
+    std::atomic<uint64_t> &s = shard->hist_sum_us[id];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s.store(s.load(std::memory_order_relaxed) + value_us, std::memory_order_relaxed);
+}
+
+static inline uint64_t bridge_monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t bridge_metrics_sum(enum bridge_counter id);
+uint64_t bridge_metrics_max(enum bridge_counter id);
+void     bridge_metrics_histogram(enum bridge_histogram id, struct bridge_histogram_snapshot *out);
+void     bridge_metrics_log_summary(void);
+
+#endif
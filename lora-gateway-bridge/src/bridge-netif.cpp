@@ -0,0 +1,261 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 网络接口缓存
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-netif.hpp"
+#include "bridge-log.hpp"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// 上报IP时接口名前缀的优先顺序
+static const char *const netif_priority[] = { "eth", "wlan", "usb" };
+
+struct netif_dump_request {
+    struct nlmsghdr nh;
+    struct rtgenmsg gen;
+};
+
+NetifCache::NetifCache() : netlink_fd(-1), netlink_ev(nullptr)
+{
+    pthread_mutex_init(&this->mutex, NULL);
+}
+
+NetifCache::~NetifCache()
+{
+    if (this->netlink_ev) {
+        event_free(this->netlink_ev);
+    }
+    if (this->netlink_fd != -1) {
+        close(this->netlink_fd);
+    }
+    pthread_mutex_destroy(&this->mutex);
+}
+
+// 调用者持有mutex
+void NetifCache::apply(const struct nlmsghdr *nh)
+{
+    if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK) {
+        const struct ifinfomsg *ifi = static_cast<const struct ifinfomsg *>(NLMSG_DATA(nh));
+        if (nh->nlmsg_type == RTM_DELLINK) {
+            this->links.erase(ifi->ifi_index);
+            return;
+        }
+        struct netif_link &link = this->links[ifi->ifi_index];
+        link.running            = (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_RUNNING);
+        int len                 = IFLA_PAYLOAD(nh);
+        for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME) {
+                link.name = static_cast<const char *>(RTA_DATA(rta));
+            } else if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == NETIF_MAC_LEN) {
+                memcpy(link.mac, RTA_DATA(rta), NETIF_MAC_LEN);
+                link.has_mac = true;
+            }
+        }
+    } else if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR) {
+        const struct ifaddrmsg *ifa = static_cast<const struct ifaddrmsg *>(NLMSG_DATA(nh));
+        if (ifa->ifa_family != AF_INET || (ifa->ifa_flags & IFA_F_SECONDARY)) {
+            return;
+        }
+        // 点对点接口的IFA_ADDRESS是对端地址，优先取IFA_LOCAL
+        uint32_t addr  = 0;
+        bool     found = false;
+        int      len   = IFA_PAYLOAD(nh);
+        for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if ((rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !found)) &&
+                RTA_PAYLOAD(rta) == sizeof(addr)) {
+                memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+                found = true;
+            }
+        }
+        if (!found) {
+            return;
+        }
+        struct netif_link &link = this->links[ifa->ifa_index];
+        if (nh->nlmsg_type == RTM_NEWADDR) {
+            link.ipv4     = addr;
+            link.has_ipv4 = true;
+        } else if (link.ipv4 == addr) {
+            link.has_ipv4 = false;
+        }
+    }
+}
+
+// 调用者持有mutex；同类接口取ifindex最小的
+void NetifCache::select_primary(void)
+{
+    string name, ip;
+    char   text[INET_ADDRSTRLEN];
+
+    for (const char *prefix : netif_priority) {
+        for (const auto &it : this->links) {
+            const struct netif_link &link = it.second;
+            if (link.running && link.has_ipv4 &&
+                link.name.compare(0, strlen(prefix), prefix) == 0) {
+                inet_ntop(AF_INET, &link.ipv4, text, sizeof(text));
+                name = link.name;
+                ip   = text;
+                break;
+            }
+        }
+        if (!name.empty()) {
+            break;
+        }
+    }
+    if (name == this->primary_name && ip == this->primary_ip) {
+        return;
+    }
+    if (name.empty()) {
+        log_warn("No usable network interface, report empty IP.");
+    } else {
+        log_info("Interface: %s, IP: %s", name.c_str(), ip.c_str());
+    }
+    this->primary_name = name;
+    this->primary_ip   = ip;
+}
+
+// 用单独的阻塞socket同步读取一次全量，避免与订阅的通知交错
+int NetifCache::dump(uint16_t type)
+{
+    struct netif_dump_request request = {};
+    struct timeval            timeout = { 1, 0 };
+    char buffer[NETIF_NETLINK_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+    bool done = false;
+    int  fd   = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (fd < 0) {
+        log_error("Failed to create netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    request.nh.nlmsg_len     = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    request.nh.nlmsg_type    = type;
+    request.nh.nlmsg_flags   = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nh.nlmsg_seq     = 1;
+    request.gen.rtgen_family = (type == RTM_GETADDR) ? AF_INET : AF_UNSPEC;
+    if (send(fd, &request, request.nh.nlmsg_len, 0) < 0) {
+        log_error("Failed to send netlink dump request: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    while (!done) {
+        int len = recv(fd, buffer, sizeof(buffer), 0);
+        if (len <= 0) {
+            log_error("Failed to read netlink dump: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        pthread_mutex_lock(&this->mutex);
+        for (struct nlmsghdr *nh = reinterpret_cast<struct nlmsghdr *>(buffer);
+             NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR) {
+                done = true;
+                break;
+            }
+            this->apply(nh);
+        }
+        pthread_mutex_unlock(&this->mutex);
+    }
+    close(fd);
+    return 0;
+}
+
+int NetifCache::resync(void)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->links.clear();
+    pthread_mutex_unlock(&this->mutex);
+    if (this->dump(RTM_GETLINK) < 0 || this->dump(RTM_GETADDR) < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&this->mutex);
+    this->select_primary();
+    pthread_mutex_unlock(&this->mutex);
+    return 0;
+}
+
+// 先订阅再读全量，期间的变化会在通知里重放一遍
+int NetifCache::load(void)
+{
+    struct sockaddr_nl addr = {};
+
+    this->netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (this->netlink_fd < 0) {
+        log_error("Failed to create netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    if (bind(this->netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error("Failed to bind netlink socket: %s", strerror(errno));
+        close(this->netlink_fd);
+        this->netlink_fd = -1;
+        return -1;
+    }
+    return this->resync();
+}
+
+void NetifCache::netlink_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    NetifCache *cache = static_cast<NetifCache *>(user_data);
+    char        buffer[NETIF_NETLINK_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int         len;
+
+    while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        pthread_mutex_lock(&cache->mutex);
+        for (struct nlmsghdr *nh = reinterpret_cast<struct nlmsghdr *>(buffer);
+             NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            cache->apply(nh);
+        }
+        cache->select_primary();
+        pthread_mutex_unlock(&cache->mutex);
+    }
+    // 接收缓冲区溢出时丢了通知，重新读全量
+    if (len < 0 && errno == ENOBUFS) {
+        log_warn("Netlink notifications overrun, reload interfaces.");
+        cache->resync();
+    }
+}
+
+int NetifCache::watch(struct event_base *base)
+{
+    if (this->netlink_fd == -1) {
+        return -1;
+    }
+    this->netlink_ev = event_new(base, this->netlink_fd, EV_READ | EV_PERSIST, netlink_cb, this);
+    if (!this->netlink_ev || event_add(this->netlink_ev, NULL) < 0) {
+        log_error("Failed to create netlink event.");
+        return -1;
+    }
+    return 0;
+}
+
+// 当前上报的IPv4地址，没有可用接口时为空
+string NetifCache::ip(void)
+{
+    pthread_mutex_lock(&this->mutex);
+    string ip = this->primary_ip;
+    pthread_mutex_unlock(&this->mutex);
+    return ip;
+}
+
+int NetifCache::mac(const char *name, uint8_t *mac)
+{
+    int ret = -1;
+    pthread_mutex_lock(&this->mutex);
+    for (const auto &it : this->links) {
+        if (it.second.has_mac && it.second.name == name) {
+            memcpy(mac, it.second.mac, NETIF_MAC_LEN);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return ret;
+}
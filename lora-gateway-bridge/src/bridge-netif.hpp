@@ -0,0 +1,65 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 网络接口缓存
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 启动时通过NETLINK_ROUTE读取全部接口和IPv4地址，之后订阅链路和
+ *          地址变化在主事件循环中更新。上报的IP取自按eth、wlan、usb顺序
+ *          第一个已启用且有载波、带IPv4地址的接口，网线拔出或DHCP换地址
+ *          后立即切换。网关ID仍固定取eth0的MAC，不随接口切换变化。
+ */
+
+#ifndef _BRIDGE_NETIF_HPP_
+#define _BRIDGE_NETIF_HPP_
+
+#include <event2/event.h>
+#include <linux/netlink.h>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#define NETIF_MAC_LEN        6
+#define NETIF_NETLINK_BUFFER 16384
+
+using namespace std;
+
+struct netif_link {
+    string   name;
+    bool     running; // IFF_UP且IFF_RUNNING
+    bool     has_mac;
+    bool     has_ipv4;
+    uint8_t  mac[NETIF_MAC_LEN];
+    uint32_t ipv4;    // 网络字节序，只记主地址
+};
+
+class NetifCache
+{
+  private:
+    pthread_mutex_t             mutex;
+    map<int, struct netif_link> links; // ifindex -> 接口，按ifindex有序
+    string                      primary_name;
+    string                      primary_ip;
+    evutil_socket_t             netlink_fd;
+    struct event               *netlink_ev;
+
+    void apply(const struct nlmsghdr *nh);
+    void select_primary(void);
+    int  dump(uint16_t type);
+    int  resync(void);
+
+    static void netlink_cb(evutil_socket_t fd, short events, void *user_data);
+
+  public:
+    NetifCache();
+    ~NetifCache();
+    NetifCache(const NetifCache &)            = delete;
+    NetifCache &operator=(const NetifCache &) = delete;
+
+    int    load(void);
+    int    watch(struct event_base *base);
+    string ip(void);
+    int    mac(const char *name, uint8_t *mac);
+};
+
+#endif
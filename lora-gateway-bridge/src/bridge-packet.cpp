@@ -0,0 +1,26 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge UDP数据报缓冲区
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-packet.hpp"
+#include "bridge-ring.hpp"
+#include <new>
+#include <stdlib.h>
+
+PacketSlab::PacketSlab(uint32_t count, size_t slot_size) : count(count)
+{
+    void *slab   = nullptr;
+    this->stride = (slot_size + BRIDGE_CACHE_LINE - 1) & ~(size_t)(BRIDGE_CACHE_LINE - 1);
+    // 一次分配，槽位之间不共享cache line
+    if (posix_memalign(&slab, BRIDGE_CACHE_LINE, this->stride * count) != 0) {
+        throw std::bad_alloc();
+    }
+    this->slab = static_cast<uint8_t *>(slab);
+}
+
+PacketSlab::~PacketSlab()
+{
+    free(this->slab);
+}
@@ -0,0 +1,38 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge UDP数据报缓冲区
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 每个worker一块连续内存，按固定大小切成槽位，recvmmsg每个槽位
+ *          收一个数据报，收到的长度随数据报一起传给上层。槽位按IPv4 UDP
+ *          最大载荷设置并对齐到cache line，多留1字节给上层补结束符。
+ */
+
+#ifndef _BRIDGE_PACKET_HPP_
+#define _BRIDGE_PACKET_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UDP_PAYLOAD_MAX  65507 /* 65535 - IPv4头20 - UDP头8 */
+#define PACKET_SLOT_SIZE (UDP_PAYLOAD_MAX + 1)
+
+// 只由所属worker的线程访问，不加锁
+class PacketSlab
+{
+  private:
+    uint8_t *slab;
+    uint32_t count;
+    size_t   stride;
+
+  public:
+    PacketSlab(uint32_t count, size_t slot_size);
+    ~PacketSlab();
+    PacketSlab(const PacketSlab &)            = delete;
+    PacketSlab &operator=(const PacketSlab &) = delete;
+
+    uint8_t *slot(uint32_t idx) const { return this->slab + idx * this->stride; }
+    uint32_t size(void) const { return this->count; }
+};
+
+#endif
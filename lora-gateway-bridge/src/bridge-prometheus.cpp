@@ -0,0 +1,210 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge Prometheus指标导出
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-prometheus.hpp"
+#include "bridge-log.hpp"
+#include "bridge-metrics.hpp"
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct prometheus_counter {
+    const char         *name;
+    const char         *labels; // 同名的行要相邻，只输出一次HELP/TYPE
+    enum bridge_counter id;
+    const char         *help;
+};
+
+/* clang-format off */
+static const struct prometheus_counter prometheus_counters[] = {
+    { "lorabridge_udp_rx_datagrams_total", "type=\"push_data\"", BRIDGE_CNT_UDP_PUSH_DATA, "UDP datagrams received by packet type." },
+    { "lorabridge_udp_rx_datagrams_total", "type=\"pull_data\"", BRIDGE_CNT_UDP_PULL_DATA, nullptr },
+    { "lorabridge_udp_rx_datagrams_total", "type=\"tx_ack\"", BRIDGE_CNT_UDP_TX_ACK, nullptr },
+    { "lorabridge_udp_rx_datagrams_total", "type=\"invalid\"", BRIDGE_CNT_UDP_INVALID, nullptr },
+    { "lorabridge_udp_rx_wakeups_total", "", BRIDGE_CNT_UDP_RX_WAKEUPS, "recvmmsg calls that returned at least one datagram." },
+    { "lorabridge_udp_tx_acks_total", "", BRIDGE_CNT_UDP_TX_ACKS, "PUSH_ACK and PULL_ACK datagrams sent." },
+    { "lorabridge_gateways_refused_total", "", BRIDGE_CNT_GATEWAYS_REFUSED, "Datagrams dropped because the gateway table was full." },
+    { "lorabridge_gateways_evicted_total", "", BRIDGE_CNT_GATEWAYS_EVICTED, "Gateway sessions removed after gateway_idle_timeout." },
+    { "lorabridge_rxpk_total", "", BRIDGE_CNT_RXPK, "Uplink frames (rxpk) received from gateways." },
+    { "lorabridge_txpk_total", "", BRIDGE_CNT_TXPK, "Downlink frames (txpk) received from MQTT." },
+    { "lorabridge_parse_errors_total", "source=\"udp\"", BRIDGE_CNT_UDP_PARSE_ERRORS, "Payloads that failed to parse." },
+    { "lorabridge_parse_errors_total", "source=\"mqtt\"", BRIDGE_CNT_MQTT_PARSE_ERRORS, nullptr },
+    { "lorabridge_uplink_publishes_total", "", BRIDGE_CNT_UPLINK_PUBLISHES, "Uplink MQTT publishes, a batch counts once." },
+    { "lorabridge_uplink_duplicates_total", "", BRIDGE_CNT_UPLINK_DUPLICATES, "Uplink copies merged or dropped by de-duplication." },
+    { "lorabridge_uplink_dedup_full_total", "", BRIDGE_CNT_UPLINK_DEDUP_FULL, "Uplinks published without de-duplication because the cache set was full." },
+    { "lorabridge_uplink_filtered_total", "reason=\"net_id\"", BRIDGE_CNT_FILTER_NETID, "Uplinks dropped by the [filters] section, by reason." },
+    { "lorabridge_uplink_filtered_total", "reason=\"join_eui\"", BRIDGE_CNT_FILTER_JOINEUI, nullptr },
+    { "lorabridge_uplink_filtered_total", "reason=\"malformed\"", BRIDGE_CNT_FILTER_MALFORMED, nullptr },
+    { "lorabridge_uplink_filtered_total", "reason=\"dev_eui\"", BRIDGE_CNT_FILTER_DEVEUI, nullptr },
+    { "lorabridge_uplink_filtered_total", "reason=\"dev_addr\"", BRIDGE_CNT_FILTER_DEVADDR, nullptr },
+    { "lorabridge_mqtt_publish_errors_total", "", BRIDGE_CNT_MQTT_PUBLISH_ERRORS, "mosquitto_publish calls that failed." },
+    { "lorabridge_mqtt_backpressure_total", "", BRIDGE_CNT_MQTT_BACKPRESSURE, "Events spooled or dropped because the in-flight window was full." },
+    { "lorabridge_mqtt_ack_timeouts_total", "", BRIDGE_CNT_MQTT_ACK_TIMEOUTS, "Publishes not acknowledged in time." },
+    { "lorabridge_mqtt_reconnect_attempts_total", "", BRIDGE_CNT_MQTT_RECONNECT_ATTEMPTS, "MQTT reconnect attempts." },
+    { "lorabridge_mqtt_reconnects_total", "", BRIDGE_CNT_MQTT_RECONNECTS, "Successful MQTT reconnects." },
+    { "lorabridge_mqtt_tls_resumed_total", "", BRIDGE_CNT_MQTT_TLS_RESUMED, "MQTT connections that resumed a TLS session." },
+    { "lorabridge_downlinks_total", "result=\"sent\"", BRIDGE_CNT_DOWNLINK_SENT, "Downlinks by outcome." },
+    { "lorabridge_downlinks_total", "result=\"dropped\"", BRIDGE_CNT_DOWNLINK_DROPS, nullptr },
+    { "lorabridge_downlinks_total", "result=\"expired\"", BRIDGE_CNT_DOWNLINK_EXPIRED, nullptr },
+    { "lorabridge_downlinks_total", "result=\"collision\"", BRIDGE_CNT_DOWNLINK_COLLISIONS, nullptr },
+    { "lorabridge_downlinks_total", "result=\"duty_cycle\"", BRIDGE_CNT_DOWNLINK_DUTY_CYCLE, nullptr },
+    { "lorabridge_downlinks_deferred_total", "", BRIDGE_CNT_DOWNLINK_DEFERRED, "Immediate downlinks delayed to avoid overlapping another transmission." },
+    { "lorabridge_downlink_retries_total", "", BRIDGE_CNT_DOWNLINK_RETRIES, "Downlinks resent after a transient TX_ACK error." },
+    { "lorabridge_downlink_ack_missing_total", "", BRIDGE_CNT_DOWNLINK_ACK_MISSING, "PULL_RESP records overwritten before their TX_ACK arrived." },
+    { "lorabridge_downlink_airtime_microseconds_total", "", BRIDGE_CNT_DOWNLINK_AIRTIME_US, "Time on air of the downlinks sent to gateways." },
+    { "lorabridge_downlink_tx_bytes_total", "", BRIDGE_CNT_DOWNLINK_TX_BYTES, "PULL_RESP bytes sent to gateways." },
+    { "lorabridge_spool_written_total", "", BRIDGE_CNT_SPOOL_WRITTEN, "Events written to the spool." },
+    { "lorabridge_spool_write_errors_total", "", BRIDGE_CNT_SPOOL_WRITE_ERRORS, "Spool writes that failed." },
+    { "lorabridge_spool_replayed_total", "", BRIDGE_CNT_SPOOL_REPLAYED, "Spooled events published after reconnect." },
+};
+/* clang-format on */
+
+static struct evhttp        *prometheus_http    = nullptr;
+static prometheus_collect_cb prometheus_collect = nullptr;
+
+void prometheus_write_header(string &out, const char *name, const char *type, const char *help)
+{
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void prometheus_write_value(string &out, const char *name, const string &labels, uint64_t value)
+{
+    char number[24];
+    snprintf(number, sizeof(number), "%" PRIu64, value);
+    out.append(name);
+    if (!labels.empty()) {
+        out.append("{").append(labels).append("}");
+    }
+    out.append(" ").append(number).append("\n");
+}
+
+// buckets为各桶独立计数，最后一个桶为+Inf；输出按Prometheus要求累计，边界换算成秒
+void prometheus_write_histogram(string &out, const char *name, const string &labels,
+                                const uint64_t *buckets, const uint64_t *bounds_us,
+                                size_t bucket_count, uint64_t sum_us)
+{
+    string   bucket_name = string(name) + "_bucket";
+    string   sep         = labels.empty() ? "" : ",";
+    uint64_t cumulative  = 0;
+    char     le[32];
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        cumulative += buckets[i];
+        if (i < bucket_count - 1) {
+            snprintf(le, sizeof(le), "le=\"%g\"", bounds_us[i] / 1000000.0);
+        } else {
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+        }
+        prometheus_write_value(out, bucket_name.c_str(), labels + sep + le, cumulative);
+    }
+    snprintf(le, sizeof(le), "%.6f", sum_us / 1000000.0);
+    out.append(name).append("_sum");
+    if (!labels.empty()) {
+        out.append("{").append(labels).append("}");
+    }
+    out.append(" ").append(le).append("\n");
+    prometheus_write_value(out, (string(name) + "_count").c_str(), labels, cumulative);
+}
+
+static void prometheus_write_bridge_histogram(string &out, const char *name, const char *help,
+                                              enum bridge_histogram id)
+{
+    struct bridge_histogram_snapshot h;
+    bridge_metrics_histogram(id, &h);
+    prometheus_write_header(out, name, "histogram", help);
+    prometheus_write_histogram(out, name, "", h.buckets, bridge_hist_bounds_us,
+                               BRIDGE_HIST_BUCKETS, h.sum_us);
+}
+
+static void prometheus_request_cb(struct evhttp_request *req, void *arg)
+{
+    string           out;
+    const char      *last = nullptr;
+    struct evbuffer *body;
+
+    out.reserve(8192);
+    for (const auto &c : prometheus_counters) {
+        if (last == nullptr || strcmp(last, c.name) != 0) {
+            prometheus_write_header(out, c.name, "counter", c.help);
+            last = c.name;
+        }
+        prometheus_write_value(out, c.name, c.labels, bridge_metrics_sum(c.id));
+    }
+    prometheus_write_bridge_histogram(out, "lorabridge_uplink_publish_seconds",
+                                      "UDP receive to MQTT publish latency of uplink frames.",
+                                      BRIDGE_HIST_UPLINK_PUBLISH_US);
+    prometheus_write_bridge_histogram(out, "lorabridge_downlink_send_seconds",
+                                      "MQTT enqueue to UDP send latency of downlink frames.",
+                                      BRIDGE_HIST_DOWNLINK_SEND_US);
+    prometheus_write_bridge_histogram(out, "lorabridge_downlink_ack_seconds",
+                                      "MQTT enqueue to TX_ACK latency of downlink frames.",
+                                      BRIDGE_HIST_DOWNLINK_ACK_US);
+    if (prometheus_collect) {
+        prometheus_collect(out);
+    }
+
+    body = evbuffer_new();
+    if (body == nullptr) {
+        evhttp_send_error(req, HTTP_INTERNAL, NULL);
+        return;
+    }
+    evbuffer_add(body, out.data(), out.length());
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                      PROMETHEUS_CONTENT_TYPE);
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+// bind为"ip:port"，ip为空时监听所有地址
+int bridge_prometheus_start(struct event_base *base, const string &bind,
+                            prometheus_collect_cb collect)
+{
+    auto idx = bind.rfind(':');
+    if (idx == string::npos || idx + 1 >= bind.length()) {
+        log_error("Invalid prometheus bind: %s", bind.c_str());
+        return -1;
+    }
+    string host = bind.substr(0, idx);
+    int    port = atoi(bind.c_str() + idx + 1);
+    if (port <= 0 || port > 65535) {
+        log_error("Invalid prometheus bind: %s", bind.c_str());
+        return -1;
+    }
+    if (host.empty()) {
+        host = "0.0.0.0";
+    }
+
+    prometheus_http = evhttp_new(base);
+    if (prometheus_http == nullptr) {
+        log_error("Failed to create prometheus http server.");
+        return -1;
+    }
+    if (evhttp_bind_socket(prometheus_http, host.c_str(), port) < 0) {
+        log_error("Failed to bind prometheus endpoint %s", bind.c_str());
+        evhttp_free(prometheus_http);
+        prometheus_http = nullptr;
+        return -1;
+    }
+    // 其他方法由evhttp直接回501
+    evhttp_set_allowed_methods(prometheus_http, EVHTTP_REQ_GET);
+    evhttp_set_cb(prometheus_http, PROMETHEUS_PATH, prometheus_request_cb, NULL);
+    prometheus_collect = collect;
+    log_info("Prometheus metrics on http://%s:%d%s", host.c_str(), port, PROMETHEUS_PATH);
+    return 0;
+}
+
+void bridge_prometheus_stop(void)
+{
+    if (prometheus_http) {
+        evhttp_free(prometheus_http);
+        prometheus_http = nullptr;
+    }
+}
@@ -0,0 +1,37 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge Prometheus指标导出
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 在主event_base上用evhttp提供/metrics，按Prometheus文本格式输出。
+ *          计数器和直方图在抓取时才合并各线程的分片，数据面不加锁；
+ *          网关、spool、在途窗口等主程序状态由collect回调追加。
+ */
+
+#ifndef _BRIDGE_PROMETHEUS_HPP_
+#define _BRIDGE_PROMETHEUS_HPP_
+
+#include <event2/event.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define PROMETHEUS_PATH         "/metrics"
+#define PROMETHEUS_BIND_DEFAULT "0.0.0.0:9800"
+#define PROMETHEUS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+using namespace std;
+
+using prometheus_collect_cb = void (*)(string &out);
+
+void prometheus_write_header(string &out, const char *name, const char *type, const char *help);
+void prometheus_write_value(string &out, const char *name, const string &labels, uint64_t value);
+void prometheus_write_histogram(string &out, const char *name, const string &labels,
+                                const uint64_t *buckets, const uint64_t *bounds_us,
+                                size_t bucket_count, uint64_t sum_us);
+
+int  bridge_prometheus_start(struct event_base *base, const string &bind,
+                             prometheus_collect_cb collect);
+void bridge_prometheus_stop(void);
+
+#endif
@@ -0,0 +1,474 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge protobuf编码
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 字段号取自ChirpStack v3 gw.proto / common.proto，按proto3规则
+ *          省略取默认值的标量字段。嵌套消息先写1字节长度占位，
+ *          结束时长度超过127再把后面的内容整体后移。
+ */
+
+#include "bridge-proto.hpp"
+#include "bridge-base64.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// gw.proto FineTimestampType / CRCStatus
+#define CHIRPSTACK_FINE_TIMESTAMP_PLAIN 2
+#define CHIRPSTACK_CRC_NO_CRC           0
+#define CHIRPSTACK_CRC_BAD_CRC          1
+#define CHIRPSTACK_CRC_OK               2
+
+// gw.proto TxAckStatus，下标即枚举值；txpk_ack用"NONE"表示成功(OK)
+#define CHIRPSTACK_TX_ACK_INTERNAL_ERROR 10
+static const char *tx_ack_status_tb[] = {
+    "IGNORED",
+    "NONE",
+    "TOO_LATE",
+    "TOO_EARLY",
+    "COLLISION_PACKET",
+    "COLLISION_BEACON",
+    "TX_FREQ",
+    "TX_POWER",
+    "GPS_UNLOCKED",
+    "QUEUE_FULL",
+    "INTERNAL_ERROR",
+    "DUTY_CYCLE_OVERFLOW",
+};
+
+void proto_reader_init(struct proto_reader *reader, const void *data, size_t len)
+{
+    reader->pos = static_cast<const uint8_t *>(data);
+    reader->end = reader->pos + len;
+}
+
+static int proto_get_varint(struct proto_reader *reader, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && reader->pos < reader->end; shift += 7) {
+        uint8_t byte = *reader->pos++;
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int proto_get_fixed(struct proto_reader *reader, size_t size, uint64_t *value)
+{
+    if (static_cast<size_t>(reader->end - reader->pos) < size) {
+        return -1;
+    }
+    *value = 0;
+    for (size_t i = 0; i < size; i++) {
+        *value |= static_cast<uint64_t>(reader->pos[i]) << (8 * i);
+    }
+    reader->pos += size;
+    return 0;
+}
+
+/*
+ * 返回1取到一个字段，0读完，-1格式错误(截断、group等不支持的类型)。
+ * 出错后reader不再可用。
+ */
+int proto_next_field(struct proto_reader *reader, struct proto_field *field)
+{
+    uint64_t tag, len;
+    int      ret = -1;
+
+    if (reader->pos >= reader->end) {
+        return 0;
+    }
+    if (proto_get_varint(reader, &tag) < 0 || (tag >> 3) == 0 || (tag >> 3) > UINT32_MAX) {
+        return -1;
+    }
+    field->number    = static_cast<uint32_t>(tag >> 3);
+    field->wire_type = static_cast<uint32_t>(tag & 0x07);
+    field->value     = 0;
+    field->ptr       = nullptr;
+    field->len       = 0;
+    switch (field->wire_type) {
+    case PROTO_WIRE_VARINT:
+        ret = proto_get_varint(reader, &field->value);
+        break;
+    case PROTO_WIRE_FIXED64:
+        ret = proto_get_fixed(reader, 8, &field->value);
+        break;
+    case PROTO_WIRE_FIXED32:
+        ret = proto_get_fixed(reader, 4, &field->value);
+        break;
+    case PROTO_WIRE_LEN:
+        if (proto_get_varint(reader, &len) == 0 &&
+            len <= static_cast<uint64_t>(reader->end - reader->pos)) {
+            field->ptr = reader->pos;
+            field->len = len;
+            reader->pos += len;
+            ret = 0;
+        }
+        break;
+    default:
+        break;
+    }
+    return (ret == 0) ? 1 : -1;
+}
+
+void proto_put_varint(string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static inline void proto_put_tag(string &out, uint32_t field, uint32_t wire_type)
+{
+    proto_put_varint(out, (static_cast<uint64_t>(field) << 3) | wire_type);
+}
+
+void proto_put_uint(string &out, uint32_t field, uint64_t value)
+{
+    if (value == 0) {
+        return;
+    }
+    proto_put_tag(out, field, PROTO_WIRE_VARINT);
+    proto_put_varint(out, value);
+}
+
+// int32/int64: 负数按64位补码编码(10字节)
+void proto_put_int(string &out, uint32_t field, int64_t value)
+{
+    if (value == 0) {
+        return;
+    }
+    proto_put_tag(out, field, PROTO_WIRE_VARINT);
+    proto_put_varint(out, static_cast<uint64_t>(value));
+}
+
+// 固定小端序，与主机字节序无关(部分MIPS平台是大端)
+void proto_put_double(string &out, uint32_t field, double value)
+{
+    uint64_t bits;
+    if (value == 0.0) {
+        return;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    proto_put_tag(out, field, PROTO_WIRE_FIXED64);
+    for (int i = 0; i < 8; i++) { out += static_cast<char>((bits >> (8 * i)) & 0xff); }
+}
+
+void proto_put_bytes(string &out, uint32_t field, const void *data, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    proto_put_tag(out, field, PROTO_WIRE_LEN);
+    proto_put_varint(out, len);
+    out.append(static_cast<const char *>(data), len);
+}
+
+// 返回消息体起始位置，交给proto_end_message回填长度
+size_t proto_begin_message(string &out, uint32_t field)
+{
+    proto_put_tag(out, field, PROTO_WIRE_LEN);
+    out += '\0';
+    return out.size();
+}
+
+void proto_end_message(string &out, size_t mark)
+{
+    uint64_t len = out.size() - mark;
+    char     buf[10];
+    int      n = 0;
+    do {
+        buf[n++] = static_cast<char>((len & 0x7f) | (len >= 0x80 ? 0x80 : 0));
+        len >>= 7;
+    } while (len);
+    out[mark - 1] = buf[0];
+    if (n > 1) {
+        out.insert(mark, buf + 1, n - 1);
+    }
+}
+
+static inline void put_timestamp(string &out, uint32_t field, int64_t seconds, int32_t nanos)
+{
+    size_t mark = proto_begin_message(out, field);
+    proto_put_int(out, 1, seconds);
+    proto_put_int(out, 2, nanos);
+    proto_end_message(out, mark);
+}
+
+static inline void put_gateway_id(string &out, uint32_t field, uint64_t gateway_eui)
+{
+    uint8_t id[8];
+    for (int i = 0; i < 8; i++) { id[i] = static_cast<uint8_t>(gateway_eui >> (56 - 8 * i)); }
+    proto_put_bytes(out, field, id, sizeof(id));
+}
+
+// ChirpStack用4字节大端的concentrator计数值作为context，下行时原样带回
+static inline void put_context(string &out, uint32_t field, uint32_t tmst)
+{
+    uint8_t ctx[4] = { static_cast<uint8_t>(tmst >> 24), static_cast<uint8_t>(tmst >> 16),
+                       static_cast<uint8_t>(tmst >> 8), static_cast<uint8_t>(tmst) };
+    proto_put_bytes(out, field, ctx, sizeof(ctx));
+}
+
+/*
+ * 解析Semtech时间字段，支持rxpk的"2013-03-31T16:21:17.528002Z"
+ * 和stat的"2014-01-12 08:59:28 GMT"两种格式，均为UTC。
+ */
+int semtech_time_parse(const char *str, size_t len, int64_t *seconds, int32_t *nanos)
+{
+    char      buf[48];
+    struct tm tm;
+    char      sep;
+    int       consumed = 0;
+
+    if (len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    /* clang-format off */
+    if (sscanf(buf, "%4d-%2d-%2d%c%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &sep, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &consumed) != 7 ||
+        (sep != 'T' && sep != ' ')) {
+        return -1;
+    }
+    /* clang-format on */
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *seconds = timegm(&tm);
+    *nanos   = 0;
+    if (buf[consumed] == '.') {
+        int32_t scale = 100000000;
+        for (const char *p = buf + consumed + 1; *p >= '0' && *p <= '9'; p++) {
+            *nanos += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+    return 0;
+}
+
+/*
+ * UplinkFrame的phy_payload(1)和tx_info(2)。
+ * PHYPayload以原始字节携带，data不是合法base64或超过255字节时返回-1。
+ */
+int chirpstack_uplink_proto_head(const struct semtech_rxpk *rxpk, string &out)
+{
+    uint8_t phy_payload[LORA_PHY_PAYLOAD_MAX];
+    int64_t value;
+    size_t  tx_info, mark;
+    int     size;
+
+    if (rxpk->data.type != JSON_SCAN_STRING) {
+        return -1;
+    }
+    size = base64_decode(rxpk->data.ptr, rxpk->data.len, phy_payload, sizeof(phy_payload));
+    if (size < 0) {
+        return -1;
+    }
+    proto_put_bytes(out, 1, phy_payload, size);
+
+    // UplinkTXInfo
+    bool fsk = json_span_equals(&rxpk->modu, "FSK");
+    tx_info  = proto_begin_message(out, 2);
+    proto_put_uint(out, 1, rxpk->frequency);
+    proto_put_uint(out, 2, fsk ? CHIRPSTACK_MODULATION_FSK : CHIRPSTACK_MODULATION_LORA);
+    if (!fsk && rxpk->datr.type == JSON_SCAN_STRING) {
+        mark = proto_begin_message(out, 3);
+        proto_put_uint(out, 1, rxpk->bandwidth);
+        proto_put_uint(out, 2, rxpk->spreading_factor);
+        if (rxpk->codr.type == JSON_SCAN_STRING) {
+            proto_put_bytes(out, 3, rxpk->codr.ptr, rxpk->codr.len);
+        }
+        proto_end_message(out, mark);
+    } else if (fsk && json_span_to_int64(&rxpk->datr, &value) == 0) {
+        mark = proto_begin_message(out, 4);
+        proto_put_uint(out, 2, value);
+        proto_end_message(out, mark);
+    }
+    proto_end_message(out, tx_info);
+    return 0;
+}
+
+/*
+ * UplinkFrame的rx_info(3)。字段号与UplinkFrameSet的repeated rx_info相同，
+ * 多个网关收到的同一帧合并时依次追加即可。
+ */
+void chirpstack_rxinfo_proto_write(const struct semtech_rxpk *rxpk, uint64_t gateway_eui,
+                                   string &out)
+{
+    int64_t value, seconds = 0;
+    int32_t nanos    = 0;
+    double  lora_snr = 0.0;
+    size_t  rx_info, mark;
+
+    // UplinkRXInfo
+    rx_info = proto_begin_message(out, 3);
+    put_gateway_id(out, 1, gateway_eui);
+    bool has_time = rxpk->time.type == JSON_SCAN_STRING &&
+                    semtech_time_parse(rxpk->time.ptr, rxpk->time.len, &seconds, &nanos) == 0;
+    if (has_time) {
+        put_timestamp(out, 2, seconds, nanos);
+    }
+    if (json_span_to_int64(&rxpk->rssi, &value) == 0) {
+        proto_put_int(out, 5, value);
+    }
+    if (json_span_to_double(&rxpk->lsnr, &lora_snr) == 0) {
+        proto_put_double(out, 6, lora_snr);
+    }
+    if (json_span_to_int64(&rxpk->chan, &value) == 0) {
+        proto_put_uint(out, 7, value);
+    }
+    if (json_span_to_int64(&rxpk->rfch, &value) == 0) {
+        proto_put_uint(out, 8, value);
+    }
+    if (has_time && json_span_to_int64(&rxpk->ftime, &value) == 0) {
+        // ftime是GPS秒内的纳秒数，与time的整秒部分组合
+        proto_put_uint(out, 12, CHIRPSTACK_FINE_TIMESTAMP_PLAIN);
+        mark = proto_begin_message(out, 14);
+        put_timestamp(out, 1, seconds, static_cast<int32_t>(value));
+        proto_end_message(out, mark);
+    }
+    if (json_span_to_int64(&rxpk->tmst, &value) == 0) {
+        put_context(out, 15, static_cast<uint32_t>(value));
+    }
+    if (rxpk->crc_status == 1) {
+        proto_put_uint(out, 17, CHIRPSTACK_CRC_OK);
+    } else if (rxpk->crc_status == -1) {
+        proto_put_uint(out, 17, CHIRPSTACK_CRC_BAD_CRC);
+    }
+    proto_end_message(out, rx_info);
+}
+
+// UplinkFrame: phy_payload(1) tx_info(2) rx_info(3)
+int chirpstack_uplink_proto_write(const struct semtech_rxpk *rxpk, uint64_t gateway_eui,
+                                  string &out)
+{
+    if (chirpstack_uplink_proto_head(rxpk, out) < 0) {
+        return -1;
+    }
+    chirpstack_rxinfo_proto_write(rxpk, gateway_eui, out);
+    return 0;
+}
+
+// GatewayStats
+void chirpstack_stats_proto_write(const struct chirpstack_gateway_stats *stats, string &out)
+{
+    put_gateway_id(out, 1, stats->gateway_eui);
+    if (stats->time != 0) {
+        put_timestamp(out, 2, stats->time, 0);
+    }
+    if (stats->has_location) {
+        size_t mark = proto_begin_message(out, 3);
+        proto_put_double(out, 1, stats->latitude);
+        proto_put_double(out, 2, stats->longitude);
+        proto_put_double(out, 3, stats->altitude);
+        proto_end_message(out, mark);
+    }
+    proto_put_uint(out, 5, stats->rx_packets_received);
+    proto_put_uint(out, 6, stats->rx_packets_received_ok);
+    proto_put_uint(out, 7, stats->tx_packets_received);
+    proto_put_uint(out, 8, stats->tx_packets_emitted);
+    proto_put_bytes(out, 9, stats->ip.data(), stats->ip.size());
+    // map<string, string> meta_data = 10，每项是key(1)/value(2)的子消息
+    for (const auto &entry : stats->meta_data) {
+        size_t mark = proto_begin_message(out, 10);
+        proto_put_bytes(out, 1, entry.first.data(), entry.first.size());
+        proto_put_bytes(out, 2, entry.second.data(), entry.second.size());
+        proto_end_message(out, mark);
+    }
+}
+
+// DownlinkFrame: token(3) items(5) gateway_id(6)，每个PULL_RESP一个item
+void chirpstack_downlink_proto_write(const struct chirpstack_downlink *downlink, string &out)
+{
+    size_t item, tx_info, mark;
+
+    proto_put_uint(out, 3, downlink->token);
+    item = proto_begin_message(out, 5);
+    proto_put_bytes(out, 1, downlink->phy_payload, downlink->phy_payload_len);
+
+    // DownlinkTXInfo
+    tx_info = proto_begin_message(out, 2);
+    put_gateway_id(out, 1, downlink->gateway_eui);
+    proto_put_uint(out, 5, downlink->frequency);
+    proto_put_int(out, 6, downlink->power);
+    if (downlink->fsk) {
+        proto_put_uint(out, 7, CHIRPSTACK_MODULATION_FSK);
+        mark = proto_begin_message(out, 9);
+        proto_put_uint(out, 1, downlink->frequency_deviation);
+        proto_put_uint(out, 2, downlink->datarate);
+        proto_end_message(out, mark);
+    } else {
+        mark = proto_begin_message(out, 8);
+        proto_put_uint(out, 1, downlink->bandwidth);
+        proto_put_uint(out, 2, downlink->spreading_factor);
+        proto_put_bytes(out, 3, downlink->code_rate.data(), downlink->code_rate.size());
+        proto_put_uint(out, 4, downlink->polarization_inversion);
+        proto_end_message(out, mark);
+    }
+    proto_put_uint(out, 12, downlink->timing);
+    if (downlink->timing == CHIRPSTACK_TIMING_IMMEDIATELY) {
+        proto_end_message(out, proto_begin_message(out, 13));
+    } else if (downlink->timing == CHIRPSTACK_TIMING_DELAY) {
+        proto_end_message(out, proto_begin_message(out, 14));
+        put_context(out, 16, downlink->tmst);
+    } else {
+        // time_since_gps_epoch(Duration)，tmms单位为毫秒
+        mark          = proto_begin_message(out, 15);
+        size_t offset = proto_begin_message(out, 1);
+        proto_put_int(out, 1, downlink->tmms / 1000);
+        proto_put_int(out, 2, (downlink->tmms % 1000) * 1000000);
+        proto_end_message(out, offset);
+        proto_end_message(out, mark);
+    }
+    proto_end_message(out, tx_info);
+    proto_end_message(out, item);
+    put_gateway_id(out, 6, downlink->gateway_eui);
+}
+
+/*
+ * DownlinkTXAck: gateway_id(1) token(2) error(3) items(5)。
+ * error为txpk_ack的错误码，"NONE"或空表示发送成功，无法识别的按INTERNAL_ERROR。
+ */
+/*
+ * downlink_id为下行命令中的downlinkID: v3的UUID是24字符的base64，解码后按16字节
+ * 写入，其他(如十进制数)原样写入。
+ */
+void chirpstack_downlink_ack_proto_write(uint64_t gateway_eui, uint32_t token,
+                                         const string &downlink_id, const string &error,
+                                         string &out)
+{
+    uint8_t  id[16];
+    int      id_len = -1;
+    uint64_t status = CHIRPSTACK_TX_ACK_INTERNAL_ERROR;
+    bool     ok     = error.empty() || error == "NONE";
+
+    put_gateway_id(out, 1, gateway_eui);
+    proto_put_uint(out, 2, token);
+    if (!ok) {
+        proto_put_bytes(out, 3, error.data(), error.size());
+    }
+    if (downlink_id.length() == BASE64_ENCODED_LEN(sizeof(id))) {
+        id_len = base64_decode(downlink_id.data(), downlink_id.length(), id, sizeof(id));
+    }
+    if (id_len > 0) {
+        proto_put_bytes(out, 4, id, id_len);
+    } else if (!downlink_id.empty()) {
+        proto_put_bytes(out, 4, downlink_id.data(), downlink_id.size());
+    }
+    for (size_t i = 0; i < sizeof(tx_ack_status_tb) / sizeof(tx_ack_status_tb[0]); i++) {
+        if (ok ? (i == 1) : (error == tx_ack_status_tb[i])) {
+            status = i;
+            break;
+        }
+    }
+    size_t mark = proto_begin_message(out, 5);
+    proto_put_uint(out, 1, status);
+    proto_end_message(out, mark);
+}
@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge protobuf编码
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 手写的protobuf编码，报文结构与ChirpStack v3 gw.proto兼容
+ *          (UplinkFrame, GatewayStats, DownlinkFrame, DownlinkTXAck)，
+ *          不依赖libprotobuf。所有写函数只向out追加；读取只做逐字段的
+ *          线格式解析，字段含义由调用者解释。
+ */
+
+#ifndef _BRIDGE_PROTO_HPP_
+#define _BRIDGE_PROTO_HPP_
+
+#include "bridge-uplink.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#define PROTO_WIRE_VARINT  0
+#define PROTO_WIRE_FIXED64 1
+#define PROTO_WIRE_LEN     2
+#define PROTO_WIRE_FIXED32 5
+
+// common.proto Modulation
+#define CHIRPSTACK_MODULATION_LORA 0
+#define CHIRPSTACK_MODULATION_FSK  1
+
+#define LORA_PHY_PAYLOAD_MAX 255 /* rxpk的size为8位 */
+
+enum bridge_marshaler {
+    BRIDGE_MARSHALER_JSON = 0,
+    BRIDGE_MARSHALER_PROTOBUF,
+};
+
+// gw.proto DownlinkTiming
+enum chirpstack_downlink_timing {
+    CHIRPSTACK_TIMING_IMMEDIATELY = 0,
+    CHIRPSTACK_TIMING_DELAY,
+    CHIRPSTACK_TIMING_GPS_EPOCH,
+};
+
+struct chirpstack_gateway_stats {
+    uint64_t gateway_eui;
+    string   ip;
+    int64_t  time; // unix秒，0表示没有
+    bool     has_location;
+    double   latitude;
+    double   longitude;
+    double   altitude;
+    uint32_t rx_packets_received;
+    uint32_t rx_packets_received_ok;
+    uint32_t tx_packets_received;
+    uint32_t tx_packets_emitted;
+
+    vector<pair<string, string>> meta_data;
+};
+
+// 已下发给网关的txpk
+struct chirpstack_downlink {
+    uint64_t       gateway_eui;
+    uint16_t       token;
+    const uint8_t *phy_payload; // 原始字节
+    size_t         phy_payload_len;
+    uint32_t       frequency; // Hz
+    int32_t        power;
+    bool           fsk;
+    uint32_t       bandwidth; // kHz
+    uint32_t       spreading_factor;
+    string         code_rate;
+    bool           polarization_inversion;
+    uint32_t       datarate;
+    uint32_t       frequency_deviation;
+    int            timing;
+    uint32_t       tmst;
+    uint64_t       tmms;
+};
+
+// 读出的一个字段；LEN类型的ptr/len指向原报文，FIXED32/FIXED64按小端读入value
+struct proto_field {
+    uint32_t       number;
+    uint32_t       wire_type;
+    uint64_t       value;
+    const uint8_t *ptr;
+    size_t         len;
+};
+
+struct proto_reader {
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+void   proto_reader_init(struct proto_reader *reader, const void *data, size_t len);
+int    proto_next_field(struct proto_reader *reader, struct proto_field *field);
+void   proto_put_varint(string &out, uint64_t value);
+void   proto_put_uint(string &out, uint32_t field, uint64_t value);
+void   proto_put_int(string &out, uint32_t field, int64_t value);
+void   proto_put_double(string &out, uint32_t field, double value);
+void   proto_put_bytes(string &out, uint32_t field, const void *data, size_t len);
+size_t proto_begin_message(string &out, uint32_t field);
+void   proto_end_message(string &out, size_t mark);
+
+int semtech_time_parse(const char *str, size_t len, int64_t *seconds, int32_t *nanos);
+
+int  chirpstack_uplink_proto_write(const struct semtech_rxpk *rxpk, uint64_t gateway_eui,
+                                   string &out);
+int  chirpstack_uplink_proto_head(const struct semtech_rxpk *rxpk, string &out);
+void chirpstack_rxinfo_proto_write(const struct semtech_rxpk *rxpk, uint64_t gateway_eui,
+                                   string &out);
+void chirpstack_stats_proto_write(const struct chirpstack_gateway_stats *stats, string &out);
+void chirpstack_downlink_proto_write(const struct chirpstack_downlink *downlink, string &out);
+void chirpstack_downlink_ack_proto_write(uint64_t gateway_eui, uint32_t token,
+                                         const string &downlink_id, const string &error,
+                                         string &out);
+
+#endif
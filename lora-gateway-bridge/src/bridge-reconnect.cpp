@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT重连
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-reconnect.hpp"
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <string.h>
+
+struct duration_unit {
+    const char *name;
+    double      ms;
+};
+
+// 长的单位在前，避免"ms"被当成"m"
+static const struct duration_unit duration_units[] = {
+    { "ns", 0.000001 }, { "us", 0.001 }, { "\xc2\xb5s", 0.001 }, { "ms", 1 },
+    { "h", 3600000 },   { "m", 60000 },  { "s", 1000 },
+};
+
+// 解析Go time.Duration格式的字符串，如"10m0s"、"24h30m15s"、"1.5s"
+int parse_duration_ms(const string &text, uint64_t *ms)
+{
+    const char *p     = text.c_str();
+    double      total = 0;
+
+    if (*p == '\0') {
+        return -1;
+    }
+    if (strcmp(p, "0") == 0) {
+        *ms = 0;
+        return 0;
+    }
+    while (*p != '\0') {
+        double value  = 0;
+        double scale  = 1;
+        bool   digits = false;
+        for (; *p >= '0' && *p <= '9'; p++, digits = true) { value = value * 10 + (*p - '0'); }
+        if (*p == '.') {
+            for (p++; *p >= '0' && *p <= '9'; p++, digits = true) {
+                scale /= 10;
+                value += (*p - '0') * scale;
+            }
+        }
+        if (!digits) {
+            return -1;
+        }
+        const struct duration_unit *unit = nullptr;
+        for (const auto &u : duration_units) {
+            if (strncmp(p, u.name, strlen(u.name)) == 0) {
+                unit = &u;
+                break;
+            }
+        }
+        if (unit == nullptr) {
+            return -1;
+        }
+        p += strlen(unit->name);
+        total += value * unit->ms;
+        if (total > (double)UINT32_MAX * 1000) {
+            return -1;
+        }
+    }
+    *ms = (uint64_t)total;
+    return 0;
+}
+
+ReconnectBackoff::ReconnectBackoff(uint64_t min_us, uint64_t max_us)
+    : min_us(min_us), max_us(max_us), attempt(0), rng(random_device{}())
+{
+}
+
+void ReconnectBackoff::set_max_delay(uint64_t max_us)
+{
+    this->max_us = (max_us < this->min_us) ? this->min_us : max_us;
+}
+
+uint64_t ReconnectBackoff::next_delay_us(void)
+{
+    uint64_t delay_us = this->max_us;
+    // 1秒翻倍到上限，移位超过上限后不再增长
+    if (this->attempt < 32 && (this->min_us << this->attempt) < this->max_us) {
+        delay_us = this->min_us << this->attempt;
+    }
+    this->attempt++;
+    uniform_int_distribution<uint64_t> jitter(delay_us / 2, delay_us);
+    return jitter(this->rng);
+}
+
+// 整个进程只有一个broker连接，保存最近一次握手得到的会话
+static SSL_SESSION    *tls_session       = nullptr;
+static pthread_mutex_t tls_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int tls_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    pthread_mutex_lock(&tls_session_mutex);
+    if (tls_session) {
+        SSL_SESSION_free(tls_session);
+    }
+    tls_session = session;
+    pthread_mutex_unlock(&tls_session_mutex);
+    // 返回1表示会话的引用由我们持有
+    return 1;
+}
+
+// libmosquitto每次连接都新建SSL，在第一次握手开始前带上保存的会话
+static void tls_info_cb(const SSL *ssl, int where, int ret)
+{
+    if (!(where & SSL_CB_HANDSHAKE_START) || !SSL_in_before(ssl)) {
+        return;
+    }
+    pthread_mutex_lock(&tls_session_mutex);
+    if (tls_session && SSL_SESSION_is_resumable(tls_session)) {
+        SSL_set_session(const_cast<SSL *>(ssl), tls_session);
+    }
+    pthread_mutex_unlock(&tls_session_mutex);
+}
+
+/*
+ * 用自己的SSL_CTX打开客户端会话缓存，WITH_DEFAULTS让libmosquitto照常
+ * 加载mosquitto_tls_set设置的证书。libmosquitto不带TLS时返回-1。
+ */
+int mqtt_tls_resume_enable(struct mosquitto *mosq)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) {
+        return -1;
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, tls_new_session_cb);
+    SSL_CTX_set_info_callback(ctx, tls_info_cb);
+    if (mosquitto_int_option(mosq, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, 1) != MOSQ_ERR_SUCCESS ||
+        mosquitto_void_option(mosq, MOSQ_OPT_SSL_CTX, ctx) != MOSQ_ERR_SUCCESS) {
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    // libmosquitto已持有一份引用
+    SSL_CTX_free(ctx);
+    return 0;
+}
+
+bool mqtt_tls_resumed(struct mosquitto *mosq)
+{
+    SSL *ssl = static_cast<SSL *>(mosquitto_ssl_get(mosq));
+    return ssl && SSL_session_reused(ssl);
+}
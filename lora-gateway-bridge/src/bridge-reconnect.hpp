@@ -0,0 +1,49 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT重连
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 断线后进程内重连，不再退出等procd拉起。重连间隔从1秒开始按2倍
+ *          增长，上限为max_reconnect_interval，每次在[间隔/2, 间隔]内随机
+ *          取值，避免大量网关在broker重启后同时重连。TLS连接保存最近一次
+ *          的会话，重连时带上以便broker支持时做会话恢复，省去完整握手。
+ */
+
+#ifndef _BRIDGE_RECONNECT_HPP_
+#define _BRIDGE_RECONNECT_HPP_
+
+#include <mosquitto.h>
+#include <random>
+#include <stdint.h>
+#include <string>
+
+#define MQTT_RECONNECT_DELAY_MIN   1000                /* ms，第一次重连前的等待 */
+#define MQTT_RECONNECT_MAX_DEFAULT (10 * 60 * 1000)    /* ms，10m0s */
+#define MQTT_RECONNECT_MAX_LIMIT   (24 * 3600 * 1000U) /* ms */
+
+using namespace std;
+
+int parse_duration_ms(const string &text, uint64_t *ms);
+
+// 只由MQTT所在线程访问，不加锁
+class ReconnectBackoff
+{
+  private:
+    uint64_t   min_us;
+    uint64_t   max_us;
+    uint32_t   attempt;
+    mt19937_64 rng;
+
+  public:
+    ReconnectBackoff(uint64_t min_us, uint64_t max_us);
+
+    void     set_max_delay(uint64_t max_us);
+    uint64_t next_delay_us(void);
+    void     reset(void) { this->attempt = 0; }
+    uint32_t attempts(void) const { return this->attempt; }
+};
+
+int  mqtt_tls_resume_enable(struct mosquitto *mosq);
+bool mqtt_tls_resumed(struct mosquitto *mosq);
+
+#endif
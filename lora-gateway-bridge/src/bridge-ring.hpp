@@ -0,0 +1,130 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 有界无锁环形队列
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details Dmitry Vyukov的有界MPMC队列: 每个槽位带序号，生产者和消费者
+ *          各自CAS一个位置计数，不加锁也不分配内存。元素在槽位内原地
+ *          填写和读取，适合固定大小的大帧。
+ */
+
+#ifndef _BRIDGE_RING_HPP_
+#define _BRIDGE_RING_HPP_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define BRIDGE_CACHE_LINE 64
+
+template <typename T> class BoundedRing
+{
+  private:
+    struct cell {
+        atomic<size_t> sequence;
+        T              data;
+    };
+
+    cell  *buffer;
+    size_t mask;
+    // 生产者和消费者的计数放在不同的cache line，避免互相失效
+    char           pad0[BRIDGE_CACHE_LINE];
+    atomic<size_t> enqueue_pos;
+    char           pad1[BRIDGE_CACHE_LINE - sizeof(atomic<size_t>)];
+    atomic<size_t> dequeue_pos;
+    char           pad2[BRIDGE_CACHE_LINE - sizeof(atomic<size_t>)];
+    atomic<size_t> high_water;
+
+  public:
+    // 容量向上取整为2的幂
+    explicit BoundedRing(size_t capacity) : mask(0), enqueue_pos(0), dequeue_pos(0), high_water(0)
+    {
+        size_t size = 2;
+        while (size < capacity) { size <<= 1; }
+        this->buffer = new cell[size];
+        this->mask   = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            this->buffer[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    ~BoundedRing() { delete[] this->buffer; }
+
+    BoundedRing(const BoundedRing &)            = delete;
+    BoundedRing &operator=(const BoundedRing &) = delete;
+
+    /*
+     * 取得一个空槽位后调用fill(T &)原地填写，然后发布给消费者。
+     * 队列满时返回false，fill不会被调用。
+     */
+    template <typename F> bool push(F fill)
+    {
+        cell  *c;
+        size_t pos = this->enqueue_pos.load(memory_order_relaxed);
+        for (;;) {
+            c             = &this->buffer[pos & this->mask];
+            size_t   seq  = c->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                            memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = this->enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+        fill(c->data);
+        c->sequence.store(pos + 1, memory_order_release);
+
+        // 近似的最高水位，只用于统计
+        size_t depth = pos + 1 - this->dequeue_pos.load(memory_order_relaxed);
+        size_t high  = this->high_water.load(memory_order_relaxed);
+        while (depth > high &&
+               !this->high_water.compare_exchange_weak(high, depth, memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    // 取出最早的元素交给consume(T &)原地读取，队列空时返回false
+    template <typename F> bool pop(F consume)
+    {
+        cell  *c;
+        size_t pos = this->dequeue_pos.load(memory_order_relaxed);
+        for (;;) {
+            c             = &this->buffer[pos & this->mask];
+            size_t   seq  = c->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (this->dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                                            memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = this->dequeue_pos.load(memory_order_relaxed);
+            }
+        }
+        consume(c->data);
+        c->sequence.store(pos + this->mask + 1, memory_order_release);
+        return true;
+    }
+
+    size_t capacity(void) const { return this->mask + 1; }
+
+    size_t size(void) const
+    {
+        size_t head = this->dequeue_pos.load(memory_order_relaxed);
+        size_t tail = this->enqueue_pos.load(memory_order_relaxed);
+        return (tail > head) ? tail - head : 0;
+    }
+
+    size_t high_water_mark(void) const { return this->high_water.load(memory_order_relaxed); }
+};
+
+#endif
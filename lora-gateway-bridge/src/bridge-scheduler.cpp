@@ -0,0 +1,79 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行JIT调度
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-scheduler.hpp"
+#include "bridge-json-scan.hpp"
+#include <algorithm>
+
+/*
+ * 取出txpk的定时方式。带tmst且不是imme的帧返回DOWNLINK_TIMING_TMST，
+ * imme、GPS时间(tmms)的帧返回DOWNLINK_TIMING_IMMEDIATE，报文不合法返回-1。
+ */
+int downlink_txpk_timing(const char *payload, size_t len, uint32_t *tmst)
+{
+    struct json_span   root, key, value, txpk;
+    struct json_cursor cursor;
+    bool               immediate = false, has_tmst = false;
+    int64_t            number    = 0;
+
+    txpk.type = JSON_SCAN_NONE;
+    if (json_scan_document(payload, len, &root) < 0 || json_scan_open(&root, &cursor) < 0) {
+        return -1;
+    }
+    while (json_scan_next_member(&cursor, &key, &value) > 0) {
+        if (json_span_equals(&key, "txpk") && value.type == JSON_SCAN_OBJECT) {
+            txpk = value;
+        }
+    }
+    if (txpk.type == JSON_SCAN_NONE || json_scan_open(&txpk, &cursor) < 0) {
+        return -1;
+    }
+    while (json_scan_next_member(&cursor, &key, &value) > 0) {
+        if (json_span_equals(&key, "imme")) {
+            immediate = (value.type == JSON_SCAN_TRUE);
+        } else if (json_span_equals(&key, "tmst") && json_span_to_int64(&value, &number) == 0) {
+            has_tmst = (number >= 0 && number <= UINT32_MAX);
+        }
+    }
+    if (immediate || !has_tmst) {
+        return DOWNLINK_TIMING_IMMEDIATE;
+    }
+    *tmst = static_cast<uint32_t>(number);
+    return DOWNLINK_TIMING_TMST;
+}
+
+// 按release_us建最小堆
+static bool release_later(const struct scheduled_downlink &a, const struct scheduled_downlink &b)
+{
+    return a.release_us > b.release_us;
+}
+
+void DownlinkScheduler::push(struct scheduled_downlink &&frame)
+{
+    this->heap.push_back(std::move(frame));
+    std::push_heap(this->heap.begin(), this->heap.end(), release_later);
+}
+
+// 最早的帧到了释放时刻时取出
+bool DownlinkScheduler::pop_ready(uint64_t now_us, struct scheduled_downlink &out)
+{
+    if (this->heap.empty() || this->heap.front().release_us > now_us) {
+        return false;
+    }
+    std::pop_heap(this->heap.begin(), this->heap.end(), release_later);
+    out = std::move(this->heap.back());
+    this->heap.pop_back();
+    return true;
+}
+
+bool DownlinkScheduler::next_release(uint64_t *release_us) const
+{
+    if (this->heap.empty()) {
+        return false;
+    }
+    *release_us = this->heap.front().release_us;
+    return true;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 下行JIT调度
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 按释放时刻(本地单调时钟)排序待下发的txpk。定时帧在预计发射前
+ *          lead time才交给网关，与packet forwarder的JIT队列行为一致，tmst由
+ *          网关上行rxpk的tmst估算出的集中器时钟换算成本地时间；立即发送的帧
+ *          收到就释放，为避开在途发射而推迟的帧到点再释放。
+ */
+
+#ifndef _BRIDGE_SCHEDULER_HPP_
+#define _BRIDGE_SCHEDULER_HPP_
+
+#include "bridge-airtime.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define DOWNLINK_LEAD_TIME_MIN     10   /* ms */
+#define DOWNLINK_LEAD_TIME_DEFAULT 200  /* ms */
+#define DOWNLINK_LEAD_TIME_MAX     3000 /* ms，forwarder的JIT队列只接受3秒内的tmst */
+#define DOWNLINK_MIN_MARGIN_US     5000 /* 离发射不足5ms时网关已来不及调度 */
+
+using namespace std;
+
+enum downlink_timing {
+    DOWNLINK_TIMING_IMMEDIATE = 0, // imme或GPS时间，收到就发
+    DOWNLINK_TIMING_TMST,          // 按集中器tmst定时
+};
+
+struct scheduled_downlink {
+    uint64_t                   due_us;     // 单调时钟，预计发射时刻
+    uint64_t                   release_us; // 单调时钟，交给网关的时刻
+    uint64_t                   enqueue_us; // 单调时钟，MQTT线程入队时刻
+    uint32_t                   airtime_us;
+    struct airtime_reservation reservation;   // 在发射账本上记的账
+    bool                       timed;         // due_us由tmst换算而来
+    uint8_t                    attempts;      // 已因TX_ACK报错重发的次数
+    uint32_t                   command_token; // 下行命令带的token，0表示没有
+    string                     downlink_id;   // 下行命令带的downlinkID
+    string                     payload;
+};
+
+int downlink_txpk_timing(const char *payload, size_t len, uint32_t *tmst);
+
+// 只由该网关的pull worker访问，不加锁
+class DownlinkScheduler
+{
+  private:
+    vector<struct scheduled_downlink> heap;
+
+  public:
+    void   push(struct scheduled_downlink &&frame);
+    bool   pop_ready(uint64_t now_us, struct scheduled_downlink &out);
+    bool   next_release(uint64_t *release_us) const;
+    size_t size(void) const { return this->heap.size(); }
+};
+
+#endif
@@ -0,0 +1,281 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 多网关会话表
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 开放寻址哈希表。查找无锁，插入和移除由互斥锁串行化，
+ *          会话在初始化完成后才发布到槽位，读者不会看到半初始化的会话。
+ *          移除的会话在槽位上留下墓碑，探测链末尾的墓碑直接清空；会话
+ *          本身延迟GATEWAY_RETIRE_DELAY后才释放，读者不需要加锁或引用计数。
+ */
+
+#include "bridge-session.hpp"
+#include "bridge-base64.hpp"
+#include "bridge-metrics.hpp"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+gateway_session::gateway_session(uint64_t eui, uint32_t queue_size, enum duty_cycle_region region)
+    : gateway_eui(eui), pinned(false), last_seen_us(bridge_monotonic_us()), push_addr(),
+      pull_addr(), has_pull_addr(false), pull_worker_id(-1), queue_downlink(queue_size),
+      dispatch_pending(false), downlink_token(static_cast<uint16_t>(random_device{}())),
+      ledger(region), clock_offset_us(0)
+{
+    char gateway_id[BASE64_ENCODED_LEN(GATEWAY_EUI_STR_LEN)];
+
+    snprintf(this->eui_str, sizeof(this->eui_str), "%016llx", (unsigned long long)eui);
+    base64_encode((const uint8_t *)this->eui_str, GATEWAY_EUI_STR_LEN, gateway_id,
+                  sizeof(gateway_id));
+    this->gateway_id.assign(gateway_id, sizeof(gateway_id));
+    this->json_gateway_id = "\"gatewayID\":\"" + this->gateway_id + "\"";
+    this->counters.push_data.store(0);
+    this->counters.pull_data.store(0);
+    this->counters.tx_ack.store(0);
+    this->counters.rxpk.store(0);
+    this->counters.stat.store(0);
+    this->counters.downlink_enqueued.store(0);
+    this->counters.downlink_sent.store(0);
+    this->counters.downlink_dropped.store(0);
+    this->counters.downlink_expired.store(0);
+    this->counters.downlink_rejected.store(0);
+}
+
+gateway_session::~gateway_session() {}
+
+// Semtech UDP v2: 版本(1) + token(2) + 类型(1) + 网关EUI(8, 大端)
+uint64_t gateway_eui_from_header(const uint8_t *buf)
+{
+    uint64_t eui = 0;
+    for (int i = 4; i < 12; i++) { eui = (eui << 8) | buf[i]; }
+    return eui;
+}
+
+static inline void downlink_drop(struct gateway_session *session)
+{
+    gateway_session_count(session->counters.downlink_dropped);
+    bridge_metrics_add(BRIDGE_CNT_DOWNLINK_DROPS);
+}
+
+/*
+ * 把一条txpk复制进下行队列的空槽位。超长或按策略被丢弃时返回-1。
+ * DOWNLINK_DROP_OLDEST时先出队丢掉最早的一条再重试，重试次数有限，
+ * 避免和消费者竞争时长时间自旋。超长的downlinkID不保存，ack中不带。
+ */
+int gateway_session_push_downlink(struct gateway_session *session, const char *payload,
+                                  size_t len, const char *downlink_id, size_t id_len,
+                                  uint32_t command_token, enum downlink_overflow policy)
+{
+    uint64_t now  = bridge_monotonic_us();
+    auto     fill = [&](struct downlink_frame &frame) {
+        frame.enqueue_us    = now;
+        frame.command_token = command_token;
+        frame.id_len        = id_len;
+        memcpy(frame.downlink_id, downlink_id, id_len);
+        frame.len = len;
+        memcpy(frame.payload, payload, len);
+    };
+
+    if (id_len > DOWNLINK_ID_MAX) {
+        id_len = 0;
+    }
+    if (len > DOWNLINK_FRAME_MAX) {
+        downlink_drop(session);
+        return -1;
+    }
+    for (int retry = 0; retry < 4; retry++) {
+        if (session->queue_downlink.push(fill)) {
+            gateway_session_count(session->counters.downlink_enqueued);
+            return 0;
+        }
+        if (policy != DOWNLINK_DROP_OLDEST) {
+            break;
+        }
+        if (session->queue_downlink.pop([](struct downlink_frame &) {})) {
+            downlink_drop(session);
+        }
+    }
+    downlink_drop(session);
+    return -1;
+}
+
+/*
+ * 用rxpk的tmst校准集中器时钟。tmst是集中器收完该包时的计数，
+ * 包经forwarder转发到这里有几到几十毫秒延迟，所以估计的集中器时间
+ * 会略晚于真实值，lead time需要覆盖这部分。
+ */
+void gateway_session_update_clock(struct gateway_session *session, uint32_t tmst, uint64_t now_us)
+{
+    uint64_t offset = now_us - tmst;
+    session->clock_offset_us.store(offset ? offset : 1, memory_order_relaxed);
+}
+
+// 计算tmst离集中器当前时间还有多久，tmst按32位回绕处理
+int gateway_session_tmst_delta(struct gateway_session *session, uint32_t tmst, uint64_t now_us,
+                               int64_t *delta_us)
+{
+    uint64_t offset = session->clock_offset_us.load(memory_order_relaxed);
+    if (offset == 0) {
+        return -1;
+    }
+    uint32_t now_tmst = static_cast<uint32_t>(now_us - offset);
+    *delta_us         = static_cast<int32_t>(tmst - now_tmst);
+    return 0;
+}
+
+static char tombstone_mark;
+
+struct gateway_session *const GatewaySessionTable::tombstone =
+    reinterpret_cast<struct gateway_session *>(&tombstone_mark);
+
+GatewaySessionTable::GatewaySessionTable(uint32_t max_sessions)
+    : capacity(1), max_sessions(max_sessions), session_count(0), used_slots(0)
+{
+    // 负载因子不超过0.5，探测链保持很短
+    while (this->capacity < max_sessions * 2) { this->capacity <<= 1; }
+    this->slots = new atomic<struct gateway_session *>[this->capacity];
+    for (uint32_t i = 0; i < this->capacity; i++) { this->slots[i].store(nullptr); }
+    pthread_mutex_init(&this->insert_mutex, NULL);
+}
+
+GatewaySessionTable::~GatewaySessionTable()
+{
+    for (uint32_t i = 0; i < this->capacity; i++) {
+        struct gateway_session *session = this->slots[i].load();
+        if (session != tombstone) {
+            delete session;
+        }
+    }
+    for (auto &entry : this->retired) { delete entry.session; }
+    delete[] this->slots;
+    pthread_mutex_destroy(&this->insert_mutex);
+}
+
+uint32_t GatewaySessionTable::slot_of(uint64_t eui) const
+{
+    return static_cast<uint32_t>((eui * 0x9E3779B97F4A7C15ULL) >> 32) & (this->capacity - 1);
+}
+
+struct gateway_session *GatewaySessionTable::find(uint64_t eui) const
+{
+    for (uint32_t i = this->slot_of(eui);; i = (i + 1) & (this->capacity - 1)) {
+        struct gateway_session *session = this->slots[i].load(memory_order_acquire);
+        if (session == nullptr) {
+            return nullptr;
+        }
+        if (session != tombstone && session->gateway_eui == eui) {
+            return session;
+        }
+    }
+}
+
+/*
+ * 插入已初始化好的会话。若同一EUI已被其他线程插入则返回已有会话，
+ * 调用者负责释放自己的那份；表满时返回nullptr。优先复用探测链上的
+ * 墓碑；至少留一个空槽，保证无锁查找总能在空槽处结束。
+ */
+struct gateway_session *GatewaySessionTable::insert(struct gateway_session *session)
+{
+    struct gateway_session *result = nullptr;
+    int64_t                 reuse  = -1;
+    pthread_mutex_lock(&this->insert_mutex);
+    uint32_t i = this->slot_of(session->gateway_eui);
+    for (;; i = (i + 1) & (this->capacity - 1)) {
+        struct gateway_session *cur = this->slots[i].load(memory_order_relaxed);
+        if (cur == nullptr) {
+            break;
+        }
+        if (cur == tombstone) {
+            reuse = (reuse < 0) ? i : reuse;
+        } else if (cur->gateway_eui == session->gateway_eui) {
+            result = cur;
+            break;
+        }
+    }
+    if (result == nullptr && this->session_count < this->max_sessions &&
+        (reuse >= 0 || this->used_slots + 1 < this->capacity)) {
+        if (!session->topic_sub_txpk.empty()) {
+            this->topic_map[session->topic_sub_txpk] = session;
+        }
+        if (reuse >= 0) {
+            i = static_cast<uint32_t>(reuse);
+        } else {
+            this->used_slots++;
+        }
+        this->slots[i].store(session, memory_order_release);
+        this->session_count++;
+        result = session;
+    }
+    pthread_mutex_unlock(&this->insert_mutex);
+    return result;
+}
+
+struct gateway_session *GatewaySessionTable::find_by_topic(const string &topic)
+{
+    struct gateway_session *session = nullptr;
+    pthread_mutex_lock(&this->insert_mutex);
+    auto iter = this->topic_map.find(topic);
+    if (iter != this->topic_map.end()) {
+        session = iter->second;
+    }
+    pthread_mutex_unlock(&this->insert_mutex);
+    return session;
+}
+
+uint32_t GatewaySessionTable::size(void)
+{
+    pthread_mutex_lock(&this->insert_mutex);
+    uint32_t count = this->session_count;
+    pthread_mutex_unlock(&this->insert_mutex);
+    return count;
+}
+
+// 后一个槽位为空时，以i结尾的连续墓碑不在任何探测链中间，直接清空
+void GatewaySessionTable::clear_tombstones(uint32_t i)
+{
+    uint32_t mask = this->capacity - 1;
+    while (this->slots[i].load(memory_order_relaxed) == tombstone &&
+           this->slots[(i + 1) & mask].load(memory_order_relaxed) == nullptr) {
+        this->slots[i].store(nullptr, memory_order_release);
+        this->used_slots--;
+        i = (i - 1) & mask;
+    }
+}
+
+/*
+ * 移除超过idle_us没有PUSH_DATA/PULL_DATA的会话(pinned除外)，移除的会话
+ * 追加到evicted，调用者取消订阅其topic；同时释放移除已超过
+ * GATEWAY_RETIRE_DELAY的会话。只由主线程调用。
+ */
+void GatewaySessionTable::evict_idle(uint64_t now_us, uint64_t idle_us,
+                                     vector<struct gateway_session *> &evicted)
+{
+    pthread_mutex_lock(&this->insert_mutex);
+    auto expired = partition(this->retired.begin(), this->retired.end(),
+                             [now_us](const struct retired_session &entry) {
+                                 return now_us - entry.retired_us <
+                                        GATEWAY_RETIRE_DELAY * 1000000ULL;
+                             });
+    for (auto it = expired; it != this->retired.end(); ++it) { delete it->session; }
+    this->retired.erase(expired, this->retired.end());
+
+    for (uint32_t i = 0; i < this->capacity; i++) {
+        struct gateway_session *session = this->slots[i].load(memory_order_relaxed);
+        if (session == nullptr || session == tombstone || session->pinned) {
+            continue;
+        }
+        // worker可能刚用更晚的时刻更新过
+        uint64_t last_seen_us = session->last_seen_us.load(memory_order_relaxed);
+        if (last_seen_us >= now_us || now_us - last_seen_us <= idle_us) {
+            continue;
+        }
+        this->slots[i].store(tombstone, memory_order_release);
+        this->topic_map.erase(session->topic_sub_txpk);
+        this->session_count--;
+        this->retired.push_back({ session, now_us });
+        evicted.push_back(session);
+        this->clear_tombstones(i);
+    }
+    pthread_mutex_unlock(&this->insert_mutex);
+}
@@ -0,0 +1,174 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 多网关会话表
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 以Semtech UDP头部第4-11字节的网关EUI为键，每个网关一条会话，
+ *          记录其PUSH/PULL地址、下行队列、预先拼好的topic和计数。
+ *          长时间没有PUSH_DATA/PULL_DATA的会话由主线程定期移除(本机网关
+ *          除外)，移除后延迟一段时间才释放，其他线程手上的指针仍然有效。
+ */
+
+#ifndef _BRIDGE_SESSION_HPP_
+#define _BRIDGE_SESSION_HPP_
+
+#include "bridge-airtime.hpp"
+#include "bridge-ring.hpp"
+#include "bridge-scheduler.hpp"
+#include "bridge-txack.hpp"
+#include <atomic>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define GATEWAY_EUI_STR_LEN    16
+#define MAX_GATEWAYS_DEFAULT   64
+#define MAX_GATEWAYS_MAX       1024
+#define DOWNLINK_FRAME_MAX     996 /* PULL_RESP缓冲区1000字节去掉4字节头 */
+#define DOWNLINK_QUEUE_DEFAULT 16
+#define DOWNLINK_QUEUE_MAX     256
+#define DOWNLINK_ID_MAX        48 /* ChirpStack的downlinkID为UUID的base64或十进制数 */
+
+#define GATEWAY_IDLE_TIMEOUT_DEFAULT 60   /* seconds，forwarder默认每10秒一个PULL_DATA */
+#define GATEWAY_IDLE_TIMEOUT_MAX     3600 /* seconds */
+#define GATEWAY_SWEEP_INTERVAL       10   /* seconds */
+#define GATEWAY_RETIRE_DELAY         60   /* seconds，移除后到释放内存 */
+
+// 下行队列满时的处理
+enum downlink_overflow {
+    DOWNLINK_DROP_NEWEST = 0, // 丢弃新到的下行
+    DOWNLINK_DROP_OLDEST,     // 丢弃队列中最早的下行，为新下行腾位置
+};
+
+using namespace std;
+
+struct gateway_session_counters {
+    atomic<uint64_t> push_data;
+    atomic<uint64_t> pull_data;
+    atomic<uint64_t> tx_ack;
+    atomic<uint64_t> rxpk;
+    atomic<uint64_t> stat;
+    atomic<uint64_t> downlink_enqueued;
+    atomic<uint64_t> downlink_sent;
+    atomic<uint64_t> downlink_dropped;
+    atomic<uint64_t> downlink_expired;
+    atomic<uint64_t> downlink_rejected; // 发射重叠或超出占空比
+};
+
+// 已序列化好的txpk，定长存放在队列槽位中；入队时刻用于统计入队到发出的延迟
+struct downlink_frame {
+    uint64_t enqueue_us;
+    uint32_t command_token;
+    uint8_t  id_len;
+    char     downlink_id[DOWNLINK_ID_MAX];
+    uint16_t len;
+    char     payload[DOWNLINK_FRAME_MAX];
+};
+
+struct gateway_session {
+    uint64_t gateway_eui;
+    char     eui_str[GATEWAY_EUI_STR_LEN + 1];
+    bool     pinned; // 本机网关，空闲时也不移除
+
+    // 最近一次PUSH_DATA/PULL_DATA的单调时钟(us)，建会话时为当前时间
+    atomic<uint64_t> last_seen_us;
+
+    // 最近一次PUSH_DATA/PULL_DATA的来源地址，由处理该网关的worker更新
+    struct sockaddr_in push_addr;
+    struct sockaddr_in pull_addr;
+    bool               has_pull_addr;
+    atomic<int>        pull_worker_id; // 收到过PULL_DATA之前为-1
+
+    // MQTT线程入队，pull_worker_id对应的worker出队发送，无锁
+    BoundedRing<struct downlink_frame> queue_downlink;
+    atomic<bool>                       dispatch_pending;
+    uint16_t                           downlink_token; // 建会话时随机取初值，每个PULL_RESP加1
+    DownlinkScheduler                  scheduler;
+    DutyCycleLedger                    ledger;
+    DownlinkTracker                    tracker;
+
+    // 本地单调时钟(us)减去集中器tmst，由上行rxpk更新，0表示还没有估计值
+    atomic<uint64_t> clock_offset_us;
+
+    string topic_pub_rxpk;
+    string topic_pub_rxpk_batch; // 开启上行合并时使用
+    string topic_pub_rxpk_set;   // merge去重时发布UplinkFrameSet
+    string topic_pub_downlink;
+    string topic_pub_downlink_ack;
+    string topic_pub_gateway_stat;
+    string topic_sub_txpk;
+
+    // EUI不变，建会话时生成一次，发布ChirpStack JSON时直接拼接
+    string gateway_id;      // eui_str的base64
+    string json_gateway_id; // "gatewayID":"<gateway_id>"
+
+    struct gateway_session_counters counters;
+
+    gateway_session(uint64_t eui, uint32_t queue_size, enum duty_cycle_region region);
+    ~gateway_session();
+};
+
+static inline void gateway_session_count(atomic<uint64_t> &counter)
+{
+    counter.fetch_add(1, memory_order_relaxed);
+}
+
+uint64_t gateway_eui_from_header(const uint8_t *buf);
+int      gateway_session_push_downlink(struct gateway_session *session, const char *payload,
+                                       size_t len, const char *downlink_id, size_t id_len,
+                                       uint32_t command_token, enum downlink_overflow policy);
+void     gateway_session_update_clock(struct gateway_session *session, uint32_t tmst,
+                                      uint64_t now_us);
+int      gateway_session_tmst_delta(struct gateway_session *session, uint32_t tmst,
+                                    uint64_t now_us, int64_t *delta_us);
+
+// 已移除、等待释放的会话
+struct retired_session {
+    struct gateway_session *session;
+    uint64_t                retired_us;
+};
+
+class GatewaySessionTable
+{
+  private:
+    uint32_t                          capacity;
+    uint32_t                          max_sessions;
+    uint32_t                          session_count;
+    uint32_t                          used_slots; // 会话和墓碑占用的槽位
+    atomic<struct gateway_session *> *slots;
+    pthread_mutex_t                   insert_mutex;
+
+    unordered_map<string, struct gateway_session *> topic_map;
+    vector<struct retired_session>                  retired;
+
+    uint32_t slot_of(uint64_t eui) const;
+    void     clear_tombstones(uint32_t i);
+
+  public:
+    // 移除会话后留在槽位上的墓碑，查找时跳过，插入时复用
+    static struct gateway_session *const tombstone;
+
+    explicit GatewaySessionTable(uint32_t max_sessions);
+    ~GatewaySessionTable();
+
+    struct gateway_session *find(uint64_t eui) const;
+    struct gateway_session *insert(struct gateway_session *session);
+    struct gateway_session *find_by_topic(const string &topic);
+    uint32_t                size(void);
+    void evict_idle(uint64_t now_us, uint64_t idle_us, vector<struct gateway_session *> &evicted);
+
+    template <typename F> void for_each(F func) const
+    {
+        for (uint32_t i = 0; i < this->capacity; i++) {
+            struct gateway_session *session = this->slots[i].load(memory_order_acquire);
+            if (session != nullptr && session != tombstone) {
+                func(session);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,370 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT断线缓存
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-spool.hpp"
+#include "bridge-log.hpp"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#define SPOOL_RECORD_MAGIC 0x4c425350 /* "LBSP" */
+
+// 分段文件中每条记录的头，后面依次是topic和payload
+struct spool_record_header {
+    uint32_t magic;
+    uint32_t crc; // 覆盖payload_len、topic_len、topic和payload
+    uint32_t payload_len;
+    uint16_t topic_len;
+    uint16_t reserved;
+};
+
+static uint32_t crc32_table[256];
+
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1; }
+        crc32_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc              = ~crc;
+    while (len--) { crc = crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8); }
+    return ~crc;
+}
+
+static uint32_t record_crc(const struct spool_record_header *hdr, const char *topic,
+                           const char *payload)
+{
+    uint32_t crc = crc32_update(0, &hdr->payload_len, sizeof(hdr->payload_len));
+    crc          = crc32_update(crc, &hdr->topic_len, sizeof(hdr->topic_len));
+    crc          = crc32_update(crc, topic, hdr->topic_len);
+    return crc32_update(crc, payload, hdr->payload_len);
+}
+
+/*
+ * 读出offset处的一条记录并校验，返回记录总长度；文件结束返回0，
+ * 记录不完整或校验失败返回-1。
+ */
+static ssize_t read_record(int fd, uint64_t offset, string &topic, string &payload)
+{
+    struct spool_record_header hdr;
+    ssize_t                    n = pread(fd, &hdr, sizeof(hdr), offset);
+    if (n == 0) {
+        return 0;
+    }
+    if (n != sizeof(hdr) || hdr.magic != SPOOL_RECORD_MAGIC) {
+        return -1;
+    }
+    topic.resize(hdr.topic_len);
+    payload.resize(hdr.payload_len);
+    offset += sizeof(hdr);
+    if (pread(fd, &topic[0], hdr.topic_len, offset) != hdr.topic_len ||
+        pread(fd, &payload[0], hdr.payload_len, offset + hdr.topic_len) !=
+            (ssize_t)hdr.payload_len ||
+        record_crc(&hdr, topic.data(), payload.data()) != hdr.crc) {
+        return -1;
+    }
+    return sizeof(hdr) + hdr.topic_len + hdr.payload_len;
+}
+
+BridgeSpool::BridgeSpool(const string &dir, uint64_t max_bytes)
+    : dir(dir), max_bytes(max_bytes), write_fd(-1), read_fd(-1), read_offset(0), read_records(0),
+      front_size(0), total_bytes(0), evicted(0), corrupt(0)
+{
+    // 至少保留4个分段，淘汰时一次只丢最早的一小部分
+    this->segment_bytes = std::min<uint64_t>(SPOOL_SEGMENT_MAX, max_bytes / 4);
+    pthread_mutex_init(&this->mutex, NULL);
+    crc32_init();
+}
+
+BridgeSpool::~BridgeSpool()
+{
+    if (this->write_fd != -1) {
+        close(this->write_fd);
+    }
+    if (this->read_fd != -1) {
+        close(this->read_fd);
+    }
+    pthread_mutex_destroy(&this->mutex);
+}
+
+string BridgeSpool::segment_path(uint32_t seq) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/spool-%08u.seg", seq);
+    return this->dir + name;
+}
+
+// 统计分段中完整的记录，截掉末尾不完整或损坏的部分
+int BridgeSpool::scan_segment(struct spool_segment &segment)
+{
+    string  path = this->segment_path(segment.seq);
+    string  topic, payload;
+    ssize_t len;
+    int     fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    segment.bytes   = 0;
+    segment.records = 0;
+    while ((len = read_record(fd, segment.bytes, topic, payload)) > 0) {
+        segment.bytes += len;
+        segment.records++;
+    }
+    if (len < 0) {
+        log_warn("Truncate damaged spool segment %s at %llu",
+                 path.c_str(),
+                 (unsigned long long)segment.bytes);
+        this->corrupt++;
+        if (ftruncate(fd, segment.bytes) < 0) {
+            log_error("Failed to truncate %s: %s", path.c_str(), strerror(errno));
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+int BridgeSpool::open_write_segment(uint32_t seq)
+{
+    string path = this->segment_path(seq);
+    int    fd   = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        log_error("Failed to open spool segment %s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+    if (this->write_fd != -1) {
+        // 换段时把写完的分段落盘
+        fdatasync(this->write_fd);
+        close(this->write_fd);
+    }
+    this->write_fd = fd;
+    this->segments.push_back({ seq, 0, 0 });
+    return 0;
+}
+
+// 删除最早的分段，还没回放的记录计入淘汰数
+void BridgeSpool::drop_front(void)
+{
+    struct spool_segment &segment = this->segments.front();
+    this->evicted += segment.records - this->read_records;
+    this->total_bytes -= segment.bytes;
+    if (this->read_fd != -1) {
+        close(this->read_fd);
+        this->read_fd = -1;
+    }
+    this->read_offset  = 0;
+    this->read_records = 0;
+    this->front_size   = 0;
+    unlink(this->segment_path(segment.seq).c_str());
+    this->segments.pop_front();
+}
+
+/*
+ * 唯一的分段回放完但开不了新段(如磁盘满)时，清空该分段原地继续写，
+ * 不能删掉它: segments不能为空，write_fd也还指向它。
+ * 清空失败时保留读位置在段尾，之后追加的记录照常回放。
+ */
+void BridgeSpool::rewind_tail(void)
+{
+    struct spool_segment &segment = this->segments.front();
+    if (ftruncate(this->write_fd, 0) < 0) {
+        log_warn("Failed to truncate spool segment %u: %s", segment.seq, strerror(errno));
+        return;
+    }
+    this->total_bytes -= segment.bytes;
+    if (this->read_fd != -1) {
+        close(this->read_fd);
+        this->read_fd = -1;
+    }
+    segment.bytes      = 0;
+    segment.records    = 0;
+    this->read_offset  = 0;
+    this->read_records = 0;
+    this->front_size   = 0;
+}
+
+// 创建目录并接管上次遗留的分段，之后总是写一个新分段
+int BridgeSpool::open(void)
+{
+    vector<uint32_t> seqs;
+    struct dirent   *entry;
+    DIR             *d;
+    unsigned         seq;
+
+    if (mkdir(this->dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        log_error("Failed to create spool directory %s: %s", this->dir.c_str(), strerror(errno));
+        return -1;
+    }
+    if ((d = opendir(this->dir.c_str())) == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(d)) != NULL) {
+        if (sscanf(entry->d_name, "spool-%08u.seg", &seq) == 1) {
+            seqs.push_back(seq);
+        }
+    }
+    closedir(d);
+    std::sort(seqs.begin(), seqs.end());
+
+    pthread_mutex_lock(&this->mutex);
+    for (auto s : seqs) {
+        struct spool_segment segment = { s, 0, 0 };
+        if (this->scan_segment(segment) < 0 || segment.records == 0) {
+            unlink(this->segment_path(s).c_str());
+            continue;
+        }
+        this->segments.push_back(segment);
+        this->total_bytes += segment.bytes;
+    }
+    int ret = this->open_write_segment(seqs.empty() ? 0 : seqs.back() + 1);
+    pthread_mutex_unlock(&this->mutex);
+    if (ret == 0 && this->segments.size() > 1) {
+        log_info("Spool %s holds %zu segment(s), %llu bytes to replay",
+                 this->dir.c_str(),
+                 this->segments.size() - 1,
+                 (unsigned long long)this->total_bytes);
+    }
+    return ret;
+}
+
+int BridgeSpool::append(const string &topic, const char *payload, size_t len)
+{
+    struct spool_record_header hdr;
+    struct iovec               iov[3];
+    uint64_t                   size = sizeof(hdr) + topic.length() + len;
+
+    if (topic.length() > UINT16_MAX || size > this->segment_bytes) {
+        return -1;
+    }
+    hdr.magic       = SPOOL_RECORD_MAGIC;
+    hdr.payload_len = len;
+    hdr.topic_len   = topic.length();
+    hdr.reserved    = 0;
+    hdr.crc         = record_crc(&hdr, topic.data(), payload);
+    iov[0]          = { &hdr, sizeof(hdr) };
+    iov[1]          = { const_cast<char *>(topic.data()), topic.length() };
+    iov[2]          = { const_cast<char *>(payload), len };
+
+    pthread_mutex_lock(&this->mutex);
+    if (this->write_fd == -1) {
+        pthread_mutex_unlock(&this->mutex);
+        return -1;
+    }
+    struct spool_segment *tail = &this->segments.back();
+    if (tail->bytes + size > this->segment_bytes) {
+        if (this->open_write_segment(tail->seq + 1) < 0) {
+            pthread_mutex_unlock(&this->mutex);
+            return -1;
+        }
+        tail = &this->segments.back();
+    }
+    // 超过总大小时整段淘汰最早的数据，正在写的分段保留
+    while (this->total_bytes + size > this->max_bytes && this->segments.size() > 1) {
+        this->drop_front();
+    }
+    tail = &this->segments.back();
+    if (writev(this->write_fd, iov, 3) != (ssize_t)size) {
+        // 写了一半的记录截掉，保持分段可解析
+        if (ftruncate(this->write_fd, tail->bytes) < 0) {
+            this->corrupt++;
+        }
+        pthread_mutex_unlock(&this->mutex);
+        return -1;
+    }
+    tail->bytes += size;
+    tail->records++;
+    this->total_bytes += size;
+    pthread_mutex_unlock(&this->mutex);
+    return 0;
+}
+
+// 取出最早一条未回放的记录，没有时返回0。记录只有pop()后才算回放完成
+int BridgeSpool::front(string &topic, string &payload)
+{
+    ssize_t len;
+
+    pthread_mutex_lock(&this->mutex);
+    for (;;) {
+        struct spool_segment &segment = this->segments.front();
+        if (this->read_offset >= segment.bytes) {
+            if (this->segments.size() == 1) {
+                pthread_mutex_unlock(&this->mutex);
+                return 0;
+            }
+            this->drop_front();
+            continue;
+        }
+        if (this->read_fd == -1) {
+            this->read_fd = ::open(this->segment_path(segment.seq).c_str(), O_RDONLY);
+        }
+        len = (this->read_fd == -1) ? -1 : read_record(this->read_fd, this->read_offset, topic,
+                                                       payload);
+        if (len > 0) {
+            this->front_size = len;
+            pthread_mutex_unlock(&this->mutex);
+            return 1;
+        }
+        // 读不出来的分段剩余部分作废
+        log_warn("Skip damaged spool segment %u", segment.seq);
+        this->corrupt++;
+        this->read_records = segment.records;
+        this->read_offset  = segment.bytes;
+    }
+}
+
+void BridgeSpool::pop(void)
+{
+    pthread_mutex_lock(&this->mutex);
+    if (this->front_size == 0) {
+        // front()之后该分段已被淘汰
+        pthread_mutex_unlock(&this->mutex);
+        return;
+    }
+    struct spool_segment &segment = this->segments.front();
+    this->read_offset += this->front_size;
+    this->read_records++;
+    this->front_size = 0;
+    if (this->read_offset >= segment.bytes) {
+        // 回放完的分段立即删除；正在写的分段也回放完时换一个新段
+        if (this->segments.size() > 1 || this->open_write_segment(segment.seq + 1) == 0) {
+            this->drop_front();
+        } else {
+            this->rewind_tail();
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+bool BridgeSpool::empty(void)
+{
+    struct spool_stats s;
+    this->stats(&s);
+    return s.pending == 0;
+}
+
+void BridgeSpool::stats(struct spool_stats *out)
+{
+    uint64_t records = 0;
+    pthread_mutex_lock(&this->mutex);
+    for (const auto &segment : this->segments) { records += segment.records; }
+    out->pending = records - this->read_records;
+    out->bytes   = this->total_bytes;
+    out->evicted = this->evicted;
+    out->corrupt = this->corrupt;
+    pthread_mutex_unlock(&this->mutex);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge MQTT断线缓存
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details MQTT断开期间的上行和统计事件按顺序追加到磁盘上的分段文件，
+ *          重连后按限定速率回放。每条记录带CRC32，进程崩溃或掉电造成的
+ *          半条记录在启动扫描时截掉。总大小超过上限时整段删除最早的分段。
+ *          回放是至少一次: 崩溃前已回放但未删除的分段会再发一次。
+ */
+
+#ifndef _BRIDGE_SPOOL_HPP_
+#define _BRIDGE_SPOOL_HPP_
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define SPOOL_DIR_DEFAULT         "/etc/lorabridge/spool"
+#define SPOOL_MAX_SIZE_MIN        256           /* KiB */
+#define SPOOL_MAX_SIZE_DEFAULT    4096          /* KiB */
+#define SPOOL_MAX_SIZE_MAX        (1024 * 1024) /* KiB */
+#define SPOOL_REPLAY_RATE_DEFAULT 50            /* 条每秒 */
+#define SPOOL_REPLAY_RATE_MAX     10000
+#define SPOOL_SEGMENT_MAX         (256 * 1024)
+#define SPOOL_REPLAY_INTERVAL_MS  100
+
+using namespace std;
+
+struct spool_segment {
+    uint32_t seq;
+    uint64_t bytes;
+    uint64_t records;
+};
+
+struct spool_stats {
+    uint64_t pending;
+    uint64_t bytes;
+    uint64_t evicted;
+    uint64_t corrupt;
+};
+
+class BridgeSpool
+{
+  private:
+    pthread_mutex_t             mutex;
+    string                      dir;
+    uint64_t                    max_bytes;
+    uint64_t                    segment_bytes;
+    deque<struct spool_segment> segments; // 最早的在前，最后一个正在写
+    int                         write_fd;
+    int                         read_fd;
+    uint64_t                    read_offset;  // 在最早分段中的读位置
+    uint64_t                    read_records; // 最早分段中已回放的条数
+    uint64_t                    front_size;   // front()取出的记录长度，pop()时跳过
+    uint64_t                    total_bytes;
+    uint64_t                    evicted;
+    uint64_t                    corrupt;
+
+    string segment_path(uint32_t seq) const;
+    int    scan_segment(struct spool_segment &segment);
+    int    open_write_segment(uint32_t seq);
+    void   drop_front(void);
+    void   rewind_tail(void);
+
+  public:
+    BridgeSpool(const string &dir, uint64_t max_bytes);
+    ~BridgeSpool();
+    BridgeSpool(const BridgeSpool &)            = delete;
+    BridgeSpool &operator=(const BridgeSpool &) = delete;
+
+    int  open(void);
+    int  append(const string &topic, const char *payload, size_t len);
+    int  front(string &topic, string &payload);
+    void pop(void);
+    bool empty(void);
+    void stats(struct spool_stats *out);
+};
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge PULL_RESP与TX_ACK关联
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-txack.hpp"
+
+#define SLOT_OF(token) ((token) & (DOWNLINK_TRACK_SLOTS - 1))
+
+DownlinkTracker::DownlinkTracker()
+{
+    pthread_mutex_init(&this->mutex, NULL);
+    for (auto &slot : this->slots) { slot.used = false; }
+}
+
+DownlinkTracker::~DownlinkTracker()
+{
+    pthread_mutex_destroy(&this->mutex);
+}
+
+// 覆盖了一条还没等到TX_ACK的记录时返回true
+bool DownlinkTracker::track(uint16_t token, uint64_t sent_us, struct scheduled_downlink &&frame)
+{
+    pthread_mutex_lock(&this->mutex);
+    struct downlink_context &slot        = this->slots[SLOT_OF(token)];
+    bool                     overwritten = slot.used;
+
+    slot.token   = token;
+    slot.used    = true;
+    slot.sent_us = sent_us;
+    slot.frame   = std::move(frame);
+    pthread_mutex_unlock(&this->mutex);
+    return overwritten;
+}
+
+// 取出token对应的记录，没有(已被覆盖或不是本桥发出的token)时返回false
+bool DownlinkTracker::take(uint16_t token, struct downlink_context &out)
+{
+    pthread_mutex_lock(&this->mutex);
+    struct downlink_context &slot  = this->slots[SLOT_OF(token)];
+    bool                     found = slot.used && slot.token == token;
+    if (found) {
+        out.token   = slot.token;
+        out.used    = true;
+        out.sent_us = slot.sent_us;
+        out.frame   = std::move(slot.frame);
+        slot.used   = false;
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return found;
+}
+
@@ -0,0 +1,50 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge PULL_RESP与TX_ACK关联
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 每个PULL_RESP使用会话内递增的token，发出时按token记下下行命令的
+ *          downlinkID、入队和发出时刻以及帧本身。网关回TX_ACK时按token取回，
+ *          算出从收到MQTT命令到网关确认的耗时，临时性错误可据此重发。
+ *          token直接映射到槽位，超过DOWNLINK_TRACK_SLOTS个未确认的记录时
+ *          最早的被覆盖(forwarder没回TX_ACK)。
+ */
+
+#ifndef _BRIDGE_TXACK_HPP_
+#define _BRIDGE_TXACK_HPP_
+
+#include "bridge-scheduler.hpp"
+#include <pthread.h>
+#include <stdint.h>
+
+#define DOWNLINK_TRACK_SLOTS    64 /* 2的幂 */
+#define DOWNLINK_RETRIES_MAX    5
+#define DOWNLINK_RETRY_DELAY_US 100000 /* TX_ACK报错后隔100ms重发 */
+
+using namespace std;
+
+struct downlink_context {
+    uint16_t                  token;
+    bool                      used;
+    uint64_t                  sent_us; // PULL_RESP发出时刻
+    struct scheduled_downlink frame;
+};
+
+// PULL_RESP由pull worker发出，TX_ACK可能由其他worker处理，加锁
+class DownlinkTracker
+{
+  private:
+    pthread_mutex_t         mutex;
+    struct downlink_context slots[DOWNLINK_TRACK_SLOTS];
+
+  public:
+    DownlinkTracker();
+    ~DownlinkTracker();
+    DownlinkTracker(const DownlinkTracker &)            = delete;
+    DownlinkTracker &operator=(const DownlinkTracker &) = delete;
+
+    bool track(uint16_t token, uint64_t sent_us, struct scheduled_downlink &&frame);
+    bool take(uint16_t token, struct downlink_context &out);
+};
+
+#endif
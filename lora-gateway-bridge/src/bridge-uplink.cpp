@@ -0,0 +1,237 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行rxpk转换
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-uplink.hpp"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    size_t      offset;
+} rxpk_fields[] = {
+    { "time", offsetof(struct semtech_rxpk, time) },
+    { "tmst", offsetof(struct semtech_rxpk, tmst) },
+    { "ftime", offsetof(struct semtech_rxpk, ftime) },
+    { "freq", offsetof(struct semtech_rxpk, freq) },
+    { "chan", offsetof(struct semtech_rxpk, chan) },
+    { "rfch", offsetof(struct semtech_rxpk, rfch) },
+    { "mid", offsetof(struct semtech_rxpk, mid) },
+    { "stat", offsetof(struct semtech_rxpk, stat) },
+    { "modu", offsetof(struct semtech_rxpk, modu) },
+    { "datr", offsetof(struct semtech_rxpk, datr) },
+    { "codr", offsetof(struct semtech_rxpk, codr) },
+    { "rssi", offsetof(struct semtech_rxpk, rssi) },
+    { "rssis", offsetof(struct semtech_rxpk, rssis) },
+    { "lsnr", offsetof(struct semtech_rxpk, lsnr) },
+    { "foff", offsetof(struct semtech_rxpk, foff) },
+    { "size", offsetof(struct semtech_rxpk, size) },
+    { "data", offsetof(struct semtech_rxpk, data) },
+};
+
+static const char *crc_status_tb[] = { "STAT_CRC_BAD", "STAT_NO_CRC", "STAT_CRC_OK" };
+
+// 与parse_uplink_datr相同的"SF%2dBW%3d"格式，直接在原报文上解析
+int semtech_datr_parse(const struct json_span *datr, uint8_t &sf, uint16_t &bw)
+{
+    const char *p   = datr->ptr;
+    const char *end = datr->ptr + datr->len;
+    int         x0 = 0, x1 = 0, n;
+
+    if (end - p < 2 || p[0] != 'S' || p[1] != 'F') {
+        return -1;
+    }
+    for (p += 2, n = 0; p < end && n < 2 && *p >= '0' && *p <= '9'; p++, n++) {
+        x0 = x0 * 10 + (*p - '0');
+    }
+    if (n == 0 || end - p < 2 || p[0] != 'B' || p[1] != 'W') {
+        return -1;
+    }
+    for (p += 2, n = 0; p < end && n < 3 && *p >= '0' && *p <= '9'; p++, n++) {
+        x1 = x1 * 10 + (*p - '0');
+    }
+    if (n == 0) {
+        return -1;
+    }
+    sf = x0;
+    bw = x1;
+    return 0;
+}
+
+/*
+ * 解析一个rxpk对象。频率不是数字或LoRa datr格式不对时返回-1，
+ * 调用者应跳过该包(与原先DOM方式的行为一致)。
+ */
+int semtech_rxpk_parse(const struct json_span *object, struct semtech_rxpk *rxpk)
+{
+    struct json_cursor cursor;
+    struct json_span   key, value;
+    int                ret;
+    double             freq;
+
+    memset(rxpk, 0, sizeof(*rxpk));
+    if (json_scan_open(object, &cursor) < 0 || object->type != JSON_SCAN_OBJECT) {
+        return -1;
+    }
+    while ((ret = json_scan_next_member(&cursor, &key, &value)) > 0) {
+        for (const auto &field : rxpk_fields) {
+            if (json_span_equals(&key, field.name)) {
+                char *base = reinterpret_cast<char *>(rxpk);
+                *reinterpret_cast<struct json_span *>(base + field.offset) = value;
+                break;
+            }
+        }
+    }
+    if (ret < 0 || json_span_to_double(&rxpk->freq, &freq) < 0) {
+        return -1;
+    }
+    rxpk->frequency = static_cast<uint64_t>(freq * 1000000);
+    if (rxpk->datr.type == JSON_SCAN_STRING &&
+        semtech_datr_parse(&rxpk->datr, rxpk->spreading_factor, rxpk->bandwidth) < 0) {
+        return -1;
+    }
+    int64_t stat = 0;
+    if (json_span_to_int64(&rxpk->stat, &stat) == 0 && stat >= -1 && stat <= 1) {
+        rxpk->crc_status = static_cast<int>(stat);
+    } else {
+        rxpk->crc_status = 2;
+    }
+    return 0;
+}
+
+static inline void put_key(string &out, const char *key)
+{
+    if (out.back() != '{') {
+        out += ',';
+    }
+    out += '"';
+    out += key;
+    out += "\":";
+}
+
+// 字符串原样带回引号，转义保持不变；缺失的字段写null
+static inline void put_span(string &out, const struct json_span *value)
+{
+    switch (value->type) {
+    case JSON_SCAN_NONE:
+        out.append("null", 4);
+        break;
+    case JSON_SCAN_STRING:
+        out += '"';
+        out.append(value->ptr, value->len);
+        out += '"';
+        break;
+    default:
+        out.append(value->ptr, value->len);
+        break;
+    }
+}
+
+static inline void put_member(string &out, const char *key, const struct json_span *value)
+{
+    put_key(out, key);
+    put_span(out, value);
+}
+
+static inline void put_optional(string &out, const char *key, const struct json_span *value)
+{
+    if (value->type != JSON_SCAN_NONE) {
+        put_member(out, key, value);
+    }
+}
+
+static inline void put_uint(string &out, const char *key, uint64_t value)
+{
+    char buf[24];
+    int  n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+    put_key(out, key);
+    out.append(buf, n);
+}
+
+// 上行对象中rxInfo之前的部分，以"rxInfo":结尾
+void chirpstack_uplink_json_head(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                 string &out)
+{
+    out += '{';
+    put_key(out, "gatewayID");
+    out += '"';
+    out += gateway_id;
+    out += '"';
+    put_member(out, "modulation", &rxpk->modu);
+    put_member(out, "phyPayload", &rxpk->data);
+    put_member(out, "phyPayloadSize", &rxpk->size);
+    put_key(out, "rxInfo");
+}
+
+// rxInfo对象；gateway_id非空时带上gatewayID，用于多网关合并后的rxInfo数组
+void chirpstack_rxinfo_json_write(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                  string &out)
+{
+    out += '{';
+    if (rxpk->crc_status <= 1) {
+        put_key(out, "CRCStatus");
+        out += '"';
+        out += crc_status_tb[rxpk->crc_status + 1];
+        out += '"';
+    }
+    put_optional(out, "LoRaFreqOffset", &rxpk->foff);
+    put_optional(out, "LoRaSNR", &rxpk->lsnr);
+    put_member(out, "channel", &rxpk->chan);
+    put_optional(out, "fineTimestampType", &rxpk->ftime);
+    if (!gateway_id.empty()) {
+        put_key(out, "gatewayID");
+        out += '"';
+        out += gateway_id;
+        out += '"';
+    }
+    // Concentrator modem ID on which pkt has been received
+    put_optional(out, "modemID", &rxpk->mid);
+    put_member(out, "rfChain", &rxpk->rfch);
+    put_member(out, "rssi", &rxpk->rssi);
+    put_optional(out, "rssis", &rxpk->rssis);
+    put_optional(out, "time", &rxpk->time);
+    put_member(out, "timestamp", &rxpk->tmst);
+    out += '}';
+}
+
+// rxInfo之后的部分，从txInfo前的逗号开始，out可以为空
+void chirpstack_uplink_json_tail(const struct semtech_rxpk *rxpk, string &out)
+{
+    out += ",\"txInfo\":{";
+    put_uint(out, "frequency", rxpk->frequency);
+    bool lora = (rxpk->datr.type == JSON_SCAN_STRING);
+    bool fsk  = json_span_is_integer(&rxpk->datr);
+    if (lora || fsk || rxpk->codr.type != JSON_SCAN_NONE) {
+        put_key(out, "modulationInfo");
+        out += '{';
+        if (fsk) {
+            // FSK datarate (unsigned, in bits per second)
+            put_member(out, "FSKDataRate", &rxpk->datr);
+        }
+        if (lora) {
+            put_uint(out, "bandwidth", rxpk->bandwidth);
+        }
+        put_optional(out, "codeRate", &rxpk->codr);
+        if (lora) {
+            put_uint(out, "spreadingFactor", rxpk->spreading_factor);
+        }
+        out += '}';
+    }
+    out += '}';
+    out += '}';
+}
+
+/*
+ * 写出ChirpStack上行JSON，字段顺序与nlohmann::json dump()的输出一致(按键名排序)。
+ * out由调用者复用，只追加不清空。
+ */
+void chirpstack_uplink_json_write(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                  string &out)
+{
+    chirpstack_uplink_json_head(rxpk, gateway_id, out);
+    chirpstack_rxinfo_json_write(rxpk, "", out);
+    chirpstack_uplink_json_tail(rxpk, out);
+}
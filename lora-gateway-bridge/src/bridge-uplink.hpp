@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge 上行rxpk转换
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 把Semtech rxpk对象解析成字段视图(指向原报文)，再直接写出
+ *          ChirpStack上行JSON，整个过程不构造DOM。
+ */
+
+#ifndef _BRIDGE_UPLINK_HPP_
+#define _BRIDGE_UPLINK_HPP_
+
+#include "bridge-json-scan.hpp"
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// rxpk字段，未出现的字段type为JSON_SCAN_NONE
+struct semtech_rxpk {
+    struct json_span time;
+    struct json_span tmst;
+    struct json_span ftime;
+    struct json_span freq;
+    struct json_span chan;
+    struct json_span rfch;
+    struct json_span mid;
+    struct json_span stat;
+    struct json_span modu;
+    struct json_span datr;
+    struct json_span codr;
+    struct json_span rssi;
+    struct json_span rssis;
+    struct json_span lsnr;
+    struct json_span foff;
+    struct json_span size;
+    struct json_span data;
+
+    // 解析后的值
+    uint64_t frequency; // Hz
+    uint8_t  spreading_factor;
+    uint16_t bandwidth;
+    int      crc_status; // -1/0/1, 无stat字段时为2
+};
+
+int  semtech_datr_parse(const struct json_span *datr, uint8_t &sf, uint16_t &bw);
+int  semtech_rxpk_parse(const struct json_span *object, struct semtech_rxpk *rxpk);
+void chirpstack_uplink_json_write(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                  string &out);
+void chirpstack_uplink_json_head(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                 string &out);
+void chirpstack_rxinfo_json_write(const struct semtech_rxpk *rxpk, const string &gateway_id,
+                                  string &out);
+void chirpstack_uplink_json_tail(const struct semtech_rxpk *rxpk, string &out);
+
+#endif
@@ -0,0 +1,350 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge DevEUI白名单
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ */
+
+#include "bridge-whitelist.hpp"
+#include "bridge-log.hpp"
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// splitmix64的终结函数，DevEUI常按厂商前缀连续分配，先打散再取位
+static uint64_t eui_mix(uint64_t eui)
+{
+    eui ^= eui >> 30;
+    eui *= 0xbf58476d1ce4e5b9ULL;
+    eui ^= eui >> 27;
+    eui *= 0x94d049bb133111ebULL;
+    eui ^= eui >> 31;
+    return eui;
+}
+
+static void bloom_build(struct whitelist_set *set)
+{
+    uint64_t bits = 64;
+    while (bits < set->dev_euis.size() * WHITELIST_BLOOM_BITS_PER_ENTRY) { bits <<= 1; }
+    set->bloom.assign(bits / 64, 0);
+    set->bloom_mask = bits - 1;
+    for (uint64_t eui : set->dev_euis) {
+        uint64_t h = eui_mix(eui), step = (h >> 32) | 1;
+        for (int i = 0; i < WHITELIST_BLOOM_HASHES; i++, h += step) {
+            uint64_t bit = h & set->bloom_mask;
+            set->bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+}
+
+static bool whitelist_contains(const struct whitelist_set *set, uint64_t eui)
+{
+    if (!set->bloom.empty()) {
+        uint64_t h = eui_mix(eui), step = (h >> 32) | 1;
+        for (int i = 0; i < WHITELIST_BLOOM_HASHES; i++, h += step) {
+            uint64_t bit = h & set->bloom_mask;
+            if (!(set->bloom[bit / 64] & (1ULL << (bit % 64)))) {
+                return false;
+            }
+        }
+    }
+    return binary_search(set->dev_euis.begin(), set->dev_euis.end(), eui);
+}
+
+static bool parse_eui(const string &text, uint64_t *eui)
+{
+    if (text.length() != 16 || text.find_first_not_of("0123456789abcdefABCDEF") != string::npos) {
+        return false;
+    }
+    *eui = strtoull(text.c_str(), NULL, 16);
+    return true;
+}
+
+DevEuiWhitelist::DevEuiWhitelist(const string &path, bool pass_unknown)
+    : path(path), learned_path(path.substr(0, path.rfind('/') + 1) + WHITELIST_LEARNED_NAME),
+      pass_unknown(pass_unknown), restored(false), current(make_shared<const whitelist_set>()),
+      enabled_flag(false), inotify_fd(-1), watch_ev(nullptr)
+{
+    pthread_mutex_init(&this->mutex, NULL);
+}
+
+DevEuiWhitelist::~DevEuiWhitelist()
+{
+    if (this->watch_ev) {
+        event_free(this->watch_ev);
+    }
+    if (this->inotify_fd != -1) {
+        close(this->inotify_fd);
+    }
+    pthread_mutex_destroy(&this->mutex);
+}
+
+// 调用时已持有mutex，按当前学到的DevAddr补全后替换
+void DevEuiWhitelist::publish(shared_ptr<struct whitelist_set> set)
+{
+    set->dev_addrs.clear();
+    for (const auto &entry : this->learned) { set->dev_addrs.push_back(entry.second); }
+    sort(set->dev_addrs.begin(), set->dev_addrs.end());
+    set->dev_addrs.erase(unique(set->dev_addrs.begin(), set->dev_addrs.end()),
+                         set->dev_addrs.end());
+    this->enabled_flag.store(set->enabled, memory_order_relaxed);
+    atomic_store(&this->current, shared_ptr<const whitelist_set>(std::move(set)));
+}
+
+// 调用时已持有mutex，{"<DevEUI>":"<DevAddr>"}，文件不存在或无法解析时从空表开始
+void DevEuiWhitelist::restore_learned(void)
+{
+    uint64_t eui, addr;
+
+    this->restored = true;
+    ifstream file(this->learned_path);
+    if (!file.is_open()) {
+        return;
+    }
+    json conf = json::parse(file, nullptr, false);
+    if (conf.is_discarded() || !conf.is_object()) {
+        log_warn("Invalid %s, learned DevAddrs discarded.", this->learned_path.c_str());
+        return;
+    }
+    for (const auto &item : conf.items()) {
+        if (!parse_eui(item.key(), &eui) || !item.value().is_string() ||
+            item.value().get<string>().length() != 8 ||
+            !parse_eui("00000000" + item.value().get<string>(), &addr)) {
+            continue;
+        }
+        this->learned[eui] = static_cast<uint32_t>(addr);
+    }
+}
+
+/*
+ * 调用时已持有mutex，先写临时文件再rename，断电时不会留下半个文件。
+ * 只在学到新DevAddr或名单删除了设备时写，不在每帧的路径上。
+ */
+void DevEuiWhitelist::save_learned(void)
+{
+    string tmp_path = this->learned_path + ".tmp";
+    json   conf     = json::object();
+    char   eui[17], addr[9];
+
+    for (const auto &entry : this->learned) {
+        snprintf(eui, sizeof(eui), "%016llx", (unsigned long long)entry.first);
+        snprintf(addr, sizeof(addr), "%08x", entry.second);
+        conf[eui] = addr;
+    }
+    ofstream file(tmp_path, ios::trunc);
+    file << conf.dump();
+    file.close();
+    if (!file || rename(tmp_path.c_str(), this->learned_path.c_str()) < 0) {
+        log_warn("Failed to save %s.", this->learned_path.c_str());
+        unlink(tmp_path.c_str());
+    }
+}
+
+/*
+ * 文件不存在时关闭过滤；内容无法解析时保留原名单并返回-1。
+ * 已学到的DevAddr中，DevEUI仍在新名单里的继续有效，第一次加载时
+ * 从learned_path恢复重启前学到的DevAddr。
+ */
+int DevEuiWhitelist::load(void)
+{
+    auto     set = make_shared<struct whitelist_set>();
+    uint64_t eui;
+
+    set->enabled    = false;
+    set->bloom_mask = 0;
+    ifstream file(this->path);
+    if (file.is_open()) {
+        json conf = json::parse(file, nullptr, false);
+        if (conf.is_discarded() || !conf.is_object()) {
+            log_warn("Invalid %s, keep the current whitelist.", this->path.c_str());
+            return -1;
+        }
+        set->enabled = conf.value("filter_enable", false);
+        if (conf.contains("white_list") && conf["white_list"].is_array()) {
+            for (const auto &item : conf["white_list"]) {
+                if (!item.is_string() || !parse_eui(item.get<string>(), &eui)) {
+                    log_warn("Invalid dev_eui in white_list: %s, ignored.", item.dump().c_str());
+                    continue;
+                }
+                set->dev_euis.push_back(eui);
+            }
+        }
+    }
+    sort(set->dev_euis.begin(), set->dev_euis.end());
+    set->dev_euis.erase(unique(set->dev_euis.begin(), set->dev_euis.end()), set->dev_euis.end());
+    if (set->dev_euis.size() >= WHITELIST_BLOOM_MIN) {
+        bloom_build(set.get());
+    }
+    if (set->enabled && set->dev_euis.empty()) {
+        log_warn("DevEUI whitelist is enabled but empty, all joins will be dropped.");
+    }
+
+    pthread_mutex_lock(&this->mutex);
+    if (!this->restored) {
+        this->restore_learned();
+    }
+    size_t learned = this->learned.size();
+    for (auto it = this->learned.begin(); it != this->learned.end();) {
+        it = whitelist_contains(set.get(), it->first) ? next(it) : this->learned.erase(it);
+    }
+    if (this->learned.size() != learned) {
+        this->save_learned();
+    }
+    this->joins.clear();
+    this->publish(set);
+    pthread_mutex_unlock(&this->mutex);
+    log_info("DevEUI whitelist %s, %zu entries.", set->enabled ? "enabled" : "disabled",
+             set->dev_euis.size());
+    return 0;
+}
+
+/*
+ * 把DevAddr记到同一网关上唯一一个未对应的Join-request名下。Join-accept在
+ * Join-request之后5秒才下发，早于LEARN_DELAY的数据帧不可能来自该设备；
+ * 同一网关上有多个设备在等待时无法区分，不学习。
+ */
+bool DevEuiWhitelist::learn(uint32_t dev_addr, uint64_t gateway_eui, uint64_t now_us)
+{
+    uint64_t dev_eui    = 0;
+    int      candidates = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    // 同一帧经多个网关到达时可能已被其他worker学到
+    auto current = atomic_load(&this->current);
+    if (binary_search(current->dev_addrs.begin(), current->dev_addrs.end(), dev_addr)) {
+        pthread_mutex_unlock(&this->mutex);
+        return true;
+    }
+    for (const auto &join : this->joins) {
+        if (join.gateway_eui == gateway_eui &&
+            now_us - join.at_us >= WHITELIST_LEARN_DELAY * 1000000ULL &&
+            now_us - join.at_us <= WHITELIST_LEARN_WINDOW * 1000000ULL) {
+            dev_eui = join.dev_eui;
+            candidates++;
+        }
+    }
+    if (candidates != 1) {
+        pthread_mutex_unlock(&this->mutex);
+        if (candidates > 1) {
+            log_info("DevAddr %08x matches %d joining devices, not learned.", dev_addr,
+                     candidates);
+        }
+        return false;
+    }
+    this->learned[dev_eui] = dev_addr;
+    this->save_learned();
+    this->joins.erase(remove_if(this->joins.begin(), this->joins.end(),
+                                [dev_eui](const struct whitelist_join &j) {
+                                    return j.dev_eui == dev_eui;
+                                }),
+                      this->joins.end());
+    this->publish(make_shared<struct whitelist_set>(*current));
+    pthread_mutex_unlock(&this->mutex);
+    log_info("DevEUI %016llx learned DevAddr %08x.", (unsigned long long)dev_eui, dev_addr);
+    return true;
+}
+
+enum uplink_filter_result DevEuiWhitelist::check(const struct lorawan_header *header,
+                                                 uint64_t gateway_eui, uint64_t now_us)
+{
+    if (!this->enabled()) {
+        return UPLINK_FILTER_PASS;
+    }
+    auto set = atomic_load(&this->current);
+    switch (header->mtype) {
+    case LORAWAN_MTYPE_JOIN_REQUEST:
+        if (!header->join_request) {
+            return UPLINK_FILTER_MALFORMED;
+        }
+        if (!whitelist_contains(set.get(), header->dev_eui)) {
+            return UPLINK_FILTER_DEVEUI;
+        }
+        if (this->pass_unknown) {
+            return UPLINK_FILTER_PASS;
+        }
+        pthread_mutex_lock(&this->mutex);
+        // 超时的和同一设备在该网关上的旧记录先移除
+        this->joins.erase(remove_if(this->joins.begin(), this->joins.end(),
+                                    [&](const struct whitelist_join &j) {
+                                        return now_us - j.at_us >
+                                                   WHITELIST_LEARN_WINDOW * 1000000ULL ||
+                                               (j.dev_eui == header->dev_eui &&
+                                                j.gateway_eui == gateway_eui);
+                                    }),
+                          this->joins.end());
+        if (this->joins.size() >= WHITELIST_JOINS_MAX) {
+            this->joins.erase(this->joins.begin());
+        }
+        this->joins.push_back({ header->dev_eui, gateway_eui, now_us });
+        pthread_mutex_unlock(&this->mutex);
+        return UPLINK_FILTER_PASS;
+    case LORAWAN_MTYPE_UNCONFIRMED_UP:
+    case LORAWAN_MTYPE_CONFIRMED_UP:
+        if (!header->data_up) {
+            return UPLINK_FILTER_MALFORMED;
+        }
+        if (this->pass_unknown ||
+            binary_search(set->dev_addrs.begin(), set->dev_addrs.end(), header->dev_addr)) {
+            return UPLINK_FILTER_PASS;
+        }
+        if (header->fcnt == 0 && this->learn(header->dev_addr, gateway_eui, now_us)) {
+            return UPLINK_FILTER_PASS;
+        }
+        return UPLINK_FILTER_DEVADDR;
+    default:
+        return UPLINK_FILTER_PASS;
+    }
+}
+
+void DevEuiWhitelist::watch_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    DevEuiWhitelist *whitelist = static_cast<DevEuiWhitelist *>(user_data);
+    string           name      = whitelist->path.substr(whitelist->path.rfind('/') + 1);
+    bool             changed   = false;
+    ssize_t          len;
+    char             buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + len;) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(p);
+            if (event->len && name == event->name) {
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (changed) {
+        whitelist->load();
+    }
+}
+
+/*
+ * 监视配置文件所在目录而不是文件本身，cgi重写或编辑器替换文件后都能收到。
+ * 目录不存在时返回-1，名单保持启动时加载的内容。
+ */
+int DevEuiWhitelist::watch(struct event_base *base)
+{
+    string   dir  = this->path.substr(0, this->path.rfind('/') + 1);
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+
+    this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotify_fd == -1) {
+        log_error("Failed to create inotify: %s", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(this->inotify_fd, dir.c_str(), mask) < 0) {
+        log_warn("Failed to watch %s: %s", dir.c_str(), strerror(errno));
+        return -1;
+    }
+    this->watch_ev = event_new(base, this->inotify_fd, EV_READ | EV_PERSIST, watch_cb, this);
+    if (!this->watch_ev || event_add(this->watch_ev, NULL) < 0) {
+        log_error("Failed to create whitelist watch event.");
+        return -1;
+    }
+    return 0;
+}
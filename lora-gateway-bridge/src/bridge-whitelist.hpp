@@ -0,0 +1,95 @@
+/**
+ * @file
+ * @brief  LoRa gateway bridge DevEUI白名单
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 读取cgi写入的lorawan_filter.conf，filter_enable为true时只放行
+ *          white_list中设备的Join-request。数据帧只带DevAddr，而Join-accept
+ *          是加密的，DevAddr未知的数据帧默认放行；配置为丢弃时，白名单设备
+ *          的Join-request通过后，同一网关在LEARN_DELAY之后、LEARN_WINDOW之内
+ *          收到的第一个FCnt为0且DevAddr未知的数据帧被认为来自该设备(同时有
+ *          多个候选时不学习)，记下其DevAddr并写入同目录下的LEARNED_NAME，
+ *          重启后恢复。
+ *          名单编译成排序数组(条目多时前面加Bloom预筛)，文件变化时由
+ *          inotify触发重新加载，新名单整体替换，数据路径不加锁。
+ */
+
+#ifndef _BRIDGE_WHITELIST_HPP_
+#define _BRIDGE_WHITELIST_HPP_
+
+#include "bridge-filter.hpp"
+#include <atomic>
+#include <event2/event.h>
+#include <memory>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define LORAWAN_FILTER_CONF_DEFAULT     "/etc/lorawan_filter/lorawan_filter.conf"
+#define WHITELIST_LEARNED_NAME          "lorawan_filter_learned.json"
+#define WHITELIST_BLOOM_MIN             256 /* 条目数达到后才建Bloom预筛 */
+#define WHITELIST_BLOOM_BITS_PER_ENTRY  10
+#define WHITELIST_BLOOM_HASHES          3
+#define WHITELIST_LEARN_WINDOW          30 /* seconds，Join-request到第一个数据帧 */
+#define WHITELIST_LEARN_DELAY           4  /* seconds，JOIN_ACCEPT_DELAY1为5秒，留出误差 */
+#define WHITELIST_JOINS_MAX             64
+
+using namespace std;
+
+// 加载后只读，整体替换
+struct whitelist_set {
+    bool             enabled;
+    vector<uint64_t> dev_euis;  // 已排序
+    vector<uint64_t> bloom;     // 为空时不预筛
+    uint64_t         bloom_mask;
+    vector<uint32_t> dev_addrs; // 已学到的DevAddr，已排序
+};
+
+// 已放行、还没对应上DevAddr的Join-request
+struct whitelist_join {
+    uint64_t dev_eui;
+    uint64_t gateway_eui;
+    uint64_t at_us;
+};
+
+class DevEuiWhitelist
+{
+  private:
+    string                             path;
+    string                             learned_path;
+    bool                               pass_unknown; // DevAddr未知的数据帧放行
+    bool                               restored;     // 已从learned_path恢复
+    shared_ptr<const whitelist_set>    current;      // 用atomic_load/atomic_store访问
+    atomic<bool>                       enabled_flag;
+    pthread_mutex_t                    mutex;        // 重新加载与学习DevAddr互斥
+    unordered_map<uint64_t, uint32_t>  learned;      // DevEUI -> DevAddr
+    vector<struct whitelist_join>      joins;
+    evutil_socket_t                    inotify_fd;
+    struct event                      *watch_ev;
+
+    void publish(shared_ptr<struct whitelist_set> set);
+    bool learn(uint32_t dev_addr, uint64_t gateway_eui, uint64_t now_us);
+    void restore_learned(void);
+    void save_learned(void);
+
+    static void watch_cb(evutil_socket_t fd, short events, void *user_data);
+
+  public:
+    DevEuiWhitelist(const string &path, bool pass_unknown);
+    ~DevEuiWhitelist();
+    DevEuiWhitelist(const DevEuiWhitelist &)            = delete;
+    DevEuiWhitelist &operator=(const DevEuiWhitelist &) = delete;
+
+    int    load(void);
+    int    watch(struct event_base *base);
+    bool   enabled(void) const { return this->enabled_flag.load(memory_order_relaxed); }
+    size_t size(void) const { return atomic_load(&this->current)->dev_euis.size(); }
+    size_t learned_size(void) const { return atomic_load(&this->current)->dev_addrs.size(); }
+
+    enum uplink_filter_result check(const struct lorawan_header *header, uint64_t gateway_eui,
+                                    uint64_t now_us);
+};
+
+#endif
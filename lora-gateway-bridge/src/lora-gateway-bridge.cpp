@@ -1,5 +1,21 @@
 #include "lora-gateway-bridge.hpp"
-#include "base64.hpp"
+#include "bridge-base64.hpp"
+#include "bridge-batch.hpp"
+#include "bridge-dedup.hpp"
+#include "bridge-downlink.hpp"
+#include "bridge-filter.hpp"
+#include "bridge-inflight.hpp"
+#include "bridge-log.hpp"
+#include "bridge-metrics.hpp"
+#include "bridge-netif.hpp"
+#include "bridge-packet.hpp"
+#include "bridge-prometheus.hpp"
+#include "bridge-proto.hpp"
+#include "bridge-reconnect.hpp"
+#include "bridge-session.hpp"
+#include "bridge-spool.hpp"
+#include "bridge-uplink.hpp"
+#include "bridge-whitelist.hpp"
 
 using namespace std;
 using json = nlohmann::json;
@@ -7,8 +23,27 @@ using json = nlohmann::json;
 struct mosquitto  *mosq   = nullptr;
 struct event_base *evbase = nullptr;
 
-static int             mqtt_keepalive = 60;
-static evutil_socket_t udp_socket;
+static int      mqtt_keepalive      = 60;
+static uint32_t udp_worker_count    = UDP_WORKERS_DEFAULT;
+static uint32_t udp_batch_size      = UDP_BATCH_SIZE_DEFAULT;
+static uint32_t max_gateway_count   = MAX_GATEWAYS_DEFAULT;
+static uint64_t gateway_idle_us     = GATEWAY_IDLE_TIMEOUT_DEFAULT * 1000000ULL; // 0表示不移除
+static uint32_t downlink_queue_size = DOWNLINK_QUEUE_DEFAULT;
+static uint64_t downlink_lead_us    = DOWNLINK_LEAD_TIME_DEFAULT * 1000ULL;
+static uint32_t downlink_retry_max  = 0; // 0表示不重发
+static uint64_t uplink_window_us    = 0; // 0表示不合并
+static uint32_t uplink_batch_frames = UPLINK_BATCH_SIZE_DEFAULT;
+static uint64_t uplink_delay_us     = UPLINK_BATCH_DELAY_DEFAULT * 1000ULL;
+static uint64_t dedup_window_us     = UPLINK_DEDUP_WINDOW_DEFAULT * 1000ULL;
+static uint32_t spool_size_kb       = SPOOL_MAX_SIZE_DEFAULT;
+static uint32_t spool_rate          = SPOOL_REPLAY_RATE_DEFAULT;
+static uint64_t reconnect_max_us    = MQTT_RECONNECT_MAX_DEFAULT * 1000ULL;
+static uint32_t inflight_window     = MQTT_INFLIGHT_DEFAULT;
+static int      marshaler_type      = BRIDGE_MARSHALER_JSON;
+
+static enum downlink_overflow    downlink_overflow_policy = DOWNLINK_DROP_OLDEST;
+static enum uplink_dedup_policy dedup_policy_type        = UPLINK_DEDUP_MERGE;
+static enum duty_cycle_region   duty_cycle_region_type   = DUTY_CYCLE_NONE;
 
 static int     mqtt_port;
 static string  mqtt_host;
@@ -19,8 +54,14 @@ static string  cert_file_path;
 static string  key_file_path;
 static string  tls_pass_phrase;
 static string  client_id;
+static string  spool_path;
 static uint8_t mqtt_qos;
 static bool    mqtt_clean_session;
+static bool    mqtt_single_thread = true;
+static bool    prometheus_enabled = false;
+static string  prometheus_bind;
+
+static vector<string> downlink_retry_on; // 这些TX_ACK错误会重发
 
 /* Topic for publish*/
 
@@ -33,23 +74,90 @@ static string topic_pub_gateway_stat;
 
 static string topic_sub_txpk;
 
-uint8_t            buffer_up[TX_BUFF_SIZE] = { 0 };
-uint8_t            buffer_down[1000]       = { 0 };
-struct sockaddr_in client_addr;
-socklen_t          client_len = sizeof(client_addr);
+/* 每个UDP worker独占一个SO_REUSEPORT套接字、event_base和收发缓冲区 */
+struct udp_worker {
+    int                     id;
+    pthread_t               tid;
+    evutil_socket_t         fd;
+    struct event_base      *base;
+    struct event           *udp_ev;
+    struct event           *downlink_ev; // MQTT线程有下行时激活
+    struct event           *schedule_ev; // 下一个定时下行的释放时刻
+    uint64_t                schedule_at_us;
+    // recvmmsg批量接收，每个槽位一个数据报
+    uint32_t                batch_size;
+    struct mmsghdr         *rx_msgs;
+    struct iovec           *rx_iovs;
+    struct sockaddr_in     *rx_addrs;
+    PacketSlab             *rx_slab;
+    // 本批次的ACK，批次处理完后一次sendmmsg发出
+    uint32_t                ack_count;
+    struct mmsghdr         *ack_msgs;
+    struct iovec           *ack_iovs;
+    struct sockaddr_in     *ack_addrs;
+    uint8_t (*acks)[4];
+    // 当前正在处理的数据报及其所属网关
+    uint8_t                *buffer_up;
+    size_t                  buffer_up_len;
+    struct sockaddr_in      client_addr;
+    socklen_t               client_len;
+    struct gateway_session *session;
+    uint64_t                rx_us; // 本批数据报的接收时刻
+    // 本worker处理各数据报时复用的临时对象
+    json                    uplink_json;
+    json                    json_pub;
+    string                  uplink_out;
+    // 上行合并，按网关分批，只由本worker访问
+    unordered_map<struct gateway_session *, struct uplink_batch> uplink_batches;
+    struct event                                                *batch_ev;
+    uint64_t                                                     batch_at_us;
+    // 上行去重，本worker创建的条目由它在窗口结束时发布
+    struct uplink_copy         dedup_copy;
+    vector<struct dedup_entry> dedup_done;
+    struct event              *dedup_ev;
+    uint64_t                   dedup_at_us;
+};
+
+static vector<struct udp_worker *> udp_worker_list;
+
+static char gateway_eui[MAX_GATEWAY_ID + 1] = { 0 };
+
+static GatewaySessionTable *gateway_sessions = nullptr;
+
+// MQTT断线缓存，spool_dir为空时不启用
+static BridgeSpool *spool = nullptr;
+static atomic<bool> mqtt_connected(false);
+static atomic<bool> spool_backlog(false);
+
+// 按mid跟踪已发布未确认的消息
+static InflightTable *inflight = nullptr;
+
+// 多个RF链、多个网关收到的同一上行，dedup_window为0时不启用
+static UplinkDedup *uplink_dedup = nullptr;
 
-static char   gateway_eui[MAX_GATEWAY_ID + 1] = { 0 };
-static string local_ip;
-static Base64 base_64_obj;
+// [filters]，启动时编译
+static UplinkFilter uplink_filter;
 
-queue<string>   queue_downlink;
-pthread_mutex_t queue_downlink_mutex = PTHREAD_MUTEX_INITIALIZER;
+// lorawan_filter.conf中的DevEUI白名单，文件变化时重新加载
+static DevEuiWhitelist *deveui_whitelist = nullptr;
+static NetifCache      *netif_cache      = nullptr;
+static bool             whitelist_pass   = true; // DevAddr未知的数据帧放行
 
-using udp_pkt_cb = int (*)(evutil_socket_t fd);
+// 单线程模式下mosquitto的socket事件，断线期间为空
+static struct event *mqtt_read_ev      = nullptr;
+static struct event *mqtt_write_ev     = nullptr;
+static struct event *mqtt_reconnect_ev = nullptr;
 
-static int response_pkt_push_data(evutil_socket_t fd);
-static int response_pkt_pull_data(evutil_socket_t fd);
-static int recieve_pkt_tx_ack(evutil_socket_t fd);
+// 断线重连，mqtt_lost_at_us为0表示当前已连接
+static ReconnectBackoff mqtt_backoff(MQTT_RECONNECT_DELAY_MIN * 1000ULL,
+                                     MQTT_RECONNECT_MAX_DEFAULT * 1000ULL);
+static atomic<uint64_t> mqtt_lost_at_us(0);
+
+using udp_pkt_cb = int (*)(struct udp_worker *worker);
+
+static int response_pkt_push_data(struct udp_worker *worker);
+static int response_pkt_pull_data(struct udp_worker *worker);
+static int recieve_pkt_tx_ack(struct udp_worker *worker);
 
 map<int, udp_pkt_cb> map_udp_pkt_cb = {
     { PKT_PUSH_DATA, response_pkt_push_data },
@@ -62,17 +170,53 @@ class BridgeToml
   private:
     toml::value toml_data;
 
+    // filters
+    vector<string>           net_ids;
+    vector<array<string, 2>> join_euis;
+    string                   whitelist_unknown_devaddr;
+
     string backend_type;
     // backend.semtech_udp
     string   udp_ip;
     uint32_t udp_port = 0;
     bool     skip_crc_check;
     bool     fake_rx_time;
-
+    uint32_t udp_workers    = UDP_WORKERS_DEFAULT;
+    uint32_t udp_batch_size = UDP_BATCH_SIZE_DEFAULT;
+    uint32_t max_gateways   = MAX_GATEWAYS_DEFAULT;
+    uint32_t gateway_idle   = GATEWAY_IDLE_TIMEOUT_DEFAULT;
+    uint32_t downlink_queue = DOWNLINK_QUEUE_DEFAULT;
+    string   downlink_overflow;
+    uint32_t downlink_lead  = DOWNLINK_LEAD_TIME_DEFAULT;
+    uint32_t dedup_window   = UPLINK_DEDUP_WINDOW_DEFAULT;
+    string   dedup_policy;
+    string   duty_cycle_region;
+
+    // backend.semtech_udp TX_ACK报错重发
+    uint32_t       downlink_retries = 0;
+    vector<string> downlink_retry_errors;
+
+    // integration
+    string marshaler;
     // integration.mqtt
     string   event_topic_template;
     string   command_topic_template;
-    uint32_t max_reconnect_interval = 0;
+    uint32_t max_reconnect_interval = MQTT_RECONNECT_MAX_DEFAULT;
+    uint32_t uplink_batch_window    = 0;
+    uint32_t uplink_batch_size      = UPLINK_BATCH_SIZE_DEFAULT;
+    uint32_t uplink_batch_max_delay = UPLINK_BATCH_DELAY_DEFAULT;
+    bool     single_threaded = true;
+    string   spool_dir;
+    uint32_t spool_max_size    = SPOOL_MAX_SIZE_DEFAULT;
+    uint32_t spool_replay_rate = SPOOL_REPLAY_RATE_DEFAULT;
+    uint32_t max_inflight      = MQTT_INFLIGHT_DEFAULT;
+
+    // general
+    int log_level = BRIDGE_LOG_DEFAULT;
+
+    // metrics.prometheus
+    bool   endpoint_enabled = false;
+    string endpoint_bind;
 
     // integration.mqtt.auth
     string mqtt_auth_type;
@@ -89,8 +233,11 @@ class BridgeToml
     string   generic_tls_key;
     string   generic_pass_phrase;
 
+    void parse_toml_general(void);
+    void parse_toml_filters(void);
     void parse_toml_backend_udp(void);
     void parse_toml_integration_generic(void);
+    void parse_toml_metrics(void);
     void parse_local_for_each(void);
 
   public:
@@ -107,6 +254,10 @@ void BridgeToml::get_bridge_config_info(void)
 {
     this->toml_data = toml::parse<toml::discard_comments>(BRIDGE_CONF_DEFAULT);
     this->parse_local_for_each();
+    bridge_log_set_level(this->log_level);
+    uplink_filter.set_net_ids(this->net_ids);
+    uplink_filter.set_join_euis(this->join_euis);
+    whitelist_pass     = (this->whitelist_unknown_devaddr != "drop");
     mqtt_host          = this->generic_ip;
     mqtt_port          = this->generic_port;
     ca_file_path       = this->generic_ca_cert;
@@ -118,6 +269,59 @@ void BridgeToml::get_bridge_config_info(void)
     mqtt_qos           = this->generic_qos;
     mqtt_clean_session = this->generic_clean_session;
     tls_pass_phrase    = this->generic_pass_phrase;
+    udp_worker_count   = this->udp_workers;
+    udp_batch_size     = this->udp_batch_size;
+    max_gateway_count  = this->max_gateways;
+    gateway_idle_us    = this->gateway_idle * 1000000ULL;
+
+    downlink_queue_size = this->downlink_queue;
+    downlink_lead_us    = this->downlink_lead * 1000ULL;
+    downlink_retry_max  = this->downlink_retries;
+    downlink_retry_on   = this->downlink_retry_errors;
+    uplink_window_us    = this->uplink_batch_window * 1000ULL;
+    uplink_batch_frames = this->uplink_batch_size;
+    uplink_delay_us     = this->uplink_batch_max_delay * 1000ULL;
+    dedup_window_us     = this->dedup_window * 1000ULL;
+    mqtt_single_thread  = this->single_threaded;
+    spool_path          = this->spool_dir;
+    spool_size_kb       = this->spool_max_size;
+    spool_rate          = this->spool_replay_rate;
+    reconnect_max_us    = this->max_reconnect_interval * 1000ULL;
+    inflight_window     = this->max_inflight;
+    prometheus_enabled  = this->endpoint_enabled;
+    prometheus_bind     = this->endpoint_bind;
+    downlink_overflow_policy =
+        (this->downlink_overflow == "drop_newest") ? DOWNLINK_DROP_NEWEST : DOWNLINK_DROP_OLDEST;
+    dedup_policy_type =
+        (this->dedup_policy == "best_snr") ? UPLINK_DEDUP_BEST_SNR : UPLINK_DEDUP_MERGE;
+    marshaler_type = (this->marshaler == "protobuf") ? BRIDGE_MARSHALER_PROTOBUF
+                                                     : BRIDGE_MARSHALER_JSON;
+    duty_cycle_region_parse(this->duty_cycle_region, &duty_cycle_region_type);
+}
+
+void BridgeToml::parse_toml_general(void)
+{
+    const auto &general = toml::find(this->toml_data, "general");
+    this->log_level     = toml::find_or<int>(general, "log_level", BRIDGE_LOG_DEFAULT);
+    if (this->log_level < BRIDGE_LOG_PANIC || this->log_level > BRIDGE_LOG_DEBUG) {
+        log_warn("Invalid log_level: %d, use default.", this->log_level);
+        this->log_level = BRIDGE_LOG_DEFAULT;
+    }
+}
+
+void BridgeToml::parse_toml_filters(void)
+{
+    const auto &filters = toml::find(this->toml_data, "filters");
+    this->net_ids       = toml::find_or<vector<string>>(filters, "net_ids", vector<string>());
+    this->join_euis     = toml::find_or<vector<array<string, 2>>>(
+        filters, "join_euis", vector<array<string, 2>>());
+    this->whitelist_unknown_devaddr =
+        toml::find_or<std::string>(filters, "whitelist_unknown_devaddr", "pass");
+    if (this->whitelist_unknown_devaddr != "pass" && this->whitelist_unknown_devaddr != "drop") {
+        log_warn("Invalid whitelist_unknown_devaddr: %s, use pass.",
+                 this->whitelist_unknown_devaddr.c_str());
+        this->whitelist_unknown_devaddr = "pass";
+    }
 }
 
 void BridgeToml::parse_toml_backend_udp(void)
@@ -137,15 +341,135 @@ void BridgeToml::parse_toml_backend_udp(void)
     }
     this->skip_crc_check = toml::find<bool>(semtech_udp, "skip_crc_check");
     this->fake_rx_time   = toml::find<bool>(semtech_udp, "fake_rx_time");
+    this->udp_workers =
+        toml::find_or<std::uint32_t>(semtech_udp, "udp_workers", UDP_WORKERS_DEFAULT);
+    if (this->udp_workers == 0 || this->udp_workers > UDP_WORKERS_MAX) {
+        log_warn("Invalid udp_workers: %u, use default.", this->udp_workers);
+        this->udp_workers = UDP_WORKERS_DEFAULT;
+    }
+    this->udp_batch_size =
+        toml::find_or<std::uint32_t>(semtech_udp, "udp_batch_size", UDP_BATCH_SIZE_DEFAULT);
+    if (this->udp_batch_size == 0 || this->udp_batch_size > UDP_BATCH_SIZE_MAX) {
+        log_warn("Invalid udp_batch_size: %u, use default.", this->udp_batch_size);
+        this->udp_batch_size = UDP_BATCH_SIZE_DEFAULT;
+    }
+    this->max_gateways =
+        toml::find_or<std::uint32_t>(semtech_udp, "max_gateways", MAX_GATEWAYS_DEFAULT);
+    if (this->max_gateways == 0 || this->max_gateways > MAX_GATEWAYS_MAX) {
+        log_warn("Invalid max_gateways: %u, use default.", this->max_gateways);
+        this->max_gateways = MAX_GATEWAYS_DEFAULT;
+    }
+    this->gateway_idle = toml::find_or<std::uint32_t>(
+        semtech_udp, "gateway_idle_timeout", GATEWAY_IDLE_TIMEOUT_DEFAULT);
+    if (this->gateway_idle > GATEWAY_IDLE_TIMEOUT_MAX) {
+        log_warn("Invalid gateway_idle_timeout: %u, use default.", this->gateway_idle);
+        this->gateway_idle = GATEWAY_IDLE_TIMEOUT_DEFAULT;
+    }
+    this->downlink_queue = toml::find_or<std::uint32_t>(
+        semtech_udp, "downlink_queue_size", DOWNLINK_QUEUE_DEFAULT);
+    if (this->downlink_queue == 0 || this->downlink_queue > DOWNLINK_QUEUE_MAX) {
+        log_warn("Invalid downlink_queue_size: %u, use default.", this->downlink_queue);
+        this->downlink_queue = DOWNLINK_QUEUE_DEFAULT;
+    }
+    this->downlink_overflow =
+        toml::find_or<std::string>(semtech_udp, "downlink_overflow", "drop_oldest");
+    if (this->downlink_overflow != "drop_oldest" && this->downlink_overflow != "drop_newest") {
+        log_warn("Invalid downlink_overflow: %s, use drop_oldest.",
+                 this->downlink_overflow.c_str());
+        this->downlink_overflow = "drop_oldest";
+    }
+    this->downlink_lead = toml::find_or<std::uint32_t>(
+        semtech_udp, "downlink_lead_time", DOWNLINK_LEAD_TIME_DEFAULT);
+    if (this->downlink_lead < DOWNLINK_LEAD_TIME_MIN ||
+        this->downlink_lead > DOWNLINK_LEAD_TIME_MAX) {
+        log_warn("Invalid downlink_lead_time: %u, use default.", this->downlink_lead);
+        this->downlink_lead = DOWNLINK_LEAD_TIME_DEFAULT;
+    }
+    this->dedup_window = toml::find_or<std::uint32_t>(
+        semtech_udp, "dedup_window", UPLINK_DEDUP_WINDOW_DEFAULT);
+    if (this->dedup_window > UPLINK_DEDUP_WINDOW_MAX) {
+        log_warn("Invalid dedup_window: %u, use default.", this->dedup_window);
+        this->dedup_window = UPLINK_DEDUP_WINDOW_DEFAULT;
+    }
+    this->dedup_policy = toml::find_or<std::string>(semtech_udp, "dedup_policy", "merge");
+    if (this->dedup_policy != "merge" && this->dedup_policy != "best_snr") {
+        log_warn("Invalid dedup_policy: %s, use merge.", this->dedup_policy.c_str());
+        this->dedup_policy = "merge";
+    }
+    enum duty_cycle_region region;
+    this->duty_cycle_region = toml::find_or<std::string>(semtech_udp, "duty_cycle_region", "");
+    if (duty_cycle_region_parse(this->duty_cycle_region, &region) < 0) {
+        log_warn("Invalid duty_cycle_region: %s, disable duty cycle.",
+                 this->duty_cycle_region.c_str());
+        this->duty_cycle_region = "";
+    }
+    this->downlink_retries = toml::find_or<std::uint32_t>(semtech_udp, "downlink_retries", 0);
+    if (this->downlink_retries > DOWNLINK_RETRIES_MAX) {
+        log_warn("Invalid downlink_retries: %u, disable retry.", this->downlink_retries);
+        this->downlink_retries = 0;
+    }
+    this->downlink_retry_errors = toml::find_or<vector<string>>(
+        semtech_udp, "downlink_retry_errors", vector<string>{ "TOO_EARLY" });
 }
 
 void BridgeToml::parse_toml_integration_generic(void)
 {
     // 定位到integration.mqtt
     const auto &integration      = toml::find(this->toml_data, "integration");
+    this->marshaler              = toml::find_or<std::string>(integration, "marshaler", "json");
+    if (this->marshaler != "json" && this->marshaler != "protobuf") {
+        log_warn("Invalid marshaler: %s, use json.", this->marshaler.c_str());
+        this->marshaler = "json";
+    }
     const auto &mqtt             = toml::find(integration, "mqtt");
     this->event_topic_template   = toml::find<std::string>(mqtt, "event_topic_template");
     this->command_topic_template = toml::find<std::string>(mqtt, "command_topic_template");
+    string   reconnect    = toml::find_or<std::string>(mqtt, "max_reconnect_interval", "10m0s");
+    uint64_t reconnect_ms = 0;
+    if (parse_duration_ms(reconnect, &reconnect_ms) < 0 ||
+        reconnect_ms < MQTT_RECONNECT_DELAY_MIN || reconnect_ms > MQTT_RECONNECT_MAX_LIMIT) {
+        log_warn("Invalid max_reconnect_interval: %s, use default.", reconnect.c_str());
+        reconnect_ms = MQTT_RECONNECT_MAX_DEFAULT;
+    }
+    this->max_reconnect_interval = reconnect_ms;
+    this->uplink_batch_window    = toml::find_or<std::uint32_t>(mqtt, "uplink_batch_window", 0);
+    if (this->uplink_batch_window > UPLINK_BATCH_WINDOW_MAX) {
+        log_warn("Invalid uplink_batch_window: %u, batching disabled.", this->uplink_batch_window);
+        this->uplink_batch_window = 0;
+    }
+    this->uplink_batch_size =
+        toml::find_or<std::uint32_t>(mqtt, "uplink_batch_size", UPLINK_BATCH_SIZE_DEFAULT);
+    if (this->uplink_batch_size == 0 || this->uplink_batch_size > UPLINK_BATCH_SIZE_MAX) {
+        log_warn("Invalid uplink_batch_size: %u, use default.", this->uplink_batch_size);
+        this->uplink_batch_size = UPLINK_BATCH_SIZE_DEFAULT;
+    }
+    this->uplink_batch_max_delay = toml::find_or<std::uint32_t>(
+        mqtt, "uplink_batch_max_delay", UPLINK_BATCH_DELAY_DEFAULT);
+    if (this->uplink_batch_max_delay == 0 ||
+        this->uplink_batch_max_delay > UPLINK_BATCH_DELAY_MAX) {
+        log_warn("Invalid uplink_batch_max_delay: %u, use default.", this->uplink_batch_max_delay);
+        this->uplink_batch_max_delay = UPLINK_BATCH_DELAY_DEFAULT;
+    }
+    this->single_threaded = toml::find_or<bool>(mqtt, "single_threaded", true);
+    this->max_inflight =
+        toml::find_or<std::uint32_t>(mqtt, "max_inflight", MQTT_INFLIGHT_DEFAULT);
+    if (this->max_inflight == 0 || this->max_inflight > MQTT_INFLIGHT_MAX) {
+        log_warn("Invalid max_inflight: %u, use default.", this->max_inflight);
+        this->max_inflight = MQTT_INFLIGHT_DEFAULT;
+    }
+    this->spool_dir       = toml::find_or<std::string>(mqtt, "spool_dir", SPOOL_DIR_DEFAULT);
+    this->spool_max_size =
+        toml::find_or<std::uint32_t>(mqtt, "spool_max_size", SPOOL_MAX_SIZE_DEFAULT);
+    if (this->spool_max_size < SPOOL_MAX_SIZE_MIN || this->spool_max_size > SPOOL_MAX_SIZE_MAX) {
+        log_warn("Invalid spool_max_size: %u, use default.", this->spool_max_size);
+        this->spool_max_size = SPOOL_MAX_SIZE_DEFAULT;
+    }
+    this->spool_replay_rate =
+        toml::find_or<std::uint32_t>(mqtt, "spool_replay_rate", SPOOL_REPLAY_RATE_DEFAULT);
+    if (this->spool_replay_rate == 0 || this->spool_replay_rate > SPOOL_REPLAY_RATE_MAX) {
+        log_warn("Invalid spool_replay_rate: %u, use default.", this->spool_replay_rate);
+        this->spool_replay_rate = SPOOL_REPLAY_RATE_DEFAULT;
+    }
     const auto &auth             = toml::find(mqtt, "auth");
     this->mqtt_auth_type         = toml::find<std::string>(auth, "type");
     const auto generic           = toml::find(auth, "generic");
@@ -177,52 +501,353 @@ void BridgeToml::parse_toml_integration_generic(void)
     this->generic_pass_phrase   = toml::find<std::string>(generic, "tls_pass_phrase");
 }
 
+void BridgeToml::parse_toml_metrics(void)
+{
+    const auto &metrics    = toml::find(this->toml_data, "metrics");
+    const auto &prometheus = toml::find(metrics, "prometheus");
+    this->endpoint_enabled = toml::find_or<bool>(prometheus, "endpoint_enabled", false);
+    this->endpoint_bind    = toml::find_or<std::string>(prometheus, "bind", "");
+    if (this->endpoint_enabled && this->endpoint_bind.empty()) {
+        log_warn("Invalid prometheus bind: empty, use %s.", PROMETHEUS_BIND_DEFAULT);
+        this->endpoint_bind = PROMETHEUS_BIND_DEFAULT;
+    }
+}
+
 void BridgeToml::parse_local_for_each(void)
 {
+    this->parse_toml_general();
+    this->parse_toml_filters();
     this->parse_toml_backend_udp();
     this->parse_toml_integration_generic();
+    this->parse_toml_metrics();
 }
 
 static void signal_cb(evutil_socket_t sig, short events, void *user_data)
 {
-    printf("INFO: sig:[%d], LoRa gateway bridge will exit...\n", sig);
+    log_info("sig:[%d], LoRa gateway bridge will exit...", sig);
     event_base_loopexit(evbase, NULL);
 }
 
+// 移除空闲的网关会话并取消订阅其下行topic，本机网关不移除
+static void gateway_sweep_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    vector<struct gateway_session *> evicted;
+
+    gateway_sessions->evict_idle(bridge_monotonic_us(), gateway_idle_us, evicted);
+    for (struct gateway_session *session : evicted) {
+        mosquitto_unsubscribe(mosq, NULL, session->topic_sub_txpk.c_str());
+        bridge_metrics_add(BRIDGE_CNT_GATEWAYS_EVICTED);
+        log_info("Gateway %s idle, session removed, %u gateway(s) online",
+                 session->eui_str,
+                 gateway_sessions->size());
+    }
+}
+
+static void metrics_timer_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    bridge_metrics_log_summary();
+    gateway_sessions->for_each([](struct gateway_session *session) {
+        struct gateway_session_counters &c = session->counters;
+        log_info("[metrics] gateway %s push:%llu pull:%llu txack:%llu rxpk:%llu stat:%llu "
+                 "downlink enqueued:%llu sent:%llu dropped:%llu expired:%llu rejected:%llu "
+                 "queue high-water:%zu/%zu scheduled:%zu",
+                 session->eui_str,
+                 (unsigned long long)c.push_data.load(memory_order_relaxed),
+                 (unsigned long long)c.pull_data.load(memory_order_relaxed),
+                 (unsigned long long)c.tx_ack.load(memory_order_relaxed),
+                 (unsigned long long)c.rxpk.load(memory_order_relaxed),
+                 (unsigned long long)c.stat.load(memory_order_relaxed),
+                 (unsigned long long)c.downlink_enqueued.load(memory_order_relaxed),
+                 (unsigned long long)c.downlink_sent.load(memory_order_relaxed),
+                 (unsigned long long)c.downlink_dropped.load(memory_order_relaxed),
+                 (unsigned long long)c.downlink_expired.load(memory_order_relaxed),
+                 (unsigned long long)c.downlink_rejected.load(memory_order_relaxed),
+                 session->queue_downlink.high_water_mark(),
+                 session->queue_downlink.capacity(),
+                 session->scheduler.size());
+    });
+    if (spool) {
+        struct spool_stats s;
+        uint64_t           replayed  = bridge_metrics_sum(BRIDGE_CNT_SPOOL_REPLAYED);
+        uint64_t           replay_ms = bridge_metrics_sum(BRIDGE_CNT_SPOOL_REPLAY_MS);
+        spool->stats(&s);
+        log_info("[metrics] spool pending:%llu bytes:%llu written:%llu write errors:%llu "
+                 "evicted:%llu corrupt:%llu replayed:%llu (%llu bytes) replay rate:%.1f/s",
+                 (unsigned long long)s.pending,
+                 (unsigned long long)s.bytes,
+                 (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_SPOOL_WRITTEN),
+                 (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_SPOOL_WRITE_ERRORS),
+                 (unsigned long long)s.evicted,
+                 (unsigned long long)s.corrupt,
+                 (unsigned long long)replayed,
+                 (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_SPOOL_REPLAY_BYTES),
+                 replay_ms ? replayed * 1000.0 / replay_ms : 0.0);
+    }
+    uint32_t expired = inflight->expire(bridge_monotonic_us(), MQTT_ACK_TIMEOUT * 1000000ULL);
+    bridge_metrics_add(BRIDGE_CNT_MQTT_ACK_TIMEOUTS, expired);
+    log_info("[metrics] mqtt in-flight:%u/%u backpressure:%llu ack timeouts:%llu "
+             "untracked:%llu",
+             inflight->size(),
+             inflight_window,
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_MQTT_BACKPRESSURE),
+             (unsigned long long)bridge_metrics_sum(BRIDGE_CNT_MQTT_ACK_TIMEOUTS),
+             (unsigned long long)inflight->untracked_count());
+    for (uint8_t qos = 0; qos < MQTT_QOS_LEVELS; qos++) {
+        struct puback_histogram h;
+        string                  buckets;
+        char                    bucket[32];
+        inflight->histogram(qos, &h);
+        if (h.count == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < PUBACK_HIST_BUCKETS; i++) {
+            if (i < PUBACK_HIST_BUCKETS - 1) {
+                snprintf(bucket, sizeof(bucket), " le%ums:%llu", puback_hist_bounds_ms[i],
+                         (unsigned long long)h.buckets[i]);
+            } else {
+                snprintf(bucket, sizeof(bucket), " inf:%llu", (unsigned long long)h.buckets[i]);
+            }
+            buckets += bucket;
+        }
+        log_info("[metrics] mqtt qos%u publish-to-ack count:%llu avg:%.2fms max:%.2fms%s",
+                 qos,
+                 (unsigned long long)h.count,
+                 h.sum_us / 1000.0 / h.count,
+                 h.max_us / 1000.0,
+                 buckets.c_str());
+    }
+}
+
+// /metrics抓取时追加主程序的状态，在主event_base上执行
+static void prometheus_collect(string &out)
+{
+    string label;
+
+    prometheus_write_header(out, "lorabridge_gateways", "gauge", "Gateways with a session.");
+    prometheus_write_value(out, "lorabridge_gateways", "", gateway_sessions->size());
+    prometheus_write_header(out, "lorabridge_gateway_rxpk_total", "counter",
+                            "Uplink frames received per gateway.");
+    gateway_sessions->for_each([&out, &label](struct gateway_session *session) {
+        label = string("gateway_id=\"") + session->eui_str + "\"";
+        prometheus_write_value(out, "lorabridge_gateway_rxpk_total", label,
+                               session->counters.rxpk.load(memory_order_relaxed));
+    });
+    prometheus_write_header(out, "lorabridge_gateway_downlinks_total", "counter",
+                            "Downlinks per gateway by outcome.");
+    gateway_sessions->for_each([&out, &label](struct gateway_session *session) {
+        struct gateway_session_counters &c = session->counters;
+        label = string("gateway_id=\"") + session->eui_str + "\",result=";
+        prometheus_write_value(out, "lorabridge_gateway_downlinks_total", label + "\"enqueued\"",
+                               c.downlink_enqueued.load(memory_order_relaxed));
+        prometheus_write_value(out, "lorabridge_gateway_downlinks_total", label + "\"sent\"",
+                               c.downlink_sent.load(memory_order_relaxed));
+        prometheus_write_value(out, "lorabridge_gateway_downlinks_total", label + "\"dropped\"",
+                               c.downlink_dropped.load(memory_order_relaxed));
+        prometheus_write_value(out, "lorabridge_gateway_downlinks_total", label + "\"expired\"",
+                               c.downlink_expired.load(memory_order_relaxed));
+        prometheus_write_value(out, "lorabridge_gateway_downlinks_total", label + "\"rejected\"",
+                               c.downlink_rejected.load(memory_order_relaxed));
+    });
+    prometheus_write_header(out, "lorabridge_downlink_queue_depth", "gauge",
+                            "Downlinks waiting in the MQTT to UDP queue per gateway.");
+    gateway_sessions->for_each([&out, &label](struct gateway_session *session) {
+        label = string("gateway_id=\"") + session->eui_str + "\"";
+        prometheus_write_value(out, "lorabridge_downlink_queue_depth", label,
+                               session->queue_downlink.size());
+    });
+    prometheus_write_header(out, "lorabridge_downlink_scheduled", "gauge",
+                            "Downlinks held until their transmit time per gateway.");
+    gateway_sessions->for_each([&out, &label](struct gateway_session *session) {
+        label = string("gateway_id=\"") + session->eui_str + "\"";
+        prometheus_write_value(out, "lorabridge_downlink_scheduled", label,
+                               session->scheduler.size());
+    });
+
+    prometheus_write_header(out, "lorabridge_whitelist_dev_euis", "gauge",
+                            "DevEUIs in the lorawan_filter.conf whitelist.");
+    prometheus_write_value(out, "lorabridge_whitelist_dev_euis", "", deveui_whitelist->size());
+    prometheus_write_header(out, "lorabridge_whitelist_dev_addrs", "gauge",
+                            "DevAddrs learned for whitelisted devices.");
+    prometheus_write_value(out, "lorabridge_whitelist_dev_addrs", "",
+                           deveui_whitelist->learned_size());
+
+    prometheus_write_header(out, "lorabridge_mqtt_connected", "gauge",
+                            "Whether the MQTT connection is up.");
+    prometheus_write_value(out, "lorabridge_mqtt_connected", "", mqtt_connected.load() ? 1 : 0);
+    prometheus_write_header(out, "lorabridge_mqtt_inflight", "gauge",
+                            "Publishes waiting for acknowledgement.");
+    prometheus_write_value(out, "lorabridge_mqtt_inflight", "", inflight->size());
+    prometheus_write_header(out, "lorabridge_mqtt_inflight_window", "gauge",
+                            "Configured max_inflight.");
+    prometheus_write_value(out, "lorabridge_mqtt_inflight_window", "", inflight_window);
+
+    uint64_t bounds_us[PUBACK_HIST_BUCKETS - 1];
+    for (size_t i = 0; i < PUBACK_HIST_BUCKETS - 1; i++) {
+        bounds_us[i] = puback_hist_bounds_ms[i] * 1000ULL;
+    }
+    prometheus_write_header(out, "lorabridge_mqtt_publish_ack_seconds", "histogram",
+                            "MQTT publish to acknowledgement latency by QoS.");
+    for (uint8_t qos = 0; qos < MQTT_QOS_LEVELS; qos++) {
+        struct puback_histogram h;
+        inflight->histogram(qos, &h);
+        prometheus_write_histogram(out, "lorabridge_mqtt_publish_ack_seconds",
+                                   "qos=\"" + to_string(qos) + "\"", h.buckets, bounds_us,
+                                   PUBACK_HIST_BUCKETS, h.sum_us);
+    }
+
+    if (spool) {
+        struct spool_stats s;
+        spool->stats(&s);
+        prometheus_write_header(out, "lorabridge_spool_pending", "gauge",
+                                "Events waiting in the spool.");
+        prometheus_write_value(out, "lorabridge_spool_pending", "", s.pending);
+        prometheus_write_header(out, "lorabridge_spool_bytes", "gauge", "Size of the spool.");
+        prometheus_write_value(out, "lorabridge_spool_bytes", "", s.bytes);
+    }
+}
+
+// 所有MQTT发布都经过这里，记下mid用于在途窗口和确认耗时统计
+static int mqtt_publish(const string &topic, const void *payload, size_t len)
+{
+    int      mid     = 0;
+    uint64_t sent_us = bridge_monotonic_us();
+    int      rc = mosquitto_publish(mosq, &mid, topic.c_str(), len, payload, mqtt_qos, false);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        inflight->sent(mid, mqtt_qos, sent_us);
+    } else {
+        bridge_metrics_add(BRIDGE_CNT_MQTT_PUBLISH_ERRORS);
+    }
+    return rc;
+}
+
+/*
+ * 上行和统计事件的发布入口。断线期间、或spool里还有没回放完的事件时
+ * 写入spool，保证重连后按原顺序发出；直接发布失败的也写入spool。
+ * 在途消息达到max_inflight时不再交给libmosquitto排队，同样写入spool，
+ * 等确认腾出窗口后由回放发出；没有spool时丢弃。
+ */
+static void publish_event(const string &topic, const char *payload, size_t len)
+{
+    bool window_full = inflight->size() >= inflight_window;
+    if (window_full) {
+        bridge_metrics_add(BRIDGE_CNT_MQTT_BACKPRESSURE);
+        if (!spool) {
+            return;
+        }
+    }
+    bool direct = !spool || (!window_full && mqtt_connected.load(memory_order_acquire) &&
+                             !spool_backlog.load(memory_order_acquire));
+    if (direct && (mqtt_publish(topic, payload, len) == MOSQ_ERR_SUCCESS || !spool)) {
+        return;
+    }
+    if (spool->append(topic, payload, len) < 0) {
+        bridge_metrics_add(BRIDGE_CNT_SPOOL_WRITE_ERRORS);
+        return;
+    }
+    bridge_metrics_add(BRIDGE_CNT_SPOOL_WRITTEN);
+    spool_backlog.store(true, memory_order_release);
+}
+
+// 连接正常时按spool_replay_rate限速回放积压的事件
+static void spool_replay_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    string   topic, payload;
+    uint32_t budget   = (spool_rate * SPOOL_REPLAY_INTERVAL_MS + 999) / 1000;
+    uint32_t replayed = 0;
+    bool     drained  = false;
+
+    if (!mqtt_connected.load(memory_order_acquire)) {
+        return;
+    }
+    // 在途窗口满时停下，等确认腾出位置后下一轮继续
+    while (replayed < budget && inflight->size() < inflight_window) {
+        if (spool->front(topic, payload) <= 0) {
+            drained = true;
+            break;
+        }
+        if (mqtt_publish(topic, payload.data(), payload.length()) != MOSQ_ERR_SUCCESS) {
+            return;
+        }
+        spool->pop();
+        bridge_metrics_add(BRIDGE_CNT_SPOOL_REPLAYED);
+        bridge_metrics_add(BRIDGE_CNT_SPOOL_REPLAY_BYTES, payload.length());
+        replayed++;
+    }
+    if (replayed > 0) {
+        bridge_metrics_add(BRIDGE_CNT_SPOOL_REPLAY_MS, SPOOL_REPLAY_INTERVAL_MS);
+    }
+    if (!drained || !spool_backlog.load(memory_order_relaxed)) {
+        return;
+    }
+    // front()之后worker可能又追加并置位，清标志后再查一次spool，不空就恢复
+    spool_backlog.store(false);
+    if (!spool->empty()) {
+        spool_backlog.store(true);
+        return;
+    }
+    log_info("Spool replay finished");
+}
+
 // Mosquitto连接回调函数
 static void on_connect(struct mosquitto *mosq, void *obj, int rc)
 {
-    printf("on_connect: %s\n", mosquitto_connack_string(rc));
+    log_info("on_connect: %s", mosquitto_connack_string(rc));
     if (rc != 0) {
-        std::cerr << "Failed to connect to MQTT broker." << std::endl;
+        log_error("Failed to connect to MQTT broker.");
         mosquitto_disconnect(mosq);
     } else {
-        std::cout << "Connected to MQTT broker." << std::endl;
-        if (topic_sub_txpk.empty() ||
-            mosquitto_subscribe(mosq, NULL, topic_sub_txpk.c_str(), mqtt_qos) < 0) {
-            std::cerr << "Failed to subscribe tx topic." << std::endl;
+        log_info("Connected to MQTT broker.");
+        mqtt_connected.store(true, memory_order_release);
+        mqtt_backoff.reset();
+        bool     resumed = mqtt_tls_resumed(mosq);
+        uint64_t lost_at = mqtt_lost_at_us.exchange(0);
+        if (lost_at != 0) {
+            uint64_t outage_us = bridge_monotonic_us() - lost_at;
+            bridge_metrics_add(BRIDGE_CNT_MQTT_RECONNECTS);
+            bridge_metrics_add(BRIDGE_CNT_MQTT_RECONNECT_US, outage_us);
+            bridge_metrics_set_max(BRIDGE_CNT_MQTT_RECONNECT_MAX_US, outage_us);
+            log_info("MQTT reconnected after %llums%s",
+                     (unsigned long long)(outage_us / 1000),
+                     resumed ? ", TLS session resumed" : "");
         }
+        if (resumed) {
+            bridge_metrics_add(BRIDGE_CNT_MQTT_TLS_RESUMED);
+        }
+        // 重新订阅所有已知网关的下行topic
+        gateway_sessions->for_each([mosq](struct gateway_session *session) {
+            if (session->topic_sub_txpk.empty() ||
+                mosquitto_subscribe(mosq, NULL, session->topic_sub_txpk.c_str(), mqtt_qos) < 0) {
+                log_error("Failed to subscribe tx topic.");
+            }
+        });
     }
 }
 
 void on_disconnect(struct mosquitto *mosq, void *userdata, int result)
 {
-    printf("WARN: MQTT broker had lost connection, LoRa gateway bridge will exit...\n");
+    uint64_t connected = 0;
+    mqtt_connected.store(false, memory_order_release);
+    mqtt_lost_at_us.compare_exchange_strong(connected, bridge_monotonic_us());
+    if (spool) {
+        log_warn("MQTT broker had lost connection, spool events until reconnected...");
+    } else {
+        log_warn("MQTT broker had lost connection, events will be lost...");
+    }
 }
 
 static void
 on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
 {
-    printf("Topic subscribed...\n");
+    log_info("Topic subscribed...");
     bool have_subscription = false;
     for (int i = 0; i < qos_count; i++) {
-        printf("on_subscribe: %d:granted qos = %d\n", i, granted_qos[i]);
+        log_info("on_subscribe: %d:granted qos = %d", i, granted_qos[i]);
         if (granted_qos[i] <= 2) {
             have_subscription = true;
         }
     }
     if (have_subscription == false) {
-        fprintf(stderr, "Error: All subscriptions rejected.\n");
+        log_error("All subscriptions rejected.");
         mosquitto_disconnect(mosq);
     }
 }
@@ -230,7 +855,8 @@ on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const in
 // Mosquitto发布回调函数
 static void on_publish(struct mosquitto *mosq, void *obj, int mid)
 {
-    std::cout << "Message published." << std::endl;
+    inflight->acked(mid, bridge_monotonic_us());
+    log_debug("Message published.");
 }
 
 static int parse_uplink_datr(string datr, uint8_t &dr, uint16_t &bw)
@@ -248,125 +874,312 @@ static int parse_uplink_datr(string datr, uint8_t &dr, uint16_t &bw)
     return -1;
 }
 
-static void publish_chirpstack_format_uplink_json(const json &json_up)
+static void publish_uplink_batch(struct gateway_session *session, struct uplink_batch *batch)
 {
-    string str_rxpk;
-    double freq = 0.0;
-    json   json_pub;
+    const string &topic = session->topic_pub_rxpk_batch;
+    uplink_batch_finish(batch, marshaler_type == BRIDGE_MARSHALER_PROTOBUF);
+    log_debug("publish topic:%s frames:%u", topic.c_str(), batch->frames);
+    publish_event(topic, batch->payload.data(), batch->payload.length());
+    bridge_metrics_add(BRIDGE_CNT_UPLINK_PUBLISHES);
+    bridge_metrics_add(BRIDGE_CNT_UPLINK_FRAMES, batch->frames);
+    uint64_t now_us = bridge_monotonic_us();
+    for (uint64_t rx_us : batch->rx_us) {
+        bridge_metrics_observe(BRIDGE_HIST_UPLINK_PUBLISH_US, now_us - rx_us);
+    }
+    uplink_batch_reset(batch);
+}
 
-    const char *stat_tb[] = { "STAT_CRC_BAD", "STAT_NO_CRC", "STAT_CRC_OK" };
-    for (const auto &rxpk : json_up["rxpk"]) {
-        json_pub["gatewayID"]      = base_64_obj.encode(string(gateway_eui));
-        json_pub["phyPayloadSize"] = rxpk["size"];
-        json_pub["phyPayload"]     = rxpk["data"];
-        if (rxpk["freq"].is_number_float()) {
-            freq                            = rxpk["freq"];
-            json_pub["txInfo"]["frequency"] = static_cast<uint64_t>(freq * 1000000);
-        } else {
-            continue;
-        }
-        json_pub["modulation"] = rxpk["modu"];
-        if (rxpk["datr"].is_string()) {
+// 按最早的到期时刻设置worker的定时器，已有更早的定时则不动
+static void udp_worker_arm_timer(struct event *ev, uint64_t *armed_at_us, uint64_t deadline_us)
+{
+    uint64_t       now_us, wait_us;
+    struct timeval tv;
 
-            uint8_t  dr;
-            uint16_t bw;
-            string   datr = rxpk["datr"];
-            if (parse_uplink_datr(datr, dr, bw) < 0) {
-                continue;
-            }
-            json_pub["txInfo"]["modulationInfo"]["bandwidth"]       = bw;
-            json_pub["txInfo"]["modulationInfo"]["spreadingFactor"] = dr;
-        } else if (rxpk["datr"].is_number_integer()) {
-            // FSK datarate (unsigned, in bits per second)
-            json_pub["txInfo"]["modulationInfo"]["FSKDataRate"] = rxpk["datr"];
+    if (*armed_at_us && *armed_at_us <= deadline_us) {
+        return;
+    }
+    now_us       = bridge_monotonic_us();
+    wait_us      = (deadline_us > now_us) ? deadline_us - now_us : 0;
+    tv.tv_sec    = wait_us / 1000000;
+    tv.tv_usec   = wait_us % 1000000;
+    *armed_at_us = deadline_us;
+    evtimer_add(ev, &tv);
+}
+
+// 定时器到点，发布本worker中合并窗口已结束或达到最大延迟的批次
+static void uplink_batch_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    struct udp_worker *worker   = static_cast<struct udp_worker *>(user_data);
+    uint64_t           now_us   = bridge_monotonic_us();
+    uint64_t           earliest = 0, deadline_us;
+
+    worker->batch_at_us = 0;
+    for (auto &entry : worker->uplink_batches) {
+        if (!uplink_batch_deadline(&entry.second, uplink_window_us, uplink_delay_us,
+                                   &deadline_us)) {
+            continue;
         }
-        if (rxpk.contains("codr")) {
-            json_pub["txInfo"]["modulationInfo"]["codeRate"] = rxpk["codr"];
+        if (deadline_us <= now_us) {
+            publish_uplink_batch(entry.first, &entry.second);
+        } else if (earliest == 0 || deadline_us < earliest) {
+            earliest = deadline_us;
         }
-        if (rxpk.contains("time")) {
-            json_pub["rxInfo"]["time"] = rxpk["time"];
+    }
+    // 只保留还有帧的批次，已移除的会话不会留在表里
+    for (auto it = worker->uplink_batches.begin(); it != worker->uplink_batches.end();) {
+        it = it->second.frames ? next(it) : worker->uplink_batches.erase(it);
+    }
+    if (earliest) {
+        udp_worker_arm_timer(worker->batch_ev, &worker->batch_at_us, earliest);
+    }
+}
+
+// 加入本网关的批次，满uplink_batch_size帧立即发布，否则等定时器
+static void udp_worker_batch_uplink(struct udp_worker      *worker,
+                                    struct gateway_session *session,
+                                    const string           &frame,
+                                    uint64_t                rx_us)
+{
+    struct uplink_batch &batch = worker->uplink_batches[session];
+    uint64_t             deadline_us;
+
+    uplink_batch_append(&batch, frame, marshaler_type == BRIDGE_MARSHALER_PROTOBUF, rx_us);
+    if (batch.frames >= uplink_batch_frames) {
+        publish_uplink_batch(session, &batch);
+        worker->uplink_batches.erase(session);
+        return;
+    }
+    uplink_batch_deadline(&batch, uplink_window_us, uplink_delay_us, &deadline_us);
+    udp_worker_arm_timer(worker->batch_ev, &worker->batch_at_us, deadline_us);
+}
+
+// 单帧上行，开启合并时交给批次，否则直接发布
+static void publish_uplink_frame(struct udp_worker      *worker,
+                                 struct gateway_session *session,
+                                 const string           &frame,
+                                 uint64_t                rx_us)
+{
+    if (uplink_window_us > 0) {
+        udp_worker_batch_uplink(worker, session, frame, rx_us);
+        return;
+    }
+    log_debug("publish topic:%s", session->topic_pub_rxpk.c_str());
+    publish_event(session->topic_pub_rxpk, frame.data(), frame.length());
+    bridge_metrics_add(BRIDGE_CNT_UPLINK_PUBLISHES);
+    bridge_metrics_add(BRIDGE_CNT_UPLINK_FRAMES);
+    bridge_metrics_observe(BRIDGE_HIST_UPLINK_PUBLISH_US, bridge_monotonic_us() - rx_us);
+}
+
+/*
+ * 去重窗口结束，发布本worker创建的条目：up topic上是SNR最高的一份，
+ * merge时另在up_set topic上发布所有副本的rxInfo。
+ */
+static void uplink_dedup_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    struct udp_worker *worker   = static_cast<struct udp_worker *>(user_data);
+    string            &frame    = worker->uplink_out;
+    uint64_t           now_us   = bridge_monotonic_us();
+    bool               protobuf = marshaler_type == BRIDGE_MARSHALER_PROTOBUF;
+    uint64_t           earliest;
+
+    worker->dedup_at_us = 0;
+    earliest            = uplink_dedup->collect(worker->id, now_us, worker->dedup_done);
+    for (const auto &entry : worker->dedup_done) {
+        log_debug("uplink received by %u copies", entry.copies);
+        if (uplink_dedup->merging()) {
+            frame.clear();
+            uplink_dedup->assemble_set(&entry, protobuf, frame);
+            log_debug("publish topic:%s", entry.session->topic_pub_rxpk_set.c_str());
+            publish_event(entry.session->topic_pub_rxpk_set, frame.data(), frame.length());
         }
-        json_pub["rxInfo"]["timestamp"] = rxpk["tmst"];
-        if (rxpk.contains("ftime")) {
-            json_pub["rxInfo"]["fineTimestampType"] = rxpk["ftime"];
+        frame.clear();
+        uplink_dedup->assemble(&entry, frame);
+        publish_uplink_frame(worker, entry.session, frame, entry.first_us);
+    }
+    worker->dedup_done.clear();
+    if (earliest) {
+        udp_worker_arm_timer(worker->dedup_ev, &worker->dedup_at_us, earliest);
+    }
+}
+
+/*
+ * 按marshaler把rxpk分三段写入worker的dedup_copy后交给去重表。
+ * 返回-1表示去重表已满或data无法解码，调用者按未开启去重处理。
+ */
+static int udp_worker_dedup_uplink(struct udp_worker         *worker,
+                                   const struct semtech_rxpk *rxpk,
+                                   const string              &gateway_id)
+{
+    struct uplink_copy *copy = &worker->dedup_copy;
+
+    copy->session = worker->session;
+    copy->head.clear();
+    copy->rx_info.clear();
+    copy->tail.clear();
+    if (json_span_to_double(&rxpk->lsnr, &copy->snr) < 0) {
+        copy->snr = -HUGE_VAL;
+    }
+    if (marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+        if (chirpstack_uplink_proto_head(rxpk, copy->head) < 0) {
+            return -1;
         }
-        json_pub["rxInfo"]["rssi"] = rxpk["rssi"];
-        if (rxpk.contains("rssis")) {
-            json_pub["rxInfo"]["rssis"] = rxpk["rssis"];
+        chirpstack_rxinfo_proto_write(rxpk, worker->session->gateway_eui, copy->rx_info);
+    } else {
+        chirpstack_uplink_json_head(rxpk, gateway_id, copy->head);
+        // up_set的rxInfo数组需要区分网关，best_snr的rxInfo与未去重时一致
+        chirpstack_rxinfo_json_write(rxpk, uplink_dedup->merging() ? gateway_id : "",
+                                     copy->rx_info);
+        chirpstack_uplink_json_tail(rxpk, copy->tail);
+    }
+    switch (uplink_dedup->add(rxpk->data.ptr, rxpk->data.len, worker->id, worker->rx_us, copy)) {
+    case UPLINK_DEDUP_FIRST:
+        udp_worker_arm_timer(worker->dedup_ev, &worker->dedup_at_us,
+                             worker->rx_us + dedup_window_us);
+        return 0;
+    case UPLINK_DEDUP_DUPLICATE:
+        bridge_metrics_add(BRIDGE_CNT_UPLINK_DUPLICATES);
+        return 0;
+    case UPLINK_DEDUP_FULL:
+    default:
+        bridge_metrics_add(BRIDGE_CNT_UPLINK_DEDUP_FULL);
+        return -1;
+    }
+}
+
+// 按[filters]和DevEUI白名单丢弃上行，返回-1表示已丢弃
+static int udp_worker_filter_uplink(struct udp_worker *worker, const struct semtech_rxpk *rxpk)
+{
+    struct lorawan_header     header;
+    enum uplink_filter_result result = UPLINK_FILTER_MALFORMED;
+
+    if (lorawan_header_decode(&rxpk->data, &header) == 0) {
+        result = uplink_filter.match(&header);
+        if (result == UPLINK_FILTER_PASS) {
+            result = deveui_whitelist->check(&header, worker->session->gateway_eui, worker->rx_us);
         }
-        if (rxpk.contains("lsnr")) {
-            json_pub["rxInfo"]["LoRaSNR"] = rxpk["lsnr"];
+    }
+    switch (result) {
+    case UPLINK_FILTER_PASS:
+        return 0;
+    case UPLINK_FILTER_NETID:
+        bridge_metrics_add(BRIDGE_CNT_FILTER_NETID);
+        break;
+    case UPLINK_FILTER_JOINEUI:
+        bridge_metrics_add(BRIDGE_CNT_FILTER_JOINEUI);
+        break;
+    case UPLINK_FILTER_MALFORMED:
+        bridge_metrics_add(BRIDGE_CNT_FILTER_MALFORMED);
+        break;
+    case UPLINK_FILTER_DEVEUI:
+        bridge_metrics_add(BRIDGE_CNT_FILTER_DEVEUI);
+        break;
+    case UPLINK_FILTER_DEVADDR:
+        bridge_metrics_add(BRIDGE_CNT_FILTER_DEVADDR);
+        break;
+    }
+    return -1;
+}
+
+// 逐个rxpk直接在原报文上解析并写出ChirpStack JSON，输出缓冲区按worker复用
+static void publish_chirpstack_format_uplink(struct udp_worker      *worker,
+                                             const struct json_span *rxpk_array)
+{
+    struct json_cursor      cursor;
+    struct json_span        item;
+    struct semtech_rxpk     rxpk;
+    struct gateway_session *session    = worker->session;
+    string                 &str_rxpk   = worker->uplink_out;
+    const string           &gateway_id = session->gateway_id;
+    int64_t                 tmst;
+
+    json_scan_open(rxpk_array, &cursor);
+    while (json_scan_next_element(&cursor, &item) > 0) {
+        if (semtech_rxpk_parse(&item, &rxpk) < 0) {
+            bridge_metrics_add(BRIDGE_CNT_UDP_PARSE_ERRORS);
+            continue;
         }
-        json_pub["rxInfo"]["channel"] = rxpk["chan"];
-        json_pub["rxInfo"]["rfChain"] = rxpk["rfch"];
-        if (rxpk.contains("foff")) {
-            json_pub["rxInfo"]["LoRaFreqOffset"] = rxpk["foff"];
+        if (json_span_to_int64(&rxpk.tmst, &tmst) == 0 && tmst >= 0 && tmst <= UINT32_MAX) {
+            gateway_session_update_clock(session, static_cast<uint32_t>(tmst),
+                                         bridge_monotonic_us());
         }
-        if (rxpk.contains("mid")) {
-            // Concentrator modem ID on which pkt has been received
-            json_pub["rxInfo"]["modemID"] = rxpk["mid"];
+        gateway_session_count(session->counters.rxpk);
+        bridge_metrics_add(BRIDGE_CNT_RXPK);
+        if ((uplink_filter.enabled() || deveui_whitelist->enabled()) &&
+            udp_worker_filter_uplink(worker, &rxpk) < 0) {
+            continue;
         }
-        if (rxpk.contains("stat")) {
-            auto stat = -1;
-            // Concentrator modem ID on which pkt has been received
-            stat                            = rxpk["stat"];
-            json_pub["rxInfo"]["CRCStatus"] = string(stat_tb[stat + 1]);
+        // CRC错误的帧内容不可信，不参与去重
+        if (uplink_dedup && rxpk.crc_status != -1 &&
+            udp_worker_dedup_uplink(worker, &rxpk, gateway_id) == 0) {
+            continue;
         }
         str_rxpk.clear();
-        str_rxpk = json_pub.dump();
-        /* clang-format off */
-        std::cout << "publish topic:" << topic_pub_rxpk << std::endl;
-        mosquitto_publish(mosq, NULL, topic_pub_rxpk.c_str(), str_rxpk.length(), str_rxpk.c_str(), mqtt_qos, false);
-        /* clang-format on */
+        if (marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+            if (chirpstack_uplink_proto_write(&rxpk, session->gateway_eui, str_rxpk) < 0) {
+                continue;
+            }
+        } else {
+            chirpstack_uplink_json_write(&rxpk, gateway_id, str_rxpk);
+        }
+        publish_uplink_frame(worker, session, str_rxpk, worker->rx_us);
     }
 }
 
-static void publish_semtech_udp_uplink_json(const json &json_up)
+static void publish_semtech_udp_uplink_json(struct gateway_session *session, const json &json_up)
 {
-    string str_rxpk = json_up.dump();
-    std::cout << "publish topic:" << topic_pub_rxpk << std::endl;
-    mosquitto_publish(
-        mosq, NULL, topic_pub_rxpk.c_str(), str_rxpk.length(), str_rxpk.c_str(), mqtt_qos, false);
+    string        str_rxpk = json_up.dump();
+    const string &topic    = session->topic_pub_rxpk;
+    log_debug("publish topic:%s", topic.c_str());
+    publish_event(topic, str_rxpk.data(), str_rxpk.length());
 }
 
-static string get_iface_ip_address(void)
+/*
+ * nlohmann::json按键名排序输出，这些消息里gatewayID排在其余键之前，
+ * 把会话里预先拼好的字段放在对象开头，省去每次编码网关ID。
+ */
+static void chirpstack_json_write(const struct gateway_session *session, const json &body,
+                                  string &out)
 {
-    struct ifaddrs *ifaddr, *ifa;
-    char            ip[INET_ADDRSTRLEN];
-    auto            iface_name = "eth";
-
-    if (getifaddrs(&ifaddr) == -1) {
-        perror("Failed to get interface addresses");
-        return "";
-    }
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET) {
-            continue;
-        }
-        struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
-        inet_ntop(AF_INET, &(addr->sin_addr), ip, INET_ADDRSTRLEN);
-        if (strstr(ifa->ifa_name, iface_name)) {
-            printf("Interface: %s, IP: %s\n", ifa->ifa_name, ip);
-            freeifaddrs(ifaddr);
-            return string(ip);
-        }
+    string dump = body.dump();
+    out         = "{" + session->json_gateway_id;
+    if (dump.length() > 2) {
+        out += ',';
     }
+    out.append(dump, 1, string::npos);
+}
 
-    freeifaddrs(ifaddr);
-    return "";
+// 键的顺序为downlinkAck或downlinkException、gatewayID、gatewayTimestamp
+static void chirpstack_ack_json_write(const struct gateway_session *session, const char *key,
+                                      const json &value, string &out)
+{
+    out = "{\"" + string(key) + "\":" + value.dump() + ",";
+    out += session->json_gateway_id;
+    out += ",\"gatewayTimestamp\":" + to_string(time(nullptr)) + "}";
 }
 
-static void publish_chirpstack_format_stat_json(const json &json_stat)
+// 开启占空比限制时，各子频段窗口内已占用和允许的发射时间(ms)放进stat的metaData
+static void gateway_duty_cycle_meta(struct gateway_session *session,
+                                    vector<pair<string, string>> &meta)
 {
-    string str_stat;
-    json   json_pub;
-    json_pub["gatewayID"] = base_64_obj.encode(string(gateway_eui));
-    if (local_ip.empty()) {
-        local_ip       = get_iface_ip_address();
-        json_pub["ip"] = local_ip;
-    } else {
-        json_pub["ip"] = local_ip;
+    struct duty_cycle_usage usage[DUTY_CYCLE_BANDS_MAX];
+    size_t                  count =
+        session->ledger.usage(bridge_monotonic_us(), usage, DUTY_CYCLE_BANDS_MAX);
+
+    for (size_t i = 0; i < count; i++) {
+        string key = string("duty_cycle_") + usage[i].name;
+        meta.emplace_back(key + "_used_ms", to_string(usage[i].used_us / 1000));
+        meta.emplace_back(key + "_budget_ms", to_string(usage[i].budget_us / 1000));
     }
+}
+
+static void publish_chirpstack_format_stat_json(struct udp_worker *worker, const json &json_stat)
+{
+    vector<pair<string, string>> meta;
+    string                       str_stat;
+    json                        &json_pub = worker->json_pub;
+    struct gateway_session      *session  = worker->session;
+    json_pub.clear();
+    json_pub["ip"]   = netif_cache->ip();
     json_pub["time"] = json_stat["stat"]["time"];
 
     // GPS setting
@@ -389,19 +1202,55 @@ static void publish_chirpstack_format_stat_json(const json &json_stat)
     json_pub["txPacketsReceived"]   = json_stat["stat"]["dwnb"];
     json_pub["txPacketsEmitted"]    = json_stat["stat"]["txnb"];
 
-    str_stat = json_pub.dump();
-    std::cout << "publish topic:" << topic_pub_gateway_stat << std::endl;
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_gateway_stat.c_str(), str_stat.length(), str_stat.c_str(), mqtt_qos, false);
-    /* clang-format on */
+    gateway_duty_cycle_meta(session, meta);
+    for (const auto &entry : meta) { json_pub["metaData"][entry.first] = entry.second; }
+
+    chirpstack_json_write(session, json_pub, str_stat);
+    gateway_session_count(session->counters.stat);
+    log_debug("publish topic:%s", session->topic_pub_gateway_stat.c_str());
+    publish_event(session->topic_pub_gateway_stat, str_stat.data(), str_stat.length());
+}
+
+static void publish_chirpstack_format_stat_proto(struct udp_worker *worker, const json &json_stat)
+{
+    struct chirpstack_gateway_stats stats;
+    string                         &str_stat = worker->uplink_out;
+    struct gateway_session         *session  = worker->session;
+    const json                     &stat     = json_stat["stat"];
+    int32_t                         nanos;
+
+    stats.gateway_eui = session->gateway_eui;
+    stats.ip          = netif_cache->ip();
+    stats.time        = 0;
+    if (stat.contains("time") && stat["time"].is_string()) {
+        string time = stat["time"];
+        semtech_time_parse(time.c_str(), time.length(), &stats.time, &nanos);
+    }
+    stats.has_location           = stat.contains("lati") && stat.contains("long");
+    stats.latitude               = stat.value("lati", 0.0);
+    stats.longitude              = stat.value("long", 0.0);
+    stats.altitude               = stat.value("alti", 0.0);
+    stats.rx_packets_received    = stat.value("rxnb", 0u);
+    stats.rx_packets_received_ok = stat.value("rxok", 0u);
+    stats.tx_packets_received    = stat.value("dwnb", 0u);
+    stats.tx_packets_emitted     = stat.value("txnb", 0u);
+    gateway_duty_cycle_meta(session, stats.meta_data);
+
+    str_stat.clear();
+    chirpstack_stats_proto_write(&stats, str_stat);
+    gateway_session_count(session->counters.stat);
+    log_debug("publish topic:%s", session->topic_pub_gateway_stat.c_str());
+    publish_event(session->topic_pub_gateway_stat, str_stat.data(), str_stat.length());
 }
 
-static void publish_chirpstack_format_downlink_json(const json &json_downlink)
+static void publish_chirpstack_format_downlink_json(struct udp_worker *worker,
+                                                    const json        &json_downlink)
 {
-    string str_txpk;
-    json   json_pub;
-    double freq                     = 0.0;
-    json_pub["gatewayID"]           = base_64_obj.encode(string(gateway_eui));
+    string                  str_txpk;
+    json                   &json_pub = worker->json_pub;
+    struct gateway_session *session  = worker->session;
+    double                  freq     = 0.0;
+    json_pub.clear();
     json_pub["phyPayloadSize"]      = json_downlink["txpk"]["size"];
     json_pub["phyPayload"]          = json_downlink["txpk"]["data"];
     freq                            = json_downlink["txpk"]["freq"];
@@ -435,299 +1284,900 @@ static void publish_chirpstack_format_downlink_json(const json &json_downlink)
         json_pub["txInfo"]["modulationInfo"]["polarizationInversion"] =
             json_downlink["txpk"]["ipol"];
     }
-    if (json_downlink["txpk"]["imme"].is_boolean()) {
+    if (json_downlink["txpk"].contains("imme") && json_downlink["txpk"]["imme"].is_boolean()) {
         bool imme          = json_downlink["txpk"]["imme"];
         json_pub["timing"] = (imme == true) ? ("IMMEDIATELY") : ("DELAY");
     }
 
-    str_txpk = json_pub.dump();
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_downlink.c_str(), str_txpk.length(), str_txpk.c_str(), mqtt_qos, false);
-    /* clang-format on */
-    std::cout << "publish topic:" << topic_pub_downlink << ":" << json_downlink.dump() << std::endl;
+    chirpstack_json_write(session, json_pub, str_txpk);
+    mqtt_publish(session->topic_pub_downlink, str_txpk.c_str(), str_txpk.length());
+    log_debug("publish topic:%s:%s",
+              session->topic_pub_downlink.c_str(),
+              json_downlink.dump().c_str());
 }
 
-static void publish_semtech_udp_downlink_json(const json &json_downlink)
+static void publish_chirpstack_format_downlink_proto(struct udp_worker *worker,
+                                                     uint16_t           token,
+                                                     const json        &json_downlink)
 {
-    string str_txpk = json_downlink.dump();
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_downlink.c_str(), str_txpk.length(), str_txpk.c_str(), mqtt_qos, false);
-    /* clang-format on */
-    std::cout << "publish topic:" << topic_pub_downlink << ":" << str_txpk << std::endl;
-}
+    struct chirpstack_downlink downlink;
+    uint8_t                    phy_payload[LORA_PHY_PAYLOAD_MAX];
+    string                    &str_txpk = worker->uplink_out;
+    struct gateway_session    *session  = worker->session;
+
+    // txpk来自MQTT命令，必需的字段缺失或类型不对时不发布
+    auto txpk = json_downlink.find("txpk");
+    if (txpk == json_downlink.end() || !txpk->is_object()) {
+        log_warn("Downlink of gateway %s has no txpk object, skip publish.", session->eui_str);
+        return;
+    }
+    auto data = txpk->find("data");
+    auto freq = txpk->find("freq");
+    auto datr = txpk->find("datr");
+    if (data == txpk->end() || !data->is_string() || freq == txpk->end() || !freq->is_number() ||
+        datr == txpk->end() || !(datr->is_string() || datr->is_number_unsigned())) {
+        log_warn("Downlink of gateway %s has invalid data, freq or datr, skip publish.",
+                 session->eui_str);
+        return;
+    }
+    const string &text = data->get_ref<const string &>();
+    int           size =
+        base64_decode(text.data(), text.length(), phy_payload, sizeof(phy_payload));
+    if (size < 0) {
+        log_warn("Downlink of gateway %s has invalid base64 data, skip publish.",
+                 session->eui_str);
+        return;
+    }
+    downlink.gateway_eui      = session->gateway_eui;
+    downlink.token            = token;
+    downlink.phy_payload      = phy_payload;
+    downlink.phy_payload_len  = size;
+    downlink.frequency        = static_cast<uint32_t>(freq->get<double>() * 1000000);
+    downlink.power            = txpk->value("powe", 0);
+    downlink.fsk              = datr->is_number();
+    downlink.bandwidth        = 0;
+    downlink.spreading_factor = 0;
+    if (datr->is_string()) {
+        uint8_t  dr;
+        uint16_t bw;
+        if (parse_uplink_datr(datr->get<string>(), dr, bw) < 0) {
+            log_warn("Downlink of gateway %s has invalid datr, skip publish.", session->eui_str);
+            return;
+        }
+        downlink.bandwidth        = bw;
+        downlink.spreading_factor = dr;
+    }
+    downlink.code_rate              = txpk->value("codr", string());
+    downlink.polarization_inversion = txpk->value("ipol", false);
+    downlink.datarate               = downlink.fsk ? datr->get<uint32_t>() : 0;
+    downlink.frequency_deviation    = txpk->value("fdev", 0u);
+    downlink.tmst                   = txpk->value("tmst", 0u);
+    downlink.tmms                   = txpk->value("tmms", 0ull);
+    if (txpk->value("imme", false)) {
+        downlink.timing = CHIRPSTACK_TIMING_IMMEDIATELY;
+    } else if (txpk->contains("tmms")) {
+        downlink.timing = CHIRPSTACK_TIMING_GPS_EPOCH;
+    } else {
+        downlink.timing = CHIRPSTACK_TIMING_DELAY;
+    }
 
-static void publish_semtech_udp_stat_json(const json &json_stat)
-{
-    string str_stat = json_stat.dump();
-    std::cout << "publish topic:" << topic_pub_gateway_stat << std::endl;
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_gateway_stat.c_str(), str_stat.length(), str_stat.c_str(), mqtt_qos, false);
-    /* clang-format on */
+    str_txpk.clear();
+    chirpstack_downlink_proto_write(&downlink, str_txpk);
+    mqtt_publish(session->topic_pub_downlink, str_txpk.c_str(), str_txpk.length());
+    log_debug("publish topic:%s:%s",
+              session->topic_pub_downlink.c_str(),
+              json_downlink.dump().c_str());
 }
 
-static int response_pkt_push_data(evutil_socket_t fd)
+static void publish_semtech_udp_downlink_json(struct gateway_session *session,
+                                              const json             &json_downlink)
 {
-    json    uplink_json;
-    uint8_t ack[32] = { 0 };
-    ack[0]          = buffer_up[0];
-    ack[1]          = buffer_up[1];
-    ack[2]          = buffer_up[2];
-    ack[3]          = PKT_PUSH_ACK;
-    sendto(fd, ack, sizeof(ack), 0, (struct sockaddr *)&client_addr, client_len);
-    uplink_json.clear();
-    try {
-        uplink_json = json::parse(buffer_up + 12);
-        if (!topic_pub_gateway_stat.empty()) {
-            if (uplink_json.contains("stat")) {
-                publish_chirpstack_format_stat_json(uplink_json);
-            }
-        }
-        if (!topic_pub_rxpk.empty()) {
-            if (uplink_json.contains("rxpk")) {
-                publish_chirpstack_format_uplink_json(uplink_json);
-            }
-        }
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << '\n';
-        return -1;
-    }
-    return 0;
+    string        str_txpk = json_downlink.dump();
+    const string &topic    = session->topic_pub_downlink;
+    mqtt_publish(topic, str_txpk.c_str(), str_txpk.length());
+    log_debug("publish topic:%s:%s", topic.c_str(), str_txpk.c_str());
 }
 
-static void publish_chirpstack_format_downlink_ack_json(const json &json_downlink_ack)
+static void publish_semtech_udp_stat_json(struct gateway_session *session, const json &json_stat)
 {
-    string str_txack;
-    json   json_pub;
-    json_pub["gatewayID"]        = base_64_obj.encode(string(gateway_eui));
-    json_pub["gatewayTimestamp"] = time(nullptr);
-    json_pub["downlinkAck"]      = json_downlink_ack["txpk_ack"];
-    str_txack                    = json_pub.dump();
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_downlink_ack.c_str(), str_txack.length(), str_txack.c_str(), mqtt_qos, false);
-    std::cout << "publish topic:" << topic_pub_downlink_ack << ":" << str_txack << std::endl;
-    /* clang-format on */
+    string        str_stat = json_stat.dump();
+    const string &topic    = session->topic_pub_gateway_stat;
+    log_debug("publish topic:%s", topic.c_str());
+    publish_event(topic, str_stat.data(), str_stat.length());
 }
 
-static void publish_semtech_udp_downlink_ack(const json &json_downlink_ack)
+// 把当前数据报的ACK加入批次，由read_cb在批次末尾统一发送
+static void udp_worker_queue_ack(struct udp_worker *worker, uint8_t type)
 {
-    string str_txack = json_downlink_ack.dump();
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_downlink_ack.c_str(), str_txack.length(), str_txack.c_str(), mqtt_qos, false);
-    std::cout << "publish topic:" << topic_pub_downlink_ack << ":" << str_txack << std::endl;
+    uint32_t idx = worker->ack_count++;
+    uint8_t *ack = worker->acks[idx];
+    ack[0]       = worker->buffer_up[0];
+    ack[1]       = worker->buffer_up[1];
+    ack[2]       = worker->buffer_up[2];
+    ack[3]       = type;
+
+    worker->ack_addrs[idx]                   = worker->client_addr;
+    worker->ack_iovs[idx].iov_base           = ack;
+    worker->ack_iovs[idx].iov_len            = sizeof(worker->acks[idx]);
+    worker->ack_msgs[idx].msg_hdr.msg_name    = &worker->ack_addrs[idx];
+    worker->ack_msgs[idx].msg_hdr.msg_namelen = sizeof(worker->ack_addrs[idx]);
+    worker->ack_msgs[idx].msg_hdr.msg_iov     = &worker->ack_iovs[idx];
+    worker->ack_msgs[idx].msg_hdr.msg_iovlen  = 1;
 }
 
-static int recieve_pkt_tx_ack(evutil_socket_t fd)
+static void udp_worker_flush_acks(struct udp_worker *worker)
 {
-    /* clang-format on */
-    (void)fd;
-    json txack_json;
-    try {
-        txack_json = json::parse(buffer_up + 12);
-        if (!topic_pub_downlink_ack.empty()) {
-            if (txack_json.contains("txpk_ack")) {
-                publish_chirpstack_format_downlink_ack_json(txack_json);
+    uint32_t sent = 0;
+    while (sent < worker->ack_count) {
+        int n = sendmmsg(worker->fd, worker->ack_msgs + sent, worker->ack_count - sent, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
             }
+            log_warn("Failed to send %u ack(s): %s", worker->ack_count - sent, strerror(errno));
+            break;
         }
-
-    } catch (const std::exception &e) {
-        std::cout << "Tx packet ok." << std::endl;
+        sent += n;
+        bridge_metrics_add(BRIDGE_CNT_UDP_TX_BATCHES);
     }
-
-    return 0;
+    bridge_metrics_add(BRIDGE_CNT_UDP_TX_ACKS, sent);
+    worker->ack_count = 0;
 }
 
-static int response_pkt_pull_data(evutil_socket_t fd)
+static int response_pkt_push_data(struct udp_worker *worker)
 {
-    json downlink_json;
-    pthread_mutex_lock(&queue_downlink_mutex);
-    // 无数据下发则发ack，有数据则发数据
-    if (queue_downlink.empty()) {
-        uint8_t ack[32] = { 0 };
-        ack[0]          = buffer_up[0];
-        ack[1]          = buffer_up[1];
-        ack[2]          = buffer_up[2];
-        ack[3]          = PKT_PULL_ACK;
-        sendto(fd, ack, sizeof(ack), 0, (struct sockaddr *)&client_addr, client_len);
-    } else {
-        memset(buffer_down, 0, sizeof(buffer_down));
-        string downlink_msg = queue_downlink.front();
-        queue_downlink.pop();
-        buffer_down[0] = buffer_up[0];
-        buffer_down[1] = buffer_up[1];
-        buffer_down[2] = buffer_up[2];
-        buffer_down[3] = PKT_PULL_RESP;
-        memcpy(buffer_down + 4, downlink_msg.c_str(), downlink_msg.length());
-        /* clang-format off */
-        sendto(fd, buffer_down, sizeof(buffer_down), 0, (struct sockaddr *)&client_addr, client_len);
-        try {
-            downlink_json = json::parse(downlink_msg);
-            if (!topic_pub_downlink.empty()) {
-                if (downlink_json.contains("txpk")) {
-                    publish_chirpstack_format_downlink_json(downlink_json);
+    json                   &uplink_json = worker->uplink_json;
+    const char             *payload     = reinterpret_cast<const char *>(worker->buffer_up) + 12;
+    struct gateway_session *session     = worker->session;
+    struct json_span        root, key, value;
+    struct json_cursor      cursor;
+    int                     ret;
+
+    udp_worker_queue_ack(worker, PKT_PUSH_ACK);
+    if (json_scan_document(payload, worker->buffer_up_len - 12, &root) < 0 ||
+        json_scan_open(&root, &cursor) < 0 || root.type != JSON_SCAN_OBJECT) {
+        log_error("Invalid PUSH_DATA json from gateway %s", session->eui_str);
+        bridge_metrics_add(BRIDGE_CNT_UDP_PARSE_ERRORS);
+        return -1;
+    }
+    // 只遍历一次顶层成员，rxpk不经过DOM
+    while ((ret = json_scan_next_member(&cursor, &key, &value)) > 0) {
+        if (json_span_equals(&key, "rxpk") && value.type == JSON_SCAN_ARRAY) {
+            if (!session->topic_pub_rxpk.empty()) {
+                publish_chirpstack_format_uplink(worker, &value);
+            }
+        } else if (json_span_equals(&key, "stat") && value.type == JSON_SCAN_OBJECT) {
+            // stat每个统计周期才一包，仍用DOM处理
+            if (session->topic_pub_gateway_stat.empty()) {
+                continue;
+            }
+            try {
+                uplink_json.clear();
+                uplink_json["stat"] = json::parse(value.ptr, value.ptr + value.len);
+                if (marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+                    publish_chirpstack_format_stat_proto(worker, uplink_json);
+                } else {
+                    publish_chirpstack_format_stat_json(worker, uplink_json);
                 }
+            } catch (const std::exception &e) {
+                log_error("%s", e.what());
+                bridge_metrics_add(BRIDGE_CNT_UDP_PARSE_ERRORS);
+                return -1;
             }
-            /* clang-format on */
-        } catch (const std::exception &e) {
-            std::cerr << e.what() << '\n';
-            pthread_mutex_unlock(&queue_downlink_mutex);
-            return -1;
         }
     }
-    pthread_mutex_unlock(&queue_downlink_mutex);
+    if (ret < 0) {
+        bridge_metrics_add(BRIDGE_CNT_UDP_PARSE_ERRORS);
+        return -1;
+    }
     return 0;
 }
 
-static void read_cb(evutil_socket_t fd, short events, void *arg)
+static void publish_chirpstack_format_downlink_ack_json(struct gateway_session *session,
+                                                        const json             &json_downlink_ack)
 {
-    memset(buffer_up, 0, sizeof(buffer_up));
-    auto n =
-        recvfrom(fd, buffer_up, sizeof(buffer_up), 0, (struct sockaddr *)&client_addr, &client_len);
-    if (n <= 0 || static_cast<int>(buffer_up[0]) != PROTOCOL_VERSION) {
-        return;
+    string        str_txack;
+    const string &topic = session->topic_pub_downlink_ack;
+    chirpstack_ack_json_write(session, "downlinkAck", json_downlink_ack["txpk_ack"], str_txack);
+    mqtt_publish(topic, str_txack.c_str(), str_txack.length());
+    log_debug("publish topic:%s:%s", topic.c_str(), str_txack.c_str());
+}
+
+static void publish_chirpstack_format_downlink_ack_proto(struct gateway_session *session,
+                                                         uint16_t                token,
+                                                         const json             &json_downlink_ack)
+{
+    string        str_txack;
+    string        error;
+    string        downlink_id;
+    uint32_t      ack_token = token;
+    const string &topic     = session->topic_pub_downlink_ack;
+    const json   &ack       = json_downlink_ack["txpk_ack"];
+    if (ack.contains("error") && ack["error"].is_string()) {
+        error = ack["error"];
     }
-    int mode = static_cast<int>(buffer_up[3]);
-    if (map_udp_pkt_cb.count(mode)) {
-        // 执行消息处理的回调
-        int ret = map_udp_pkt_cb[mode](fd);
-        if (ret < 0) {
-            std::cout << "WARN: [readcb]Something went wrong.." << std::endl;
-        }
+    // 关联到下行命令的ack带命令的token和downlinkID
+    if (ack.contains("token") && ack["token"].is_number_unsigned()) {
+        ack_token = ack["token"];
+    }
+    if (ack.contains("downlinkID") && ack["downlinkID"].is_string()) {
+        downlink_id = ack["downlinkID"];
     }
+    chirpstack_downlink_ack_proto_write(
+        session->gateway_eui, ack_token, downlink_id, error, str_txack);
+    mqtt_publish(topic, str_txack.c_str(), str_txack.length());
+    log_debug("publish topic:%s:%s", topic.c_str(), json_downlink_ack.dump().c_str());
 }
 
-// UDP面向无连接， TCP面向缓冲区，前者不能用bufferevent
-static void bufferevent_read_cb(struct bufferevent *bev, void *ctx)
+static void publish_semtech_udp_downlink_ack(struct gateway_session *session,
+                                             const json             &json_downlink_ack)
 {
-    struct evbuffer *input = bufferevent_get_input(bev);
-    size_t           len   = evbuffer_get_length(input);
-    if (len > 0) {
-        std::vector<uint8_t> buffer(len);
-        evbuffer_copyout(input, buffer.data(), len);
-        // 处理接收到的LoRaWAN上行数据
-        // 清空缓冲区
-        evbuffer_drain(input, len);
-    }
+    string        str_txack = json_downlink_ack.dump();
+    const string &topic     = session->topic_pub_downlink_ack;
+    mqtt_publish(topic, str_txack.c_str(), str_txack.length());
+    log_debug("publish topic:%s:%s", topic.c_str(), str_txack.c_str());
 }
 
-static void publish_remote_downlink_items_exception(const string &exception)
+static void publish_downlink_ack(struct gateway_session *session, uint16_t token,
+                                 const json &txack_json)
 {
-    string str_txack;
-    json   json_pub;
-    json_pub["gatewayID"]         = base_64_obj.encode(string(gateway_eui));
-    json_pub["gatewayTimestamp"]  = time(nullptr);
-    json_pub["downlinkException"] = exception;
-    str_txack                     = json_pub.dump();
-    /* clang-format off */
-    mosquitto_publish(mosq, NULL, topic_pub_downlink_ack.c_str(), str_txack.length(), str_txack.c_str(), mqtt_qos, false);
-    std::cout << "publish topic:" << topic_pub_downlink_ack << ":" << str_txack << std::endl;
-    /* clang-format on */
+    if (txack_json.contains("txpk_ack") && marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+        publish_chirpstack_format_downlink_ack_proto(session, token, txack_json);
+    } else if (txack_json.contains("txpk_ack")) {
+        publish_chirpstack_format_downlink_ack_json(session, txack_json);
+    }
 }
 
-static void parse_remote_downlink_items_json(const json &json_dl)
+/*
+ * ack中带上下行命令的downlinkID和token(命令没带token时用PULL_RESP的token)，
+ * 以及从MQTT入队到现在的耗时，服务端据此把ack对应回命令。
+ */
+static void downlink_ack_context(json &ack, const struct scheduled_downlink &frame, uint16_t token,
+                                 uint64_t now_us)
 {
-    string base64_gwid = json_dl["gatewayID"];
-    if (base_64_obj.encode(string(gateway_eui)) != base64_gwid ||
-        // use for unit testing
-        base64_gwid != "0000000000000000") {
-        string err_msg = "Gateway ID  is not correct.";
-        std::cout << err_msg << std::endl;
-        publish_remote_downlink_items_exception(err_msg);
-        return;
+    if (!frame.downlink_id.empty()) {
+        ack["downlinkID"] = frame.downlink_id;
     }
-    json     json_udp;
-    string   modu;
-    float    freq;
-    uint32_t bw, sf;
-    string   str_udp;
-    try {
-        for (auto &txpk : json_dl["downlinkItems"]) {
-            json_udp.clear();
-            json_udp["txpk"]["data"] = txpk["phyPayload"];
-            json_udp["txpk"]["size"] = txpk["phyPayloadSize"];
-            //  CLASS A or CLASS C
-            string timing = txpk["txInfo"]["timing"];
-            if (timing == "IMMEDIATELY") {
-                json_udp["txpk"]["imme"] = true;
-            } else if (timing == "DELAY") {
-                json_udp["txpk"]["imme"] = false;
-                if (txpk.contains("timestamp")) {
-                    json_udp["txpk"]["tmst"] = txpk["txInfo"]["timestamp"];
-                } else {
-                    string err_msg = "Missing timestamp field.";
-                    std::cout << err_msg << std::endl;
-                    publish_remote_downlink_items_exception(err_msg);
-                }
-            } else {
-                string err_msg = "Error: Unrecognized timing type.";
-                std::cout << err_msg << std::endl;
-                publish_remote_downlink_items_exception(err_msg);
-            }
-            json_udp["txpk"]["powe"] = txpk["txInfo"]["power"];
-            freq                     = txpk["txInfo"]["frequency"];
-            json_udp["txpk"]["freq"] = static_cast<float>(freq) / 1000000.0f;
-            modu                     = txpk["modulation"];
-            json_udp["txpk"]["modu"] = modu;
-            if (modu == "LORA") {
-                json_udp["txpk"]["rfch"] = 0;
-                bw                       = txpk["txInfo"]["modulationInfo"]["bandwidth"];
-                sf                       = txpk["txInfo"]["modulationInfo"]["spreadingFactor"];
-                string datr              = "SF" + to_string(sf) + "BW" + to_string(bw);
-                json_udp["txpk"]["datr"] = datr;
-                json_udp["txpk"]["codr"] = txpk["txInfo"]["modulationInfo"]["codeRate"];
-                json_udp["txpk"]["ipol"] =
-                    txpk["txInfo"]["modulationInfo"]["polarizationInversion"];
-            } else if (modu == "FSK") {
-                //只能是0
-                json_udp["txpk"]["rfch"] = 0;
-                // json_udp["txpk"]["rfch"] = txpk["txInfo"]["modulationInfo"]["rfChain"];
-                json_udp["txpk"]["datr"] = txpk["txInfo"]["modulationInfo"]["FSKDataRate"];
-                json_udp["txpk"]["fdev"] = txpk["txInfo"]["modulationInfo"]["FSKFreqDev"];
-            } else {
-                string err_msg = "ERROR modulation.";
-                std ::cout << err_msg << std::endl;
-                publish_remote_downlink_items_exception(err_msg);
-                return;
-            }
-            if (txpk["txInfo"].contains("preambleSize")) {
-                json_udp["txpk"]["prea"] = txpk["txInfo"]["preambleSize"];
-            }
-            if (txpk["txInfo"].contains("noCRC")) {
-                json_udp["txpk"]["ncrc"] = txpk["txInfo"]["noCRC"];
+    ack["token"]     = frame.command_token ? frame.command_token : token;
+    ack["latencyUs"] = now_us - frame.enqueue_us;
+}
+
+// 不下发的下行在ack topic上带原因报告给服务端
+static void publish_downlink_error(struct gateway_session          *session,
+                                   const struct scheduled_downlink &frame, const char *reason)
+{
+    json     txack_json;
+    uint16_t token = ++session->downlink_token;
+
+    if (session->topic_pub_downlink_ack.empty()) {
+        return;
+    }
+    txack_json["txpk_ack"]["error"] = reason;
+    downlink_ack_context(txack_json["txpk_ack"], frame, token, bridge_monotonic_us());
+    publish_downlink_ack(session, token, txack_json);
+}
+
+// 错过发射窗口的下行
+static void report_downlink_expired(struct gateway_session          *session,
+                                    const struct scheduled_downlink &frame, const char *reason)
+{
+    gateway_session_count(session->counters.downlink_expired);
+    bridge_metrics_add(BRIDGE_CNT_DOWNLINK_EXPIRED);
+    log_warn("Downlink of gateway %s missed its window (%s), drop downlink.",
+             session->eui_str,
+             reason);
+    publish_downlink_error(session, frame, reason);
+}
+
+// 与在途发射重叠或超出占空比的下行
+static void report_downlink_rejected(struct gateway_session          *session,
+                                     const struct scheduled_downlink &frame, const char *reason,
+                                     enum bridge_counter counter)
+{
+    gateway_session_count(session->counters.downlink_rejected);
+    bridge_metrics_add(counter);
+    log_warn("Downlink of gateway %s rejected (%s), drop downlink.", session->eui_str, reason);
+    publish_downlink_error(session, frame, reason);
+}
+
+/*
+ * 在网关的发射账本上为下行记账，start_known为false时发射时刻未知，只记占空比。
+ * 立即发送的帧与在途发射重叠时顺延，due_us改为顺延后的发射时刻；
+ * 不能下发的帧报告原因后返回-1。
+ */
+static int reserve_downlink_airtime(struct gateway_session *session, uint32_t frequency,
+                                    bool start_known, uint64_t now_us,
+                                    struct scheduled_downlink &frame)
+{
+    uint64_t start   = frame.due_us;
+    uint64_t defer   = frame.timed ? 0 : DOWNLINK_DEFER_MAX;
+    int      verdict = session->ledger.reserve(frequency,
+                                               frame.airtime_us,
+                                               now_us,
+                                               start_known ? &start : nullptr,
+                                               defer,
+                                               &frame.reservation);
+
+    if (verdict == AIRTIME_COLLISION) {
+        report_downlink_rejected(
+            session, frame, "COLLISION_PACKET", BRIDGE_CNT_DOWNLINK_COLLISIONS);
+        return -1;
+    }
+    if (verdict == AIRTIME_DUTY_CYCLE) {
+        report_downlink_rejected(
+            session, frame, "DUTY_CYCLE_OVERFLOW", BRIDGE_CNT_DOWNLINK_DUTY_CYCLE);
+        return -1;
+    }
+    if (start != frame.due_us) {
+        bridge_metrics_add(BRIDGE_CNT_DOWNLINK_DEFERRED);
+        log_debug("Downlink of gateway %s deferred %lluus.",
+                  session->eui_str,
+                  (unsigned long long)(start - frame.due_us));
+        frame.due_us = start;
+    }
+    return 0;
+}
+
+/*
+ * 把无锁队列里的新下行按释放时刻放进会话的调度堆。
+ * 带tmst的帧用集中器时钟估计换算成本地时间，已经来不及的直接报告:
+ * 入队时还来得及的是在bridge里过期(EXPIRED)，否则是到达就太晚(TOO_LATE)。
+ * 还没有时钟估计(没收到过上行)时tmst帧按立即发送处理。
+ * 能算出空中时间的帧随后在发射账本上记账，见reserve_downlink_airtime。
+ */
+static void udp_worker_schedule_downlinks(struct gateway_session *session)
+{
+    struct scheduled_downlink frame;
+    struct txpk_airtime       txpk;
+    uint32_t                  tmst     = 0;
+    int64_t                   delta_us = 0;
+    uint64_t                  now_us   = bridge_monotonic_us();
+    auto                      take     = [&frame](struct downlink_frame &queued) {
+        frame.enqueue_us    = queued.enqueue_us;
+        frame.attempts      = 0;
+        frame.command_token = queued.command_token;
+        frame.downlink_id.assign(queued.downlink_id, queued.id_len);
+        frame.payload.assign(queued.payload, queued.len);
+    };
+
+    while (session->queue_downlink.pop(take)) {
+        const char *payload     = frame.payload.data();
+        size_t      len         = frame.payload.length();
+        int         timing      = downlink_txpk_timing(payload, len, &tmst);
+        bool        start_known = true;
+
+        // 立即发送的帧在forwarder里还要等TX_JIT_DELAY才发射
+        frame.due_us = now_us + DOWNLINK_TX_JIT_US;
+        frame.timed  = false;
+        if (timing == DOWNLINK_TIMING_TMST &&
+            gateway_session_tmst_delta(session, tmst, now_us, &delta_us) == 0) {
+            if (delta_us < DOWNLINK_MIN_MARGIN_US) {
+                int64_t     waited = static_cast<int64_t>(now_us - frame.enqueue_us);
+                const char *reason =
+                    (delta_us + waited >= DOWNLINK_MIN_MARGIN_US) ? "EXPIRED" : "TOO_LATE";
+                report_downlink_expired(session, frame, reason);
+                continue;
             }
-            if (txpk["txInfo"].contains("noHeader")) {
-                json_udp["txpk"]["nhdr"] = txpk["txInfo"]["noHeader"];
+            frame.due_us = now_us + delta_us;
+            frame.timed  = true;
+        } else if (timing == DOWNLINK_TIMING_TMST) {
+            start_known = false; // forwarder按tmst发射，对应的本地时刻未知
+        }
+        frame.airtime_us             = 0;
+        frame.reservation.airtime_us = 0;
+        if (downlink_txpk_airtime(payload, len, &txpk) == 0) {
+            frame.airtime_us = txpk_airtime_us(&txpk);
+        }
+        if (frame.airtime_us > 0 &&
+            reserve_downlink_airtime(session, txpk.frequency, start_known, now_us, frame) < 0) {
+            continue;
+        }
+        if (frame.timed) {
+            frame.release_us =
+                (frame.due_us > downlink_lead_us) ? frame.due_us - downlink_lead_us : 0;
+        } else if (frame.due_us > now_us + DOWNLINK_TX_JIT_US) {
+            frame.release_us = frame.due_us - DOWNLINK_TX_JIT_US; // 顺延的帧到点再交给网关
+        } else {
+            frame.release_us = frame.enqueue_us;
+        }
+        session->scheduler.push(std::move(frame));
+    }
+}
+
+// 按该网关下一个下行的释放时刻设置worker的定时器
+static void udp_worker_arm_schedule(struct udp_worker *worker, struct gateway_session *session)
+{
+    uint64_t release_us;
+
+    if (session->scheduler.next_release(&release_us)) {
+        udp_worker_arm_timer(worker->schedule_ev, &worker->schedule_at_us, release_us);
+    }
+}
+
+/*
+ * 把调度堆中到了释放时刻的下行以PULL_RESP发往最近的PULL_DATA地址，
+ * 更晚的留在堆里等定时器。只在该网关的pull worker上调用。
+ */
+static void udp_worker_send_downlinks(struct udp_worker *worker, struct gateway_session *session)
+{
+    json                      downlink_json;
+    struct scheduled_downlink frame;
+    uint64_t                  now_us;
+    uint8_t                   header[4];
+    struct iovec              iov[2];
+    struct msghdr             msg = {};
+
+    worker->session = session;
+    udp_worker_schedule_downlinks(session);
+    while (session->scheduler.pop_ready(now_us = bridge_monotonic_us(), frame)) {
+        if (frame.timed && frame.due_us < now_us + DOWNLINK_MIN_MARGIN_US) {
+            session->ledger.release(&frame.reservation);
+            report_downlink_expired(session, frame, "EXPIRED");
+            continue;
+        }
+        // v2协议PULL_RESP的token由服务端生成，TX_ACK会带回
+        uint16_t token = ++session->downlink_token;
+        header[0]      = PROTOCOL_VERSION;
+        header[1]      = token >> 8;
+        header[2]      = token & 0xff;
+        header[3]      = PKT_PULL_RESP;
+        // 头部和txpk分两段发出，只带上txpk末尾的结束符
+        iov[0].iov_base = header;
+        iov[0].iov_len  = sizeof(header);
+        iov[1].iov_base = const_cast<char *>(frame.payload.c_str());
+        iov[1].iov_len  = frame.payload.length() + 1;
+        msg.msg_name    = &session->pull_addr;
+        msg.msg_namelen = sizeof(session->pull_addr);
+        msg.msg_iov     = iov;
+        msg.msg_iovlen  = 2;
+        ssize_t sent    = sendmsg(worker->fd, &msg, 0);
+        if (sent > 0) {
+            bridge_metrics_add(BRIDGE_CNT_DOWNLINK_TX_BYTES, sent);
+        }
+        bridge_metrics_add(BRIDGE_CNT_DOWNLINK_AIRTIME_US, frame.airtime_us);
+        // 定时帧和顺延的帧从释放时刻算起，不计按计划等待的时间
+        uint64_t ready_us = (frame.release_us > frame.enqueue_us) ? frame.release_us
+                                                                   : frame.enqueue_us;
+        uint64_t sent_us = bridge_monotonic_us();
+        uint64_t latency = sent_us - ready_us;
+        gateway_session_count(session->counters.downlink_sent);
+        bridge_metrics_add(BRIDGE_CNT_DOWNLINK_SENT);
+        bridge_metrics_add(BRIDGE_CNT_DOWNLINK_LATENCY_US, latency);
+        bridge_metrics_set_max(BRIDGE_CNT_DOWNLINK_LATENCY_MAX_US, latency);
+        bridge_metrics_observe(BRIDGE_HIST_DOWNLINK_SEND_US, sent_us - frame.enqueue_us);
+        if (!session->topic_pub_downlink.empty()) {
+            try {
+                downlink_json = json::parse(frame.payload);
+                if (downlink_json.contains("txpk") &&
+                    marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+                    publish_chirpstack_format_downlink_proto(worker, token, downlink_json);
+                } else if (downlink_json.contains("txpk")) {
+                    publish_chirpstack_format_downlink_json(worker, downlink_json);
+                }
+            } catch (const std::exception &e) {
+                log_error("%s", e.what());
             }
-            str_udp.clear();
-            str_udp = json_udp.dump();
-            pthread_mutex_lock(&queue_downlink_mutex);
-            queue_downlink.push(str_udp);
-            pthread_mutex_unlock(&queue_downlink_mutex);
         }
-    } catch (const nlohmann::json::exception &e) {
-        publish_remote_downlink_items_exception(string(e.what()));
+        // 记下帧本身，等TX_ACK时关联或重发
+        if (session->tracker.track(token, sent_us, std::move(frame))) {
+            bridge_metrics_add(BRIDGE_CNT_DOWNLINK_ACK_MISSING);
+        }
+    }
+    udp_worker_arm_schedule(worker, session);
+}
+
+static bool downlink_retryable(const string &error)
+{
+    for (const auto &name : downlink_retry_on) {
+        if (name == error) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * TX_ACK报了downlink_retry_errors中的错误时，隔DOWNLINK_RETRY_DELAY_US把帧放回
+ * 调度堆重发，成功放回返回0。调度堆只由pull worker访问，TX_ACK落在其他worker上
+ * (网关换了端口)时不重发；定时帧在重发后来不及发射时也不重发。
+ * 原来的账已由调用者退回，重发按新的发射时刻重新记账，记账被拒的帧已报告
+ * 原因，同样返回0。
+ */
+static int udp_worker_retry_downlink(struct udp_worker *worker, struct scheduled_downlink &frame,
+                                     const string &error, uint64_t now_us)
+{
+    struct gateway_session *session    = worker->session;
+    uint64_t                release_us = now_us + DOWNLINK_RETRY_DELAY_US;
+    uint32_t                frequency  = frame.reservation.frequency;
+
+    if (frame.attempts >= downlink_retry_max || !downlink_retryable(error) ||
+        session->pull_worker_id.load(memory_order_relaxed) != worker->id) {
+        return -1;
+    }
+    if (frame.timed && frame.due_us < release_us + DOWNLINK_MIN_MARGIN_US) {
+        return -1;
+    }
+    if (!frame.timed) {
+        frame.due_us = release_us + DOWNLINK_TX_JIT_US;
+    }
+    if (frame.airtime_us > 0 &&
+        reserve_downlink_airtime(session, frequency, frame.reservation.busy, now_us, frame) < 0) {
+        return 0;
+    }
+    frame.attempts++;
+    frame.release_us = release_us;
+    if (!frame.timed && frame.due_us > release_us + DOWNLINK_TX_JIT_US) {
+        frame.release_us = frame.due_us - DOWNLINK_TX_JIT_US; // 顺延的帧到点再交给网关
+    }
+    bridge_metrics_add(BRIDGE_CNT_DOWNLINK_RETRIES);
+    log_info("Downlink of gateway %s got %s, retry %u/%u.",
+             session->eui_str,
+             error.c_str(),
+             frame.attempts,
+             downlink_retry_max);
+    session->scheduler.push(std::move(frame));
+    udp_worker_arm_schedule(worker, session);
+    return 0;
+}
+
+/*
+ * 按token取回PULL_RESP发出时记下的下行，ack中带上命令的downlinkID、token和
+ * 从MQTT入队到收到TX_ACK的耗时。重发的帧不发布ack，等最后一次的TX_ACK。
+ */
+static int recieve_pkt_tx_ack(struct udp_worker *worker)
+{
+    struct gateway_session *session = worker->session;
+    struct downlink_context ctx;
+    json                    txack_json;
+    string                  error  = "NONE";
+    uint16_t                token  = (worker->buffer_up[1] << 8) | worker->buffer_up[2];
+    uint64_t                now_us = bridge_monotonic_us();
+
+    if (worker->buffer_up_len > 12) {
+        try {
+            txack_json = json::parse(worker->buffer_up + 12);
+        } catch (const std::exception &e) {
+            bridge_metrics_add(BRIDGE_CNT_UDP_PARSE_ERRORS);
+            return 0;
+        }
+    } else {
+        txack_json["txpk_ack"]["error"] = error; // 没有payload的TX_ACK表示发送成功
+    }
+    auto ack = txack_json.find("txpk_ack");
+    if (ack == txack_json.end() || !ack->is_object()) {
+        return 0;
+    }
+    if (ack->contains("error") && (*ack)["error"].is_string()) {
+        error = (*ack)["error"];
+    }
+    if (session->tracker.take(token, ctx)) {
+        log_debug("TX_ACK of gateway %s token %u: %s, %lluus after PULL_RESP.",
+                  session->eui_str,
+                  token,
+                  error.c_str(),
+                  (unsigned long long)(now_us - ctx.sent_us));
+        // TX_POWER时forwarder降功率照常发射，其他错误都没有发射，退回所记的账
+        if (error != "NONE" && error != "TX_POWER") {
+            session->ledger.release(&ctx.frame.reservation);
+        }
+        if (error != "NONE" && udp_worker_retry_downlink(worker, ctx.frame, error, now_us) == 0) {
+            return 0;
+        }
+        downlink_ack_context(*ack, ctx.frame, token, now_us);
+        bridge_metrics_observe(BRIDGE_HIST_DOWNLINK_ACK_US, now_us - ctx.frame.enqueue_us);
+    }
+    if (!session->topic_pub_downlink_ack.empty()) {
+        publish_downlink_ack(session, token, txack_json);
+    }
+    return 0;
+}
+
+// 定时器到点，发出本worker各会话中到了释放时刻的下行
+static void downlink_schedule_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    struct udp_worker *worker = static_cast<struct udp_worker *>(user_data);
+    worker->schedule_at_us    = 0;
+    gateway_sessions->for_each([worker](struct gateway_session *session) {
+        if (session->pull_worker_id.load(memory_order_relaxed) == worker->id &&
+            session->scheduler.size() > 0) {
+            udp_worker_send_downlinks(worker, session);
+        }
+    });
+}
+
+// 有下行的会话由MQTT线程标记dispatch_pending，这里逐个取出发送
+static void downlink_dispatch_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    struct udp_worker *worker = static_cast<struct udp_worker *>(user_data);
+    gateway_sessions->for_each([worker](struct gateway_session *session) {
+        if (session->pull_worker_id.load(memory_order_relaxed) == worker->id &&
+            session->dispatch_pending.exchange(false)) {
+            udp_worker_send_downlinks(worker, session);
+        }
+    });
+}
+
+// PULL_DATA总是回PULL_ACK，顺带发出还在队列里的下行
+static int response_pkt_pull_data(struct udp_worker *worker)
+{
+    udp_worker_queue_ack(worker, PKT_PULL_ACK);
+    udp_worker_send_downlinks(worker, worker->session);
+    return 0;
+}
+
+/*
+ * MQTT线程调用: 入队后唤醒该网关的pull worker立即下发，不等下一个PULL_DATA。
+ * 还没收到过PULL_DATA的网关只入队，等第一个PULL_DATA时发出。
+ */
+static void gateway_session_enqueue_downlink(struct gateway_session                   *session,
+                                             const char                               *payload,
+                                             size_t                                    len,
+                                             const struct chirpstack_downlink_command *command)
+{
+    bridge_metrics_add(BRIDGE_CNT_TXPK);
+    if (gateway_session_push_downlink(session,
+                                      payload,
+                                      len,
+                                      command->downlink_id.ptr,
+                                      command->downlink_id.len,
+                                      command->token,
+                                      downlink_overflow_policy) < 0) {
+        log_warn("Downlink queue of gateway %s is full or frame too long, drop downlink.",
+                 session->eui_str);
+    }
+    int id = session->pull_worker_id.load(memory_order_acquire);
+    if (id >= 0 && !session->dispatch_pending.exchange(true)) {
+        event_active(udp_worker_list[id]->downlink_ev, EV_WRITE, 0);
+    }
+}
+
+static struct gateway_session *gateway_session_create(uint64_t eui)
+{
+    struct gateway_session *session =
+        new gateway_session(eui, downlink_queue_size, duty_cycle_region_type);
+    string prefix = string("gateway/") + string(session->eui_str) + string("/event/");
+    session->topic_pub_rxpk         = prefix + string("up");
+    session->topic_pub_rxpk_batch   = session->topic_pub_rxpk + UPLINK_BATCH_TOPIC_SUFFIX;
+    session->topic_pub_rxpk_set     = session->topic_pub_rxpk + UPLINK_DEDUP_SET_TOPIC_SUFFIX;
+    session->topic_pub_downlink     = prefix + string("down");
+    session->topic_pub_downlink_ack = prefix + string("ack");
+    session->topic_pub_gateway_stat = prefix + string("stat");
+    session->topic_sub_txpk         = prefix + string("tx");
+
+    struct gateway_session *stored = gateway_sessions->insert(session);
+    if (stored != session) {
+        // 其他线程已创建或会话表已满
+        delete session;
+        return stored;
+    }
+    log_info("New gateway %s, %u gateway(s) online", session->eui_str, gateway_sessions->size());
+    // 未连接时订阅失败，on_connect会统一补订阅
+    mosquitto_subscribe(mosq, NULL, session->topic_sub_txpk.c_str(), mqtt_qos);
+    return session;
+}
+
+// 根据头部的网关EUI找到会话，O(1)且无锁，首次出现的网关自动建会话
+static struct gateway_session *udp_worker_lookup_session(struct udp_worker *worker)
+{
+    uint64_t                eui     = gateway_eui_from_header(worker->buffer_up);
+    struct gateway_session *session = gateway_sessions->find(eui);
+    if (session == nullptr) {
+        session = gateway_session_create(eui);
+        if (session == nullptr) {
+            bridge_metrics_add(BRIDGE_CNT_GATEWAYS_REFUSED);
+            log_warn("Gateway table is full, drop datagram.");
+            return nullptr;
+        }
+    }
+    return session;
+}
+
+static void udp_worker_handle_datagram(struct udp_worker *worker)
+{
+    uint8_t *buffer_up = worker->buffer_up;
+    if (worker->buffer_up_len < 12 || static_cast<int>(buffer_up[0]) != PROTOCOL_VERSION) {
+        bridge_metrics_add(BRIDGE_CNT_UDP_INVALID);
+        return;
+    }
+    int mode = static_cast<int>(buffer_up[3]);
+    if (!map_udp_pkt_cb.count(mode)) {
+        bridge_metrics_add(BRIDGE_CNT_UDP_INVALID);
+    } else {
+        struct gateway_session *session = udp_worker_lookup_session(worker);
+        if (session == nullptr) {
+            return;
+        }
+        worker->session = session;
+        if (mode == PKT_PUSH_DATA || mode == PKT_PULL_DATA) {
+            session->last_seen_us.store(worker->rx_us, memory_order_relaxed);
+        }
+        if (mode == PKT_PUSH_DATA) {
+            session->push_addr = worker->client_addr;
+            gateway_session_count(session->counters.push_data);
+            bridge_metrics_add(BRIDGE_CNT_UDP_PUSH_DATA);
+        } else if (mode == PKT_PULL_DATA) {
+            session->pull_addr     = worker->client_addr;
+            session->has_pull_addr = true;
+            session->pull_worker_id.store(worker->id, memory_order_release);
+            gateway_session_count(session->counters.pull_data);
+            bridge_metrics_add(BRIDGE_CNT_UDP_PULL_DATA);
+        } else if (mode == PKT_TX_ACK) {
+            gateway_session_count(session->counters.tx_ack);
+            bridge_metrics_add(BRIDGE_CNT_UDP_TX_ACK);
+        }
+        // 执行消息处理的回调
+        int ret = map_udp_pkt_cb.at(mode)(worker);
+        if (ret < 0) {
+            log_warn("[readcb]Something went wrong..");
+        }
+    }
+}
+
+static void read_cb(evutil_socket_t fd, short events, void *arg)
+{
+    struct udp_worker *worker = static_cast<struct udp_worker *>(arg);
+    for (uint32_t i = 0; i < worker->batch_size; i++) {
+        worker->rx_msgs[i].msg_hdr.msg_namelen = sizeof(worker->rx_addrs[i]);
+    }
+    // 一次唤醒最多收取batch_size个数据报
+    int n = recvmmsg(fd, worker->rx_msgs, worker->batch_size, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        return;
+    }
+    worker->rx_us = bridge_monotonic_us();
+    bridge_metrics_add(BRIDGE_CNT_UDP_RX_WAKEUPS);
+    bridge_metrics_add(BRIDGE_CNT_UDP_RX_DATAGRAMS, n);
+    for (int i = 0; i < n; i++) {
+        worker->buffer_up     = worker->rx_slab->slot(i);
+        worker->buffer_up_len = worker->rx_msgs[i].msg_len;
+        // 上层按C字符串解析json，只在数据末尾补0
+        worker->buffer_up[worker->buffer_up_len] = 0;
+        worker->client_addr                      = worker->rx_addrs[i];
+        worker->client_len                       = worker->rx_msgs[i].msg_hdr.msg_namelen;
+        udp_worker_handle_datagram(worker);
+    }
+    udp_worker_flush_acks(worker);
+}
+
+// UDP面向无连接， TCP面向缓冲区，前者不能用bufferevent
+static void bufferevent_read_cb(struct bufferevent *bev, void *ctx)
+{
+    struct evbuffer *input = bufferevent_get_input(bev);
+    size_t           len   = evbuffer_get_length(input);
+    if (len > 0) {
+        std::vector<uint8_t> buffer(len);
+        evbuffer_copyout(input, buffer.data(), len);
+        // 处理接收到的LoRaWAN上行数据
+        // 清空缓冲区
+        evbuffer_drain(input, len);
+    }
+}
+
+static void publish_remote_downlink_items_exception(struct gateway_session *session,
+                                                    const string           &exception)
+{
+    string        str_txack;
+    const string &topic = session->topic_pub_downlink_ack;
+    if (marshaler_type == BRIDGE_MARSHALER_PROTOBUF) {
+        // 下行命令在桥内被拒绝，没有对应的PULL_RESP token
+        chirpstack_downlink_ack_proto_write(session->gateway_eui, 0, "", exception, str_txack);
+    } else {
+        chirpstack_ack_json_write(session, "downlinkException", json(exception), str_txack);
+    }
+    mqtt_publish(topic, str_txack.c_str(), str_txack.length());
+    log_debug("publish topic:%s:%s", topic.c_str(), str_txack.c_str());
+}
+
+/*
+ * 在MQTT报文上逐项把downlinkItems写成txpk入队。出错的项报告原因后跳过，
+ * 不影响同一命令中的其他项。
+ */
+static void parse_remote_downlink_items(struct gateway_session                   *session,
+                                        const struct chirpstack_downlink_command *command)
+{
+    struct json_cursor cursor;
+    struct json_span   item;
+    char               txpk[DOWNLINK_FRAME_MAX];
+    const char        *error;
+    int                len, ret;
+
+    // 只接受发给本网关的命令，gatewayID为该网关EUI的base64
+    if (command->gateway_id.type != JSON_SCAN_STRING ||
+        !json_span_equals(&command->gateway_id, session->gateway_id.c_str())) {
+        string err_msg = "Gateway ID  is not correct.";
+        log_warn("%s", err_msg.c_str());
+        publish_remote_downlink_items_exception(session, err_msg);
+        return;
+    }
+    if (command->items.type != JSON_SCAN_ARRAY || json_scan_open(&command->items, &cursor) < 0) {
+        bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
+        publish_remote_downlink_items_exception(session, "Invalid downlinkItems field.");
+        return;
+    }
+    while ((ret = json_scan_next_element(&cursor, &item)) > 0) {
+        len = chirpstack_downlink_item_txpk(&item, txpk, sizeof(txpk), &error);
+        if (len < 0) {
+            bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
+            log_warn("%s", error);
+            publish_remote_downlink_items_exception(session, error);
+            continue;
+        }
+        gateway_session_enqueue_downlink(session, txpk, len, command);
+    }
+}
+
+/*
+ * protobuf DownlinkFrame同样逐项写成txpk。gateway_id可以省略(topic已经
+ * 确定了网关)，出现时必须与会话一致。
+ */
+static void parse_remote_downlink_frame(struct gateway_session                   *session,
+                                        const struct chirpstack_downlink_command *command)
+{
+    struct downlink_proto_cursor cursor;
+    const uint8_t               *item;
+    size_t                       item_len;
+    char                         txpk[DOWNLINK_FRAME_MAX];
+    const char                  *error;
+    int                          len, ret;
+
+    if (command->has_gateway_eui && command->gateway_eui != session->gateway_eui &&
+        command->gateway_eui != 0) {
+        string err_msg = "Gateway ID  is not correct.";
+        log_warn("%s", err_msg.c_str());
+        publish_remote_downlink_items_exception(session, err_msg);
+        return;
+    }
+    chirpstack_downlink_proto_open(command, &cursor);
+    while ((ret = chirpstack_downlink_proto_next(&cursor, &item, &item_len)) > 0) {
+        len = chirpstack_downlink_proto_item_txpk(item, item_len, txpk, sizeof(txpk), &error);
+        if (len < 0) {
+            bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
+            log_warn("%s", error);
+            publish_remote_downlink_items_exception(session, error);
+            continue;
+        }
+        gateway_session_enqueue_downlink(session, txpk, len, command);
+    }
+    if (ret < 0) {
+        bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
+        publish_remote_downlink_items_exception(session, "Invalid downlink items.");
     }
-    return;
 }
 
 static void
 on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
 {
-    json json_downlink;
-    std::cout << "Received MQTT message on topic: " << message->topic << std::endl;
-    std::string payload(static_cast<const char *>(message->payload), message->payloadlen);
-    try {
-        json_downlink = json::parse(payload);
-    } catch (const json::exception &) {
-        std::cout << "Invalid json: " << std::endl;
+    struct chirpstack_downlink_command command;
+    log_debug("Received MQTT message on topic: %s", message->topic);
+    // 按订阅topic找到目标网关
+    struct gateway_session *session = gateway_sessions->find_by_topic(string(message->topic));
+    if (session == nullptr) {
+        log_warn("Unknown gateway topic: %s", message->topic);
+        return;
+    }
+    // 只扫描用到的字段，不建DOM
+    const char *payload = static_cast<const char *>(message->payload);
+    // protobuf的DownlinkFrame不会以'{'开头(字段15的group)，JSON命令两种marshaler下都接受
+    if (marshaler_type == BRIDGE_MARSHALER_PROTOBUF && message->payloadlen > 0 &&
+        payload[0] != '{') {
+        if (chirpstack_downlink_command_proto_parse(payload, message->payloadlen, &command) < 0) {
+            log_warn("Invalid protobuf on topic %s", message->topic);
+            bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
+            return;
+        }
+        parse_remote_downlink_frame(session, &command);
+        return;
+    }
+    if (chirpstack_downlink_command_parse(payload, message->payloadlen, &command) < 0) {
+        log_warn("Invalid json on topic %s", message->topic);
+        bridge_metrics_add(BRIDGE_CNT_MQTT_PARSE_ERRORS);
         return;
     }
     // semtech udp type packet
-    if (json_downlink.contains("txpk")) {
-        pthread_mutex_lock(&queue_downlink_mutex);
-        queue_downlink.push(payload);
-        pthread_mutex_unlock(&queue_downlink_mutex);
-    } else if (json_downlink.contains("downlinkItems")) {
-        parse_remote_downlink_items_json(json_downlink);
+    if (command.txpk.type != JSON_SCAN_NONE) {
+        gateway_session_enqueue_downlink(session, payload, message->payloadlen, &command);
+    } else if (command.items.type != JSON_SCAN_NONE) {
+        parse_remote_downlink_items(session, &command);
     }
 }
 
@@ -737,36 +2187,16 @@ static int parse_bridge_toml_file(void)
     try { // 读取lorabridge toml 配置参数
         toml.get_bridge_config_info();
     } catch (const std::exception &e) {
-        std::cerr << e.what() << '\n';
+        log_error("%s", e.what());
         return -1;
     }
     return 0;
 }
 
-static int get_local_eth_mac(unsigned char *mac_address)
-{
-    struct ifreq ifr;
-    int          sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        std::cerr << "Failed to socket." << '\n';
-        return -1;
-    }
-    strncpy(ifr.ifr_name, ETH_NAME_DEFAULT, IFNAMSIZ - 1);
-    if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
-        std::cerr << "Failed to ioctl." << '\n';
-        close(sock);
-        return -1;
-    }
-    unsigned char *buf = (unsigned char *)ifr.ifr_hwaddr.sa_data;
-    memcpy(mac_address, buf, MAX_LORA_MAC);
-    close(sock);
-    return 0;
-}
-
 static int generate_gateway_id_by_mac(char *gw_id)
 {
     unsigned char mac_buf[MAX_LORA_MAC] = { 0 };
-    if (get_local_eth_mac(mac_buf) != 0) {
+    if (netif_cache->mac(ETH_NAME_DEFAULT, mac_buf) != 0) {
         return -1;
     }
     char id_buf[MAX_GATEWAY_ID + 1] = { 0 };
@@ -790,11 +2220,11 @@ static int lora_bridge_set_mqtt_topic(void)
         json_ifstream.close();
         eui = local_json["gateway_eui"];
     } catch (const std::exception &e) {
-        std::cerr << e.what() << '\n';
+        log_error("%s", e.what());
     }
 
     if (generate_gateway_id_by_mac(gateway_eui) < 0) {
-        std::cerr << "Failed to get eth mac." << std::endl;
+        log_error("Failed to get eth mac.");
         return -1;
     }
     if (eui != string(gateway_eui)) {
@@ -814,7 +2244,7 @@ static int lora_bridge_set_mqtt_topic(void)
         json_ofstream << setting_json.dump(4) << endl;
         json_ofstream.close();
     } else {
-        std::cout << "Topic has been writen to file." << std::endl;
+        log_info("Topic has been writen to file.");
         topic_pub_rxpk         = local_json["topic_pub_rxpk"];
         topic_pub_downlink     = local_json["topic_pub_downlink"];
         topic_pub_downlink_ack = local_json["topic_pub_downlink_ack"];
@@ -826,7 +2256,7 @@ static int lora_bridge_set_mqtt_topic(void)
 
 int password_cb(char *buf, int size, int rwflag, void *userdata)
 {
-    std::cout << "===enter tls pass phrase===" << std::endl << tls_pass_phrase << std::endl;
+    log_debug("===enter tls pass phrase===");
     int len = tls_pass_phrase.length();
     if (len < size) {
         strcpy(buf, tls_pass_phrase.c_str());
@@ -836,31 +2266,373 @@ int password_cb(char *buf, int size, int rwflag, void *userdata)
     return 0;
 }
 
+// 断线后等待退避时间，打印并计数每次重连尝试
+static uint64_t mqtt_reconnect_delay_us(void)
+{
+    uint64_t delay_us = mqtt_backoff.next_delay_us();
+    bridge_metrics_add(BRIDGE_CNT_MQTT_RECONNECT_ATTEMPTS);
+    log_info("MQTT reconnect attempt %u in %llums",
+             mqtt_backoff.attempts(),
+             (unsigned long long)(delay_us / 1000));
+    return delay_us;
+}
+
+// 代替mosquitto_loop_forever，它的重连间隔不带抖动，且CONNACK被拒后会退出
 void *mqtt_message_thread(void *arg)
 {
     pthread_detach(pthread_self());
-    mosquitto_loop_forever(mosq, -1, 1);
+    while (true) {
+        int rc = mosquitto_loop(mosq, -1, 1);
+        while (rc != MOSQ_ERR_SUCCESS) {
+            uint64_t        delay_us = mqtt_reconnect_delay_us();
+            struct timespec ts       = { (time_t)(delay_us / 1000000),
+                                         (long)(delay_us % 1000000) * 1000 };
+            nanosleep(&ts, NULL);
+            rc = mosquitto_reconnect(mosq);
+            if (rc != MOSQ_ERR_SUCCESS) {
+                log_warn("MQTT reconnect failed: %s", mosquitto_strerror(rc));
+            }
+        }
+    }
     return NULL;
 }
 
+/*
+ * 单线程模式: mosquitto的socket直接挂在evbase上，收发、keepalive和回调
+ * 都在主线程执行，不再需要mqtt_message_thread。其他UDP worker线程里的
+ * mosquitto_publish由libmosquitto自己加锁并直接写socket，没写完的部分
+ * 由写事件或misc定时器继续发送。
+ */
+static void mqtt_events_want_write(void)
+{
+    if (mqtt_write_ev && mosquitto_want_write(mosq)) {
+        event_add(mqtt_write_ev, NULL);
+    }
+}
+
+static void mqtt_events_del(void)
+{
+    if (mqtt_read_ev) {
+        event_free(mqtt_read_ev);
+        mqtt_read_ev = nullptr;
+    }
+    if (mqtt_write_ev) {
+        event_free(mqtt_write_ev);
+        mqtt_write_ev = nullptr;
+    }
+}
+
+static void mqtt_schedule_reconnect(void)
+{
+    uint64_t       delay_us = mqtt_reconnect_delay_us();
+    struct timeval tv       = { (time_t)(delay_us / 1000000), (suseconds_t)(delay_us % 1000000) };
+    evtimer_add(mqtt_reconnect_ev, &tv);
+}
+
+// loop_read/write/misc出错时socket已不可用，去掉事件并按退避时间重连
+static void mqtt_connection_lost(int rc)
+{
+    log_warn("MQTT loop error: %s", mosquitto_strerror(rc));
+    mqtt_events_del();
+    if (mqtt_connected.load(memory_order_acquire)) {
+        on_disconnect(mosq, NULL, rc);
+    }
+    mqtt_schedule_reconnect();
+}
+
+static void mqtt_read_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    int rc = mosquitto_loop_read(mosq, 1);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        mqtt_connection_lost(rc);
+        return;
+    }
+    mqtt_events_want_write();
+}
+
+static void mqtt_write_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    int rc = mosquitto_loop_write(mosq, 1);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        mqtt_connection_lost(rc);
+        return;
+    }
+    mqtt_events_want_write();
+}
+
+static int mqtt_events_add(void)
+{
+    int fd = mosquitto_socket(mosq);
+    if (fd < 0) {
+        return -1;
+    }
+    mqtt_read_ev  = event_new(evbase, fd, EV_READ | EV_PERSIST, mqtt_read_cb, NULL);
+    mqtt_write_ev = event_new(evbase, fd, EV_WRITE, mqtt_write_cb, NULL);
+    if (!mqtt_read_ev || !mqtt_write_ev || event_add(mqtt_read_ev, NULL) < 0) {
+        log_error("Failed to create mqtt socket event.");
+        mqtt_events_del();
+        return -1;
+    }
+    mqtt_events_want_write();
+    return 0;
+}
+
+// 异步重连，CONNACK由读事件处理，失败时由mqtt_connection_lost安排下一次
+static void mqtt_reconnect_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    int rc = mosquitto_reconnect_async(mosq);
+    if (rc != MOSQ_ERR_SUCCESS || mqtt_events_add() < 0) {
+        log_warn("MQTT reconnect failed: %s", mosquitto_strerror(rc));
+        mqtt_schedule_reconnect();
+    }
+}
+
+// 周期处理keepalive和重传，断线期间等mqtt_reconnect_ev
+static void mqtt_misc_cb(evutil_socket_t fd, short events, void *user_data)
+{
+    if (!mqtt_read_ev) {
+        return;
+    }
+    int rc = mosquitto_loop_misc(mosq);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        mqtt_connection_lost(rc);
+        return;
+    }
+    mqtt_events_want_write();
+}
+
+static int udp_worker_bind_socket(struct udp_worker *worker, bool reuse_port)
+{
+    worker->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (worker->fd == -1) {
+        log_error("Failed to create UDP socket.");
+        return -1;
+    }
+    // 多个worker共享同一端口，由内核在套接字之间分发数据报
+    int on = 1;
+    if (reuse_port && setsockopt(worker->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        log_error("Failed to set SO_REUSEPORT: %s", strerror(errno));
+        return -1;
+    }
+    sockaddr_in serveraddr{};
+    serveraddr.sin_family      = AF_INET;
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serveraddr.sin_port        = htons(LORAWAN_UDP_PORT);
+
+    if (bind(worker->fd, reinterpret_cast<const sockaddr *>(&serveraddr), sizeof(serveraddr)) ==
+        -1) {
+        log_error("Failed to bind socket.");
+        return -1;
+    }
+    evutil_make_socket_nonblocking(worker->fd);
+    return 0;
+}
+
+/*
+ * 按网关EUI(Semtech报头的第4-11字节)给reuseport组内的数据报选socket，
+ * 同一个packet forwarder的上行和下行socket发来的报文都由同一个worker
+ * 按顺序处理。
+ */
+static int udp_workers_attach_steering(evutil_socket_t fd, uint32_t count)
+{
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog;
+    prog.len    = static_cast<unsigned short>(sizeof(code) / sizeof(code[0]));
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        log_warn("Failed to attach reuseport steering, fall back to kernel hash: %s",
+                 strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void *udp_worker_thread(void *arg)
+{
+    struct udp_worker *worker = static_cast<struct udp_worker *>(arg);
+    event_base_dispatch(worker->base);
+    return NULL;
+}
+
+static void udp_workers_stop(void)
+{
+    for (auto worker : udp_worker_list) {
+        if (worker->base != evbase) {
+            event_base_loopbreak(worker->base);
+            pthread_join(worker->tid, NULL);
+        }
+    }
+    for (auto worker : udp_worker_list) {
+        if (worker->udp_ev) {
+            event_free(worker->udp_ev);
+        }
+        if (worker->downlink_ev) {
+            event_free(worker->downlink_ev);
+        }
+        if (worker->schedule_ev) {
+            event_free(worker->schedule_ev);
+        }
+        if (worker->batch_ev) {
+            event_free(worker->batch_ev);
+        }
+        if (worker->dedup_ev) {
+            event_free(worker->dedup_ev);
+        }
+        if (worker->base && worker->base != evbase) {
+            event_base_free(worker->base);
+        }
+        if (worker->fd != -1) {
+            close(worker->fd);
+        }
+        delete worker->rx_slab;
+        delete[] worker->rx_msgs;
+        delete[] worker->rx_iovs;
+        delete[] worker->rx_addrs;
+        delete[] worker->ack_msgs;
+        delete[] worker->ack_iovs;
+        delete[] worker->ack_addrs;
+        delete[] worker->acks;
+        delete worker;
+    }
+    udp_worker_list.clear();
+}
+
+static void udp_worker_alloc_batch(struct udp_worker *worker, uint32_t batch_size)
+{
+    worker->batch_size = batch_size;
+    worker->rx_msgs    = new mmsghdr[batch_size]();
+    worker->rx_iovs    = new iovec[batch_size]();
+    worker->rx_addrs   = new sockaddr_in[batch_size]();
+    worker->rx_slab    = new PacketSlab(batch_size, PACKET_SLOT_SIZE);
+    worker->ack_msgs   = new mmsghdr[batch_size]();
+    worker->ack_iovs   = new iovec[batch_size]();
+    worker->ack_addrs  = new sockaddr_in[batch_size]();
+    worker->acks       = new uint8_t[batch_size][4]();
+    worker->uplink_out.reserve(TX_BUFF_SIZE);
+    for (uint32_t i = 0; i < batch_size; i++) {
+        worker->rx_iovs[i].iov_base          = worker->rx_slab->slot(i);
+        worker->rx_iovs[i].iov_len           = PACKET_SLOT_SIZE - 1;
+        worker->rx_msgs[i].msg_hdr.msg_name  = &worker->rx_addrs[i];
+        worker->rx_msgs[i].msg_hdr.msg_iov   = &worker->rx_iovs[i];
+        worker->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+// worker 0 跑在主线程的evbase上，其余worker各自拥有线程和event_base
+static int udp_workers_start(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        struct udp_worker *worker = new udp_worker();
+        worker->id                = i;
+        worker->fd                = -1;
+        worker->client_len        = sizeof(worker->client_addr);
+        udp_worker_alloc_batch(worker, udp_batch_size);
+        udp_worker_list.push_back(worker);
+        worker->base = (i == 0) ? evbase : event_base_new();
+        if (!worker->base) {
+            log_error("Failed to create worker event base.");
+            return -1;
+        }
+        if (udp_worker_bind_socket(worker, count > 1) < 0) {
+            return -1;
+        }
+        worker->udp_ev = event_new(worker->base, worker->fd, EV_READ | EV_PERSIST, read_cb, worker);
+        if (!worker->udp_ev || event_add(worker->udp_ev, NULL) < 0) {
+            log_error("Failed to create udp event.");
+            return -1;
+        }
+        worker->downlink_ev = event_new(worker->base, -1, 0, downlink_dispatch_cb, worker);
+        worker->schedule_ev = evtimer_new(worker->base, downlink_schedule_cb, worker);
+        if (!worker->downlink_ev || !worker->schedule_ev) {
+            log_error("Failed to create downlink event.");
+            return -1;
+        }
+        worker->batch_ev = evtimer_new(worker->base, uplink_batch_cb, worker);
+        if (!worker->batch_ev) {
+            log_error("Failed to create uplink batch event.");
+            return -1;
+        }
+        worker->dedup_ev = evtimer_new(worker->base, uplink_dedup_cb, worker);
+        if (!worker->dedup_ev) {
+            log_error("Failed to create uplink dedup event.");
+            return -1;
+        }
+    }
+    if (count > 1) {
+        udp_workers_attach_steering(udp_worker_list[0]->fd, count);
+    }
+    for (auto worker : udp_worker_list) {
+        if (worker->base != evbase &&
+            pthread_create(&worker->tid, NULL, udp_worker_thread, worker) != 0) {
+            log_error("Failed to create udp worker thread.");
+            event_free(worker->udp_ev);
+            worker->udp_ev = nullptr;
+            event_base_free(worker->base);
+            worker->base = nullptr;
+            return -1;
+        }
+    }
+    log_info("%u udp worker(s) listening on port %d, batch size %u, base64 %s",
+             count,
+             LORAWAN_UDP_PORT,
+             udp_batch_size,
+             base64_impl_name());
+    return 0;
+}
+
 int main(void)
 {
+    // 启动失败时日志直接同步写出
+    if (bridge_log_start() < 0) {
+        log_warn("Failed to start log writer, log synchronously.");
+    }
     if (parse_bridge_toml_file() < 0) {
-        std::cerr << "Failed to parse bridge toml file." << std::endl;
+        log_error("Failed to parse bridge toml file.");
         return -1;
     }
 
+    // 网关ID取eth0的MAC，先读一次接口
+    netif_cache = new NetifCache();
+    if (netif_cache->load() < 0) {
+        log_error("Failed to read network interfaces.");
+    }
     if (lora_bridge_set_mqtt_topic() < 0) {
-        std::cerr << "Failed to setup mqtt topic." << std::endl;
+        log_error("Failed to setup mqtt topic.");
         return -1;
     }
+    // 本机网关的会话沿用topic配置文件中的topic, 其余网关首次上报时创建
+    gateway_sessions = new GatewaySessionTable(max_gateway_count);
+    inflight         = new InflightTable(inflight_window);
+    if (dedup_window_us > 0) {
+        uplink_dedup = new UplinkDedup(dedup_window_us, dedup_policy_type);
+    }
+    deveui_whitelist = new DevEuiWhitelist(LORAWAN_FILTER_CONF_DEFAULT, whitelist_pass);
+    deveui_whitelist->load();
+    struct gateway_session *local_gw = new gateway_session(
+        strtoull(gateway_eui, NULL, 16), downlink_queue_size, duty_cycle_region_type);
+    local_gw->pinned                 = true;
+    local_gw->topic_pub_rxpk         = topic_pub_rxpk;
+    local_gw->topic_pub_rxpk_batch   = topic_pub_rxpk + UPLINK_BATCH_TOPIC_SUFFIX;
+    local_gw->topic_pub_rxpk_set     = topic_pub_rxpk + UPLINK_DEDUP_SET_TOPIC_SUFFIX;
+    local_gw->topic_pub_downlink     = topic_pub_downlink;
+    local_gw->topic_pub_downlink_ack = topic_pub_downlink_ack;
+    local_gw->topic_pub_gateway_stat = topic_pub_gateway_stat;
+    local_gw->topic_sub_txpk         = topic_sub_txpk;
+    gateway_sessions->insert(local_gw);
     // 初始化Mosquitto库
     mosquitto_lib_init();
 
     // 创建Mosquitto客户端
     mosq = mosquitto_new(nullptr, mqtt_clean_session, nullptr);
     if (!mosq) {
-        std::cerr << "Failed to create Mosquitto client." << std::endl;
+        log_error("Failed to create Mosquitto client.");
         return -1;
     }
 
@@ -871,22 +2643,24 @@ int main(void)
     // 设置发布回调函数
     mosquitto_publish_callback_set(mosq, on_publish);
     mosquitto_message_callback_set(mosq, on_message);
+    // QoS 1/2的在途上限与上行窗口一致，超出的由我们写入spool而不是在库里排队
+    mosquitto_max_inflight_messages_set(mosq, inflight_window);
 
     // 设置用户名和密码
     if (!mqtt_username.empty() && !mqtt_password.empty()) {
-        std::cout << "Set username and password..." << std::endl;
+        log_info("Set username and password...");
         mosquitto_username_pw_set(mosq, mqtt_username.c_str(), mqtt_password.c_str());
     }
 
     // 设置TLS选项
     if (!ca_file_path.empty() && !key_file_path.empty() && !cert_file_path.empty()) {
         auto capath = "/etc/ssl";
-        std::cout << "Set TLS encryption...." << std::endl;
-        printf("Cafile: %s, Cafile path: %s, Certfile:%s, Keyfile: %s\n",
-               ca_file_path.c_str(),
-               capath,
-               cert_file_path.c_str(),
-               key_file_path.c_str());
+        log_info("Set TLS encryption....");
+        log_info("Cafile: %s, Cafile path: %s, Certfile:%s, Keyfile: %s",
+                 ca_file_path.c_str(),
+                 capath,
+                 cert_file_path.c_str(),
+                 key_file_path.c_str());
         mosquitto_tls_set(mosq,
                           ca_file_path.c_str(),
                           capath,
@@ -894,47 +2668,26 @@ int main(void)
                           key_file_path.c_str(),
                           password_cb);
         mosquitto_tls_insecure_set(mosq, true);
+        if (mqtt_tls_resume_enable(mosq) < 0) {
+            log_warn("TLS session resumption is not available.");
+        }
     }
 
+    // worker线程之间需要跨线程唤醒event_base
+    evthread_use_pthreads();
+
     // 创建事件处理器
     evbase = event_base_new();
     if (!evbase) {
-        std::cerr << "Failed to create event base." << std::endl;
-        mosquitto_destroy(mosq);
-        mosquitto_lib_cleanup();
-        return -1;
-    }
-
-    // 创建UDP套接字和事件
-    udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_socket == -1) {
-        std::cerr << "Failed to create UDP socket." << std::endl;
-        event_base_free(evbase);
-        mosquitto_destroy(mosq);
-        mosquitto_lib_cleanup();
-        return -1;
-    }
-
-    struct event *udp_ev = event_new(evbase, udp_socket, EV_READ | EV_PERSIST, read_cb, NULL);
-    if (!udp_ev || event_add(udp_ev, NULL) < 0) {
-        std::cerr << "Failed to create udp event." << std::endl;
-        close(udp_socket);
-        event_base_free(evbase);
+        log_error("Failed to create event base.");
         mosquitto_destroy(mosq);
         mosquitto_lib_cleanup();
         return -1;
     }
 
-    sockaddr_in serveraddr{};
-    serveraddr.sin_family      = AF_INET;
-    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serveraddr.sin_port        = htons(LORAWAN_UDP_PORT);
-
-    if (bind(udp_socket, reinterpret_cast<const sockaddr *>(&serveraddr), sizeof(serveraddr)) ==
-        -1) {
-        std::cerr << "Failed to bind socket." << std::endl;
-        close(udp_socket);
-        event_free(udp_ev);
+    // 创建UDP套接字和事件, 每个worker一个
+    if (udp_workers_start(udp_worker_count) < 0) {
+        udp_workers_stop();
         event_base_free(evbase);
         mosquitto_destroy(mosq);
         mosquitto_lib_cleanup();
@@ -943,47 +2696,131 @@ int main(void)
 
     struct event *signal_event = evsignal_new(evbase, SIGINT, signal_cb, NULL);
     if (!signal_event || event_add(signal_event, NULL) < 0) {
-        std::cerr << "Could not create/add a signal event!" << std::endl;
-        close(udp_socket);
-        event_free(udp_ev);
+        log_error("Could not create/add a signal event!");
+        udp_workers_stop();
         event_base_free(evbase);
         mosquitto_destroy(mosq);
         mosquitto_lib_cleanup();
         return -1;
     }
+    struct event  *metrics_event = event_new(evbase, -1, EV_PERSIST, metrics_timer_cb, NULL);
+    struct timeval metrics_tv    = { METRICS_LOG_INTERVAL, 0 };
+    if (!metrics_event || event_add(metrics_event, &metrics_tv) < 0) {
+        log_error("Could not create/add a metrics event!");
+    }
+    // 会话表满后新网关被拒绝，移除空闲会话腾出位置
+    struct event  *sweep_event = nullptr;
+    struct timeval sweep_tv    = { GATEWAY_SWEEP_INTERVAL, 0 };
+    if (gateway_idle_us > 0) {
+        sweep_event = event_new(evbase, -1, EV_PERSIST, gateway_sweep_cb, NULL);
+        if (!sweep_event || event_add(sweep_event, &sweep_tv) < 0) {
+            log_error("Could not create/add a gateway sweep event!");
+        }
+    }
+    // 目录不存在时不重新加载，白名单保持启动时的内容
+    deveui_whitelist->watch(evbase);
+    netif_cache->watch(evbase);
+    // spool打不开时照常运行，只是断线期间的事件会丢失
+    struct event  *spool_event = nullptr;
+    struct timeval spool_tv    = { 0, SPOOL_REPLAY_INTERVAL_MS * 1000 };
+    if (!spool_path.empty()) {
+        spool = new BridgeSpool(spool_path, spool_size_kb * 1024ULL);
+        if (spool->open() < 0) {
+            log_warn("Failed to open spool %s, spool disabled.", spool_path.c_str());
+            delete spool;
+            spool = nullptr;
+        }
+    }
+    if (spool) {
+        spool_backlog.store(!spool->empty());
+        spool_event = event_new(evbase, -1, EV_PERSIST, spool_replay_cb, NULL);
+        if (!spool_event || event_add(spool_event, &spool_tv) < 0) {
+            log_error("Could not create/add a spool event!");
+        }
+    }
+    // 导出端口被占用等不影响转发
+    if (prometheus_enabled &&
+        bridge_prometheus_start(evbase, prometheus_bind, prometheus_collect) < 0) {
+        log_warn("Prometheus endpoint disabled.");
+    }
+    // 第一次连不上也不退出，进入重连流程，期间事件写入spool
+    mqtt_backoff.set_max_delay(reconnect_max_us);
     int ret = mosquitto_connect(mosq, mqtt_host.c_str(), mqtt_port, mqtt_keepalive);
     if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "Error: %s, program exit....\n", mosquitto_strerror(ret));
-        close(udp_socket);
-        event_free(udp_ev);
-        event_free(signal_event);
-        event_base_free(evbase);
-        mosquitto_destroy(mosq);
-        mosquitto_lib_cleanup();
-        return -1;
+        log_error("%s, MQTT broker:%s:%d, keep retrying....",
+                  mosquitto_strerror(ret),
+                  mqtt_host.c_str(),
+                  mqtt_port);
+        mqtt_lost_at_us.store(bridge_monotonic_us());
+    } else {
+        log_info("Connected broker successfully, MQTT broker:%s:%d, QoS:%d, keepalive:%d",
+                 mqtt_host.c_str(),
+                 mqtt_port,
+                 (int)mqtt_qos,
+                 mqtt_keepalive);
+    }
+    log_info("Uplink rx topic:%s", topic_pub_rxpk.c_str());
+    log_info("Downlink tx topic:%s", topic_pub_downlink.c_str());
+    log_info("Downlink tx ack topic:%s", topic_pub_downlink_ack.c_str());
+    log_info("Gateway statistics topic:%s", topic_pub_gateway_stat.c_str());
+    log_info("Tx topic receiving tx packet:%s", topic_sub_txpk.c_str());
+
+    struct event  *mqtt_misc_ev = nullptr;
+    struct timeval mqtt_misc_tv = { MQTT_MISC_INTERVAL, 0 };
+    if (mqtt_single_thread) {
+        mqtt_misc_ev      = event_new(evbase, -1, EV_PERSIST, mqtt_misc_cb, NULL);
+        mqtt_reconnect_ev = evtimer_new(evbase, mqtt_reconnect_cb, NULL);
+        if (!mqtt_misc_ev || !mqtt_reconnect_ev || event_add(mqtt_misc_ev, &mqtt_misc_tv) < 0 ||
+            (ret == MOSQ_ERR_SUCCESS && mqtt_events_add() < 0)) {
+            log_warn("Failed to drive MQTT from the event loop, use MQTT thread.");
+            if (mqtt_misc_ev) {
+                event_free(mqtt_misc_ev);
+                mqtt_misc_ev = nullptr;
+            }
+            if (mqtt_reconnect_ev) {
+                event_free(mqtt_reconnect_ev);
+                mqtt_reconnect_ev = nullptr;
+            }
+            mqtt_single_thread = false;
+        } else if (ret != MOSQ_ERR_SUCCESS) {
+            mqtt_schedule_reconnect();
+        }
+    }
+    if (!mqtt_single_thread) {
+        pthread_t mqtt_tid;
+        pthread_create(&mqtt_tid, NULL, mqtt_message_thread, NULL);
     }
-    printf("Connected broker successfully, loop start....\n MQTT broker:%s:%d, QoS:%d, "
-           "keepalive:%d \n",
-           mqtt_host.c_str(),
-           mqtt_port,
-           (int)mqtt_qos,
-           mqtt_keepalive);
-    std::cout << "Uplink rx topic:" << topic_pub_rxpk << std::endl;
-    std::cout << "Downlink tx topic:" << topic_pub_downlink << std::endl;
-    std::cout << "Downlink tx ack topic:" << topic_pub_downlink_ack << std::endl;
-    std::cout << "Gateway statistics topic:" << topic_pub_gateway_stat << std::endl;
-    std::cout << "Tx topic receiving tx packet:" << topic_sub_txpk << std::endl;
-
-    pthread_t mqtt_tid;
-    pthread_create(&mqtt_tid, NULL, mqtt_message_thread, NULL);
 
     event_base_dispatch(evbase);
-    mosquitto_loop_stop(mosq, false);
-    event_free(udp_ev);
+    if (mqtt_single_thread) {
+        mqtt_events_del();
+    } else {
+        mosquitto_loop_stop(mosq, false);
+    }
+    if (mqtt_misc_ev) {
+        event_free(mqtt_misc_ev);
+    }
+    if (mqtt_reconnect_ev) {
+        event_free(mqtt_reconnect_ev);
+    }
+    bridge_prometheus_stop();
+    udp_workers_stop();
     event_free(signal_event);
+    if (metrics_event) {
+        event_free(metrics_event);
+    }
+    if (sweep_event) {
+        event_free(sweep_event);
+    }
+    if (spool_event) {
+        event_free(spool_event);
+    }
+    delete spool;
+    delete uplink_dedup;
+    delete deveui_whitelist;
+    delete netif_cache;
     event_base_free(evbase);
     mosquitto_destroy(mosq);
     mosquitto_lib_cleanup();
-    close(udp_socket);
     return 0;
 }
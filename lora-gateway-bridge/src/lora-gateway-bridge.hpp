@@ -1,7 +1,6 @@
 #ifndef _LORA_GATEWAY_BRIDGE_H
 #define _LORA_GATEWAY_BRIDGE_H
 
-#include "base64.hpp"
 #include <arpa/inet.h>
 #include <cstdlib>
 #include <cstring>
@@ -10,13 +9,15 @@
 #include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/listener.h>
+#include <event2/thread.h>
 #include <event2/util.h>
 #include <fcntl.h>
-#include <ifaddrs.h>
 #include <iostream>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <map>
+#include <math.h>
 #include <mosquitto.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -55,10 +56,16 @@
 #define MAX_GATEWAY_ID            16
 #define LORAWAN_UDP_SERVER        "0.0.0.0"
 #define LORAWAN_UDP_PORT          1700
+#define UDP_WORKERS_DEFAULT       1
+#define UDP_WORKERS_MAX           16
+#define UDP_BATCH_SIZE_DEFAULT    16
+#define UDP_BATCH_SIZE_MAX        64
+#define METRICS_LOG_INTERVAL      60 /* seconds */
 
 #define MQTT_BROKER_DEFAULT    "127.0.0.1"
 #define MQTT_PORT_DEFAULT      1883
 #define MQTT_KEEPALIVE_DEFAULT 60
+#define MQTT_MISC_INTERVAL     1 /* seconds, keepalive和重连检查 */
 
 
 
@@ -0,0 +1,101 @@
+/**
+ * @file
+ * @brief  lorabridge Base64性能测试
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 在目标网关上比较旧的Base64类与bridge-base64的编解码耗时。
+ *          长度取LoRa常见的PHYPayload大小，255为rxpk/txpk的上限；
+ *          bridge-base64解码到栈上的缓冲区，与桥接程序中的用法一致。
+ *          用法: base64-bench [每种长度的次数]
+ */
+
+#include "base64.hpp"
+#include "bridge-base64.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+
+#define BENCH_ROUNDS_DEFAULT 200000
+#define BENCH_LEN_MAX        255
+
+using namespace std;
+
+static const size_t bench_lens[] = { 12, 23, 51, 115, 222, 255 };
+
+// 防止编译器把结果没被用到的调用优化掉
+static volatile size_t bench_sink;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_len(size_t len, unsigned long rounds)
+{
+    string   raw(len, '\0');
+    char     text[BASE64_ENCODED_LEN(BENCH_LEN_MAX)];
+    uint8_t  bytes[BENCH_LEN_MAX];
+    Base64   legacy;
+    uint64_t begin;
+    double   legacy_enc, legacy_dec, bridge_enc, bridge_dec;
+
+    for (size_t i = 0; i < len; i++) { raw[i] = (char)(i * 131 + 7); }
+    string encoded = legacy.encode(raw);
+
+    begin = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        bench_sink = bench_sink + legacy.encode(raw).length();
+    }
+    legacy_enc = (double)(monotonic_ns() - begin) / rounds;
+
+    begin = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        bench_sink = bench_sink + legacy.decode(encoded).length();
+    }
+    legacy_dec = (double)(monotonic_ns() - begin) / rounds;
+
+    begin = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        bench_sink =
+            bench_sink + base64_encode((const uint8_t *)raw.data(), len, text, sizeof(text));
+    }
+    bridge_enc = (double)(monotonic_ns() - begin) / rounds;
+
+    begin = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        bench_sink =
+            bench_sink + base64_decode(encoded.data(), encoded.length(), bytes, sizeof(bytes));
+    }
+    bridge_dec = (double)(monotonic_ns() - begin) / rounds;
+
+    printf("%5zu %12.1f %12.1f %12.1f %12.1f %8.1fx\n",
+           len,
+           legacy_enc,
+           bridge_enc,
+           legacy_dec,
+           bridge_dec,
+           legacy_dec / bridge_dec);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_ROUNDS_DEFAULT;
+
+    if (rounds == 0) {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    printf("base64 bench: impl %s, %lu rounds, ns per call\n", base64_impl_name(), rounds);
+    printf("%5s %12s %12s %12s %12s %9s\n",
+           "bytes",
+           "Base64 enc",
+           "bridge enc",
+           "Base64 dec",
+           "bridge dec",
+           "dec gain");
+    for (size_t len : bench_lens) { bench_len(len, rounds); }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file
+ * @brief  lorabridge Base64差分测试
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 用随机输入比较bridge-base64与旧的Base64类的编解码结果。旧类遇到
+ *          非法字符直接exit，所以只把合法输入交给它比较；含非法字符、长度
+ *          不对或输出空间不足的输入只检查base64_decode返回-1。本机可用的
+ *          每个实现(AVX2/SSSE3/NEON/scalar)都用同一组输入各跑一遍，另外把
+ *          偶尔夹着非法字节的输入交给所有实现，结果必须与scalar完全一致。
+ *          用法: base64-fuzz [次数] [种子]
+ */
+
+#include "base64.hpp"
+#include "bridge-base64.hpp"
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define FUZZ_ROUNDS_DEFAULT 200000
+#define FUZZ_LEN_MAX        1024 /* 覆盖AVX2的32字节块和标量尾部 */
+
+using namespace std;
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static mt19937 rng;
+
+static size_t random_len(void)
+{
+    // 一半取短输入，尾部长度的各种情况出现得更多
+    return (rng() & 1) ? rng() % 16 : rng() % (FUZZ_LEN_MAX + 1);
+}
+
+static void dump(const char *what, const string &input)
+{
+    fprintf(stderr, "%s, input(%zu): %s\n", what, input.length(), input.c_str());
+}
+
+// 随机字节编码，与旧类的结果比较后再解码回来
+static int fuzz_encode(void)
+{
+    string  raw(random_len(), '\0');
+    char    text[BASE64_ENCODED_LEN(FUZZ_LEN_MAX)];
+    uint8_t bytes[FUZZ_LEN_MAX];
+    Base64  legacy;
+
+    for (auto &c : raw) { c = (char)rng(); }
+    int len = base64_encode((const uint8_t *)raw.data(), raw.length(), text, sizeof(text));
+    if (len < 0 || string(text, len) != legacy.encode(raw)) {
+        dump("encode mismatch", legacy.encode(raw));
+        return -1;
+    }
+    int size = base64_decode(text, len, bytes, sizeof(bytes));
+    if (size != (int)raw.length() || memcmp(bytes, raw.data(), size) != 0) {
+        dump("round trip mismatch", string(text, len));
+        return -1;
+    }
+    return 0;
+}
+
+// 合法字符组成的输入，可能带'='填充，长度不对时两边都应出错
+static int fuzz_decode_valid(void)
+{
+    string  input(random_len(), '\0');
+    uint8_t bytes[FUZZ_LEN_MAX];
+    Base64  legacy;
+    string  expect;
+    bool    legacy_ok = true;
+
+    for (auto &c : input) { c = alphabet[rng() % 64]; }
+    if (input.length() % 4 >= 2 && (rng() & 1)) {
+        input.append(4 - input.length() % 4, '=');
+    }
+    try {
+        expect = legacy.decode(input);
+    } catch (const std::exception &e) {
+        legacy_ok = false;
+    }
+    int size = base64_decode(input.data(), input.length(), bytes, sizeof(bytes));
+    if (!legacy_ok) {
+        if (size != -1) {
+            dump("input rejected by Base64 accepted", input);
+            return -1;
+        }
+        return 0;
+    }
+    if (size != (int)expect.length() || memcmp(bytes, expect.data(), size) != 0) {
+        dump("decode mismatch", input);
+        return -1;
+    }
+    // 输出空间少一个字节时必须拒绝，不能越界写
+    if (size > 0 && base64_decode(input.data(), input.length(), bytes, size - 1) != -1) {
+        dump("short output accepted", input);
+        return -1;
+    }
+    return 0;
+}
+
+// 在合法输入中随机换入非法字节
+static int fuzz_decode_invalid(void)
+{
+    string  input(random_len() / 4 * 4 + 4, '\0');
+    uint8_t bytes[FUZZ_LEN_MAX];
+
+    for (auto &c : input) { c = alphabet[rng() % 64]; }
+    size_t count = 1 + rng() % 3;
+    for (size_t i = 0; i < count; i++) {
+        char bad;
+        do {
+            bad = (char)rng();
+        } while (strchr(alphabet, bad) != nullptr || bad == '='); // strchr也排除了'\0'
+        input[rng() % input.length()] = bad;
+    }
+    if (base64_decode(input.data(), input.length(), bytes, sizeof(bytes)) != -1) {
+        dump("invalid input accepted", input);
+        return -1;
+    }
+    return 0;
+}
+
+// 同一输入交给每个实现解码，返回值和输出都与最后一个(scalar)比较
+static int fuzz_cross(void)
+{
+    string  input(random_len(), '\0');
+    uint8_t expect[FUZZ_LEN_MAX];
+    uint8_t bytes[FUZZ_LEN_MAX];
+    size_t  scalar = base64_impl_count() - 1;
+
+    for (auto &c : input) { c = (rng() % 64) ? alphabet[rng() % 64] : (char)rng(); }
+    base64_impl_select(scalar);
+    int expect_size = base64_decode(input.data(), input.length(), expect, sizeof(expect));
+    for (size_t i = 0; i < scalar; i++) {
+        base64_impl_select(i);
+        int size = base64_decode(input.data(), input.length(), bytes, sizeof(bytes));
+        if (size != expect_size || (size > 0 && memcmp(bytes, expect, size) != 0)) {
+            fprintf(stderr, "%s differs from scalar, ", base64_impl_name());
+            dump("cross mismatch", input);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : FUZZ_ROUNDS_DEFAULT;
+    unsigned long seed   = (argc > 2) ? strtoul(argv[2], NULL, 0) : random_device{}();
+
+    for (size_t impl = 0; impl < base64_impl_count(); impl++) {
+        rng.seed(seed);
+        base64_impl_select(impl);
+        printf("base64 fuzz: impl %s, %lu rounds, seed %lu\n", base64_impl_name(), rounds, seed);
+        for (unsigned long i = 0; i < rounds; i++) {
+            if (fuzz_encode() < 0 || fuzz_decode_valid() < 0 || fuzz_decode_invalid() < 0) {
+                fprintf(stderr, "failed at round %lu, seed %lu\n", i, seed);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    printf("base64 fuzz: cross check of %zu impls, %lu rounds\n", base64_impl_count(), rounds);
+    for (unsigned long i = 0; i < rounds; i++) {
+        if (fuzz_cross() < 0) {
+            fprintf(stderr, "failed at round %lu, seed %lu\n", i, seed);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
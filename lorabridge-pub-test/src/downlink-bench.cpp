@@ -0,0 +1,187 @@
+/**
+ * @file
+ * @brief  lorabridge下行命令转换性能测试
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 比较ChirpStack downlinkItems命令转Semtech txpk的两种做法:
+ *          DOM: 旧版的nlohmann解析整个命令，每项再建一棵txpk树后dump()；
+ *          scan: bridge-downlink在MQTT报文上扫描，逐项写进栈上的缓冲区。
+ *          命令分别带1、8、64项，每项24字节LoRa PHYPayload。报告每条命令
+ *          每秒能处理的条数、每项的耗时和堆分配次数。
+ *          用法: downlink-bench [每种命令的次数]
+ */
+
+#include "bridge-downlink.hpp"
+#include <new>
+#include <nlohmann/json.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+
+#define BENCH_ROUNDS_DEFAULT 2000
+#define BENCH_FRAME_MAX      996 /* 与bridge的DOWNLINK_FRAME_MAX相同 */
+
+using namespace std;
+using json = nlohmann::json;
+
+static const unsigned bench_item_counts[] = { 1, 8, 64 };
+
+// 单线程计数，统计全局operator new的调用次数
+static unsigned long bench_allocs;
+
+void *operator new(size_t size)
+{
+    bench_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    free(ptr);
+}
+
+// 防止编译器把结果没被用到的调用优化掉
+static volatile size_t bench_sink;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static string downlink_command(unsigned count)
+{
+    string out = "{\"gatewayID\":\"AQIDBAUGBwg=\",\"token\":1234,"
+                 "\"downlinkID\":\"AAECAwQFBgcICQoLDA0ODw==\",\"downlinkItems\":[";
+
+    for (unsigned i = 0; i < count; i++) {
+        char item[512];
+        snprintf(item,
+                 sizeof(item),
+                 "%s{\"phyPayload\":\"YAEAAAEAAQABAgMEBQYHCAkKCwwNDg8Q\",\"phyPayloadSize\":24,"
+                 "\"txInfo\":{\"timing\":\"IMMEDIATELY\",\"power\":14,\"frequency\":%u,"
+                 "\"modulationInfo\":{\"bandwidth\":125,\"spreadingFactor\":%u,"
+                 "\"codeRate\":\"4/5\",\"polarizationInversion\":true}},\"modulation\":\"LORA\"}",
+                 i ? "," : "",
+                 868100000 + (i % 3) * 200000,
+                 7 + i % 6);
+        out += item;
+    }
+    return out + "]}";
+}
+
+// 旧版parse_remote_downlink_items_json的转换部分(IMMEDIATELY的LoRa项)
+static void translate_dom(const string &command, json &json_udp, string &out)
+{
+    json     json_dl = json::parse(command);
+    float    freq;
+    uint32_t bw, sf;
+    string   modu;
+
+    for (auto &txpk : json_dl["downlinkItems"]) {
+        json_udp.clear();
+        json_udp["txpk"]["data"] = txpk["phyPayload"];
+        json_udp["txpk"]["size"] = txpk["phyPayloadSize"];
+        json_udp["txpk"]["imme"] = true;
+        json_udp["txpk"]["powe"] = txpk["txInfo"]["power"];
+        freq                     = txpk["txInfo"]["frequency"];
+        json_udp["txpk"]["freq"] = static_cast<float>(freq) / 1000000.0f;
+        modu                     = txpk["modulation"];
+        json_udp["txpk"]["modu"] = modu;
+        json_udp["txpk"]["rfch"] = 0;
+        bw                       = txpk["txInfo"]["modulationInfo"]["bandwidth"];
+        sf                       = txpk["txInfo"]["modulationInfo"]["spreadingFactor"];
+        json_udp["txpk"]["datr"] = "SF" + to_string(sf) + "BW" + to_string(bw);
+        json_udp["txpk"]["codr"] = txpk["txInfo"]["modulationInfo"]["codeRate"];
+        json_udp["txpk"]["ipol"] = txpk["txInfo"]["modulationInfo"]["polarizationInversion"];
+        out                      = json_udp.dump();
+        bench_sink               = bench_sink + out.length();
+    }
+}
+
+// 现在on_message和parse_remote_downlink_items的做法
+static void translate_scan(const string &command)
+{
+    struct chirpstack_downlink_command parsed;
+    struct json_cursor                 cursor;
+    struct json_span                   item;
+    char                               txpk[BENCH_FRAME_MAX];
+    const char                        *error;
+
+    if (chirpstack_downlink_command_parse(command.data(), command.length(), &parsed) < 0 ||
+        json_scan_open(&parsed.items, &cursor) < 0) {
+        return;
+    }
+    while (json_scan_next_element(&cursor, &item) > 0) {
+        int len = chirpstack_downlink_item_txpk(&item, txpk, sizeof(txpk), &error);
+        if (len > 0) {
+            bench_sink = bench_sink + len;
+        }
+    }
+}
+
+static void bench_count(unsigned count, unsigned long rounds)
+{
+    string        command = downlink_command(count);
+    string        dom_out;
+    json          json_udp;
+    uint64_t      begin, dom_ns, scan_ns;
+    unsigned long allocs, dom_allocs, scan_allocs;
+
+    translate_dom(command, json_udp, dom_out);
+
+    allocs = bench_allocs;
+    begin  = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) { translate_dom(command, json_udp, dom_out); }
+    dom_ns     = monotonic_ns() - begin;
+    dom_allocs = bench_allocs - allocs;
+
+    allocs = bench_allocs;
+    begin  = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) { translate_scan(command); }
+    scan_ns     = monotonic_ns() - begin;
+    scan_allocs = bench_allocs - allocs;
+
+    printf("%5u %10.0f %10.0f %10.1f %10.1f %10.1f %10.1f %8.1fx\n",
+           count,
+           rounds * 1e9 / dom_ns,
+           rounds * 1e9 / scan_ns,
+           (double)dom_ns / rounds / count,
+           (double)scan_ns / rounds / count,
+           (double)dom_allocs / rounds / count,
+           (double)scan_allocs / rounds / count,
+           (double)dom_ns / scan_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_ROUNDS_DEFAULT;
+
+    if (rounds == 0) {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    printf("downlink bench: %lu rounds, msg/s per command, ns and allocs per item\n", rounds);
+    printf("%5s %10s %10s %10s %10s %10s %10s %9s\n",
+           "items",
+           "DOM msg/s",
+           "scan msg/s",
+           "DOM ns",
+           "scan ns",
+           "DOM alloc",
+           "scan alloc",
+           "gain");
+    for (unsigned count : bench_item_counts) { bench_count(count, rounds); }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file
+ * @brief  lorabridge rxpk转换性能测试
+ * @author Copyright (C) Shenzhen Minew Technologies Co., Ltd All rights reserved.
+ *
+ * @details 比较PUSH_DATA中rxpk转ChirpStack上行JSON的两种做法:
+ *          DOM: 旧版的nlohmann解析整个PUSH_DATA，每个rxpk再建一棵树后dump()；
+ *          scan: bridge-json-scan在原报文上定位字段，bridge-uplink直接写出JSON。
+ *          两者的json对象和输出字符串都在循环外复用，与UDP worker的用法一致；
+ *          gatewayID预先算好，只比较转换本身。报告每个rxpk的耗时和堆分配次数。
+ *          用法: rxpk-bench [每种报文的次数]
+ */
+
+#include "bridge-json-scan.hpp"
+#include "bridge-uplink.hpp"
+#include <new>
+#include <nlohmann/json.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+
+#define BENCH_ROUNDS_DEFAULT 20000
+#define BENCH_GATEWAY_ID     "AQIDBAUGBwg=" /* 0102030405060708 */
+
+using namespace std;
+using json = nlohmann::json;
+
+static const unsigned bench_rxpk_counts[] = { 1, 8 };
+
+// 单线程计数，统计全局operator new的调用次数
+static unsigned long bench_allocs;
+
+void *operator new(size_t size)
+{
+    bench_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    free(ptr);
+}
+
+// 防止编译器把结果没被用到的调用优化掉
+static volatile size_t bench_sink;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 与fake packet forwarder相同字段的rxpk，23字节PHYPayload
+static string push_data(unsigned count)
+{
+    string out = "{\"rxpk\":[";
+
+    for (unsigned i = 0; i < count; i++) {
+        char rxpk[512];
+        snprintf(rxpk,
+                 sizeof(rxpk),
+                 "%s{\"time\":\"2024-01-01T00:00:00.%06uZ\",\"tmst\":%u,\"chan\":%u,\"rfch\":0,"
+                 "\"freq\":868.100000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF7BW125\","
+                 "\"codr\":\"4/5\",\"lsnr\":9.5,\"rssi\":-35,\"size\":23,"
+                 "\"data\":\"QAEAAAEAAQABAgMEBQYHCAkKCwwNDg8=\"}",
+                 i ? "," : "",
+                 i,
+                 1000000 + i * 1000,
+                 i % 8);
+        out += rxpk;
+    }
+    return out + "]}";
+}
+
+// 旧版publish_chirpstack_format_uplink_json的转换部分
+static void translate_dom(const string &packet, json &uplink_json, json &json_pub, string &out)
+{
+    const char *stat_tb[] = { "STAT_CRC_BAD", "STAT_NO_CRC", "STAT_CRC_OK" };
+    double      freq;
+
+    uplink_json = json::parse(packet);
+    for (const auto &rxpk : uplink_json["rxpk"]) {
+        json_pub.clear();
+        json_pub["gatewayID"]      = BENCH_GATEWAY_ID;
+        json_pub["phyPayloadSize"] = rxpk["size"];
+        json_pub["phyPayload"]     = rxpk["data"];
+        if (!rxpk["freq"].is_number_float()) {
+            continue;
+        }
+        freq                            = rxpk["freq"];
+        json_pub["txInfo"]["frequency"] = static_cast<uint64_t>(freq * 1000000);
+        json_pub["modulation"]          = rxpk["modu"];
+        if (rxpk["datr"].is_string()) {
+            int    dr, bw;
+            string datr = rxpk["datr"];
+            if (sscanf(datr.c_str(), "SF%2dBW%3d", &dr, &bw) != 2) {
+                continue;
+            }
+            json_pub["txInfo"]["modulationInfo"]["bandwidth"]       = bw;
+            json_pub["txInfo"]["modulationInfo"]["spreadingFactor"] = dr;
+        }
+        if (rxpk.contains("codr")) {
+            json_pub["txInfo"]["modulationInfo"]["codeRate"] = rxpk["codr"];
+        }
+        if (rxpk.contains("time")) {
+            json_pub["rxInfo"]["time"] = rxpk["time"];
+        }
+        json_pub["rxInfo"]["timestamp"] = rxpk["tmst"];
+        json_pub["rxInfo"]["rssi"]      = rxpk["rssi"];
+        if (rxpk.contains("lsnr")) {
+            json_pub["rxInfo"]["LoRaSNR"] = rxpk["lsnr"];
+        }
+        json_pub["rxInfo"]["channel"] = rxpk["chan"];
+        json_pub["rxInfo"]["rfChain"] = rxpk["rfch"];
+        if (rxpk.contains("stat")) {
+            int stat                        = rxpk["stat"];
+            json_pub["rxInfo"]["CRCStatus"] = string(stat_tb[stat + 1]);
+        }
+        out        = json_pub.dump();
+        bench_sink = bench_sink + out.length();
+    }
+}
+
+// 现在response_pkt_push_data和publish_chirpstack_format_uplink的做法
+static void translate_scan(const string &packet, const string &gateway_id, string &out)
+{
+    struct json_span    root, key, value, item;
+    struct json_cursor  members, elements;
+    struct semtech_rxpk rxpk;
+
+    if (json_scan_document(packet.data(), packet.length(), &root) < 0 ||
+        json_scan_open(&root, &members) < 0) {
+        return;
+    }
+    while (json_scan_next_member(&members, &key, &value) > 0) {
+        if (!json_span_equals(&key, "rxpk") || json_scan_open(&value, &elements) < 0) {
+            continue;
+        }
+        while (json_scan_next_element(&elements, &item) > 0) {
+            if (semtech_rxpk_parse(&item, &rxpk) < 0) {
+                continue;
+            }
+            out.clear();
+            chirpstack_uplink_json_write(&rxpk, gateway_id, out);
+            bench_sink = bench_sink + out.length();
+        }
+    }
+}
+
+static void bench_count(unsigned count, unsigned long rounds)
+{
+    string        packet = push_data(count);
+    string        gateway_id(BENCH_GATEWAY_ID);
+    string        dom_out, scan_out;
+    json          uplink_json, json_pub;
+    uint64_t      begin;
+    unsigned long allocs;
+    double        dom_ns, scan_ns, dom_allocs, scan_allocs;
+
+    // 先各跑一次，让复用的json和string长到稳定大小
+    translate_dom(packet, uplink_json, json_pub, dom_out);
+    scan_out.reserve(1024);
+    translate_scan(packet, gateway_id, scan_out);
+
+    allocs = bench_allocs;
+    begin  = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        translate_dom(packet, uplink_json, json_pub, dom_out);
+    }
+    dom_ns     = (double)(monotonic_ns() - begin) / rounds / count;
+    dom_allocs = (double)(bench_allocs - allocs) / rounds / count;
+
+    allocs = bench_allocs;
+    begin  = monotonic_ns();
+    for (unsigned long i = 0; i < rounds; i++) {
+        translate_scan(packet, gateway_id, scan_out);
+    }
+    scan_ns     = (double)(monotonic_ns() - begin) / rounds / count;
+    scan_allocs = (double)(bench_allocs - allocs) / rounds / count;
+
+    printf("%5u %10.1f %10.1f %10.1f %10.1f %8.1fx\n",
+           count,
+           dom_ns,
+           dom_allocs,
+           scan_ns,
+           scan_allocs,
+           dom_ns / scan_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_ROUNDS_DEFAULT;
+
+    if (rounds == 0) {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    printf("rxpk bench: %lu rounds, per rxpk\n", rounds);
+    printf("%5s %10s %10s %10s %10s %9s\n",
+           "rxpk",
+           "DOM ns",
+           "DOM alloc",
+           "scan ns",
+           "scan alloc",
+           "gain");
+    for (unsigned count : bench_rxpk_counts) { bench_count(count, rounds); }
+    return EXIT_SUCCESS;
+}